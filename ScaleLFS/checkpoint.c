@@ -1055,6 +1055,243 @@ void f3fs_remove_dirty_inode(struct inode *inode)
 	spin_unlock(&sbi->inode_lock[type]);
 }
 
+/*
+ * Parallel data flush: with data_flush, the file inodes queued on
+ * inode_list[FILE_INODE] are written back by a pool of workers rather than
+ * one after another by whoever hit the dirty threshold.  Each worker claims
+ * the first inode not yet taken in this round and rotates it to the tail,
+ * so a file is written by exactly one worker per round.  The workers share
+ * the data logs, so files flushed at the same time interleave there.  A
+ * round ends once no queued inode is left unclaimed.
+ *
+ * Rounds are started with flush_lock held, which also serializes them
+ * against f3fs_stop_wb_workers().
+ */
+static void wb_flush_inodes(struct wb_worker *w)
+{
+	struct f3fs_sb_info *sbi = w->sbi;
+	struct list_head *head = &sbi->inode_list[FILE_INODE];
+	struct f3fs_inode_info *fi;
+	struct inode *inode;
+
+	for (;;) {
+		struct writeback_control wbc = {
+			.sync_mode = WB_SYNC_ALL,
+			.nr_to_write = LONG_MAX,
+			.range_start = 0,
+			.range_end = LLONG_MAX,
+		};
+		bool claimed = false;
+
+		if (unlikely(f3fs_cp_error(sbi)) || kthread_should_stop())
+			return;
+
+		inode = NULL;
+		spin_lock(&sbi->inode_lock[FILE_INODE]);
+		list_for_each_entry(fi, head, dirty_list) {
+			if (fi->i_wb_round == w->round)
+				continue;
+			fi->i_wb_round = w->round;
+			list_move_tail(&fi->dirty_list, head);
+			inode = igrab(&fi->vfs_inode);
+			claimed = true;
+			break;
+		}
+		spin_unlock(&sbi->inode_lock[FILE_INODE]);
+
+		if (!claimed)
+			return;
+
+		if (!inode) {
+			/* same as f3fs_sync_dirty_inodes() for a freeing inode */
+			f3fs_submit_merged_write(sbi, DATA);
+			cond_resched();
+			continue;
+		}
+
+		/* skips the writepages mutex and f3fs_balance_fs() */
+		F3FS_I(inode)->cp_task = current;
+		filemap_fdatawrite_wbc(inode->i_mapping, &wbc);
+		F3FS_I(inode)->cp_task = NULL;
+		iput(inode);
+
+		atomic64_inc(&w->inodes);
+		atomic64_add(LONG_MAX - wbc.nr_to_write, &w->pages);
+		cond_resched();
+	}
+}
+
+static int wb_worker_func(void *data)
+{
+	struct wb_worker *w = data;
+	struct wb_pool_control *wpc = &w->sbi->wb_pool;
+
+	while (!kthread_should_stop()) {
+		u64 start;
+
+		wait_event_interruptible(wpc->wait_queue,
+				kthread_should_stop() ||
+				READ_ONCE(wpc->round) != w->round);
+		if (kthread_should_stop())
+			break;
+		w->round = READ_ONCE(wpc->round);
+
+		start = ktime_get_ns();
+		wb_flush_inodes(w);
+		atomic64_add(ktime_get_ns() - start, &w->busy_ns);
+
+		if (atomic_dec_and_test(&wpc->busy))
+			wake_up_all(&wpc->done_queue);
+	}
+	return 0;
+}
+
+/* called with flush_lock held */
+static bool wb_start_round(struct f3fs_sb_info *sbi)
+{
+	struct wb_pool_control *wpc = &sbi->wb_pool;
+	bool empty;
+
+	if (atomic_read(&wpc->busy))
+		return false;
+
+	spin_lock(&sbi->inode_lock[FILE_INODE]);
+	empty = list_empty(&sbi->inode_list[FILE_INODE]);
+	spin_unlock(&sbi->inode_lock[FILE_INODE]);
+	if (empty)
+		return false;
+
+	atomic_set(&wpc->busy, wpc->nr_workers);
+	atomic_inc(&wpc->rounds);
+	smp_wmb();
+	WRITE_ONCE(wpc->round, wpc->round + 1);
+	wake_up_all(&wpc->wait_queue);
+	return true;
+}
+
+/* called with flush_lock held */
+static int wb_sync_round(struct f3fs_sb_info *sbi)
+{
+	struct wb_pool_control *wpc = &sbi->wb_pool;
+
+	/* a running round may have passed the inodes dirtied since */
+	wait_event(wpc->done_queue, !atomic_read(&wpc->busy));
+	if (wb_start_round(sbi))
+		wait_event(wpc->done_queue, !atomic_read(&wpc->busy));
+
+	return unlikely(f3fs_cp_error(sbi)) ? -EIO : 0;
+}
+
+void f3fs_kick_wb_workers(struct f3fs_sb_info *sbi)
+{
+	if (!READ_ONCE(sbi->wb_pool.workers))
+		return;
+
+	/* whoever holds it is flushing already */
+	if (!mutex_trylock(&sbi->flush_lock))
+		return;
+	if (sbi->wb_pool.workers)
+		wb_start_round(sbi);
+	mutex_unlock(&sbi->flush_lock);
+}
+
+int f3fs_start_wb_workers(struct f3fs_sb_info *sbi)
+{
+	struct wb_pool_control *wpc = &sbi->wb_pool;
+	dev_t dev = sbi->sb->s_bdev->bd_dev;
+	struct wb_worker *workers;
+	int i;
+
+	if (wpc->workers || sbi->num_wb_thread <= 0)
+		return 0;
+
+	workers = f3fs_kzalloc(sbi, sizeof(struct wb_worker) *
+				sbi->num_wb_thread, GFP_KERNEL);
+	if (!workers)
+		return -ENOMEM;
+
+	init_waitqueue_head(&wpc->wait_queue);
+	init_waitqueue_head(&wpc->done_queue);
+	atomic_set(&wpc->busy, 0);
+
+	for (i = 0; i < sbi->num_wb_thread; i++) {
+		struct wb_worker *w = &workers[i];
+
+		w->sbi = sbi;
+		w->idx = i;
+		w->round = wpc->round;
+		w->task = kthread_run(wb_worker_func, w, "f3fs_wb-%u:%u-%d",
+					MAJOR(dev), MINOR(dev), i);
+		if (IS_ERR(w->task)) {
+			while (--i >= 0)
+				kthread_stop(workers[i].task);
+			kfree(workers);
+			return -ENOMEM;
+		}
+	}
+
+	wpc->nr_workers = sbi->num_wb_thread;
+	mutex_lock(&sbi->flush_lock);
+	wpc->workers = workers;
+	mutex_unlock(&sbi->flush_lock);
+	return 0;
+}
+
+void f3fs_stop_wb_workers(struct f3fs_sb_info *sbi)
+{
+	struct wb_pool_control *wpc = &sbi->wb_pool;
+	struct wb_worker *workers;
+	int i;
+
+	mutex_lock(&sbi->flush_lock);
+	workers = wpc->workers;
+	wpc->workers = NULL;
+	mutex_unlock(&sbi->flush_lock);
+
+	if (!workers)
+		return;
+
+	for (i = 0; i < wpc->nr_workers; i++)
+		kthread_stop(workers[i].task);
+	atomic_set(&wpc->busy, 0);
+	wpc->nr_workers = 0;
+	kfree(workers);
+}
+
+int f3fs_wb_workers_seq_show(struct seq_file *seq,
+						void *offset)
+{
+	struct super_block *sb = seq->private;
+	struct f3fs_sb_info *sbi = F3FS_SB(sb);
+	struct wb_pool_control *wpc = &sbi->wb_pool;
+	int i;
+
+	mutex_lock(&sbi->flush_lock);
+	if (!wpc->workers) {
+		mutex_unlock(&sbi->flush_lock);
+		seq_puts(seq, "data flush workers are off\n");
+		return 0;
+	}
+
+	seq_printf(seq, "rounds: %d, dirty_kick: %u pages\n",
+			atomic_read(&wpc->rounds), wpc->dirty_kick);
+	seq_printf(seq, "%-8s %12s %14s %12s %10s\n",
+			"worker", "inodes", "pages", "busy_ms", "MB/s");
+	for (i = 0; i < wpc->nr_workers; i++) {
+		struct wb_worker *w = &wpc->workers[i];
+		u64 pages = atomic64_read(&w->pages);
+		u64 busy_ns = atomic64_read(&w->busy_ns);
+		u64 mbps = busy_ns ? div64_u64(pages * F3FS_BLKSIZE * 1000,
+						busy_ns) : 0;
+
+		seq_printf(seq, "%-8d %12lld %14llu %12llu %10llu\n",
+				w->idx, atomic64_read(&w->inodes), pages,
+				div_u64(busy_ns, NSEC_PER_MSEC), mbps);
+	}
+	mutex_unlock(&sbi->flush_lock);
+	return 0;
+}
+
 int f3fs_sync_dirty_inodes(struct f3fs_sb_info *sbi, enum inode_type type)
 {
 	struct list_head *head;
@@ -1063,6 +1300,10 @@ int f3fs_sync_dirty_inodes(struct f3fs_sb_info *sbi, enum inode_type type)
 	bool is_dir = (type == DIR_INODE);
 	unsigned long ino = 0;
 
+	/* FILE_INODE is only flushed under flush_lock */
+	if (type == FILE_INODE && sbi->wb_pool.workers)
+		return wb_sync_round(sbi);
+
 	trace_f3fs_sync_dirty_inodes_enter(sbi->sb, is_dir,
 				get_pages(sbi, is_dir ?
 				F3FS_DIRTY_DENTS : F3FS_DIRTY_DATA));
@@ -1368,6 +1609,12 @@ static void update_ckpt_flags(struct f3fs_sb_info *sbi, struct cp_control *cpc)
 	if (is_sbi_flag_set(sbi, SBI_QUOTA_NEED_REPAIR))
 		__set_ckpt_flags(ckpt, CP_QUOTA_NEED_FSCK_FLAG);
 
+	/* the pack tail may carry reclaim records until the next checkpoint */
+	if (sbi->reclaim_journal && !(cpc->reason & CP_UMOUNT))
+		__set_ckpt_flags(ckpt, CP_RECLAIM_JOURNAL_FLAG);
+	else
+		__clear_ckpt_flags(ckpt, CP_RECLAIM_JOURNAL_FLAG);
+
 	/* set this flag to activate crc|cp_ver for recovery */
 	__set_ckpt_flags(ckpt, CP_CRC_RECOVERY_FLAG);
 	__clear_ckpt_flags(ckpt, CP_NOCRC_RECOVERY_FLAG);
@@ -1461,6 +1708,12 @@ static int do_checkpoint(struct f3fs_sb_info *sbi, struct cp_control *cpc)
 				curseg_alloc_type(sbi, i + CURSEG_HOT_NODE);
 	}
 	for (i = 0; i < NR_CURSEG_DATA_TYPE; i++) {
+		if (i >= NR_DATA_LOG(sbi)) {
+			ckpt->cur_data_segno[i] = cpu_to_le32(NULL_SEGNO);
+			ckpt->cur_data_blkoff[i] = 0;
+			ckpt->alloc_type[i + CURSEG_HOT_DATA] = LFS;
+			continue;
+		}
 		ckpt->cur_data_segno[i] =
 			cpu_to_le32(curseg_segno(sbi, i + CURSEG_HOT_DATA));
 		ckpt->cur_data_blkoff[i] =
@@ -1468,11 +1721,12 @@ static int do_checkpoint(struct f3fs_sb_info *sbi, struct cp_control *cpc)
 		ckpt->alloc_type[i + CURSEG_HOT_DATA] =
 				curseg_alloc_type(sbi, i + CURSEG_HOT_DATA);
 	}
+	ckpt->nr_gc_log = cpu_to_le16(sbi->nr_gc_log);
 
 	/* 2 cp + n data seg summary + orphan inode blocks */
 	data_sum_blocks = f3fs_npages_for_summary_flush(sbi, false);
 	spin_lock_irqsave(&sbi->cp_lock, flags);
-	if (data_sum_blocks < NR_CURSEG_DATA_TYPE)
+	if (data_sum_blocks < NR_DATA_LOG(sbi))
 		__set_ckpt_flags(ckpt, CP_COMPACT_SUM_FLAG);
 	else
 		__clear_ckpt_flags(ckpt, CP_COMPACT_SUM_FLAG);
@@ -1585,12 +1839,16 @@ static int do_checkpoint(struct f3fs_sb_info *sbi, struct cp_control *cpc)
 	clear_sbi_flag(sbi, SBI_NEED_CP);
 	clear_sbi_flag(sbi, SBI_QUOTA_SKIP_FLUSH);
 
-	spin_lock(&sbi->stat_lock);
+	f3fs_stat_lock(sbi);
 	sbi->unusable_block_count = 0;
-	spin_unlock(&sbi->stat_lock);
+	f3fs_stat_unlock(sbi);
 
 	__set_cp_next_pack(sbi);
 
+	/* the new pack supersedes every journaled reclaim */
+	sbi->rj_blkoff = 0;
+	sbi->rj_seq = 0;
+
 	/*
 	 * redirty superblock if metadata like node page or inode cache is
 	 * updated during writing checkpoint.
@@ -1704,6 +1962,325 @@ int f3fs_write_checkpoint(struct f3fs_sb_info *sbi, struct cp_control *cpc)
 	return err;
 }
 
+/*
+ * The reclaim journal lives in the unused tail of the live cp pack
+ * segment, between the pack itself and the nat bits.
+ */
+static block_t reclaim_journal_start(struct f3fs_sb_info *sbi)
+{
+	return __start_cp_addr(sbi) +
+		le32_to_cpu(F3FS_CKPT(sbi)->cp_pack_total_block_count);
+}
+
+static unsigned int reclaim_journal_blocks(struct f3fs_sb_info *sbi)
+{
+	unsigned int used = le32_to_cpu(F3FS_CKPT(sbi)->cp_pack_total_block_count) +
+					NM_I(sbi)->nat_bits_blocks;
+
+	return used < sbi->blocks_per_seg ? sbi->blocks_per_seg - used : 0;
+}
+
+static __u32 reclaim_block_chksum(struct f3fs_sb_info *sbi,
+					struct f3fs_reclaim_block *blk)
+{
+	unsigned int ofs = offsetof(struct f3fs_reclaim_block, cp_ver);
+
+	return f3fs_crc32(sbi, (unsigned char *)blk + ofs, F3FS_BLKSIZE - ofs);
+}
+
+static void fill_reclaim_block(struct f3fs_sb_info *sbi,
+				struct f3fs_reclaim_block *blk,
+				struct gc_reclaim_batch *rb,
+				unsigned int idx, unsigned int count)
+{
+	unsigned int i, start = idx * F3FS_RECLAIM_ENTRIES;
+	unsigned int nr = min_t(unsigned int, rb->nr - start,
+						F3FS_RECLAIM_ENTRIES);
+
+	blk->magic = cpu_to_le32(F3FS_RECLAIM_MAGIC);
+	blk->cp_ver = cpu_to_le64(cur_cp_version(F3FS_CKPT(sbi)));
+	blk->seq = cpu_to_le32(sbi->rj_seq);
+	blk->segno = cpu_to_le32(rb->segno);
+	blk->blk_idx = cpu_to_le16(idx);
+	blk->blk_count = cpu_to_le16(count);
+	blk->entry_count = cpu_to_le16(nr);
+
+	for (i = 0; i < nr; i++) {
+		struct gc_reclaim_entry *e = &rb->entries[start + i];
+
+		blk->entries[i].nid = cpu_to_le32(e->nid);
+		blk->entries[i].ofs_in_node = cpu_to_le16(e->ofs_in_node);
+		blk->entries[i].old_addr = cpu_to_le32(e->old_blkaddr);
+		blk->entries[i].new_addr = cpu_to_le32(e->new_blkaddr);
+	}
+	blk->check_sum = cpu_to_le32(reclaim_block_chksum(sbi, blk));
+}
+
+/*
+ * Make the GC moves in @rb durable in the reclaim journal and hand the
+ * victim segment back to the free pool without waiting for a checkpoint.
+ * The caller must have written back every copy in @rb already.
+ */
+int f3fs_commit_reclaim(struct f3fs_sb_info *sbi, struct gc_reclaim_batch *rb)
+{
+	unsigned int count = DIV_ROUND_UP(rb->nr, F3FS_RECLAIM_ENTRIES);
+	blk_opf_t opf = REQ_OP_WRITE | REQ_SYNC | REQ_META | REQ_PRIO;
+	struct block_device *bdev;
+	struct bio_vec *bv;
+	struct bvec_iter_all iter_all;
+	struct bio *bio;
+	block_t blkaddr;
+	sector_t sector;
+	unsigned int i;
+	int err = 0;
+
+	/* a running checkpoint resets the journal and frees the segment */
+	if (!f3fs_down_write_trylock(&sbi->cp_global_sem))
+		return -EAGAIN;
+
+	/* only a pack flagged for it may carry journal records */
+	if (!is_set_ckpt_flags(sbi, CP_RECLAIM_JOURNAL_FLAG) ||
+			!f3fs_segment_reclaimable(sbi, rb)) {
+		err = -EAGAIN;
+		goto out;
+	}
+	if (sbi->rj_blkoff + count > reclaim_journal_blocks(sbi)) {
+		err = -ENOSPC;
+		goto out;
+	}
+
+	if (!test_opt(sbi, NOBARRIER))
+		opf |= REQ_PREFLUSH | REQ_FUA;
+	blkaddr = reclaim_journal_start(sbi) + sbi->rj_blkoff;
+	bdev = f3fs_target_device(sbi, blkaddr, &sector);
+	bio = bio_alloc(bdev, count, opf, GFP_NOIO);
+	bio->bi_iter.bi_sector = sector;
+
+	for (i = 0; i < count; i++) {
+		struct page *page = alloc_page(GFP_NOIO | __GFP_ZERO);
+
+		if (!page) {
+			err = -ENOMEM;
+			goto free_bio;
+		}
+		fill_reclaim_block(sbi, page_address(page), rb, i, count);
+		bio_add_page(bio, page, PAGE_SIZE, 0);
+	}
+
+	err = submit_bio_wait(bio);
+	if (err) {
+		f3fs_warn(sbi, "reclaim journal write failed, segno:%u err:%d",
+							rb->segno, err);
+		goto free_bio;
+	}
+
+	f3fs_reclaim_prefree_segment(sbi, rb);
+	sbi->rj_blkoff += count;
+	sbi->rj_seq++;
+	sbi->rj_reclaimed_segs++;
+free_bio:
+	bio_for_each_segment_all(bv, bio, iter_all)
+		__free_page(bv->bv_page);
+	bio_put(bio);
+out:
+	f3fs_up_write(&sbi->cp_global_sem);
+	return err;
+}
+
+static bool reclaim_block_valid(struct f3fs_sb_info *sbi,
+				struct f3fs_reclaim_block *blk,
+				unsigned int seq)
+{
+	return le32_to_cpu(blk->magic) == F3FS_RECLAIM_MAGIC &&
+		le64_to_cpu(blk->cp_ver) == cur_cp_version(F3FS_CKPT(sbi)) &&
+		le32_to_cpu(blk->seq) == seq &&
+		le32_to_cpu(blk->segno) < MAIN_SEGS(sbi) &&
+		le16_to_cpu(blk->blk_idx) < le16_to_cpu(blk->blk_count) &&
+		le16_to_cpu(blk->entry_count) <= F3FS_RECLAIM_ENTRIES &&
+		le32_to_cpu(blk->check_sum) == reclaim_block_chksum(sbi, blk);
+}
+
+/*
+ * Check that the record starting at @blkaddr is complete.  A torn record
+ * is simply the end of the journal.
+ */
+static unsigned int reclaim_record_blocks(struct f3fs_sb_info *sbi,
+				block_t blkaddr, unsigned int seq,
+				unsigned int remain)
+{
+	unsigned int i, count = 0, segno = 0;
+
+	for (i = 0; i == 0 || i < count; i++) {
+		struct page *page = f3fs_get_meta_page(sbi, blkaddr + i);
+		struct f3fs_reclaim_block *blk;
+		bool valid;
+
+		if (IS_ERR(page))
+			return 0;
+		blk = (struct f3fs_reclaim_block *)page_address(page);
+		valid = reclaim_block_valid(sbi, blk, seq) &&
+			le16_to_cpu(blk->blk_idx) == i;
+		if (valid && i == 0) {
+			count = le16_to_cpu(blk->blk_count);
+			segno = le32_to_cpu(blk->segno);
+			valid = count <= remain;
+		} else if (valid) {
+			valid = le16_to_cpu(blk->blk_count) == count &&
+				le32_to_cpu(blk->segno) == segno;
+		}
+		f3fs_put_page(page, 1);
+		if (!valid)
+			return 0;
+	}
+	return count;
+}
+
+static int replay_reclaim_entry(struct f3fs_sb_info *sbi,
+				struct f3fs_reclaim_entry *re)
+{
+	nid_t nid = le32_to_cpu(re->nid);
+	unsigned int ofs = le16_to_cpu(re->ofs_in_node);
+	block_t old_blkaddr = le32_to_cpu(re->old_addr);
+	block_t new_blkaddr = le32_to_cpu(re->new_addr);
+	struct f3fs_summary sum;
+	struct f3fs_extent *ext;
+	struct node_info ni;
+	struct page *page;
+	__le32 *addr;
+	nid_t ino;
+	int err;
+
+	if (!f3fs_is_valid_blkaddr(sbi, old_blkaddr, DATA_GENERIC) ||
+			!f3fs_is_valid_blkaddr(sbi, new_blkaddr, DATA_GENERIC))
+		return -EFSCORRUPTED;
+
+	err = f3fs_get_node_info(sbi, nid, &ni, false);
+	if (err)
+		return err;
+	if (ni.blk_addr == NULL_ADDR)
+		return 0;
+
+	page = f3fs_get_node_page(sbi, nid);
+	if (IS_ERR(page))
+		return PTR_ERR(page);
+
+	if (IS_INODE(page))
+		ofs += offset_in_addr(&F3FS_NODE(page)->i);
+	if (ofs >= (IS_INODE(page) ? DEF_ADDRS_PER_INODE :
+						DEF_ADDRS_PER_BLOCK)) {
+		f3fs_put_page(page, 1);
+		return -EFSCORRUPTED;
+	}
+
+	addr = blkaddr_in_node(F3FS_NODE(page)) + ofs;
+	if (le32_to_cpu(*addr) != old_blkaddr) {
+		/* the checkpoint does not point there, nothing to redo */
+		f3fs_put_page(page, 1);
+		return 0;
+	}
+
+	f3fs_wait_on_page_writeback(page, NODE, true, true);
+	*addr = cpu_to_le32(new_blkaddr);
+	set_page_dirty(page);
+	ino = ino_of_node(page);
+	f3fs_put_page(page, 1);
+
+	/* the persisted largest extent may still cover the old address */
+	page = f3fs_get_node_page(sbi, ino);
+	if (IS_ERR(page))
+		return PTR_ERR(page);
+	ext = &F3FS_NODE(page)->i.i_ext;
+	if (le32_to_cpu(ext->len) && le32_to_cpu(ext->blk) <= old_blkaddr &&
+			old_blkaddr - le32_to_cpu(ext->blk) < le32_to_cpu(ext->len)) {
+		f3fs_wait_on_page_writeback(page, NODE, true, true);
+		ext->len = 0;
+		set_page_dirty(page);
+	}
+	f3fs_put_page(page, 1);
+
+	set_summary(&sum, le32_to_cpu(re->nid), le16_to_cpu(re->ofs_in_node),
+								ni.version);
+	f3fs_replay_block_move(sbi, &sum, old_blkaddr, new_blkaddr);
+	return 0;
+}
+
+static int replay_reclaim_record(struct f3fs_sb_info *sbi, block_t blkaddr,
+				unsigned int count, unsigned int *moves)
+{
+	unsigned int i, j;
+	int err = 0;
+
+	for (i = 0; i < count && !err; i++) {
+		struct page *page = f3fs_get_meta_page(sbi, blkaddr + i);
+		struct f3fs_reclaim_block *blk;
+
+		if (IS_ERR(page))
+			return PTR_ERR(page);
+		blk = (struct f3fs_reclaim_block *)page_address(page);
+		for (j = 0; j < le16_to_cpu(blk->entry_count) && !err; j++)
+			err = replay_reclaim_entry(sbi, &blk->entries[j]);
+		*moves += j;
+		f3fs_put_page(page, 1);
+	}
+	return err;
+}
+
+/*
+ * Redo the GC moves of every segment handed back since the last checkpoint.
+ * This only changes in-memory node pages and segment info; the journal is
+ * kept and appended to until the next checkpoint makes it redundant.
+ */
+int f3fs_replay_reclaim_journal(struct f3fs_sb_info *sbi)
+{
+	block_t start = reclaim_journal_start(sbi);
+	unsigned int max_blks = reclaim_journal_blocks(sbi);
+	unsigned int blkoff = 0, seq = 0, moves = 0;
+	int err = 0;
+
+	if (!f3fs_sb_has_reclaim_journal(sbi) ||
+			!is_set_ckpt_flags(sbi, CP_RECLAIM_JOURNAL_FLAG))
+		return 0;
+
+	/* replay dirties node pages, which a read-only mount can't write */
+	if ((f3fs_readonly(sbi->sb) || f3fs_hw_is_readonly(sbi)) && max_blks &&
+			reclaim_record_blocks(sbi, start, 0, max_blks)) {
+		f3fs_err(sbi, "Need to replay the reclaim journal, but write "
+				"access unavailable, please mount read-write");
+		return -EROFS;
+	}
+
+	while (blkoff < max_blks) {
+		unsigned int count = reclaim_record_blocks(sbi, start + blkoff,
+						seq, max_blks - blkoff);
+
+		if (!count)
+			break;
+		err = replay_reclaim_record(sbi, start + blkoff, count, &moves);
+		if (err)
+			break;
+		blkoff += count;
+		seq++;
+	}
+
+	if (max_blks)
+		invalidate_mapping_pages(META_MAPPING(sbi), start,
+						start + max_blks - 1);
+	if (err) {
+		f3fs_err(sbi, "reclaim journal replay failed, seq:%u err:%d",
+								seq, err);
+		return err;
+	}
+
+	sbi->rj_blkoff = blkoff;
+	sbi->rj_seq = seq;
+	if (seq) {
+		set_sbi_flag(sbi, SBI_IS_DIRTY);
+		f3fs_notice(sbi, "reclaim journal: replayed %u segments, %u blocks",
+								seq, moves);
+	}
+	return 0;
+}
+
 void f3fs_init_ino_entry_info(struct f3fs_sb_info *sbi)
 {
 	int i;
@@ -14,6 +14,7 @@
 #include <linux/lz4.h>
 #include <linux/zstd.h>
 #include <linux/pagevec.h>
+#include <linux/seq_file.h>
 
 #include "f3fs.h"
 #include "node.h"
@@ -172,11 +173,110 @@ void f3fs_compress_ctx_add_page(struct compress_ctx *cc, struct page *page)
 	cc->cluster_idx = cluster_idx(cc, page->index);
 }
 
+/*
+ * Compressor workspaces are cached per CPU and per algorithm, one for
+ * compression and one for decompression, rather than allocated for every
+ * cluster.  A cached workspace too small for the level or cluster size at
+ * hand is replaced by a bigger one, and the f3fs shrinker drops them all
+ * under memory pressure.  Slots are only touched with xchg()/cmpxchg(), so
+ * a task that migrates or a read completion in softirq just ends up using
+ * another CPU's slot.
+ */
+enum {
+	CWS_COMPRESS,
+	CWS_DECOMPRESS,
+	NR_CWS,
+};
+
+struct compress_workspace {
+	size_t size;
+	char mem[] __aligned(8);
+};
+
+struct compress_ws_slots {
+	struct compress_workspace *ws[COMPRESS_MAX][NR_CWS];
+};
+
+static DEFINE_PER_CPU(struct compress_ws_slots, compress_ws_slots);
+static atomic_t nr_cached_workspaces = ATOMIC_INIT(0);
+
+static struct compress_workspace **cws_slot(int cpu, int algo, int dir)
+{
+	return &per_cpu_ptr(&compress_ws_slots, cpu)->ws[algo][dir];
+}
+
+static void *get_compress_workspace(struct inode *inode, int dir,
+							size_t size)
+{
+	int algo = F3FS_I(inode)->i_compress_algorithm;
+	struct compress_workspace *ws;
+
+	ws = xchg(cws_slot(raw_smp_processor_id(), algo, dir), NULL);
+	if (ws) {
+		atomic_dec(&nr_cached_workspaces);
+		if (ws->size >= size)
+			return ws->mem;
+		kvfree(ws);
+	}
+
+	ws = f3fs_kvmalloc(F3FS_I_SB(inode), struct_size(ws, mem, size),
+								GFP_NOFS);
+	if (!ws)
+		return NULL;
+	ws->size = size;
+	return ws->mem;
+}
+
+static void put_compress_workspace(struct inode *inode, int dir, void *mem)
+{
+	int algo = F3FS_I(inode)->i_compress_algorithm;
+	struct compress_workspace *ws;
+
+	if (!mem)
+		return;
+
+	ws = mem - offsetof(struct compress_workspace, mem);
+	if (cmpxchg(cws_slot(raw_smp_processor_id(), algo, dir),
+							NULL, ws)) {
+		kvfree(ws);
+		return;
+	}
+	atomic_inc(&nr_cached_workspaces);
+}
+
+unsigned long f3fs_count_compress_workspaces(void)
+{
+	return atomic_read(&nr_cached_workspaces);
+}
+
+unsigned long f3fs_shrink_compress_workspaces(unsigned long nr_shrink)
+{
+	struct compress_workspace *ws;
+	unsigned long freed = 0;
+	int cpu, algo, dir;
+
+	for_each_possible_cpu(cpu) {
+		for (algo = 0; algo < COMPRESS_MAX; algo++) {
+			for (dir = 0; dir < NR_CWS; dir++) {
+				if (freed >= nr_shrink)
+					return freed;
+				ws = xchg(cws_slot(cpu, algo, dir), NULL);
+				if (!ws)
+					continue;
+				atomic_dec(&nr_cached_workspaces);
+				kvfree(ws);
+				freed++;
+			}
+		}
+	}
+	return freed;
+}
+
 #ifdef CONFIG_F3FS_FS_LZO
 static int lzo_init_compress_ctx(struct compress_ctx *cc)
 {
-	cc->private = f3fs_kvmalloc(F3FS_I_SB(cc->inode),
-				LZO1X_MEM_COMPRESS, GFP_NOFS);
+	cc->private = get_compress_workspace(cc->inode, CWS_COMPRESS,
+							LZO1X_MEM_COMPRESS);
 	if (!cc->private)
 		return -ENOMEM;
 
@@ -186,7 +286,7 @@ static int lzo_init_compress_ctx(struct compress_ctx *cc)
 
 static void lzo_destroy_compress_ctx(struct compress_ctx *cc)
 {
-	kvfree(cc->private);
+	put_compress_workspace(cc->inode, CWS_COMPRESS, cc->private);
 	cc->private = NULL;
 }
 
@@ -241,11 +341,11 @@ static int lz4_init_compress_ctx(struct compress_ctx *cc)
 	unsigned int size = LZ4_MEM_COMPRESS;
 
 #ifdef CONFIG_F3FS_FS_LZ4HC
-	if (F3FS_I(cc->inode)->i_compress_flag >> COMPRESS_LEVEL_OFFSET)
+	if (cc->level)
 		size = LZ4HC_MEM_COMPRESS;
 #endif
 
-	cc->private = f3fs_kvmalloc(F3FS_I_SB(cc->inode), size, GFP_NOFS);
+	cc->private = get_compress_workspace(cc->inode, CWS_COMPRESS, size);
 	if (!cc->private)
 		return -ENOMEM;
 
@@ -260,15 +360,14 @@ static int lz4_init_compress_ctx(struct compress_ctx *cc)
 
 static void lz4_destroy_compress_ctx(struct compress_ctx *cc)
 {
-	kvfree(cc->private);
+	put_compress_workspace(cc->inode, CWS_COMPRESS, cc->private);
 	cc->private = NULL;
 }
 
 #ifdef CONFIG_F3FS_FS_LZ4HC
 static int lz4hc_compress_pages(struct compress_ctx *cc)
 {
-	unsigned char level = F3FS_I(cc->inode)->i_compress_flag >>
-						COMPRESS_LEVEL_OFFSET;
+	unsigned char level = cc->level;
 	int len;
 
 	if (level)
@@ -340,17 +439,16 @@ static int zstd_init_compress_ctx(struct compress_ctx *cc)
 	zstd_cstream *stream;
 	void *workspace;
 	unsigned int workspace_size;
-	unsigned char level = F3FS_I(cc->inode)->i_compress_flag >>
-						COMPRESS_LEVEL_OFFSET;
+	unsigned char level = cc->level;
 
 	if (!level)
 		level = F3FS_ZSTD_DEFAULT_CLEVEL;
 
-	params = zstd_get_params(F3FS_ZSTD_DEFAULT_CLEVEL, cc->rlen);
+	params = zstd_get_params(level, cc->rlen);
 	workspace_size = zstd_cstream_workspace_bound(&params.cParams);
 
-	workspace = f3fs_kvmalloc(F3FS_I_SB(cc->inode),
-					workspace_size, GFP_NOFS);
+	workspace = get_compress_workspace(cc->inode, CWS_COMPRESS,
+							workspace_size);
 	if (!workspace)
 		return -ENOMEM;
 
@@ -359,7 +457,7 @@ static int zstd_init_compress_ctx(struct compress_ctx *cc)
 		printk_ratelimited("%sF3FS-fs (%s): %s zstd_init_cstream failed\n",
 				KERN_ERR, F3FS_I_SB(cc->inode)->sb->s_id,
 				__func__);
-		kvfree(workspace);
+		put_compress_workspace(cc->inode, CWS_COMPRESS, workspace);
 		return -EIO;
 	}
 
@@ -372,7 +470,7 @@ static int zstd_init_compress_ctx(struct compress_ctx *cc)
 
 static void zstd_destroy_compress_ctx(struct compress_ctx *cc)
 {
-	kvfree(cc->private);
+	put_compress_workspace(cc->inode, CWS_COMPRESS, cc->private);
 	cc->private = NULL;
 	cc->private2 = NULL;
 }
@@ -431,8 +529,8 @@ static int zstd_init_decompress_ctx(struct decompress_io_ctx *dic)
 
 	workspace_size = zstd_dstream_workspace_bound(max_window_size);
 
-	workspace = f3fs_kvmalloc(F3FS_I_SB(dic->inode),
-					workspace_size, GFP_NOFS);
+	workspace = get_compress_workspace(dic->inode, CWS_DECOMPRESS,
+							workspace_size);
 	if (!workspace)
 		return -ENOMEM;
 
@@ -441,7 +539,7 @@ static int zstd_init_decompress_ctx(struct decompress_io_ctx *dic)
 		printk_ratelimited("%sF3FS-fs (%s): %s zstd_init_dstream failed\n",
 				KERN_ERR, F3FS_I_SB(dic->inode)->sb->s_id,
 				__func__);
-		kvfree(workspace);
+		put_compress_workspace(dic->inode, CWS_DECOMPRESS, workspace);
 		return -EIO;
 	}
 
@@ -453,7 +551,7 @@ static int zstd_init_decompress_ctx(struct decompress_io_ctx *dic)
 
 static void zstd_destroy_decompress_ctx(struct decompress_io_ctx *dic)
 {
-	kvfree(dic->private);
+	put_compress_workspace(dic->inode, CWS_DECOMPRESS, dic->private);
 	dic->private = NULL;
 	dic->private2 = NULL;
 }
@@ -662,7 +760,18 @@ static int f3fs_compress_pages(struct compress_ctx *cc)
 		goto out_vunmap_rbuf;
 	}
 
-	ret = cops->compress_pages(cc);
+	if (cc->gc_recompress) {
+		struct gc_recompress_info *gri =
+				&F3FS_I_SB(cc->inode)->gc_recompr;
+		u64 start = ktime_get_ns(), delta;
+
+		ret = cops->compress_pages(cc);
+		delta = ktime_get_ns() - start;
+		atomic64_add(delta, &gri->cpu_ns);
+		atomic64_add(delta, &gri->window_ns);
+	} else {
+		ret = cops->compress_pages(cc);
+	}
 	if (ret)
 		goto out_vunmap_cbuf;
 
@@ -705,6 +814,15 @@ static int f3fs_compress_pages(struct compress_ctx *cc)
 
 	cc->valid_nr_cpages = new_nr_cpages;
 
+	if (cc->gc_queued) {
+		struct gc_recompress_info *gri =
+				&F3FS_I_SB(cc->inode)->gc_recompr;
+
+		if (cc->gc_recompress)
+			atomic64_inc(&gri->done);
+		atomic64_add(new_nr_cpages, &gri->new_blocks);
+	}
+
 	trace_f3fs_compress_pages_end(cc->inode, cc->cluster_idx,
 							cc->clen, ret);
 	return 0;
@@ -996,6 +1114,158 @@ int f3fs_is_compressed_cluster(struct inode *inode, pgoff_t index)
 		false);
 }
 
+/*
+ * Before handing a cluster to the compressor, sample it and estimate the
+ * Shannon entropy of its bytes, as btrfs does: already-compressed media
+ * and encrypted data come out close to 8 bits per byte and are written as
+ * is.  SAMPLE_LEN bytes are read every SAMPLE_STRIDE bytes, which keeps
+ * each histogram bucket within a u16 for the largest cluster.
+ */
+#define COMPR_SAMPLE_STRIDE	512
+#define COMPR_SAMPLE_LEN	16
+#define COMPR_SMALL_ALPHABET	64	/* this few byte values always pack */
+#define COMPR_ENTROPY_PCT	85	/* % of 8 bits/byte considered random */
+#define COMPR_MAX_BACKOFF	6	/* skip at most 63 clusters in a row */
+
+/* 4 * log2(x), to keep some precision in integer arithmetic */
+static inline unsigned int ilog2_w(u64 x)
+{
+	return ilog2(x * x * x * x);
+}
+
+static bool cluster_looks_compressible(struct compress_ctx *cc)
+{
+	u16 bucket[256] = { 0 };
+	unsigned int nr_samples = 0, distinct = 0;
+	unsigned int i, j, k, entropy;
+	u64 sum = 0;
+
+	for (i = 0; i < cc->cluster_size; i++) {
+		u8 *p = kmap_local_page(cc->rpages[i]);
+
+		for (j = 0; j < PAGE_SIZE; j += COMPR_SAMPLE_STRIDE)
+			for (k = 0; k < COMPR_SAMPLE_LEN; k++)
+				bucket[p[j + k]]++;
+		kunmap_local(p);
+		nr_samples += PAGE_SIZE / COMPR_SAMPLE_STRIDE *
+							COMPR_SAMPLE_LEN;
+	}
+
+	for (i = 0; i < 256; i++) {
+		if (!bucket[i])
+			continue;
+		distinct++;
+		sum += bucket[i] * ilog2_w(bucket[i]);
+	}
+	if (distinct <= COMPR_SMALL_ALPHABET)
+		return true;
+
+	/* H = log2(n) - sum(c * log2(c)) / n, in quarter bits */
+	entropy = ilog2_w(nr_samples) - div_u64(sum, nr_samples);
+	return entropy * 100 < COMPR_ENTROPY_PCT * 4 * BITS_PER_BYTE;
+}
+
+/*
+ * A file whose clusters keep failing to compress is not even sampled for
+ * the next 2^n - 1 clusters, n growing with every failure in a row.
+ */
+static void compress_backoff(struct compress_ctx *cc)
+{
+	struct f3fs_inode_info *fi = F3FS_I(cc->inode);
+
+	if (fi->i_compr_backoff < COMPR_MAX_BACKOFF)
+		fi->i_compr_backoff++;
+	fi->i_compr_skip = (1 << fi->i_compr_backoff) - 1;
+}
+
+static bool cluster_worth_compress(struct compress_ctx *cc)
+{
+	struct f3fs_inode_info *fi = F3FS_I(cc->inode);
+
+	/* it did compress before, GC only wants it smaller */
+	if (cc->gc_queued)
+		return true;
+
+	if (fi->i_compr_skip)
+		fi->i_compr_skip--;
+	else if (cluster_looks_compressible(cc))
+		return true;
+	else
+		compress_backoff(cc);
+
+	F3FS_I_SB(cc->inode)->compr_skipped_cluster++;
+	add_compr_block_stat(cc->inode, cc->cluster_size);
+	return false;
+}
+
+/* the level GC recompresses @inode's cold clusters at, 0 if it cannot */
+static unsigned char gc_recompress_level(struct inode *inode)
+{
+	unsigned int level = READ_ONCE(F3FS_I_SB(inode)->gc_recompr.level);
+
+	switch (F3FS_I(inode)->i_compress_algorithm) {
+#ifdef CONFIG_F3FS_FS_LZ4HC
+	case COMPRESS_LZ4:
+		return min_t(unsigned int, level, LZ4HC_MAX_CLEVEL);
+#endif
+#ifdef CONFIG_F3FS_FS_ZSTD
+	case COMPRESS_ZSTD:
+		return min_t(unsigned int, level, zstd_max_clevel());
+#endif
+	default:
+		/* lzo has no levels */
+		return 0;
+	}
+}
+
+/* whether GC recompression has CPU time left in the current window */
+static bool gc_recompress_in_budget(struct gc_recompress_info *gri)
+{
+	unsigned int budget_ms = READ_ONCE(gri->budget_ms);
+
+	if (!budget_ms)
+		return true;
+	if (time_after(jiffies, READ_ONCE(gri->window) + HZ)) {
+		WRITE_ONCE(gri->window, jiffies);
+		atomic64_set(&gri->window_ns, 0);
+	}
+	return atomic64_read(&gri->window_ns) < (u64)budget_ms * NSEC_PER_MSEC;
+}
+
+/*
+ * Pick the level for the cluster in @cc: the inode's, or the GC one if GC
+ * queued the cluster for recompression.  The mark is consumed here, so a
+ * later write of the same pages goes back to the inode's level.  Clusters
+ * queued faster than writeback drains them may find the budget used up by
+ * now; those are rewritten at the inode's level, which costs what a plain
+ * copy of a compressed cluster would, and are neither counted as done nor
+ * charged to the budget.  Every queued cluster still lands in new_blocks,
+ * however it ends up written, so the ratio old_blocks/new_blocks stays fair.
+ */
+static void cluster_compress_level(struct compress_ctx *cc)
+{
+	int i;
+
+	cc->level = F3FS_I(cc->inode)->i_compress_flag >> COMPRESS_LEVEL_OFFSET;
+	cc->gc_queued = false;
+	cc->gc_recompress = false;
+
+	for (i = 0; i < cc->cluster_size; i++) {
+		if (!cc->rpages[i] || !page_private_recompress(cc->rpages[i]))
+			continue;
+		clear_page_private_recompress(cc->rpages[i]);
+		cc->gc_queued = true;
+	}
+	if (!cc->gc_queued)
+		return;
+	if (!gc_recompress_in_budget(&F3FS_I_SB(cc->inode)->gc_recompr)) {
+		atomic64_inc(&F3FS_I_SB(cc->inode)->gc_recompr.throttled);
+		return;
+	}
+	cc->gc_recompress = true;
+	cc->level = max(cc->level, gc_recompress_level(cc->inode));
+}
+
 static bool cluster_may_compress(struct compress_ctx *cc)
 {
 	if (!f3fs_need_compress_data(cc->inode))
@@ -1504,21 +1774,35 @@ int f3fs_write_multi_pages(struct compress_ctx *cc,
 	int err;
 
 	*submitted = 0;
+	cluster_compress_level(cc);
 	if (cluster_may_compress(cc)) {
+		if (!cluster_worth_compress(cc))
+			goto write;
+
 		err = f3fs_compress_pages(cc);
 		if (err == -EAGAIN) {
 			add_compr_block_stat(cc->inode, cc->cluster_size);
+			if (cc->gc_queued)
+				atomic64_add(cc->cluster_size,
+					&F3FS_I_SB(cc->inode)->gc_recompr.new_blocks);
+			else
+				compress_backoff(cc);
 			goto write;
 		} else if (err) {
 			f3fs_put_rpages_wbc(cc, wbc, true, 1);
 			goto destroy_out;
 		}
+		F3FS_I(cc->inode)->i_compr_backoff = 0;
 
 		err = f3fs_write_compressed_pages(cc, submitted,
 							wbc, io_type);
 		if (!err)
 			return 0;
 		f3fs_bug_on(F3FS_I_SB(cc->inode), err != -EAGAIN);
+	} else if (cc->gc_queued) {
+		/* e.g. compression got turned off since GC queued it */
+		atomic64_add(cc->cluster_size,
+				&F3FS_I_SB(cc->inode)->gc_recompr.new_blocks);
 	}
 write:
 	f3fs_bug_on(F3FS_I_SB(cc->inode), *submitted);
@@ -1530,6 +1814,112 @@ int f3fs_write_multi_pages(struct compress_ctx *cc,
 	return err;
 }
 
+bool f3fs_gc_may_recompress(struct inode *inode)
+{
+	struct f3fs_inode_info *fi = F3FS_I(inode);
+	struct gc_recompress_info *gri = &F3FS_I_SB(inode)->gc_recompr;
+
+	if (!f3fs_compressed_file(inode) ||
+			is_inode_flag_set(inode, FI_COMPRESS_RELEASED))
+		return false;
+	if (gc_recompress_level(inode) <=
+			fi->i_compress_flag >> COMPRESS_LEVEL_OFFSET)
+		return false;
+
+	if (gc_recompress_in_budget(gri))
+		return true;
+	atomic64_inc(&gri->throttled);
+	return false;
+}
+
+/*
+ * Queue the compressed cluster holding @index for recompression: read it
+ * back through the page cache and dirty it like BG GC does for plain
+ * data, marked so that writeback compresses it at the GC level.  Returns
+ * -EAGAIN if the cluster is not compressed or cannot be queued whole, for
+ * the caller to copy it.
+ */
+int f3fs_gc_recompress_cluster(struct inode *inode, pgoff_t index)
+{
+	struct f3fs_inode_info *fi = F3FS_I(inode);
+	struct gc_recompress_info *gri = &F3FS_I_SB(inode)->gc_recompr;
+	struct address_space *mapping = inode->i_mapping;
+	pgoff_t start = round_down(index, fi->i_cluster_size);
+	DEFINE_READAHEAD(ractl, NULL, NULL, mapping, start);
+	struct page **pages;
+	int nr_cblocks, i, err = 0;
+
+	nr_cblocks = __f3fs_cluster_blocks(inode,
+				start >> fi->i_log_cluster_size, true);
+	if (nr_cblocks < 0)
+		return nr_cblocks;
+	if (!nr_cblocks)
+		return -EAGAIN;
+
+	/* decompress the cluster once, not once per page */
+	page_cache_ra_unbounded(&ractl, fi->i_cluster_size, 0);
+
+	pages = page_array_alloc(inode, fi->i_cluster_size);
+	if (!pages)
+		return -ENOMEM;
+
+	/* lock every page before marking any, the caller copies on -EAGAIN */
+	for (i = 0; i < fi->i_cluster_size; i++) {
+		struct page *page;
+
+		page = read_cache_page(mapping, start + i, NULL, NULL);
+		if (IS_ERR(page)) {
+			err = PTR_ERR(page);
+			goto out;
+		}
+		lock_page(page);
+		pages[i] = page;
+
+		/* another block of this cluster got here first */
+		if (!i && page_private_recompress(page))
+			goto out;
+		if (page->mapping != mapping || PageWriteback(page)) {
+			err = -EAGAIN;
+			goto out;
+		}
+	}
+
+	for (i = 0; i < fi->i_cluster_size; i++) {
+		set_page_dirty(pages[i]);
+		set_page_private_gcing(pages[i]);
+		set_page_private_recompress(pages[i]);
+	}
+
+	atomic64_inc(&gri->queued);
+	/* the COMPRESS_ADDR slot is counted too */
+	atomic64_add(nr_cblocks - 1, &gri->old_blocks);
+out:
+	for (i = 0; i < fi->i_cluster_size && pages[i]; i++)
+		f3fs_put_page(pages[i], 1);
+	page_array_free(inode, pages, fi->i_cluster_size);
+	return err;
+}
+
+int f3fs_gc_recompress_seq_show(struct seq_file *seq, void *offset)
+{
+	struct super_block *sb = seq->private;
+	struct gc_recompress_info *gri = &F3FS_SB(sb)->gc_recompr;
+	u64 old_blocks = atomic64_read(&gri->old_blocks);
+	u64 new_blocks = atomic64_read(&gri->new_blocks);
+
+	seq_printf(seq, "level: %u, budget: %u ms/s\n",
+			gri->level, gri->budget_ms);
+	seq_printf(seq, "clusters queued: %lld, recompressed: %lld, "
+			"over budget: %lld\n",
+			atomic64_read(&gri->queued), atomic64_read(&gri->done),
+			atomic64_read(&gri->throttled));
+	seq_printf(seq, "cpu: %llu ms\n",
+			div_u64(atomic64_read(&gri->cpu_ns), NSEC_PER_MSEC));
+	seq_printf(seq, "blocks before: %llu, after: %llu, reclaimed: %lld\n",
+			old_blocks, new_blocks, (s64)(old_blocks - new_blocks));
+	return 0;
+}
+
 static inline bool allow_memalloc_for_decomp(struct f3fs_sb_info *sbi,
 		bool pre_alloc)
 {
@@ -2045,6 +2435,7 @@ int __init f3fs_init_compress_cache(void)
 
 void f3fs_destroy_compress_cache(void)
 {
+	f3fs_shrink_compress_workspaces(ULONG_MAX);
 	f3fs_destroy_dic_cache();
 	f3fs_destroy_cic_cache();
 }
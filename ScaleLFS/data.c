@@ -358,6 +358,8 @@ static void f3fs_write_end_io2(struct bio *bio)
     }
 
     if (unlikely(bio->bi_status)) {
+      /* the reclaim journal must not log a copy that never landed */
+      SetPageError(page);
       if (type == F3FS_WB_CP_DATA)
         f3fs_stop_checkpoint(sbi, true);
     }
@@ -582,12 +584,35 @@ static bool f3fs_crypt_mergeable_bio(struct bio *bio, const struct inode *inode,
 	return fscrypt_mergeable_bio(bio, inode, next_idx);
 }
 
+/*
+ * Inode checksums are filled in once per node bio, right before it goes
+ * out, instead of one page at a time under curseg_mutex.  Node pages are
+ * stable under writeback, so nothing can change them in between.
+ */
+static void f3fs_chksum_node_bio(struct f3fs_sb_info *sbi, struct bio *bio)
+{
+	struct bio_vec *bv;
+	struct bvec_iter_all iter_all;
+
+	if (!f3fs_sb_has_inode_chksum(sbi))
+		return;
+
+	bio_for_each_segment_all(bv, bio, iter_all) {
+		if (page_private_dummy(bv->bv_page))
+			continue;
+		f3fs_inode_chksum_set(sbi, bv->bv_page);
+	}
+}
+
 static inline void __submit_bio2(struct f3fs_sb_info *sbi,
         struct bio *bio, enum page_type type)
 {
   if (!is_read_io(bio_op(bio))) {
     unsigned int start;
 
+    if (type == NODE)
+      f3fs_chksum_node_bio(sbi, bio);
+
     if (type != DATA && type != NODE)
       goto submit_io;
 
@@ -636,6 +661,9 @@ static inline void __submit_bio(struct f3fs_sb_info *sbi,
 	if (!is_read_io(bio_op(bio))) {
 		unsigned int start;
 
+		if (type == NODE)
+			f3fs_chksum_node_bio(sbi, bio);
+
 		if (type != DATA && type != NODE)
 			goto submit_io;
 
@@ -793,7 +821,7 @@ static void __f3fs_submit_merged_write(struct f3fs_sb_info *sbi,
 	enum page_type btype = PAGE_TYPE_OF_BIO(type);
 	struct f3fs_bio_info *io = sbi->write_io[btype] + temp;
 
-	f3fs_down_write(&io->io_rwsem);
+	f3fs_io_down_write(io);
 
 	/* change META to META_FLUSH in the checkpoint procedure */
 	if (type >= META_FLUSH) {
@@ -803,7 +831,7 @@ static void __f3fs_submit_merged_write(struct f3fs_sb_info *sbi,
 			io->bio->bi_opf |= REQ_PREFLUSH | REQ_FUA;
 	}
 	__submit_merged_bio(io);
-	f3fs_up_write(&io->io_rwsem);
+	f3fs_io_up_write(io);
 }
 
 static void __submit_merged_write_cond(struct f3fs_sb_info *sbi,
@@ -818,9 +846,9 @@ static void __submit_merged_write_cond(struct f3fs_sb_info *sbi,
 			enum page_type btype = PAGE_TYPE_OF_BIO(type);
 			struct f3fs_bio_info *io = sbi->write_io[btype] + temp;
 
-			f3fs_down_read(&io->io_rwsem);
+			f3fs_io_down_read(io);
 			ret = __has_merged_page(io->bio, inode, page, ino);
-			f3fs_up_read(&io->io_rwsem);
+			f3fs_io_up_read(io);
 		}
 		if (ret)
 			__f3fs_submit_merged_write(sbi, type, temp);
@@ -1102,18 +1130,18 @@ void f3fs_submit_page_write2(struct f3fs_io_info *fio)
 
   f3fs_bug_on(sbi, is_read_io(fio->op));
 
-  f3fs_down_write(&io->io_rwsem);
+  f3fs_io_down_write(io);
 next:
   if (fio->in_list) {
-    spin_lock(&io->io_lock);
+    f3fs_io_lock(io);
     if (list_empty(&io->io_list)) {
-      spin_unlock(&io->io_lock);
+      f3fs_io_unlock(io);
       goto out;
     }
     fio = list_first_entry(&io->io_list,
             struct f3fs_io_info, list);
     list_del(&fio->list);
-    spin_unlock(&io->io_lock);
+    f3fs_io_unlock(io);
   }
 
   verify_fio_blkaddr(fio);
@@ -1171,7 +1199,7 @@ void f3fs_submit_page_write2(struct f3fs_io_info *fio)
   if (is_sbi_flag_set(sbi, SBI_IS_SHUTDOWN) ||
       !f3fs_is_checkpoint_ready(sbi))
     __submit_merged_bio2(io);
-  f3fs_up_write(&io->io_rwsem);
+  f3fs_io_up_write(io);
 }
 
 void f3fs_submit_page_write(struct f3fs_io_info *fio)
@@ -1184,18 +1212,18 @@ void f3fs_submit_page_write(struct f3fs_io_info *fio)
 	f3fs_bug_on(sbi, is_read_io(fio->op));
 
 
-	f3fs_down_write(&io->io_rwsem);
+	f3fs_io_down_write(io);
 next:
 	if (fio->in_list) {
-		spin_lock(&io->io_lock);
+		f3fs_io_lock(io);
 		if (list_empty(&io->io_list)) {
-			spin_unlock(&io->io_lock);
+			f3fs_io_unlock(io);
 			goto out;
 		}
 		fio = list_first_entry(&io->io_list,
 						struct f3fs_io_info, list);
 		list_del(&fio->list);
-		spin_unlock(&io->io_lock);
+		f3fs_io_unlock(io);
 	}
 
 	verify_fio_blkaddr(fio);
@@ -1252,7 +1280,7 @@ void f3fs_submit_page_write(struct f3fs_io_info *fio)
 	if (is_sbi_flag_set(sbi, SBI_IS_SHUTDOWN) ||
 				!f3fs_is_checkpoint_ready(sbi))
 		__submit_merged_bio(io);
-	f3fs_up_write(&io->io_rwsem);
+	f3fs_io_up_write(io);
 }
 
 static struct bio *f3fs_grab_read_bio(struct inode *inode, block_t blkaddr,
@@ -1741,6 +1769,92 @@ static int __allocate_data_block(struct dnode_of_data *dn, int seg_type)
 	return 0;
 }
 
+/*
+ * Allocate a physically contiguous run for up to @count consecutive
+ * NULL_ADDR/NEW_ADDR slots of @dn, starting at dn->ofs_in_node, and at
+ * @goal unless that is NULL_ADDR.  Returns the number of blocks mapped,
+ * with dn->data_blkaddr set to the first one and dn->ofs_in_node left
+ * unchanged, or a negative errno.
+ */
+static int __allocate_data_blocks(struct dnode_of_data *dn, int seg_type,
+					block_t goal, unsigned int count)
+{
+	struct f3fs_sb_info *sbi = F3FS_I_SB(dn->inode);
+	unsigned int ofs_in_node = dn->ofs_in_node;
+	unsigned int i, nr, nr_null = 0;
+	struct node_info ni;
+	blkcnt_t reserved;
+	block_t blkaddr, start;
+	int err;
+
+	if (unlikely(is_inode_flag_set(dn->inode, FI_NO_ALLOC)))
+		return -EPERM;
+
+	for (nr = 0; nr < count; nr++) {
+		blkaddr = data_blkaddr(dn->inode, dn->node_page,
+						ofs_in_node + nr);
+		if (blkaddr == NULL_ADDR)
+			nr_null++;
+		else if (blkaddr != NEW_ADDR)
+			break;
+	}
+	if (!nr)
+		return 0;
+
+	err = f3fs_get_node_info(sbi, dn->nid, &ni, false);
+	if (err)
+		return err;
+
+	reserved = nr_null;
+	if (reserved) {
+		err = inc_valid_block_count(sbi, dn->inode, &reserved);
+		if (err)
+			return err;
+		/* short of space: only map as many holes as we reserved */
+		if (reserved < nr_null) {
+			unsigned int holes = 0;
+
+			for (nr = 0; nr < count; nr++) {
+				blkaddr = data_blkaddr(dn->inode,
+					dn->node_page, ofs_in_node + nr);
+				if (blkaddr == NULL_ADDR &&
+						holes++ == reserved)
+					break;
+			}
+			nr_null = reserved;
+		}
+	}
+
+	nr = f3fs_allocate_data_blocks(sbi, goal, &start, dn->nid,
+					ofs_in_node, ni.version, nr, seg_type);
+
+	/* the log may end short of the holes we reserved */
+	for (i = 0; i < nr; i++)
+		if (data_blkaddr(dn->inode, dn->node_page,
+					ofs_in_node + i) == NULL_ADDR)
+			nr_null--;
+	if (nr_null)
+		dec_valid_block_count(sbi, dn->inode, nr_null);
+	if (!nr)
+		return 0;
+
+	f3fs_wait_on_page_writeback(dn->node_page, NODE, true, true);
+	for (i = 0; i < nr; i++) {
+		dn->ofs_in_node = ofs_in_node + i;
+		dn->data_blkaddr = start + i;
+		__set_data_blkaddr(dn);
+	}
+	if (set_page_dirty(dn->node_page))
+		dn->node_changed = true;
+
+	dn->ofs_in_node = ofs_in_node;
+	dn->data_blkaddr = start;
+	f3fs_update_extent_cache_range(dn, f3fs_start_bidx_of_node(
+			ofs_of_node(dn->node_page), dn->inode) + ofs_in_node,
+			start, nr);
+	return nr;
+}
+
 void f3fs_do_map_lock(struct f3fs_sb_info *sbi, int flag, bool lock)
 {
 	if (flag == F3FS_GET_BLOCK_PRE_AIO) {
@@ -1775,6 +1889,7 @@ int f3fs_map_blocks(struct inode *inode, struct f3fs_map_blocks *map,
 	struct extent_info ei = {0, };
 	block_t blkaddr;
 	unsigned int start_pgofs;
+	unsigned int alloc_run = 0;
 	int bidx = 0;
 
 	if (!maxblocks)
@@ -1896,10 +2011,26 @@ int f3fs_map_blocks(struct inode *inode, struct f3fs_map_blocks *map,
 					last_ofs_in_node = dn.ofs_in_node;
 				}
 			} else {
+				block_t goal = NULL_ADDR;
+
 				WARN_ON(flag != F3FS_GET_BLOCK_PRE_DIO &&
 					flag != F3FS_GET_BLOCK_DIO);
-				err = __allocate_data_block(&dn,
+				/* a DIO extent only grows where the log is */
+				if (flag == F3FS_GET_BLOCK_DIO && map->m_len)
+					goal = map->m_pblk + ofs;
+				err = __allocate_data_blocks(&dn,
+					map->m_seg_type, goal,
+					min_t(pgoff_t, end - pgofs,
+					end_offset - dn.ofs_in_node));
+				if (err > 0) {
+					alloc_run = err;
+					err = 0;
+				} else if (!err && goal != NULL_ADDR) {
+					goto sync_out;
+				} else if (!err) {
+					err = __allocate_data_block(&dn,
 							map->m_seg_type);
+				}
 				if (!err) {
 					if (flag == F3FS_GET_BLOCK_PRE_DIO)
 						file_need_truncate(inode);
@@ -1926,8 +2057,12 @@ int f3fs_map_blocks(struct inode *inode, struct f3fs_map_blocks *map,
 				goto sync_out;
 			if (flag == F3FS_GET_BLOCK_FIEMAP &&
 						blkaddr == NULL_ADDR) {
+				/* report the whole run of holes at once */
 				if (map->m_next_pgofs)
-					*map->m_next_pgofs = pgofs + 1;
+					*map->m_next_pgofs = pgofs +
+						f3fs_next_mapped_ofs(&dn,
+							end_offset) -
+						dn.ofs_in_node;
 				goto sync_out;
 			}
 			if (flag != F3FS_GET_BLOCK_FIEMAP) {
@@ -1972,6 +2107,15 @@ int f3fs_map_blocks(struct inode *inode, struct f3fs_map_blocks *map,
 	dn.ofs_in_node++;
 	pgofs++;
 
+	/* the rest of a run allocated above follows the first block */
+	if (alloc_run > 1) {
+		dn.ofs_in_node += alloc_run - 1;
+		pgofs += alloc_run - 1;
+		ofs += alloc_run - 1;
+		map->m_len += alloc_run - 1;
+	}
+	alloc_run = 0;
+
 	/* preallocate blocks in batch for one dnode page */
 	if (flag == F3FS_GET_BLOCK_PRE_AIO &&
 			(pgofs == end || dn.ofs_in_node == end_offset)) {
@@ -2268,6 +2412,21 @@ int f3fs_fiemap(struct inode *inode, struct fiemap_extent_info *fieinfo,
 		flags |= FIEMAP_EXTENT_LAST;
 	}
 
+	/*
+	 * The extent cache and dnode boundaries can split one physical
+	 * extent across several mappings; report it as one record.
+	 */
+	if (size && !flags && !compr_cluster && start_blk <= last_blk &&
+	    (map.m_flags & F3FS_MAP_MAPPED) &&
+	    !(map.m_flags & F3FS_MAP_UNWRITTEN) &&
+	    __is_valid_data_blkaddr(map.m_pblk) &&
+	    logical + size == blks_to_bytes(inode, start_blk) &&
+	    phys && phys + size == blks_to_bytes(inode, map.m_pblk)) {
+		size += blks_to_bytes(inode, map.m_len);
+		start_blk += map.m_len;
+		goto prep_next;
+	}
+
 	compr_appended = false;
 	/* In a case of compressed cluster, append this to the last extent */
 	if (compr_cluster && ((map.m_flags & F3FS_MAP_UNWRITTEN) ||
@@ -2815,6 +2974,140 @@ int f3fs_encrypt_one_page(struct f3fs_io_info *fio)
 	return 0;
 }
 
+void f3fs_init_adaptive_ipu(struct f3fs_sb_info *sbi)
+{
+	struct adaptive_ipu_info *ai = &sbi->adaptive_ipu;
+	int i;
+
+	ai->cost = DEF_IPU_ADAPTIVE_COST;
+	ai->min_score = DEF_IPU_ADAPTIVE_SCORE;
+
+	/* zoned devices can't take IPU, rotating ones pay a seek for it */
+	ai->rand_ok = !f3fs_sb_has_blkzoned(sbi);
+	if (!f3fs_is_multi_device(sbi)) {
+		ai->rand_ok &= bdev_nonrot(sbi->sb->s_bdev);
+		return;
+	}
+	for (i = 0; i < sbi->s_ndevs; i++)
+		ai->rand_ok &= bdev_nonrot(FDEV(i).bdev);
+}
+
+static void adaptive_ipu_switch(struct f3fs_sb_info *sbi, bool on)
+{
+	struct adaptive_ipu_info *ai = &sbi->adaptive_ipu;
+
+	if (cmpxchg(&ai->active, !on, on) != !on)
+		return;
+	atomic64_inc(on ? &ai->engaged : &ai->released);
+}
+
+static inline bool adaptive_ipu_enabled(struct f3fs_sb_info *sbi)
+{
+	return SM_I(sbi)->ipu_policy & (0x1 << F3FS_IPU_ADAPTIVE);
+}
+
+/*
+ * GC reports every victim section it cleans: @moved valid blocks were
+ * copied to free @freed blocks. Their ratio is averaged into the GC cost
+ * that switches adaptive IPU on and off.
+ */
+void f3fs_update_adaptive_ipu(struct f3fs_sb_info *sbi, unsigned int moved,
+							unsigned int freed)
+{
+	struct adaptive_ipu_info *ai = &sbi->adaptive_ipu;
+	unsigned int cost, sample;
+
+	sample = min_t(u64, div_u64((u64)moved * 100, max(freed, 1U)),
+						IPU_ADAPTIVE_COST_MAX);
+	cost = (READ_ONCE(ai->gc_cost) * 7 + sample) / 8;
+	WRITE_ONCE(ai->gc_cost, cost);
+
+	if (!(SM_I(sbi)->ipu_policy & (0x1 << F3FS_IPU_ADAPTIVE)) ||
+							!ai->rand_ok) {
+		adaptive_ipu_switch(sbi, false);
+		return;
+	}
+
+	if (cost >= READ_ONCE(ai->cost) &&
+			utilization(sbi) > SM_I(sbi)->min_ipu_util)
+		adaptive_ipu_switch(sbi, true);
+	else if (cost < READ_ONCE(ai->cost) / 2)
+		adaptive_ipu_switch(sbi, false);
+}
+
+/*
+ * Each inode scores its overwrites: a write that doesn't follow the
+ * previous one adds IPU_ADAPTIVE_SMALL, each block continuing it takes
+ * one off. Only inodes doing small random overwrites keep a high score.
+ */
+static bool adaptive_inplace_update(struct inode *inode,
+					struct f3fs_io_info *fio)
+{
+	struct f3fs_sb_info *sbi = F3FS_I_SB(inode);
+	struct f3fs_inode_info *fi = F3FS_I(inode);
+	struct adaptive_ipu_info *ai = &sbi->adaptive_ipu;
+	pgoff_t index = fio->page->index;
+
+	if (!(SM_I(sbi)->ipu_policy & (0x1 << F3FS_IPU_ADAPTIVE)))
+		return false;
+	if (IS_ENCRYPTED(inode) || f3fs_compressed_file(inode))
+		return false;
+
+	/* need_inplace_update() may ask twice for the same page */
+	if (index == fi->i_ipu_last)
+		return READ_ONCE(ai->active) &&
+			fi->i_ipu_score >= READ_ONCE(ai->min_score);
+
+	if (index == fi->i_ipu_last + 1) {
+		if (fi->i_ipu_score)
+			fi->i_ipu_score--;
+	} else {
+		fi->i_ipu_score = min(fi->i_ipu_score + IPU_ADAPTIVE_SMALL,
+						IPU_ADAPTIVE_SCORE_MAX);
+	}
+	fi->i_ipu_last = index;
+
+	if (fi->i_ipu_score < READ_ONCE(ai->min_score)) {
+		atomic64_inc(&ai->opu_seq);
+		return false;
+	}
+
+	/* free space may have come back without GC running */
+	if (READ_ONCE(ai->active) && utilization(sbi) + IPU_ADAPTIVE_HYST <=
+						SM_I(sbi)->min_ipu_util)
+		adaptive_ipu_switch(sbi, false);
+
+	if (!READ_ONCE(ai->active)) {
+		atomic64_inc(&ai->opu_idle);
+		return false;
+	}
+	atomic64_inc(&ai->ipu_blocks);
+	return true;
+}
+
+int f3fs_adaptive_ipu_seq_show(struct seq_file *seq,
+							void *offset)
+{
+	struct super_block *sb = seq->private;
+	struct f3fs_sb_info *sbi = F3FS_SB(sb);
+	struct adaptive_ipu_info *ai = &sbi->adaptive_ipu;
+
+	seq_printf(seq, "enabled: %d, device ok: %d, active: %u\n",
+			!!(SM_I(sbi)->ipu_policy & (0x1 << F3FS_IPU_ADAPTIVE)),
+			ai->rand_ok, READ_ONCE(ai->active));
+	seq_printf(seq, "gc cost: %u%%, threshold: %u%%, utilization: %d%%\n",
+			READ_ONCE(ai->gc_cost), ai->cost, utilization(sbi));
+	seq_printf(seq, "switched on: %lld, off: %lld\n",
+			atomic64_read(&ai->engaged),
+			atomic64_read(&ai->released));
+	seq_printf(seq, "in place: %lld, out of place: %lld sequential, "
+			"%lld while off\n",
+			atomic64_read(&ai->ipu_blocks),
+			atomic64_read(&ai->opu_seq),
+			atomic64_read(&ai->opu_idle));
+	return 0;
+}
+
 static inline bool check_inplace_update_policy(struct inode *inode,
 				struct f3fs_io_info *fio)
 {
@@ -2834,6 +3127,8 @@ static inline bool check_inplace_update_policy(struct inode *inode,
 	if (policy & (0x1 << F3FS_IPU_SSR_UTIL) && f3fs_need_SSR(sbi) &&
 			utilization(sbi) > SM_I(sbi)->min_ipu_util)
 		return true;
+	if (fio && adaptive_inplace_update(inode, fio))
+		return true;
 
 	/*
 	 * IPU for rewrite async pages
@@ -2865,6 +3160,10 @@ bool f3fs_should_update_inplace(struct inode *inode, struct f3fs_io_info *fio)
 	if (f3fs_is_pinned_file(inode))
 		return true;
 
+	/* LFS mode leaves the log only for adaptive IPU */
+	if (f3fs_lfs_mode(F3FS_I_SB(inode)))
+		return fio && adaptive_inplace_update(inode, fio);
+
 	/* if this is cold file, we should overwrite to avoid fragmentation */
 	if (file_is_cold(inode))
 		return true;
@@ -2881,7 +3180,8 @@ bool f3fs_should_update_outplace(struct inode *inode, struct f3fs_io_info *fio)
 		return false;
 	if (fio && is_sbi_flag_set(sbi, SBI_NEED_FSCK))
 		return true;
-	if (f3fs_lfs_mode(sbi))
+	/* scored even while inactive, to be ready when GC gets expensive */
+	if (f3fs_lfs_mode(sbi) && !(fio && adaptive_ipu_enabled(sbi)))
 		return true;
 	if (S_ISDIR(inode->i_mode))
 		return true;
@@ -3670,7 +3970,7 @@ void f3fs_write_failed(struct inode *inode, loff_t to)
 
 	/* In the fs-verity case, f3fs_end_enable_verity() does the truncate */
 	if (to > i_size && !f3fs_verity_in_progress(inode)) {
-		struct RangeLock* range = f3fs_down_write3(&F3FS_I(inode)->i_gc_rwsem[WRITE]);
+		struct RangeLock* range = f3fs_down_write3(F3FS_I_SB(inode), &F3FS_I(inode)->i_gc_rwsem[WRITE]);
 		filemap_invalidate_lock(inode->i_mapping);
 
 		truncate_pagecache(inode, i_size);
@@ -4187,7 +4487,7 @@ static int f3fs_migrate_blocks(struct inode *inode, block_t start_blk,
 	unsigned int end_sec = secidx + blkcnt / blk_per_sec;
 	int ret = 0;
 
-	struct RangeLock* range = f3fs_down_write3(&F3FS_I(inode)->i_gc_rwsem[WRITE]);
+	struct RangeLock* range = f3fs_down_write3(sbi, &F3FS_I(inode)->i_gc_rwsem[WRITE]);
 	filemap_invalidate_lock(inode->i_mapping);
 
 	set_inode_flag(inode, FI_ALIGNED_WRITE);
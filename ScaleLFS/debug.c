@@ -251,7 +251,8 @@ static void update_mem_info(struct f3fs_sb_info *sbi)
 
 	/* build curseg */
 	si->base_mem += sizeof(struct curseg_info) * NR_CURSEG_TYPE;
-	si->base_mem += PAGE_SIZE * NR_CURSEG_TYPE;
+	si->base_mem += PAGE_SIZE *
+		(NR_CURSEG_TYPE - MAX_GC_WORKER + sbi->nr_gc_log);
 
 	/* build dirty segmap */
 	si->base_mem += sizeof(struct dirty_seglist_info);
@@ -891,8 +891,10 @@ void f3fs_drop_nlink(struct inode *dir, struct inode *inode)
 	}
 	f3fs_up_write(&F3FS_I(inode)->i_sem);
 
-	if (inode->i_nlink == 0)
+	if (inode->i_nlink == 0) {
+		f3fs_gc_icache_forget(sbi, inode);
 		f3fs_add_orphan_inode(inode);
+	}
 	else
 		f3fs_release_orphan_inode(sbi);
 }
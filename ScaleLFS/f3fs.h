@@ -24,7 +24,8 @@
 #include <linux/blkdev.h>
 #include <linux/quotaops.h>
 #include <linux/part_stat.h>
-#include <crypto/hash.h>
+#include <linux/jump_label.h>
+#include <linux/sched/clock.h>
 
 #include <linux/fscrypt.h>
 #include <linux/fsverity.h>
@@ -33,6 +34,7 @@
 #include "lockfree_list.h"
 
 struct pagevec;
+struct seq_file;
 
 #ifdef CONFIG_F3FS_CHECK_FS
 #define f3fs_bug_on(sbi, condition)	BUG_ON(condition)
@@ -148,6 +150,7 @@ struct f3fs_mount_info {
 	kuid_t s_resuid;		/* reserved blocks for uid */
 	kgid_t s_resgid;		/* reserved blocks for gid */
 	int active_logs;		/* # of active logs */
+	int gc_logs;			/* # of GC data logs, 0 keeps the checkpoint's */
 	int inline_xattr_size;		/* inline xattr size */
 #ifdef CONFIG_F3FS_FAULT_INJECTION
 	struct f3fs_fault_info fault_info;	/* For fault injection */
@@ -201,6 +204,7 @@ struct f3fs_mount_info {
 #define F3FS_FEATURE_CASEFOLD		0x1000
 #define F3FS_FEATURE_COMPRESSION	0x2000
 #define F3FS_FEATURE_RO			0x4000
+#define F3FS_FEATURE_RECLAIM_JOURNAL	0x8000
 
 #define __F3FS_HAS_FEATURE(raw_super, mask)				\
 	((raw_super->feature & cpu_to_le32(mask)) != 0)
@@ -294,6 +298,30 @@ struct inode_entry {
 	struct inode *inode;	/* vfs inode pointer */
 };
 
+/* inodes GC keeps referenced across rounds, see gc_icache_get() */
+struct gc_inode_cache {
+	spinlock_t lock;		/* protects iroot, lru and count */
+	struct radix_tree_root iroot;	/* ino -> inode_entry */
+	struct list_head lru;		/* least recently used first */
+	unsigned int count;		/* # of cached inodes */
+	unsigned int max_count;		/* cap on count */
+};
+
+/* a block GC moved out of its victim, for the reclaim journal */
+struct gc_reclaim_entry {
+	nid_t nid;			/* dnode holding the address */
+	unsigned short ofs_in_node;	/* slot in that dnode */
+	block_t old_blkaddr;		/* address in the victim */
+	block_t new_blkaddr;		/* address of the copy */
+	struct page *page;		/* copy in flight, pinned until written */
+};
+
+struct gc_reclaim_batch {
+	unsigned int segno;		/* victim segment */
+	unsigned int nr;		/* # of valid entries */
+	struct gc_reclaim_entry entries[];
+};
+
 struct fsync_node_entry {
 	struct list_head list;	/* list head */
 	struct page *page;	/* warm node page pointer */
@@ -320,6 +348,30 @@ struct ckpt_req_control {
 	unsigned int peak_time;		/* peak wait time in msec until now */
 };
 
+/* parallel data flush, see f3fs_start_wb_workers() */
+#define DEF_WB_DIRTY_KICK	8192	/* dirty data pages that kick the pool */
+
+struct wb_worker {
+	struct f3fs_sb_info *sbi;
+	struct task_struct *task;
+	int idx;
+	unsigned long round;		/* last round this worker ran */
+	atomic64_t inodes;		/* # of inodes flushed */
+	atomic64_t pages;		/* # of data pages written */
+	atomic64_t busy_ns;		/* time spent flushing */
+};
+
+struct wb_pool_control {
+	struct wb_worker *workers;
+	int nr_workers;
+	wait_queue_head_t wait_queue;	/* idle workers sleep here */
+	wait_queue_head_t done_queue;	/* waiters for the end of a round */
+	unsigned long round;		/* bumped when a round starts */
+	atomic_t busy;			/* # of workers still in this round */
+	atomic_t rounds;		/* # of rounds run */
+	unsigned int dirty_kick;	/* dirty pages to start a round */
+};
+
 /* for the bitmap indicate blocks to be discarded */
 struct discard_entry {
 	struct list_head list;	/* list head */
@@ -785,6 +837,7 @@ struct f3fs_inode_info {
 	unsigned int clevel;		/* maximum level of given file name */
 	struct task_struct *task;	/* lookup and create consistency */
 	struct task_struct *cp_task;	/* separate cp/wb IO stats*/
+	unsigned long i_wb_round;	/* last flush round that claimed it */
 	nid_t i_xattr_nid;		/* node id that contains xattrs */
 	loff_t	last_disk_size;		/* lastly written file size */
 	spinlock_t i_size_lock;		/* protect last_disk_size */
@@ -818,6 +871,15 @@ struct f3fs_inode_info {
 	unsigned char i_compress_level;		/* compress level (lz4hc,zstd) */
 	unsigned short i_compress_flag;		/* compress flag */
 	unsigned int i_cluster_size;		/* cluster size */
+	unsigned char i_compr_backoff;		/* log2 of clusters to skip */
+	unsigned short i_compr_skip;		/* clusters left to skip */
+
+	/* for adaptive in-place update */
+	pgoff_t i_ipu_last;			/* last overwritten index */
+	unsigned char i_ipu_score;		/* recent random overwrites */
+
+	unsigned char i_gc_log;			/* GC log + 1 of the worker that
+						 * last queued blocks, 0 if none */
 
 	unsigned int atomic_write_cnt;
 };
@@ -933,6 +995,7 @@ struct f3fs_nm_info {
 	struct radix_tree_root nat_root;/* root of the nat entry cache */
 	struct radix_tree_root nat_set_root;/* root of the nat set cache */
 	struct f3fs_rwsem nat_tree_lock;	/* protect nat entry tree */
+	u64 nat_tree_lock_token;		/* nat_tree_down_write() timing */
 	struct list_head nat_entries;	/* cached nat entry list (clean) */
 	spinlock_t nat_list_lock;	/* protect clean nat entry list */
 	unsigned int nat_cnt[MAX_NAT_STATE]; /* the # of cached nat entries */
@@ -1011,6 +1074,15 @@ static inline void set_new_dnode(struct dnode_of_data *dn, struct inode *inode,
 #define NR_CURSEG_PERSIST_TYPE	(NR_CURSEG_DATA_TYPE + NR_CURSEG_NODE_TYPE)
 #define NR_CURSEG_TYPE		(NR_CURSEG_INMEM_TYPE + NR_CURSEG_PERSIST_TYPE)
 
+/*
+ * MAX_GC_WORKER bounds the GC data logs; only the first sbi->nr_gc_log of
+ * them are in use, and the checkpoint carries summaries for just those.
+ */
+#define NR_DATA_LOG(sbi)	(3 + (sbi)->nr_gc_log)
+#define NR_PERSIST_LOG(sbi)	(NR_DATA_LOG(sbi) + NR_CURSEG_NODE_TYPE)
+#define CURSEG_GC_DATA_LAST(sbi)					\
+	(CURSEG_COLD_GC_DATA_START + (sbi)->nr_gc_log - 1)
+
 enum {
 	CURSEG_HOT_DATA	= 0,	/* directory entry blocks */
 	CURSEG_WARM_DATA,	/* data blocks */
@@ -1235,6 +1307,8 @@ struct f3fs_bio_info {
 	struct f3fs_io_info fio;	/* store buffered io info. */
 	struct f3fs_rwsem io_rwsem;	/* blocking op for bio */
 	spinlock_t io_lock;		/* serialize DATA/NODE IOs */
+	u64 io_rwsem_token;		/* lock profiler stamps, see */
+	u64 io_lock_token;		/* f3fs_lock_timed() */
 	struct list_head io_list;	/* track fios */
 	struct list_head bio_list;	/* bio entry list head */
 	struct f3fs_rwsem bio_list_lock;	/* lock to protect bio entry list */
@@ -1399,7 +1473,8 @@ static inline void f3fs_clear_bit(unsigned int nr, char *addr);
  * bit 3	PAGE_PRIVATE_ONGOING_MIGRATION
  * bit 4	PAGE_PRIVATE_INLINE_INODE
  * bit 5	PAGE_PRIVATE_REF_RESOURCE
- * bit 6-	f3fs private data
+ * bit 6	PAGE_PRIVATE_RECOMPRESS
+ * bit 7-	f3fs private data
  *
  * Layout B: lowest bit should be 0
  * page.private is a wrapped pointer.
@@ -1411,6 +1486,7 @@ enum {
 	PAGE_PRIVATE_ONGOING_MIGRATION,		/* data page which is on-going migrating */
 	PAGE_PRIVATE_INLINE_INODE,		/* inode page contains inline data */
 	PAGE_PRIVATE_REF_RESOURCE,		/* dirty page has referenced resources */
+	PAGE_PRIVATE_RECOMPRESS,		/* GC wants its cluster compressed harder */
 	PAGE_PRIVATE_MAX
 };
 
@@ -1453,18 +1529,21 @@ PAGE_PRIVATE_GET_FUNC(inline, INLINE_INODE);
 PAGE_PRIVATE_GET_FUNC(gcing, ONGOING_MIGRATION);
 PAGE_PRIVATE_GET_FUNC(atomic, ATOMIC_WRITE);
 PAGE_PRIVATE_GET_FUNC(dummy, DUMMY_WRITE);
+PAGE_PRIVATE_GET_FUNC(recompress, RECOMPRESS);
 
 PAGE_PRIVATE_SET_FUNC(reference, REF_RESOURCE);
 PAGE_PRIVATE_SET_FUNC(inline, INLINE_INODE);
 PAGE_PRIVATE_SET_FUNC(gcing, ONGOING_MIGRATION);
 PAGE_PRIVATE_SET_FUNC(atomic, ATOMIC_WRITE);
 PAGE_PRIVATE_SET_FUNC(dummy, DUMMY_WRITE);
+PAGE_PRIVATE_SET_FUNC(recompress, RECOMPRESS);
 
 PAGE_PRIVATE_CLEAR_FUNC(reference, REF_RESOURCE);
 PAGE_PRIVATE_CLEAR_FUNC(inline, INLINE_INODE);
 PAGE_PRIVATE_CLEAR_FUNC(gcing, ONGOING_MIGRATION);
 PAGE_PRIVATE_CLEAR_FUNC(atomic, ATOMIC_WRITE);
 PAGE_PRIVATE_CLEAR_FUNC(dummy, DUMMY_WRITE);
+PAGE_PRIVATE_CLEAR_FUNC(recompress, RECOMPRESS);
 
 static inline unsigned long get_page_private_data(struct page *page)
 {
@@ -1546,6 +1625,9 @@ struct compress_ctx {
 	size_t clen;			/* valid data length in cbuf */
 	void *private;			/* payload buffer for specified compression algorithm */
 	void *private2;			/* extra payload buffer */
+	unsigned char level;		/* compress level for this cluster */
+	bool gc_queued;			/* cluster queued by GC to recompress */
+	bool gc_recompress;		/* ... and compressed at the GC level */
 };
 
 /* compress context for write IO path */
@@ -1612,6 +1694,67 @@ struct decompress_io_ctx {
 #define MAX_COMPRESS_LOG_SIZE		8
 #define MAX_COMPRESS_WINDOW_SIZE(log_size)	((PAGE_SIZE) << (log_size))
 
+/*
+ * BG GC may rewrite cold compressed clusters at a higher level instead of
+ * copying their blocks: it reads and dirties the cluster, and writeback
+ * recompresses it.
+ */
+struct gc_recompress_info {
+	unsigned int level;		/* level to recompress at, 0: off */
+	unsigned int budget_ms;		/* CPU ms per second, 0: no limit */
+	unsigned long window;		/* jiffies the budget window opened */
+	atomic64_t window_ns;		/* CPU time spent in this window */
+	atomic64_t queued;		/* clusters GC dirtied to recompress */
+	atomic64_t throttled;		/* clusters kept at their level over budget */
+	atomic64_t done;		/* clusters recompressed */
+	atomic64_t cpu_ns;		/* total CPU time recompressing */
+	atomic64_t old_blocks;		/* compressed blocks before */
+	atomic64_t new_blocks;		/* compressed blocks after */
+};
+
+/* locks the contention profiler samples, see lockstat.c */
+enum f3fs_lock_class {
+	LOCK_CURSEG,		/* curseg_info.curseg_mutex */
+	LOCK_IO_RWSEM,		/* f3fs_bio_info.io_rwsem */
+	LOCK_IO,		/* f3fs_bio_info.io_lock */
+	LOCK_SEGMAP,		/* free_segmap_info.segmap_lock */
+	LOCK_STAT,		/* f3fs_sb_info.stat_lock */
+	LOCK_NAT_TREE,		/* f3fs_nm_info.nat_tree_lock */
+	LOCK_CP_RWSEM,		/* f3fs_sb_info.cp_rwsem */
+	LOCK_SENTRY,		/* seg_entry.local_lock */
+	LOCK_GC_INTERNAL_CP,	/* f3fs_sb_info.gc_internal_cp */
+	LOCK_RANGE,		/* i_gc_rwsem lock-free list */
+	NR_LOCK_CLASS,
+};
+
+struct f3fs_lock_stat {
+	u64 acquired;		/* sampled acquisitions */
+	u64 contended;		/* of them, ones that had to wait */
+	u64 wait_ns;		/* time spent waiting */
+	u64 wait_max_ns;
+	u64 held;		/* sampled releases */
+	u64 hold_ns;		/* time held */
+	u64 hold_max_ns;
+};
+
+struct f3fs_lock_stats {
+	unsigned int tick;	/* acquisitions since the last sample */
+	struct f3fs_lock_stat stat[NR_LOCK_CLASS];
+};
+
+struct adaptive_ipu_info {
+	unsigned int cost;		/* GC cost (x100) to switch IPU on */
+	unsigned int min_score;		/* inode score to take IPU */
+	unsigned int gc_cost;		/* moving average of GC cost (x100) */
+	unsigned int active;		/* IPU is on for random overwrites */
+	bool rand_ok;			/* device handles random writes well */
+	atomic64_t engaged;		/* times IPU was switched on */
+	atomic64_t released;		/* times IPU was switched off */
+	atomic64_t ipu_blocks;		/* overwrites sent in place */
+	atomic64_t opu_seq;		/* overwrites too sequential for IPU */
+	atomic64_t opu_idle;		/* random overwrites while switched off */
+};
+
 struct f3fs_sb_info {
 	struct super_block *sb;			/* pointer to VFS super block */
 	struct proc_dir_entry *s_proc;		/* proc entry */
@@ -1635,8 +1778,6 @@ struct f3fs_sb_info {
 
 	/* for bio operations */
 	struct f3fs_bio_info *write_io[NR_PAGE_TYPE];	/* for write bios */
-	/* keep migration IO order for LFS mode */
-	struct f3fs_rwsem io_order_lock;
 	mempool_t *write_io_dummy;		/* Dummy pages */
 	pgoff_t page_eio_ofs[NR_PAGE_TYPE];	/* EIO page offset */
 	int page_eio_cnt[NR_PAGE_TYPE];		/* EIO count */
@@ -1653,7 +1794,11 @@ struct f3fs_sb_info {
 	wait_queue_head_t cp_wait;
 	unsigned long last_time[MAX_TIME];	/* to store time in jiffies */
 	long interval_time[MAX_TIME];		/* to store thresholds */
+	unsigned int idle_gap_min_ms;		/* shortest gap counted as idle */
+	unsigned int idle_gap_ewma_ms;		/* EWMA of idle gaps */
+	unsigned long last_read_time;		/* jiffies of the last read */
 	struct ckpt_req_control cprc_info;	/* for checkpoint request control */
+	struct wb_pool_control wb_pool;		/* parallel data flush workers */
 
 	struct inode_management im[MAX_INO_ENTRY];	/* manage inode cache */
 
@@ -1734,6 +1879,7 @@ struct f3fs_sb_info {
 						 */
 	struct f3fs_gc_kthread	*gc_thread;	/* GC thread */
 	struct atgc_management am;		/* atgc management */
+	struct gc_inode_cache gc_icache;	/* inodes pinned by GC */
 	unsigned int cur_victim_sec;		/* current victim section num */
 	unsigned int gc_mode;			/* current GC state */
 	unsigned int next_victim_seg[2];	/* next segment in victim section */
@@ -1779,6 +1925,7 @@ struct f3fs_sb_info {
 	unsigned int ndirty_inode[NR_INODE_TYPE];	/* # of dirty inodes */
 #endif
 	spinlock_t stat_lock;			/* lock for stat operations */
+	u64 stat_lock_token;			/* f3fs_stat_lock() timing */
 
 	/* to attach REQ_META|REQ_FUA flags */
 	unsigned long long data_io_flag;
@@ -1810,9 +1957,6 @@ struct f3fs_sb_info {
 	u64 sectors_written_start;
 	u64 kbytes_written;
 
-	/* Reference to checksum algorithm driver via cryptoapi */
-	struct crypto_shash *s_chksum_driver;
-
 	/* Precomputed FS UUID checksum for seeding other checksums */
 	__u32 s_chksum_seed;
 
@@ -1844,6 +1988,10 @@ struct f3fs_sb_info {
 	u64 compr_written_block;
 	u64 compr_saved_block;
 	u32 compr_new_inode;
+	u64 compr_skipped_cluster;	/* clusters not worth compressing */
+
+	/* For recompressing cold clusters at GC time */
+	struct gc_recompress_info gc_recompr;
 
 	/* For compressed block cache */
 	struct inode *compress_inode;		/* cache compressed blocks */
@@ -1871,7 +2019,29 @@ struct f3fs_sb_info {
   atomic_t gc_read_blocks;
   atomic_t gc_written_blocks;
   int num_gc_thread;
+	unsigned int nr_gc_log;			/* # of GC data logs in use */
+	int num_wb_thread;			/* # of data flush workers */
+	struct gc_attr_table __percpu *gc_attr;	/* GC cost per inode/cgroup */
+	spinlock_t gc_css_lock;			/* for gc_css and gc_cgroup */
+	struct cgroup_subsys_state *gc_css;	/* blkcg GC I/O is charged to */
+	char *gc_cgroup;			/* its path, NULL for the root */
 	struct mutex gc_internal_cp;		/* lock for segment bitmaps */
+	u64 gc_internal_cp_token;		/* f3fs_lock_gc_cp() timing */
+
+	/* for reclaim journal */
+	unsigned int reclaim_journal;		/* reuse prefree before checkpoint */
+	unsigned int rj_blkoff;			/* next free journal block */
+	unsigned int rj_seq;			/* next record number */
+	unsigned int rj_reclaimed_segs;		/* segments reclaimed through it */
+
+	/* for adaptive in-place update */
+	struct adaptive_ipu_info adaptive_ipu;
+
+	/* for lock contention profiling */
+	unsigned int lock_stat_rate;		/* sample 1 in N, 0: off */
+	struct f3fs_lock_stats __percpu *lock_stat;
+	u64 cp_rwsem_token;			/* f3fs_lock_all() timing */
+	struct dentry *lock_stat_dentry;	/* its debugfs report */
 };
 
 #ifdef CONFIG_F3FS_FAULT_INJECTION
@@ -1916,17 +2086,59 @@ static inline bool f3fs_is_multi_device(struct f3fs_sb_info *sbi)
 	return sbi->s_ndevs > 1;
 }
 
+/* the last foreground request, read or not */
+static inline unsigned long f3fs_last_fg_time(struct f3fs_sb_info *sbi)
+{
+	unsigned long req = READ_ONCE(sbi->last_time[REQ_TIME]);
+	unsigned long rd = READ_ONCE(sbi->last_read_time);
+
+	return time_after(rd, req) ? rd : req;
+}
+
+/*
+ * Learn how long the device usually stays quiet, so that background GC
+ * can size its rounds to fit.  A new gap weighs 1/8, and gaps past the
+ * idle interval are caught by f3fs_time_over() anyway.
+ */
+static inline void f3fs_learn_idle_gap(struct f3fs_sb_info *sbi,
+						unsigned long now)
+{
+	unsigned int gap = jiffies_to_msecs(now - f3fs_last_fg_time(sbi));
+
+	if (gap >= sbi->idle_gap_min_ms) {
+		unsigned int ewma = sbi->idle_gap_ewma_ms;
+
+		gap = min_t(unsigned int, gap,
+			sbi->interval_time[GC_TIME] * MSEC_PER_SEC);
+		sbi->idle_gap_ewma_ms = ewma - (ewma >> 3) + (gap >> 3);
+	}
+}
+
 static inline void f3fs_update_time(struct f3fs_sb_info *sbi, int type)
 {
 	unsigned long now = jiffies;
 
-	sbi->last_time[type] = now;
-
 	/* DISCARD_TIME and GC_TIME are based on REQ_TIME */
 	if (type == REQ_TIME) {
+		f3fs_learn_idle_gap(sbi, now);
 		sbi->last_time[DISCARD_TIME] = now;
 		sbi->last_time[GC_TIME] = now;
 	}
+	sbi->last_time[type] = now;
+}
+
+/*
+ * Reads leave the idle timers alone, but they end an idle gap for
+ * background GC.  Only the first read in a jiffy writes the stamp.
+ */
+static inline void f3fs_update_read_time(struct f3fs_sb_info *sbi)
+{
+	unsigned long now = jiffies;
+
+	if (READ_ONCE(sbi->last_read_time) == now)
+		return;
+	f3fs_learn_idle_gap(sbi, now);
+	WRITE_ONCE(sbi->last_read_time, now);
 }
 
 static inline bool f3fs_time_over(struct f3fs_sb_info *sbi, int type)
@@ -1953,24 +2165,15 @@ static inline unsigned int f3fs_time_to_wait(struct f3fs_sb_info *sbi,
 /*
  * Inline functions
  */
+/*
+ * Same value as the "crc32" shash: crc32_le() seeded with @crc, without
+ * pre/post inversion.  lib/crc32 picks the arch-accelerated variant, so
+ * there is no tfm to look up and no descriptor to set up per call.
+ */
 static inline u32 __f3fs_crc32(struct f3fs_sb_info *sbi, u32 crc,
 			      const void *address, unsigned int length)
 {
-	struct {
-		struct shash_desc shash;
-		char ctx[4];
-	} desc;
-	int err;
-
-	BUG_ON(crypto_shash_descsize(sbi->s_chksum_driver) != sizeof(desc.ctx));
-
-	desc.shash.tfm = sbi->s_chksum_driver;
-	*(u32 *)desc.ctx = crc;
-
-	err = crypto_shash_update(&desc.shash, address, length);
-	BUG_ON(err);
-
-	return *(u32 *)desc.ctx;
+	return crc32_le(crc, address, length);
 }
 
 static inline u32 f3fs_crc32(struct f3fs_sb_info *sbi, const void *address,
@@ -2152,6 +2355,93 @@ static inline void clear_ckpt_flags(struct f3fs_sb_info *sbi, unsigned int f)
 	spin_unlock_irqrestore(&sbi->cp_lock, flags);
 }
 
+DECLARE_STATIC_KEY_FALSE(f3fs_lock_stat_key);
+
+/*
+ * Returns the time a sampled acquisition starts at, or 0 when it isn't
+ * sampled. The static key keeps this a no-op until some mount turns the
+ * profiler on. Waiters and holders migrate between CPUs, so this takes
+ * the global clock rather than local_clock().
+ */
+static inline u64 f3fs_lock_stat_start(struct f3fs_sb_info *sbi)
+{
+	unsigned int rate;
+
+	if (!static_branch_unlikely(&f3fs_lock_stat_key))
+		return 0;
+	rate = READ_ONCE(sbi->lock_stat_rate);
+	if (!rate || this_cpu_inc_return(sbi->lock_stat->tick) < rate)
+		return 0;
+	this_cpu_write(sbi->lock_stat->tick, 0);
+	return ktime_get_ns() ?: 1;
+}
+
+static inline u64 f3fs_lock_stat_wait(struct f3fs_sb_info *sbi, int class,
+								u64 start)
+{
+	u64 now = ktime_get_ns();
+	u64 wait = now - start;
+
+	this_cpu_inc(sbi->lock_stat->stat[class].contended);
+	this_cpu_add(sbi->lock_stat->stat[class].wait_ns, wait);
+	if (wait > this_cpu_read(sbi->lock_stat->stat[class].wait_max_ns))
+		this_cpu_write(sbi->lock_stat->stat[class].wait_max_ns, wait);
+	return now;
+}
+
+static inline void f3fs_lock_stat_release(struct f3fs_sb_info *sbi,
+						int class, u64 start)
+{
+	u64 hold;
+
+	if (!start)
+		return;
+	hold = ktime_get_ns() - start;
+	this_cpu_inc(sbi->lock_stat->stat[class].held);
+	this_cpu_add(sbi->lock_stat->stat[class].hold_ns, hold);
+	if (hold > this_cpu_read(sbi->lock_stat->stat[class].hold_max_ns))
+		this_cpu_write(sbi->lock_stat->stat[class].hold_max_ns, hold);
+}
+
+/*
+ * Take a lock with @lock_expr, and time the wait when the acquisition is
+ * sampled and @try_expr fails. Evaluates to the token the matching
+ * f3fs_unlock_timed() takes to account the hold time; exclusive holders
+ * keep it next to the lock, shared ones drop it.
+ */
+#define f3fs_lock_timed(sbi, class, try_expr, lock_expr)		\
+({									\
+	u64 __start = f3fs_lock_stat_start(sbi);			\
+									\
+	if (!__start) {							\
+		lock_expr;						\
+	} else {							\
+		this_cpu_inc((sbi)->lock_stat->stat[class].acquired);	\
+		if (!(try_expr)) {					\
+			lock_expr;					\
+			__start = f3fs_lock_stat_wait(sbi, class, __start); \
+		}							\
+	}								\
+	__start;							\
+})
+
+#define f3fs_unlock_timed(sbi, class, unlock_expr, token)		\
+do {									\
+	u64 __token = (token);						\
+									\
+	unlock_expr;							\
+	f3fs_lock_stat_release(sbi, class, __token);			\
+} while (0)
+
+#define f3fs_mutex_lock_timed(sbi, class, lock)				\
+	f3fs_lock_timed(sbi, class, mutex_trylock(lock), mutex_lock(lock))
+#define f3fs_mutex_unlock_timed(sbi, class, lock, token)		\
+	f3fs_unlock_timed(sbi, class, mutex_unlock(lock), token)
+#define f3fs_spin_lock_timed(sbi, class, lock)				\
+	f3fs_lock_timed(sbi, class, spin_trylock(lock), spin_lock(lock))
+#define f3fs_spin_unlock_timed(sbi, class, lock, token)			\
+	f3fs_unlock_timed(sbi, class, spin_unlock(lock), token)
+
 #define init_f3fs_rwsem(sem)					\
 do {								\
 	static struct lock_class_key __key;			\
@@ -2183,9 +2473,30 @@ static inline void f3fs_down_read2(struct f3fs_rwsem2 *sem)
   f3fs_down_range(sem, 0, MAX_SIZE, false);
 }
 
-static inline struct RangeLock* f3fs_down_read3(struct f3fs_rwsem3 *sem)
+/*
+ * The lock-free list spins rather than sleeps, so the profiler times the
+ * whole spin as a wait; a failed RWRangeTryAcquire() on the full range
+ * isn't safe to probe with, so every sampled acquisition counts as
+ * contended. RangeLocks are per acquisition, hold time isn't.
+ */
+static inline struct RangeLock *f3fs_range_acquire_timed(
+		struct f3fs_sb_info *sbi, struct f3fs_rwsem3 *sem, bool writable)
+{
+	u64 start = f3fs_lock_stat_start(sbi);
+	struct RangeLock *range;
+
+	range = RWRangeAcquire(&sem->list_rl, 0, MAX_SIZE, writable);
+	if (start) {
+		this_cpu_inc(sbi->lock_stat->stat[LOCK_RANGE].acquired);
+		f3fs_lock_stat_wait(sbi, LOCK_RANGE, start);
+	}
+	return range;
+}
+
+static inline struct RangeLock* f3fs_down_read3(struct f3fs_sb_info *sbi,
+						struct f3fs_rwsem3 *sem)
 {
-  return RWRangeAcquire(&sem->list_rl, 0, MAX_SIZE, false);
+	return f3fs_range_acquire_timed(sbi, sem, false);
 }
 static inline void f3fs_down_read(struct f3fs_rwsem *sem)
 {
@@ -2240,9 +2551,10 @@ static inline void f3fs_down_write2(struct f3fs_rwsem2 *sem)
   f3fs_down_range(sem, 0, MAX_SIZE, true);
 }
 
-static inline struct RangeLock* f3fs_down_write3(struct f3fs_rwsem3* sem)
+static inline struct RangeLock* f3fs_down_write3(struct f3fs_sb_info *sbi,
+						struct f3fs_rwsem3 *sem)
 {
-  return RWRangeAcquire(&sem->list_rl, 0, MAX_SIZE, true);
+	return f3fs_range_acquire_timed(sbi, sem, true);
 }
 
 static inline void f3fs_down_write(struct f3fs_rwsem *sem)
@@ -2307,9 +2619,21 @@ static inline void f3fs_up_write(struct f3fs_rwsem *sem)
 #endif
 }
 
+#define f3fs_down_read_timed(sbi, class, sem)				\
+	f3fs_lock_timed(sbi, class, f3fs_down_read_trylock(sem),	\
+						f3fs_down_read(sem))
+#define f3fs_up_read_timed(sbi, class, sem, token)			\
+	f3fs_unlock_timed(sbi, class, f3fs_up_read(sem), token)
+#define f3fs_down_write_timed(sbi, class, sem)				\
+	f3fs_lock_timed(sbi, class, f3fs_down_write_trylock(sem),	\
+						f3fs_down_write(sem))
+#define f3fs_up_write_timed(sbi, class, sem, token)			\
+	f3fs_unlock_timed(sbi, class, f3fs_up_write(sem), token)
+
 static inline void f3fs_lock_op(struct f3fs_sb_info *sbi)
 {
-	f3fs_down_read(&sbi->cp_rwsem);
+	/* readers are many and unlock elsewhere, time their wait only */
+	f3fs_down_read_timed(sbi, LOCK_CP_RWSEM, &sbi->cp_rwsem);
 }
 
 static inline int f3fs_trylock_op(struct f3fs_sb_info *sbi)
@@ -2328,12 +2652,72 @@ static inline void f3fs_unlock_op(struct f3fs_sb_info *sbi)
 
 static inline void f3fs_lock_all(struct f3fs_sb_info *sbi)
 {
-	f3fs_down_write(&sbi->cp_rwsem);
+	sbi->cp_rwsem_token = f3fs_down_write_timed(sbi, LOCK_CP_RWSEM,
+							&sbi->cp_rwsem);
 }
 
 static inline void f3fs_unlock_all(struct f3fs_sb_info *sbi)
 {
-	f3fs_up_write(&sbi->cp_rwsem);
+	f3fs_up_write_timed(sbi, LOCK_CP_RWSEM, &sbi->cp_rwsem,
+						sbi->cp_rwsem_token);
+}
+
+static inline void f3fs_stat_lock(struct f3fs_sb_info *sbi)
+{
+	sbi->stat_lock_token = f3fs_spin_lock_timed(sbi, LOCK_STAT,
+							&sbi->stat_lock);
+}
+
+static inline void f3fs_stat_unlock(struct f3fs_sb_info *sbi)
+{
+	f3fs_spin_unlock_timed(sbi, LOCK_STAT, &sbi->stat_lock,
+						sbi->stat_lock_token);
+}
+
+static inline void f3fs_lock_gc_cp(struct f3fs_sb_info *sbi)
+{
+	sbi->gc_internal_cp_token = f3fs_mutex_lock_timed(sbi,
+				LOCK_GC_INTERNAL_CP, &sbi->gc_internal_cp);
+}
+
+static inline void f3fs_unlock_gc_cp(struct f3fs_sb_info *sbi)
+{
+	f3fs_mutex_unlock_timed(sbi, LOCK_GC_INTERNAL_CP,
+			&sbi->gc_internal_cp, sbi->gc_internal_cp_token);
+}
+
+static inline void f3fs_io_down_read(struct f3fs_bio_info *io)
+{
+	f3fs_down_read_timed(io->sbi, LOCK_IO_RWSEM, &io->io_rwsem);
+}
+
+static inline void f3fs_io_up_read(struct f3fs_bio_info *io)
+{
+	f3fs_up_read(&io->io_rwsem);
+}
+
+static inline void f3fs_io_down_write(struct f3fs_bio_info *io)
+{
+	io->io_rwsem_token = f3fs_down_write_timed(io->sbi, LOCK_IO_RWSEM,
+							&io->io_rwsem);
+}
+
+static inline void f3fs_io_up_write(struct f3fs_bio_info *io)
+{
+	f3fs_up_write_timed(io->sbi, LOCK_IO_RWSEM, &io->io_rwsem,
+						io->io_rwsem_token);
+}
+
+static inline void f3fs_io_lock(struct f3fs_bio_info *io)
+{
+	io->io_lock_token = f3fs_spin_lock_timed(io->sbi, LOCK_IO,
+							&io->io_lock);
+}
+
+static inline void f3fs_io_unlock(struct f3fs_bio_info *io)
+{
+	f3fs_spin_unlock_timed(io->sbi, LOCK_IO, &io->io_lock,
+						io->io_lock_token);
 }
 
 static inline int __get_cp_reason(struct f3fs_sb_info *sbi)
@@ -2416,7 +2800,7 @@ static inline int inc_valid_block_count(struct f3fs_sb_info *sbi,
 	 */
 	percpu_counter_add(&sbi->alloc_valid_block_count, (*count));
 
-	spin_lock(&sbi->stat_lock);
+	f3fs_stat_lock(sbi);
 	sbi->total_valid_block_count += (block_t)(*count);
 	avail_user_block_count = sbi->user_block_count -
 					sbi->current_reserved_blocks;
@@ -2442,11 +2826,11 @@ static inline int inc_valid_block_count(struct f3fs_sb_info *sbi,
 		release = diff;
 		sbi->total_valid_block_count -= diff;
 		if (!*count) {
-			spin_unlock(&sbi->stat_lock);
+			f3fs_stat_unlock(sbi);
 			goto enospc;
 		}
 	}
-	spin_unlock(&sbi->stat_lock);
+	f3fs_stat_unlock(sbi);
 
 	if (unlikely(release)) {
 		percpu_counter_sub(&sbi->alloc_valid_block_count, release);
@@ -2482,14 +2866,14 @@ static inline void dec_valid_block_count(struct f3fs_sb_info *sbi,
 {
 	blkcnt_t sectors = count << F3FS_LOG_SECTORS_PER_BLOCK;
 
-	spin_lock(&sbi->stat_lock);
+	f3fs_stat_lock(sbi);
 	f3fs_bug_on(sbi, sbi->total_valid_block_count < (block_t) count);
 	sbi->total_valid_block_count -= (block_t)count;
 	if (sbi->reserved_blocks &&
 		sbi->current_reserved_blocks < sbi->reserved_blocks)
 		sbi->current_reserved_blocks = min(sbi->reserved_blocks,
 					sbi->current_reserved_blocks + count);
-	spin_unlock(&sbi->stat_lock);
+	f3fs_stat_unlock(sbi);
 	if (unlikely(inode->i_blocks < sectors)) {
 		f3fs_warn(sbi, "Inconsistent i_blocks, ino:%lu, iblocks:%llu, sectors:%llu",
 			  inode->i_ino,
@@ -2609,6 +2993,18 @@ static inline block_t __cp_payload(struct f3fs_sb_info *sbi)
 	return le32_to_cpu(F3FS_RAW_SUPER(sbi)->cp_payload);
 }
 
+/* # of GC data logs the checkpoint carries; older images carry them all */
+static inline unsigned int ckpt_gc_logs(struct f3fs_checkpoint *ckpt)
+{
+	return le16_to_cpu(ckpt->nr_gc_log) ?: MAX_GC_WORKER;
+}
+
+static inline bool curseg_in_use(struct f3fs_sb_info *sbi, int type)
+{
+	return type <= CURSEG_GC_DATA_LAST(sbi) ||
+		type > CURSEG_COLD_GC_DATA_END;
+}
+
 static inline void *__bitmap_ptr(struct f3fs_sb_info *sbi, int flag)
 {
 	struct f3fs_checkpoint *ckpt = F3FS_CKPT(sbi);
@@ -2689,7 +3085,7 @@ static inline int inc_valid_node_count(struct f3fs_sb_info *sbi,
 		goto enospc;
 	}
 
-	spin_lock(&sbi->stat_lock);
+	f3fs_stat_lock(sbi);
 
 	valid_block_count = sbi->total_valid_block_count +
 					sbi->current_reserved_blocks + 1;
@@ -2706,19 +3102,19 @@ static inline int inc_valid_node_count(struct f3fs_sb_info *sbi,
 		user_block_count -= sbi->unusable_block_count;
 
 	if (unlikely(valid_block_count > user_block_count)) {
-		spin_unlock(&sbi->stat_lock);
+		f3fs_stat_unlock(sbi);
 		goto enospc;
 	}
 
 	valid_node_count = sbi->total_valid_node_count + 1;
 	if (unlikely(valid_node_count > sbi->total_node_count)) {
-		spin_unlock(&sbi->stat_lock);
+		f3fs_stat_unlock(sbi);
 		goto enospc;
 	}
 
 	sbi->total_valid_node_count++;
 	sbi->total_valid_block_count++;
-	spin_unlock(&sbi->stat_lock);
+	f3fs_stat_unlock(sbi);
 
 	if (inode) {
 		if (is_inode)
@@ -2743,7 +3139,7 @@ static inline int inc_valid_node_count(struct f3fs_sb_info *sbi,
 static inline void dec_valid_node_count(struct f3fs_sb_info *sbi,
 					struct inode *inode, bool is_inode)
 {
-	spin_lock(&sbi->stat_lock);
+	f3fs_stat_lock(sbi);
 
 	if (unlikely(!sbi->total_valid_block_count ||
 			!sbi->total_valid_node_count)) {
@@ -2760,7 +3156,7 @@ static inline void dec_valid_node_count(struct f3fs_sb_info *sbi,
 		sbi->current_reserved_blocks < sbi->reserved_blocks)
 		sbi->current_reserved_blocks++;
 
-	spin_unlock(&sbi->stat_lock);
+	f3fs_stat_unlock(sbi);
 
 	if (is_inode) {
 		dquot_free_inode(inode);
@@ -2985,6 +3381,45 @@ static inline block_t f3fs_data_blkaddr(struct dnode_of_data *dn)
 	return data_blkaddr(dn->inode, dn->node_page, dn->ofs_in_node);
 }
 
+static inline __le32 *f3fs_dnode_addrs(struct dnode_of_data *dn)
+{
+	__le32 *addr_array = blkaddr_in_node(F3FS_NODE(dn->node_page));
+
+	if (IS_INODE(dn->node_page) && f3fs_has_extra_attr(dn->inode))
+		addr_array += get_extra_isize(dn->inode);
+	return addr_array;
+}
+
+/*
+ * Return the first offset in [dn->ofs_in_node, end) that is not a hole,
+ * or end.  NULL_ADDR is zero, so memchr_inv() steps over a run of holes
+ * a word at a time instead of decoding every address.
+ */
+static inline unsigned int f3fs_next_mapped_ofs(struct dnode_of_data *dn,
+							unsigned int end)
+{
+	__le32 *addr_array = f3fs_dnode_addrs(dn);
+	unsigned int ofs = dn->ofs_in_node;
+	u8 *p;
+
+	if (ofs >= end)
+		return end;
+	p = memchr_inv(addr_array + ofs, 0, (end - ofs) * sizeof(__le32));
+	return p ? (p - (u8 *)addr_array) / sizeof(__le32) : end;
+}
+
+/* Return the first hole in [dn->ofs_in_node, end), or end. */
+static inline unsigned int f3fs_next_hole_ofs(struct dnode_of_data *dn,
+							unsigned int end)
+{
+	__le32 *addr_array = f3fs_dnode_addrs(dn);
+	unsigned int ofs = dn->ofs_in_node;
+
+	while (ofs < end && addr_array[ofs] != cpu_to_le32(NULL_ADDR))
+		ofs++;
+	return ofs;
+}
+
 static inline int f3fs_test_bit(unsigned int nr, char *addr)
 {
 	int mask;
@@ -3765,6 +4200,12 @@ void f3fs_do_replace_block(struct f3fs_sb_info *sbi, struct f3fs_summary *sum,
 			block_t old_blkaddr, block_t new_blkaddr,
 			bool recover_curseg, bool recover_newaddr,
 			bool from_gc);
+bool f3fs_segment_reclaimable(struct f3fs_sb_info *sbi,
+			struct gc_reclaim_batch *rb);
+void f3fs_reclaim_prefree_segment(struct f3fs_sb_info *sbi,
+			struct gc_reclaim_batch *rb);
+void f3fs_replay_block_move(struct f3fs_sb_info *sbi, struct f3fs_summary *sum,
+			block_t old_blkaddr, block_t new_blkaddr);
 void f3fs_replace_block(struct f3fs_sb_info *sbi, struct dnode_of_data *dn,
 			block_t old_addr, block_t new_addr,
 			unsigned char version, bool recover_curseg,
@@ -3773,6 +4214,10 @@ void f3fs_allocate_data_block2(struct f3fs_sb_info *sbi, struct page *page,
 			block_t old_blkaddr, block_t *new_blkaddr,
 			struct f3fs_summary *sum, int type,
 			struct f3fs_io_info *fio);
+unsigned int f3fs_allocate_data_blocks(struct f3fs_sb_info *sbi,
+			block_t goal, block_t *new_blkaddr, nid_t nid,
+			unsigned int ofs_in_node, unsigned char version,
+			unsigned int count, int type);
 void f3fs_update_device_state(struct f3fs_sb_info *sbi, nid_t ino,
 					block_t blkaddr, unsigned int blkcnt);
 void f3fs_wait_on_page_writeback(struct page *page,
@@ -3782,8 +4227,10 @@ void f3fs_wait_on_block_writeback_range(struct inode *inode, block_t blkaddr,
 								block_t len);
 void f3fs_write_data_summaries(struct f3fs_sb_info *sbi, block_t start_blk);
 void f3fs_write_node_summaries(struct f3fs_sb_info *sbi, block_t start_blk);
-int f3fs_lookup_journal_in_cursum(struct f3fs_journal *journal, int type,
+int f3fs_lookup_journal_in_cursum(struct curseg_info *curseg, int type,
 			unsigned int val, int alloc);
+void f3fs_reset_journal_index(struct curseg_info *curseg);
+void f3fs_build_journal_index(struct curseg_info *curseg, int type);
 void f3fs_flush_sit_entries(struct f3fs_sb_info *sbi, struct cp_control *cpc);
 int f3fs_fix_curseg_write_pointer(struct f3fs_sb_info *sbi);
 int f3fs_check_write_pointer(struct f3fs_sb_info *sbi);
@@ -3844,6 +4291,8 @@ int f3fs_sync_dirty_inodes(struct f3fs_sb_info *sbi, enum inode_type type);
 void f3fs_wait_on_all_pages(struct f3fs_sb_info *sbi, int type);
 u64 f3fs_get_sectors_written(struct f3fs_sb_info *sbi);
 int f3fs_write_checkpoint(struct f3fs_sb_info *sbi, struct cp_control *cpc);
+int f3fs_commit_reclaim(struct f3fs_sb_info *sbi, struct gc_reclaim_batch *rb);
+int f3fs_replay_reclaim_journal(struct f3fs_sb_info *sbi);
 void f3fs_init_ino_entry_info(struct f3fs_sb_info *sbi);
 int __init f3fs_create_checkpoint_caches(void);
 void f3fs_destroy_checkpoint_caches(void);
@@ -3851,6 +4300,10 @@ int f3fs_issue_checkpoint(struct f3fs_sb_info *sbi);
 int f3fs_start_ckpt_thread(struct f3fs_sb_info *sbi);
 void f3fs_stop_ckpt_thread(struct f3fs_sb_info *sbi);
 void f3fs_init_ckpt_req_control(struct f3fs_sb_info *sbi);
+int f3fs_start_wb_workers(struct f3fs_sb_info *sbi);
+void f3fs_stop_wb_workers(struct f3fs_sb_info *sbi);
+void f3fs_kick_wb_workers(struct f3fs_sb_info *sbi);
+int f3fs_wb_workers_seq_show(struct seq_file *seq, void *offset);
 
 /*
  * data.c
@@ -3901,6 +4354,11 @@ int f3fs_fiemap(struct inode *inode, struct fiemap_extent_info *fieinfo,
 int f3fs_encrypt_one_page(struct f3fs_io_info *fio);
 bool f3fs_should_update_inplace(struct inode *inode, struct f3fs_io_info *fio);
 bool f3fs_should_update_outplace(struct inode *inode, struct f3fs_io_info *fio);
+void f3fs_init_adaptive_ipu(struct f3fs_sb_info *sbi);
+void f3fs_update_adaptive_ipu(struct f3fs_sb_info *sbi, unsigned int moved,
+							unsigned int freed);
+int f3fs_adaptive_ipu_seq_show(struct seq_file *seq,
+							void *offset);
 int f3fs_write_single_data_page(struct page *page, int *submitted,
 				struct bio **bio, sector_t *last_block,
 				struct writeback_control *wbc,
@@ -3925,9 +4383,17 @@ void f3fs_stop_gc_thread(struct f3fs_sb_info *sbi);
 block_t f3fs_start_bidx_of_node(unsigned int node_ofs, struct inode *inode);
 int f3fs_gc(struct f3fs_sb_info *sbi, struct f3fs_gc_control *gc_control);
 void f3fs_build_gc_manager(struct f3fs_sb_info *sbi);
+void f3fs_gc_icache_forget(struct f3fs_sb_info *sbi, struct inode *inode);
+unsigned long f3fs_count_gc_icache(struct f3fs_sb_info *sbi);
+unsigned long f3fs_shrink_gc_icache(struct f3fs_sb_info *sbi,
+						unsigned long nr_shrink);
 int f3fs_resize_fs(struct f3fs_sb_info *sbi, __u64 block_count);
 int __init f3fs_create_garbage_collection_cache(void);
 void f3fs_destroy_garbage_collection_cache(void);
+int f3fs_init_gc_attr(struct f3fs_sb_info *sbi);
+void f3fs_destroy_gc_attr(struct f3fs_sb_info *sbi);
+int f3fs_set_gc_cgroup(struct f3fs_sb_info *sbi, const char *path);
+int f3fs_gc_attr_seq_show(struct seq_file *seq, void *offset);
 
 /*
  * recovery.c
@@ -4255,6 +4721,15 @@ void f3fs_exit_sysfs(void);
 int f3fs_register_sysfs(struct f3fs_sb_info *sbi);
 void f3fs_unregister_sysfs(struct f3fs_sb_info *sbi);
 
+/*
+ * lockstat.c
+ */
+void f3fs_set_lock_stat_rate(struct f3fs_sb_info *sbi, unsigned int rate);
+int f3fs_init_lock_stat(struct f3fs_sb_info *sbi);
+void f3fs_destroy_lock_stat(struct f3fs_sb_info *sbi);
+void __init f3fs_create_lock_stat_root(void);
+void f3fs_destroy_lock_stat_root(void);
+
 /* verity.c */
 extern const struct fsverity_operations f3fs_verityops;
 
@@ -4333,6 +4808,11 @@ int f3fs_init_page_array_cache(struct f3fs_sb_info *sbi);
 void f3fs_destroy_page_array_cache(struct f3fs_sb_info *sbi);
 int __init f3fs_init_compress_cache(void);
 void f3fs_destroy_compress_cache(void);
+unsigned long f3fs_count_compress_workspaces(void);
+unsigned long f3fs_shrink_compress_workspaces(unsigned long nr_shrink);
+bool f3fs_gc_may_recompress(struct inode *inode);
+int f3fs_gc_recompress_cluster(struct inode *inode, pgoff_t index);
+int f3fs_gc_recompress_seq_show(struct seq_file *seq, void *offset);
 struct address_space *COMPRESS_MAPPING(struct f3fs_sb_info *sbi);
 void f3fs_invalidate_compress_page(struct f3fs_sb_info *sbi, block_t blkaddr);
 void f3fs_cache_compressed_page(struct f3fs_sb_info *sbi, struct page *page,
@@ -4387,6 +4867,12 @@ static inline int f3fs_init_page_array_cache(struct f3fs_sb_info *sbi) { return
 static inline void f3fs_destroy_page_array_cache(struct f3fs_sb_info *sbi) { }
 static inline int __init f3fs_init_compress_cache(void) { return 0; }
 static inline void f3fs_destroy_compress_cache(void) { }
+static inline unsigned long f3fs_count_compress_workspaces(void) { return 0; }
+static inline unsigned long f3fs_shrink_compress_workspaces(
+			unsigned long nr_shrink) { return 0; }
+static inline bool f3fs_gc_may_recompress(struct inode *inode) { return false; }
+static inline int f3fs_gc_recompress_cluster(struct inode *inode,
+				pgoff_t index) { return -EOPNOTSUPP; }
 static inline void f3fs_invalidate_compress_page(struct f3fs_sb_info *sbi,
 				block_t blkaddr) { }
 static inline void f3fs_cache_compressed_page(struct f3fs_sb_info *sbi,
@@ -4468,6 +4954,7 @@ F3FS_FEATURE_FUNCS(sb_chksum, SB_CHKSUM);
 F3FS_FEATURE_FUNCS(casefold, CASEFOLD);
 F3FS_FEATURE_FUNCS(compression, COMPRESSION);
 F3FS_FEATURE_FUNCS(readonly, RO);
+F3FS_FEATURE_FUNCS(reclaim_journal, RECLAIM_JOURNAL);
 
 static inline bool f3fs_may_extent_tree(struct inode *inode)
 {
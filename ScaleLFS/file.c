@@ -41,6 +41,7 @@ static vm_fault_t f3fs_filemap_fault(struct vm_fault *vmf)
 	struct inode *inode = file_inode(vmf->vma->vm_file);
 	vm_fault_t ret;
 
+	f3fs_update_read_time(F3FS_I_SB(inode));
 	ret = filemap_fault(vmf);
 	if (!ret)
 		f3fs_update_iostat(F3FS_I_SB(inode), APP_MAPPED_READ_IO,
@@ -417,6 +418,7 @@ static loff_t f3fs_seek_block(struct file *file, loff_t offset, int whence)
 	struct inode *inode = file->f_mapping->host;
 	loff_t maxbytes = inode->i_sb->s_maxbytes;
 	struct dnode_of_data dn;
+	struct extent_info ei = {0, };
 	pgoff_t pgofs, end_offset;
 	loff_t data_ofs = offset;
 	loff_t isize;
@@ -442,6 +444,14 @@ static loff_t f3fs_seek_block(struct file *file, loff_t offset, int whence)
 	pgofs = (pgoff_t)(offset >> PAGE_SHIFT);
 
 	for (; data_ofs < isize; data_ofs = (loff_t)pgofs << PAGE_SHIFT) {
+		/* a cached extent is data without reading its dnode */
+		if (f3fs_lookup_extent_cache(inode, pgofs, &ei)) {
+			if (whence == SEEK_DATA)
+				goto found;
+			pgofs = ei.fofs + ei.len;
+			continue;
+		}
+
 		set_new_dnode(&dn, inode, NULL, NULL, 0);
 		err = f3fs_get_dnode_of_data(&dn, pgofs, LOOKUP_NODE);
 		if (err && err != -ENOENT) {
@@ -459,10 +469,22 @@ static loff_t f3fs_seek_block(struct file *file, loff_t offset, int whence)
 		end_offset = ADDRS_PER_PAGE(dn.node_page, inode);
 
 		/* find data/hole in dnode block */
-		for (; dn.ofs_in_node < end_offset;
-				dn.ofs_in_node++, pgofs++,
-				data_ofs = (loff_t)pgofs << PAGE_SHIFT) {
+		while (dn.ofs_in_node < end_offset) {
 			block_t blkaddr;
+			unsigned int ofs;
+
+			/* skip straight to the next candidate address */
+			if (whence == SEEK_DATA)
+				ofs = f3fs_next_mapped_ofs(&dn, end_offset);
+			else
+				ofs = f3fs_next_hole_ofs(&dn, end_offset);
+			if (ofs != dn.ofs_in_node) {
+				pgofs += ofs - dn.ofs_in_node;
+				data_ofs = (loff_t)pgofs << PAGE_SHIFT;
+				dn.ofs_in_node = ofs;
+			}
+			if (ofs == end_offset)
+				break;
 
 			blkaddr = f3fs_data_blkaddr(&dn);
 
@@ -478,6 +500,9 @@ static loff_t f3fs_seek_block(struct file *file, loff_t offset, int whence)
 				f3fs_put_dnode(&dn);
 				goto found;
 			}
+			dn.ofs_in_node++;
+			pgofs++;
+			data_ofs = (loff_t)pgofs << PAGE_SHIFT;
 		}
 		f3fs_put_dnode(&dn);
 	}
@@ -954,7 +979,7 @@ int f3fs_setattr(struct user_namespace *mnt_userns, struct dentry *dentry,
 				return err;
 		}
 
-		range = f3fs_down_write3(&F3FS_I(inode)->i_gc_rwsem[WRITE]);
+		range = f3fs_down_write3(F3FS_I_SB(inode), &F3FS_I(inode)->i_gc_rwsem[WRITE]);
 		filemap_invalidate_lock(inode->i_mapping);
 
 		truncate_setsize(inode, attr->ia_size);
@@ -1109,7 +1134,7 @@ static int punch_hole(struct inode *inode, loff_t offset, loff_t len)
 			blk_start = (loff_t)pg_start << PAGE_SHIFT;
 			blk_end = (loff_t)pg_end << PAGE_SHIFT;
 
-			range = f3fs_down_write3(&F3FS_I(inode)->i_gc_rwsem[WRITE]);
+			range = f3fs_down_write3(sbi, &F3FS_I(inode)->i_gc_rwsem[WRITE]);
 			filemap_invalidate_lock(inode->i_mapping);
 
 			truncate_pagecache_range(inode, blk_start, blk_end - 1);
@@ -1353,7 +1378,7 @@ static int f3fs_do_collapse(struct inode *inode, loff_t offset, loff_t len)
 	f3fs_balance_fs(sbi, true);
 
 	/* avoid gc operation during block exchange */
-	range = f3fs_down_write3(&F3FS_I(inode)->i_gc_rwsem[WRITE]);
+	range = f3fs_down_write3(sbi, &F3FS_I(inode)->i_gc_rwsem[WRITE]);
 	filemap_invalidate_lock(inode->i_mapping);
 
 	f3fs_lock_op(sbi);
@@ -1507,7 +1532,7 @@ static int f3fs_zero_range(struct inode *inode, loff_t offset, loff_t len,
 			pgoff_t end;
       struct RangeLock* range = NULL;
 
-			range = f3fs_down_write3(&F3FS_I(inode)->i_gc_rwsem[WRITE]);
+			range = f3fs_down_write3(sbi, &F3FS_I(inode)->i_gc_rwsem[WRITE]);
 			filemap_invalidate_lock(mapping);
 
 			truncate_pagecache_range(inode,
@@ -1608,7 +1633,7 @@ static int f3fs_insert_range(struct inode *inode, loff_t offset, loff_t len)
 	idx = DIV_ROUND_UP(i_size_read(inode), PAGE_SIZE);
 
 	/* avoid gc operation during block exchange */
-	range = f3fs_down_write3(&F3FS_I(inode)->i_gc_rwsem[WRITE]);
+	range = f3fs_down_write3(sbi, &F3FS_I(inode)->i_gc_rwsem[WRITE]);
 	filemap_invalidate_lock(mapping);
 	truncate_pagecache(inode, offset);
 
@@ -2023,7 +2048,7 @@ static int f3fs_ioc_start_atomic_write(struct file *filp)
 	if (ret)
 		goto out;
 
-	range = f3fs_down_write3(&fi->i_gc_rwsem[WRITE]);
+	range = f3fs_down_write3(sbi, &fi->i_gc_rwsem[WRITE]);
 
 	/*
 	 * Should wait end_io to count F3FS_WB_CP_DATA correctly by
@@ -2777,7 +2802,7 @@ static int f3fs_move_file_range(struct file *file_in, loff_t pos_in,
 
 	f3fs_balance_fs(sbi, true);
 
-	range_src = f3fs_down_write3(&F3FS_I(src)->i_gc_rwsem[WRITE]);
+	range_src = f3fs_down_write3(sbi, &F3FS_I(src)->i_gc_rwsem[WRITE]);
 	if (src != dst) {
 		ret = -EBUSY;
     range_dst = f3fs_down_write_trylock3(&F3FS_I(dst)->i_gc_rwsem[WRITE]);
@@ -3172,7 +3197,7 @@ int f3fs_precache_extents(struct inode *inode)
     struct RangeLock* range = NULL;
 		map.m_len = end - map.m_lblk;
 
-		range = f3fs_down_write3(&fi->i_gc_rwsem[WRITE]);
+		range = f3fs_down_write3(F3FS_I_SB(inode), &fi->i_gc_rwsem[WRITE]);
 		err = f3fs_map_blocks(inode, &map, 0, F3FS_GET_BLOCK_PRECACHE);
 		f3fs_up_write3(range);
 		if (err)
@@ -3420,7 +3445,7 @@ static int f3fs_release_compress_blocks(struct file *filp, unsigned long arg)
 	if (!atomic_read(&F3FS_I(inode)->i_compr_blocks))
 		goto out;
 
-	range = f3fs_down_write3(&F3FS_I(inode)->i_gc_rwsem[WRITE]);
+	range = f3fs_down_write3(sbi, &F3FS_I(inode)->i_gc_rwsem[WRITE]);
 	filemap_invalidate_lock(inode->i_mapping);
 
 	last_idx = DIV_ROUND_UP(i_size_read(inode), PAGE_SIZE);
@@ -3574,7 +3599,7 @@ static int f3fs_reserve_compress_blocks(struct file *filp, unsigned long arg)
 		goto unlock_inode;
 	}
 
-	range = f3fs_down_write3(&F3FS_I(inode)->i_gc_rwsem[WRITE]);
+	range = f3fs_down_write3(sbi, &F3FS_I(inode)->i_gc_rwsem[WRITE]);
 	filemap_invalidate_lock(inode->i_mapping);
 
 	last_idx = DIV_ROUND_UP(i_size_read(inode), PAGE_SIZE);
@@ -3730,7 +3755,7 @@ static int f3fs_sec_trim_file(struct file *filp, unsigned long arg)
 	if (ret)
 		goto err;
 
-	range_lock = f3fs_down_write3(&F3FS_I(inode)->i_gc_rwsem[WRITE]);
+	range_lock = f3fs_down_write3(sbi, &F3FS_I(inode)->i_gc_rwsem[WRITE]);
 	filemap_invalidate_lock(mapping);
 
 	ret = filemap_write_and_wait_range(mapping, range.start,
@@ -4257,7 +4282,7 @@ static ssize_t f3fs_dio_read_iter(struct kiocb *iocb, struct iov_iter *to)
 			goto out;
 		}
 	} else {
-		range = f3fs_down_read3(&fi->i_gc_rwsem[READ]);
+		range = f3fs_down_read3(sbi, &fi->i_gc_rwsem[READ]);
 	}
 
 	/*
@@ -4311,6 +4336,7 @@ static ssize_t f3fs_file_read_iter(struct kiocb *iocb, struct iov_iter *to)
 		kfree(p);
 	}
 skip_read_trace:
+	f3fs_update_read_time(F3FS_I_SB(inode));
 	if (f3fs_should_use_dio(inode, iocb, to)) {
 		ret = f3fs_dio_read_iter(iocb, to);
 	} else {
@@ -4498,9 +4524,9 @@ static ssize_t f3fs_dio_write_iter(struct kiocb *iocb, struct iov_iter *from,
 		if (ret)
 			goto out;
 
-		range_w = f3fs_down_read3(&fi->i_gc_rwsem[WRITE]);
+		range_w = f3fs_down_read3(sbi, &fi->i_gc_rwsem[WRITE]);
 		if (do_opu)
-			range_r = f3fs_down_read3(&fi->i_gc_rwsem[READ]);
+			range_r = f3fs_down_read3(sbi, &fi->i_gc_rwsem[READ]);
 	}
 
 	/*
@@ -4650,7 +4676,7 @@ static ssize_t f3fs_file_write_iter(struct kiocb *iocb, struct iov_iter *from)
 
 	/* Don't leave any preallocated blocks around past i_size. */
 	if (preallocated && i_size_read(inode) < target_size) {
-		struct RangeLock* range = f3fs_down_write3(&F3FS_I(inode)->i_gc_rwsem[WRITE]);
+		struct RangeLock* range = f3fs_down_write3(F3FS_I_SB(inode), &F3FS_I(inode)->i_gc_rwsem[WRITE]);
 		filemap_invalidate_lock(inode->i_mapping);
 		if (!f3fs_truncate(inode))
 			file_dont_truncate(inode);
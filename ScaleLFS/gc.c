@@ -15,6 +15,12 @@
 #include <linux/sched/signal.h>
 #include <linux/random.h>
 #include <linux/sched/mm.h>
+#include <linux/hash.h>
+#include <linux/sort.h>
+#include <linux/seq_file.h>
+#include <linux/cgroup.h>
+#include <linux/backing-dev.h>
+#include <linux/blk-cgroup.h>
 
 #include "f3fs.h"
 #include "node.h"
@@ -28,6 +34,39 @@ static struct kmem_cache *victim_entry_slab;
 static unsigned int count_bits(const unsigned long *addr,
 				unsigned int offset, unsigned int len);
 
+/*
+ * Decide whether one background round fits in the current idle gap.  The
+ * gap is predicted from the EWMA of past ones; a gap that has already
+ * outlasted the prediction is expected to last about as long again.
+ */
+static bool gc_idle_window_fits(struct f3fs_sb_info *sbi,
+				struct f3fs_gc_kthread *gc_th)
+{
+	unsigned int idle_ms, predicted;
+
+	if (sbi->gc_mode != GC_NORMAL)
+		return is_idle(sbi, GC_TIME);
+	if (is_inflight_io(sbi, GC_TIME))
+		return false;
+
+	idle_ms = jiffies_to_msecs(jiffies - f3fs_last_fg_time(sbi));
+	if (idle_ms < sbi->idle_gap_min_ms)
+		return false;
+	if (f3fs_time_over(sbi, GC_TIME))
+		return true;
+
+	predicted = max(READ_ONCE(sbi->idle_gap_ewma_ms), 2 * idle_ms);
+	return predicted - idle_ms >= gc_th->slice_ewma_ms;
+}
+
+/* poll for the next idle window, backing off while the device is busy */
+static void gc_idle_backoff(struct f3fs_sb_info *sbi,
+				struct f3fs_gc_kthread *gc_th, unsigned int *wait)
+{
+	*wait = min(max(*wait * 2, sbi->idle_gap_min_ms),
+					gc_th->min_sleep_time);
+}
+
 static int gc_thread_func(void *data)
 {
 	struct f3fs_sb_info *sbi = data;
@@ -44,7 +83,8 @@ static int gc_thread_func(void *data)
 
 	set_freezable();
 	do {
-		bool sync_mode, foreground = false;
+		bool sync_mode, foreground = false, predicted = false;
+		unsigned long slice_start = 0;
 
 		wait_event_interruptible_timeout(*wq,
 				kthread_should_stop() || freezing(current) ||
@@ -124,17 +164,27 @@ static int gc_thread_func(void *data)
 			goto next;
 		}
 
-		if (!is_idle(sbi, GC_TIME)) {
+		if (gc_th->idle_predict && has_enough_invalid_blocks(sbi)) {
+			if (!gc_idle_window_fits(sbi, gc_th)) {
+				gc_th->idle_skipped++;
+				gc_idle_backoff(sbi, gc_th, &wait_ms);
+				f3fs_up_write(&sbi->gc_lock);
+				stat_io_skip_bggc_count(sbi);
+				goto next;
+			}
+			/* keep cleaning while the window lasts */
+			wait_ms = sbi->idle_gap_min_ms;
+			predicted = true;
+		} else if (!is_idle(sbi, GC_TIME)) {
 			increase_sleep_time(gc_th, &wait_ms);
 			f3fs_up_write(&sbi->gc_lock);
 			stat_io_skip_bggc_count(sbi);
 			goto next;
-		}
-
-		if (has_enough_invalid_blocks(sbi))
+		} else if (has_enough_invalid_blocks(sbi)) {
 			decrease_sleep_time(gc_th, &wait_ms);
-		else
+		} else {
 			increase_sleep_time(gc_th, &wait_ms);
+		}
 do_gc:
 		if (!foreground)
 			stat_inc_bggc_count(sbi->stat_info);
@@ -149,6 +199,12 @@ static int gc_thread_func(void *data)
 		gc_control.no_bg_gc = foreground;
 		gc_control.nr_free_secs = foreground ? 1 : 0;
 
+		if (predicted && !sync_mode) {
+			gc_th->slice_stamp = f3fs_last_fg_time(sbi);
+			WRITE_ONCE(gc_th->in_slice, true);
+			slice_start = jiffies;
+		}
+
 		/* if return value is not zero, no victim was selected */
 		if (f3fs_gc(sbi, &gc_control)) {
 			/* don't bother wait_ms by foreground gc */
@@ -156,6 +212,21 @@ static int gc_thread_func(void *data)
 				wait_ms = gc_th->no_gc_sleep_time;
 		}
 
+		WRITE_ONCE(gc_th->in_slice, false);
+
+		/* only rounds which ran to completion tell how long one takes */
+		if (slice_start && f3fs_last_fg_time(sbi) !=
+						gc_th->slice_stamp) {
+			gc_th->idle_preempted++;
+			wait_ms = sbi->idle_gap_min_ms;
+		} else if (slice_start) {
+			unsigned int ms = max(1U,
+				jiffies_to_msecs(jiffies - slice_start));
+			unsigned int ewma = gc_th->slice_ewma_ms;
+
+			gc_th->slice_ewma_ms = ewma - (ewma >> 3) + (ms >> 3);
+		}
+
 		if (foreground)
 			wake_up_all(&gc_th->fggc_wq);
 
@@ -171,6 +242,21 @@ static int gc_thread_func(void *data)
 	return 0;
 }
 
+/*
+ * Charge the I/O of a background GC round to the GC cgroup, if there is
+ * one.  Foreground GC has writers waiting for its space and keeps the
+ * root's weight.
+ */
+static void gc_worker_charge(struct f3fs_sb_info *sbi,
+				struct f3fs_gc_control *gc_control)
+{
+	if (gc_control->init_gc_type != BG_GC)
+		return;
+	spin_lock(&sbi->gc_css_lock);
+	kthread_associate_blkcg(sbi->gc_css);
+	spin_unlock(&sbi->gc_css_lock);
+}
+
 static int gc_worker_func(void* data)
 {
   struct worker_arg* worker_arg = (struct worker_arg*)data;
@@ -180,7 +266,9 @@ static int gc_worker_func(void* data)
         msecs_to_jiffies(300));
 
     if (worker_arg->state == 1) {
+      gc_worker_charge(worker_arg->sbi, worker_arg->gc_control);
       worker_arg->ret = do_gc(worker_arg->sbi, worker_arg->gc_control, worker_arg->idx, worker_arg->multiple_victim);
+      kthread_associate_blkcg(NULL);
       worker_arg->state = 0;
       wake_up(&worker_arg->caller_wq);
     }
@@ -205,6 +293,19 @@ int f3fs_start_gc_thread(struct f3fs_sb_info *sbi)
 	gc_th->min_sleep_time = DEF_GC_THREAD_MIN_SLEEP_TIME;
 	gc_th->max_sleep_time = DEF_GC_THREAD_MAX_SLEEP_TIME;
 	gc_th->no_gc_sleep_time = DEF_GC_THREAD_NOGC_SLEEP_TIME;
+
+	gc_th->idle_predict = 1;
+	gc_th->slice_ewma_ms = DEF_GC_IDLE_SLICE_MS;
+	gc_th->idle_skipped = 0;
+	gc_th->idle_preempted = 0;
+	gc_th->in_slice = false;
+	gc_th->slice_stamp = 0;
+
+	gc_th->gc_iocost = 1;
+	gc_th->gc_active_workers = num_gc_thread;
+	gc_th->gc_iocost_debt_us = DEF_GC_IOCOST_DEBT_US;
+	gc_th->gc_iocost_backoffs = 0;
+	gc_th->gc_iocost_vrate = 0;
   gc_th->worker_args = f3fs_kmalloc(sbi,
     sizeof(struct worker_arg) * num_gc_thread,
     GFP_KERNEL);
@@ -308,15 +409,13 @@ static void select_policy(struct f3fs_sb_info *sbi, int gc_type,
 {
 	struct dirty_seglist_info *dirty_i = DIRTY_I(sbi);
 
-	if (p->alloc_mode == SSR) {
-		p->gc_mode = GC_GREEDY;
-		p->dirty_bitmap = dirty_i->dirty_segmap[type];
-		p->max_search = atomic_read(&dirty_i->nr_dirty[type]);
-		p->ofs_unit = 1;
-	} else if (p->alloc_mode == AT_SSR) {
+	if (p->alloc_mode == SSR || p->alloc_mode == AT_SSR) {
+		enum dirty_type t = seg_dirty_index(type);
+
 		p->gc_mode = GC_GREEDY;
-		p->dirty_bitmap = dirty_i->dirty_segmap[type];
-		p->max_search = atomic_read(&dirty_i->nr_dirty[type]);
+		p->dirty_bitmap = dirty_i->dirty_segmap[t];
+		p->max_search = percpu_counter_sum_positive(
+						&dirty_i->nr_dirty_type[t]);
 		p->ofs_unit = 1;
 	} else {
 		p->gc_mode = select_gc_type(sbi, gc_type);
@@ -394,10 +493,9 @@ static unsigned int check_bg_victims(struct f3fs_sb_info *sbi)
 
 static unsigned int get_cb_cost(struct f3fs_sb_info *sbi, unsigned int segno)
 {
-	struct sit_info *sit_i = SIT_I(sbi);
 	unsigned int secno = GET_SEC_FROM_SEG(sbi, segno);
 	unsigned int start = GET_SEG_FROM_SEC(sbi, secno);
-	unsigned long long mtime = 0;
+	unsigned long long mtime = 0, min_mtime, max_mtime;
 	unsigned int vblocks;
 	unsigned char age = 0;
 	unsigned char u;
@@ -414,14 +512,11 @@ static unsigned int get_cb_cost(struct f3fs_sb_info *sbi, unsigned int segno)
 	u = (vblocks * 100) >> sbi->log_blocks_per_seg;
 
 	/* Handle if the system time has changed by the user */
-	if (mtime < sit_i->min_mtime)
-		sit_i->min_mtime = mtime;
-  {
-    unsigned long long max_mtime = update_max_mtime_atomic(sbi, mtime);
-    if (max_mtime != sit_i->min_mtime)
-      age = 100 - div64_u64(100 * (mtime - sit_i->min_mtime),
-          max_mtime - sit_i->min_mtime);
-  }
+	min_mtime = update_min_mtime_atomic(sbi, mtime);
+	max_mtime = update_max_mtime_atomic(sbi, mtime);
+	if (max_mtime != min_mtime)
+		age = 100 - div64_u64(100 * (mtime - min_mtime),
+					max_mtime - min_mtime);
 
 	return UINT_MAX - ((100 * (100 - u) * age) / (100 + u));
 }
@@ -455,11 +550,11 @@ static unsigned int count_bits(const unsigned long *addr,
 }
 
 static struct victim_entry *attach_victim_entry(struct f3fs_sb_info *sbi,
+				struct atgc_management *am,
 				unsigned long long mtime, unsigned int segno,
 				struct rb_node *parent, struct rb_node **p,
 				bool left_most)
 {
-	struct atgc_management *am = &sbi->am;
 	struct victim_entry *ve;
 
 	ve =  f3fs_kmem_cache_alloc(victim_entry_slab,
@@ -479,21 +574,21 @@ static struct victim_entry *attach_victim_entry(struct f3fs_sb_info *sbi,
 }
 
 static void insert_victim_entry(struct f3fs_sb_info *sbi,
+				struct atgc_management *am,
 				unsigned long long mtime, unsigned int segno)
 {
-	struct atgc_management *am = &sbi->am;
 	struct rb_node **p;
 	struct rb_node *parent = NULL;
 	bool left_most = true;
 
 	p = f3fs_lookup_rb_tree_ext(sbi, &am->root, &parent, mtime, &left_most);
-	attach_victim_entry(sbi, mtime, segno, parent, p, left_most);
+	attach_victim_entry(sbi, am, mtime, segno, parent, p, left_most);
 }
 
 static void add_victim_entry(struct f3fs_sb_info *sbi,
+				struct atgc_management *am,
 				struct victim_sel_policy *p, unsigned int segno)
 {
-	struct sit_info *sit_i = SIT_I(sbi);
 	unsigned int secno = GET_SEC_FROM_SEG(sbi, segno);
 	unsigned int start = GET_SEG_FROM_SEC(sbi, secno);
 	unsigned long long mtime = 0;
@@ -510,25 +605,24 @@ static void add_victim_entry(struct f3fs_sb_info *sbi,
 	mtime = div_u64(mtime, sbi->segs_per_sec);
 
 	/* Handle if the system time has changed by the user */
-	if (mtime < sit_i->min_mtime)
-		sit_i->min_mtime = mtime;
-  update_max_mtime_atomic(sbi, mtime);
-	if (mtime < sit_i->dirty_min_mtime)
-		sit_i->dirty_min_mtime = mtime;
-	if (mtime > sit_i->dirty_max_mtime)
-		sit_i->dirty_max_mtime = mtime;
+	update_min_mtime_atomic(sbi, mtime);
+	update_max_mtime_atomic(sbi, mtime);
+	if (mtime < p->dirty_min_mtime)
+		p->dirty_min_mtime = mtime;
+	if (mtime > p->dirty_max_mtime)
+		p->dirty_max_mtime = mtime;
 
 	/* don't choose young section as candidate */
-	if (sit_i->dirty_max_mtime - mtime < p->age_threshold)
+	if (p->dirty_max_mtime - mtime < p->age_threshold)
 		return;
 
-	insert_victim_entry(sbi, mtime, segno);
+	insert_victim_entry(sbi, am, mtime, segno);
 }
 
 static struct rb_node *lookup_central_victim(struct f3fs_sb_info *sbi,
+						struct atgc_management *am,
 						struct victim_sel_policy *p)
 {
-	struct atgc_management *am = &sbi->am;
 	struct rb_node *parent = NULL;
 	bool left_most;
 
@@ -537,25 +631,64 @@ static struct rb_node *lookup_central_victim(struct f3fs_sb_info *sbi,
 	return parent;
 }
 
+/*
+ * Age-weighted cost of a GC_AT candidate, the lower the better.  Entries
+ * outside of the [min_mtime, max_mtime) window cost UINT_MAX.
+ */
+static unsigned int atgc_victim_cost(struct f3fs_sb_info *sbi,
+				struct atgc_management *am,
+				struct victim_entry *ve,
+				unsigned long long min_mtime,
+				unsigned long long max_mtime,
+				unsigned long long accu,
+				unsigned long long *age)
+{
+	unsigned long long total_time = max_mtime - min_mtime;
+	unsigned int sec_blocks = CAP_BLKS_PER_SEC(sbi);
+	unsigned int vblocks;
+	unsigned long long u;
+
+	if (ve->mtime >= max_mtime || ve->mtime < min_mtime)
+		return UINT_MAX;
+
+	/* age = 10000 * x% * 60 */
+	*age = div64_u64(accu * (max_mtime - ve->mtime), total_time) *
+							am->age_weight;
+
+	vblocks = get_valid_blocks(sbi, ve->segno, true);
+	f3fs_bug_on(sbi, !vblocks || vblocks == sec_blocks);
+
+	/* u = 10000 * x% * 40 */
+	u = div64_u64(accu * (sec_blocks - vblocks), sec_blocks) *
+						(100 - am->age_weight);
+
+	f3fs_bug_on(sbi, *age + u >= UINT_MAX);
+
+	return UINT_MAX - (*age + u);
+}
+
+static unsigned long long atgc_accuracy(unsigned long long total_time)
+{
+	unsigned long long accu = div64_u64(ULLONG_MAX, total_time);
+
+	return min_t(unsigned long long, div_u64(accu, 100),
+					DEFAULT_ACCURACY_CLASS);
+}
+
 static void atgc_lookup_victim(struct f3fs_sb_info *sbi,
+						struct atgc_management *am,
 						struct victim_sel_policy *p)
 {
-	struct sit_info *sit_i = SIT_I(sbi);
-	struct atgc_management *am = &sbi->am;
 	struct rb_root_cached *root = &am->root;
 	struct rb_node *node;
 	struct rb_entry *re;
 	struct victim_entry *ve;
-	unsigned long long total_time;
-	unsigned long long age, u, accu;
-	unsigned long long max_mtime = sit_i->dirty_max_mtime;
-	unsigned long long min_mtime = sit_i->dirty_min_mtime;
-	unsigned int sec_blocks = CAP_BLKS_PER_SEC(sbi);
-	unsigned int vblocks;
+	unsigned long long age, accu;
+	unsigned long long max_mtime = p->dirty_max_mtime;
+	unsigned long long min_mtime = p->dirty_min_mtime;
 	unsigned int dirty_threshold = max(am->max_candidate_count,
 					am->candidate_ratio *
 					am->victim_count / 100);
-	unsigned int age_weight = am->age_weight;
 	unsigned int cost;
 	unsigned int iter = 0;
 
@@ -563,11 +696,7 @@ static void atgc_lookup_victim(struct f3fs_sb_info *sbi,
 		return;
 
 	max_mtime += 1;
-	total_time = max_mtime - min_mtime;
-
-	accu = div64_u64(ULLONG_MAX, total_time);
-	accu = min_t(unsigned long long, div_u64(accu, 100),
-					DEFAULT_ACCURACY_CLASS);
+	accu = atgc_accuracy(max_mtime - min_mtime);
 
 	node = rb_first_cached(root);
 next:
@@ -577,23 +706,9 @@ static void atgc_lookup_victim(struct f3fs_sb_info *sbi,
 
 	ve = (struct victim_entry *)re;
 
-	if (ve->mtime >= max_mtime || ve->mtime < min_mtime)
+	cost = atgc_victim_cost(sbi, am, ve, min_mtime, max_mtime, accu, &age);
+	if (cost == UINT_MAX)
 		goto skip;
-
-	/* age = 10000 * x% * 60 */
-	age = div64_u64(accu * (max_mtime - ve->mtime), total_time) *
-								age_weight;
-
-	vblocks = get_valid_blocks(sbi, ve->segno, true);
-	f3fs_bug_on(sbi, !vblocks || vblocks == sec_blocks);
-
-	/* u = 10000 * x% * 40 */
-	u = div64_u64(accu * (sec_blocks - vblocks), sec_blocks) *
-							(100 - age_weight);
-
-	f3fs_bug_on(sbi, age + u >= UINT_MAX);
-
-	cost = UINT_MAX - (age + u);
 	iter++;
 
 	if (cost < p->min_cost ||
@@ -609,21 +724,90 @@ static void atgc_lookup_victim(struct f3fs_sb_info *sbi,
 	}
 }
 
+/*
+ * GC_AT flavour of the multi-victim selection: keep the @nr cheapest
+ * candidates of @am in @result and claim them in victim_secmap.  @am is
+ * private to the caller, so parallel GC workers only meet each other on
+ * the victim_secmap bits; a candidate another worker claimed first is
+ * simply dropped.
+ */
+static int atgc_lookup_multiple_victim(struct f3fs_sb_info *sbi,
+						struct atgc_management *am,
+						struct victim_sel_policy *p,
+						unsigned int *result,
+						unsigned int nr)
+{
+	struct dirty_seglist_info *dirty_i = DIRTY_I(sbi);
+	unsigned int cost[VICTIM_COUNT];
+	struct rb_node *node;
+	struct victim_entry *ve;
+	unsigned long long age, accu;
+	unsigned long long max_mtime = p->dirty_max_mtime;
+	unsigned long long min_mtime = p->dirty_min_mtime;
+	unsigned int dirty_threshold = max(am->max_candidate_count,
+					am->candidate_ratio *
+					am->victim_count / 100);
+	unsigned int iter = 0, count = 0, selected = 0;
+	unsigned int c;
+	int i, worst = 0;
+
+	if (max_mtime < min_mtime)
+		return 0;
+
+	max_mtime += 1;
+	accu = atgc_accuracy(max_mtime - min_mtime);
+
+	for (node = rb_first_cached(&am->root);
+			node && iter < dirty_threshold; node = rb_next(node)) {
+		ve = rb_entry(node, struct victim_entry, rb_node);
+
+		c = atgc_victim_cost(sbi, am, ve, min_mtime, max_mtime,
+								accu, &age);
+		if (c == UINT_MAX)
+			continue;
+		iter++;
+
+		if (count < nr) {
+			result[count] = ve->segno;
+			cost[count++] = c;
+		} else if (c < cost[worst]) {
+			result[worst] = ve->segno;
+			cost[worst] = c;
+		} else {
+			continue;
+		}
+
+		for (i = 0, worst = 0; i < count; i++)
+			if (cost[i] > cost[worst])
+				worst = i;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (test_and_set_bit(GET_SEC_FROM_SEG(sbi, result[i]),
+						dirty_i->victim_secmap))
+			continue;
+		result[selected++] = result[i];
+	}
+	for (i = selected; i < nr; i++)
+		result[i] = NULL_SEGNO;
+
+	return selected;
+}
+
 /*
  * select candidates around source section in range of
  * [target - dirty_threshold, target + dirty_threshold]
  */
 static void atssr_lookup_victim(struct f3fs_sb_info *sbi,
+						struct atgc_management *am,
 						struct victim_sel_policy *p)
 {
-	struct sit_info *sit_i = SIT_I(sbi);
-	struct atgc_management *am = &sbi->am;
 	struct rb_node *node;
 	struct rb_entry *re;
 	struct victim_entry *ve;
 	unsigned long long age;
-	unsigned long long max_mtime = sit_i->dirty_max_mtime;
-	unsigned long long min_mtime = sit_i->dirty_min_mtime;
+	unsigned long long max_mtime = p->dirty_max_mtime;
+	unsigned long long min_mtime = p->dirty_min_mtime;
 	unsigned int seg_blocks = sbi->blocks_per_seg;
 	unsigned int vblocks;
 	unsigned int dirty_threshold = max(am->max_candidate_count,
@@ -637,7 +821,7 @@ static void atssr_lookup_victim(struct f3fs_sb_info *sbi,
 		return;
 	max_mtime += 1;
 next_stage:
-	node = lookup_central_victim(sbi, p);
+	node = lookup_central_victim(sbi, am, p);
 next_node:
 	re = rb_entry_safe(node, struct rb_entry, rb_node);
 	if (!re) {
@@ -687,22 +871,23 @@ static void atssr_lookup_victim(struct f3fs_sb_info *sbi,
 	}
 }
 static void lookup_victim_by_age(struct f3fs_sb_info *sbi,
+						struct atgc_management *am,
 						struct victim_sel_policy *p)
 {
 	f3fs_bug_on(sbi, !f3fs_check_rb_tree_consistence(sbi,
-						&sbi->am.root, true));
+						&am->root, true));
 
 	if (p->gc_mode == GC_AT)
-		atgc_lookup_victim(sbi, p);
+		atgc_lookup_victim(sbi, am, p);
 	else if (p->alloc_mode == AT_SSR)
-		atssr_lookup_victim(sbi, p);
+		atssr_lookup_victim(sbi, am, p);
 	else
 		f3fs_bug_on(sbi, 1);
 }
 
-static void release_victim_entry(struct f3fs_sb_info *sbi)
+static void release_victim_entry(struct f3fs_sb_info *sbi,
+						struct atgc_management *am)
 {
-	struct atgc_management *am = &sbi->am;
 	struct victim_entry *ve, *tmp;
 
 	list_for_each_entry_safe(ve, tmp, &am->victim_list, list) {
@@ -803,8 +988,10 @@ static int get_victim_by_default(struct f3fs_sb_info *sbi,
 	is_atgc = (p.gc_mode == GC_AT || p.alloc_mode == AT_SSR);
 	nsearched = 0;
 
-	if (is_atgc)
-		SIT_I(sbi)->dirty_min_mtime = ULLONG_MAX;
+	if (is_atgc) {
+		p.dirty_min_mtime = ULLONG_MAX;
+		p.dirty_max_mtime = sm->dirty_max_mtime;
+	}
 
 	if (*result != NULL_SEGNO) {
 		if (!get_valid_blocks(sbi, *result, false)) {
@@ -912,7 +1099,7 @@ static int get_victim_by_default(struct f3fs_sb_info *sbi,
 			goto next;
 
 		if (is_atgc) {
-			add_victim_entry(sbi, &p, segno);
+			add_victim_entry(sbi, &sbi->am, &p, segno);
 			goto next;
 		}
 
@@ -937,8 +1124,9 @@ static int get_victim_by_default(struct f3fs_sb_info *sbi,
 
 	/* get victim for GC_AT/AT_SSR */
 	if (is_atgc) {
-		lookup_victim_by_age(sbi, &p);
-		release_victim_entry(sbi);
+		sm->dirty_max_mtime = p.dirty_max_mtime;
+		lookup_victim_by_age(sbi, &sbi->am, &p);
+		release_victim_entry(sbi, &sbi->am);
 	}
 
 	if (is_atgc && p.min_segno == NULL_SEGNO &&
@@ -1004,22 +1192,36 @@ static int get_multiple_victim_by_default(struct f3fs_sb_info *sbi,
   unsigned int selected_cost[VICTIM_COUNT] = {0,};
   int selected_count = 0;
   bool changed = false;
-
-	last_segment = MAIN_SECS(sbi) * sbi->segs_per_sec;
+	struct atgc_management am;
 
 	p.alloc_mode = alloc_mode;
 	p.age = age;
 	p.age_threshold = sbi->am.age_threshold;
 
+retry:
+	last_segment = MAIN_SECS(sbi) * sbi->segs_per_sec;
 	select_policy(sbi, gc_type, type, &p);
 	p.min_segno = NULL_SEGNO;
 	p.oldest_age = 0;
 	p.min_cost = get_max_cost(sbi, &p);
 
 	is_atgc = (p.gc_mode == GC_AT || p.alloc_mode == AT_SSR);
-  f3fs_bug_on(sbi, is_atgc);
+	f3fs_bug_on(sbi, p.alloc_mode != LFS);
 	nsearched = 0;
 
+	/*
+	 * sbi->am.root belongs to the single victim path under seglist_lock,
+	 * so collect GC_AT candidates in a tree of our own.
+	 */
+	if (is_atgc) {
+		am = sbi->am;
+		am.root = RB_ROOT_CACHED;
+		INIT_LIST_HEAD(&am.victim_list);
+		am.victim_count = 0;
+		p.dirty_min_mtime = ULLONG_MAX;
+		p.dirty_max_mtime = READ_ONCE(sm->dirty_max_mtime);
+	}
+
 	ret = -ENODATA;
 	if (p.max_search == 0)
 		goto out;
@@ -1060,19 +1262,24 @@ static int get_multiple_victim_by_default(struct f3fs_sb_info *sbi,
 		if (gc_type == FG_GC && f3fs_section_is_pinned(dirty_i, secno))
 			goto next;
 
+		if (is_atgc) {
+			add_victim_entry(sbi, &am, &p, segno);
+			goto next;
+		}
+
 		cost = get_gc_cost(sbi, segno, &p);
     changed = false;
     if (selected_count < VICTIM_COUNT) {
-      if (!test_and_set_bit(segno, dirty_i->victim_secmap)) {
-        clear_bit(result[selected_count], dirty_i->victim_secmap);
+      if (!test_and_set_bit(secno, dirty_i->victim_secmap)) {
         result[selected_count] = segno;
         selected_cost[selected_count] = cost;
         selected_count++;
         changed = true;
       }
     } else if (local_max > cost) {
-      if (!test_and_set_bit(segno, dirty_i->victim_secmap)) {
-        clear_bit(result[local_max_idx], dirty_i->victim_secmap);
+      if (!test_and_set_bit(secno, dirty_i->victim_secmap)) {
+        clear_bit(GET_SEC_FROM_SEG(sbi, result[local_max_idx]),
+            dirty_i->victim_secmap);
         result[local_max_idx] = segno;
         selected_cost[local_max_idx] = cost;
         changed = true;
@@ -1097,9 +1304,23 @@ static int get_multiple_victim_by_default(struct f3fs_sb_info *sbi,
 		}
 	}
 
+	if (is_atgc) {
+		if (p.dirty_max_mtime > READ_ONCE(sm->dirty_max_mtime))
+			WRITE_ONCE(sm->dirty_max_mtime, p.dirty_max_mtime);
+		selected_count = atgc_lookup_multiple_victim(sbi, &am, &p,
+							result, VICTIM_COUNT);
+		release_victim_entry(sbi, &am);
+
+		if (!selected_count && sm->elapsed_time < p.age_threshold) {
+			p.age_threshold = 0;
+			goto retry;
+		}
+		ret = selected_count ? 0 : -ENODATA;
+	}
+
 out:
   for (int i = 0 ; i < selected_count ; i++) {
-    set_bit(result[i], dirty_i->victim_secmap);
+    set_bit(GET_SEC_FROM_SEG(sbi, result[i]), dirty_i->victim_secmap);
   }
 
 	if (p.min_segno != NULL_SEGNO)
@@ -1153,6 +1374,401 @@ static void put_gc_inode(struct gc_inode_list *gc_list)
 	}
 }
 
+/*
+ * Inodes touched by one GC round are handed to sbi->gc_icache instead of
+ * being iput() right away, so that the next round finding blocks of the
+ * same file does not have to rebuild the inode from its node page. The
+ * cache is a bounded LRU holding one reference per inode; unlinked inodes
+ * are dropped from f3fs_drop_nlink() so their eviction is not delayed.
+ */
+static void init_gc_icache(struct f3fs_sb_info *sbi)
+{
+	struct gc_inode_cache *gic = &sbi->gc_icache;
+
+	spin_lock_init(&gic->lock);
+	INIT_RADIX_TREE(&gic->iroot, GFP_ATOMIC);
+	INIT_LIST_HEAD(&gic->lru);
+	gic->count = 0;
+	gic->max_count = DEF_GC_ICACHE_MAX;
+}
+
+static struct inode *gc_icache_get(struct f3fs_sb_info *sbi, nid_t ino)
+{
+	struct gc_inode_cache *gic = &sbi->gc_icache;
+	struct inode_entry *ie;
+	struct inode *inode = NULL;
+
+	if (!READ_ONCE(gic->count))
+		return NULL;
+
+	spin_lock(&gic->lock);
+	ie = radix_tree_lookup(&gic->iroot, ino);
+	if (ie) {
+		inode = ie->inode;
+		ihold(inode);
+		list_move_tail(&ie->list, &gic->lru);
+	}
+	spin_unlock(&gic->lock);
+	return inode;
+}
+
+/* caller must hold gic->lock */
+static unsigned long gc_icache_isolate(struct gc_inode_cache *gic,
+				unsigned long nr, struct list_head *dispose)
+{
+	struct inode_entry *ie, *next_ie;
+	unsigned long isolated = 0;
+
+	list_for_each_entry_safe(ie, next_ie, &gic->lru, list) {
+		if (isolated >= nr)
+			break;
+		radix_tree_delete(&gic->iroot, ie->inode->i_ino);
+		list_move_tail(&ie->list, dispose);
+		gic->count--;
+		isolated++;
+	}
+	return isolated;
+}
+
+static void gc_icache_dispose(struct list_head *dispose)
+{
+	struct inode_entry *ie, *next_ie;
+
+	list_for_each_entry_safe(ie, next_ie, dispose, list) {
+		list_del(&ie->list);
+		iput(ie->inode);
+		kmem_cache_free(f3fs_inode_entry_slab, ie);
+	}
+}
+
+/* hand the references held by @gc_list over to the cache */
+static void gc_icache_put(struct f3fs_sb_info *sbi,
+				struct gc_inode_list *gc_list)
+{
+	struct gc_inode_cache *gic = &sbi->gc_icache;
+	struct inode_entry *ie, *next_ie;
+	LIST_HEAD(dispose);
+	LIST_HEAD(added);
+	unsigned int over;
+
+	list_for_each_entry_safe(ie, next_ie, &gc_list->ilist, list) {
+		struct inode *inode = ie->inode;
+
+		radix_tree_delete(&gc_list->iroot, inode->i_ino);
+
+		if (!READ_ONCE(gic->max_count) || !inode->i_nlink ||
+				is_bad_inode(inode) ||
+				is_sbi_flag_set(sbi, SBI_IS_CLOSE) ||
+				radix_tree_preload(GFP_NOFS)) {
+			list_move_tail(&ie->list, &dispose);
+			continue;
+		}
+
+		spin_lock(&gic->lock);
+		if (radix_tree_insert(&gic->iroot, inode->i_ino, ie)) {
+			list_move_tail(&ie->list, &dispose);
+		} else {
+			list_move_tail(&ie->list, &gic->lru);
+			gic->count++;
+		}
+		spin_unlock(&gic->lock);
+		radix_tree_preload_end();
+	}
+
+	/*
+	 * Pairs with the barrier in f3fs_gc_icache_forget(): either it sees
+	 * the inode cached, or we see the link count it dropped.
+	 */
+	smp_mb();
+
+	spin_lock(&gic->lock);
+	list_for_each_entry_safe(ie, next_ie, &gic->lru, list) {
+		if (ie->inode->i_nlink)
+			continue;
+		radix_tree_delete(&gic->iroot, ie->inode->i_ino);
+		list_move_tail(&ie->list, &dispose);
+		gic->count--;
+	}
+	over = gic->count > gic->max_count ? gic->count - gic->max_count : 0;
+	if (over)
+		gc_icache_isolate(gic, over, &dispose);
+	spin_unlock(&gic->lock);
+
+	gc_icache_dispose(&dispose);
+}
+
+void f3fs_gc_icache_forget(struct f3fs_sb_info *sbi, struct inode *inode)
+{
+	struct gc_inode_cache *gic = &sbi->gc_icache;
+	struct inode_entry *ie;
+
+	/* pairs with the barrier in gc_icache_put() */
+	smp_mb();
+	if (!READ_ONCE(gic->count))
+		return;
+
+	spin_lock(&gic->lock);
+	ie = radix_tree_lookup(&gic->iroot, inode->i_ino);
+	if (ie && ie->inode == inode) {
+		radix_tree_delete(&gic->iroot, inode->i_ino);
+		list_del(&ie->list);
+		gic->count--;
+	} else {
+		ie = NULL;
+	}
+	spin_unlock(&gic->lock);
+
+	if (ie) {
+		/* the caller still holds its own reference */
+		iput(inode);
+		kmem_cache_free(f3fs_inode_entry_slab, ie);
+	}
+}
+
+unsigned long f3fs_count_gc_icache(struct f3fs_sb_info *sbi)
+{
+	return READ_ONCE(sbi->gc_icache.count);
+}
+
+unsigned long f3fs_shrink_gc_icache(struct f3fs_sb_info *sbi,
+						unsigned long nr_shrink)
+{
+	struct gc_inode_cache *gic = &sbi->gc_icache;
+	unsigned long freed;
+	LIST_HEAD(dispose);
+
+	if (!READ_ONCE(gic->count))
+		return 0;
+
+	spin_lock(&gic->lock);
+	freed = gc_icache_isolate(gic, nr_shrink, &dispose);
+	spin_unlock(&gic->lock);
+
+	gc_icache_dispose(&dispose);
+	return freed;
+}
+
+int f3fs_init_gc_attr(struct f3fs_sb_info *sbi)
+{
+	spin_lock_init(&sbi->gc_css_lock);
+	sbi->gc_css = NULL;
+	sbi->gc_cgroup = NULL;
+
+	sbi->gc_attr = alloc_percpu(struct gc_attr_table);
+	if (!sbi->gc_attr)
+		return -ENOMEM;
+	return 0;
+}
+
+void f3fs_destroy_gc_attr(struct f3fs_sb_info *sbi)
+{
+	f3fs_set_gc_cgroup(sbi, NULL);
+	free_percpu(sbi->gc_attr);
+	sbi->gc_attr = NULL;
+}
+
+/*
+ * Charge GC I/O to the cgroup at @path on the default hierarchy rather than
+ * to the root, so that iocost weighs it by that cgroup's io.weight.  NULL,
+ * "" or "/" go back to the root.
+ */
+int f3fs_set_gc_cgroup(struct f3fs_sb_info *sbi, const char *path)
+{
+	struct cgroup_subsys_state *css = NULL, *old;
+	char *name = NULL;
+
+	if (path && *path && strcmp(path, "/")) {
+#ifdef CONFIG_BLK_CGROUP
+		struct cgroup *cgrp = cgroup_get_from_path(path);
+
+		if (IS_ERR(cgrp))
+			return PTR_ERR(cgrp);
+		css = cgroup_get_e_css(cgrp, &io_cgrp_subsys);
+		cgroup_put(cgrp);
+
+		name = kstrdup(path, GFP_KERNEL);
+		if (!name) {
+			css_put(css);
+			return -ENOMEM;
+		}
+#else
+		return -EOPNOTSUPP;
+#endif
+	}
+
+	spin_lock(&sbi->gc_css_lock);
+	old = sbi->gc_css;
+	sbi->gc_css = css;
+	swap(name, sbi->gc_cgroup);
+	spin_unlock(&sbi->gc_css_lock);
+
+	if (old)
+		css_put(old);
+	kfree(name);
+	return 0;
+}
+
+static u64 gc_attr_cgroup(struct inode *inode)
+{
+	u64 cgroup = 0;
+#ifdef CONFIG_CGROUP_WRITEBACK
+	struct bdi_writeback *wb;
+
+	/* wb can be switched under us, but it is freed after a grace period */
+	rcu_read_lock();
+	wb = READ_ONCE(inode->i_wb);
+	if (wb && wb->memcg_css)
+		cgroup = cgroup_ino(wb->memcg_css->cgroup);
+	rcu_read_unlock();
+#endif
+	return cgroup;
+}
+
+static void gc_attr_account(struct f3fs_sb_info *sbi, nid_t ino, u64 cgroup)
+{
+	struct gc_attr_table *table = get_cpu_ptr(sbi->gc_attr);
+	unsigned int hash = hash_32(ino, GC_ATTR_HASH_BITS);
+	struct gc_attr_entry *e, *stale = NULL;
+	int i;
+
+	for (i = 0; i < GC_ATTR_MAX_PROBE; i++) {
+		e = &table->entries[hash];
+
+		if (!e->ino || e->ino == ino)
+			goto found;
+		if (!stale || time_before(e->last, stale->last))
+			stale = e;
+		hash = (hash + 1) & (GC_ATTR_HASH_SIZE - 1);
+	}
+
+	/*
+	 * Inodes come and go, so make room by evicting the entry charged
+	 * least recently and keep its blocks in others.
+	 */
+	e = stale;
+	WRITE_ONCE(table->others, table->others + e->blocks);
+	WRITE_ONCE(e->ino, 0);
+	WRITE_ONCE(e->cgroup, 0);
+	WRITE_ONCE(e->blocks, 0);
+found:
+	if (!e->ino)
+		WRITE_ONCE(e->ino, ino);
+	/* node blocks don't know the cgroup of their owner */
+	if (cgroup)
+		WRITE_ONCE(e->cgroup, cgroup);
+	WRITE_ONCE(e->blocks, e->blocks + 1);
+	e->last = jiffies;
+	put_cpu_ptr(sbi->gc_attr);
+}
+
+static int gc_attr_cmp_ino(const void *a, const void *b)
+{
+	const struct gc_attr_entry *ea = a, *eb = b;
+
+	if (ea->ino != eb->ino)
+		return ea->ino < eb->ino ? -1 : 1;
+	return 0;
+}
+
+static int gc_attr_cmp_cgroup(const void *a, const void *b)
+{
+	const struct gc_attr_entry *ea = a, *eb = b;
+
+	if (ea->cgroup != eb->cgroup)
+		return ea->cgroup < eb->cgroup ? -1 : 1;
+	return 0;
+}
+
+static int gc_attr_cmp_blocks(const void *a, const void *b)
+{
+	const struct gc_attr_entry *ea = a, *eb = b;
+
+	if (ea->blocks != eb->blocks)
+		return ea->blocks > eb->blocks ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Sort @entries by @cmp_key and fold the ones having the same key together,
+ * then return the # of remaining entries sorted by migrated blocks.
+ */
+static int gc_attr_merge(struct gc_attr_entry *entries, int count,
+			int (*cmp_key)(const void *, const void *))
+{
+	int i, merged = 0;
+
+	if (!count)
+		return 0;
+
+	sort(entries, count, sizeof(*entries), cmp_key, NULL);
+	for (i = 1; i < count; i++) {
+		if (!cmp_key(&entries[merged], &entries[i])) {
+			entries[merged].blocks += entries[i].blocks;
+			/* node block charges carry no cgroup */
+			if (!entries[merged].cgroup)
+				entries[merged].cgroup = entries[i].cgroup;
+			continue;
+		}
+		entries[++merged] = entries[i];
+	}
+	merged++;
+	sort(entries, merged, sizeof(*entries), gc_attr_cmp_blocks, NULL);
+	return merged;
+}
+
+int f3fs_gc_attr_seq_show(struct seq_file *seq, void *offset)
+{
+	struct super_block *sb = seq->private;
+	struct f3fs_sb_info *sbi = F3FS_SB(sb);
+	struct gc_attr_entry *entries;
+	u64 total = 0, others = 0;
+	int count = 0, nr, i, cpu;
+
+	entries = f3fs_kvzalloc(sbi, array_size(num_possible_cpus(),
+			GC_ATTR_HASH_SIZE * sizeof(*entries)), GFP_KERNEL);
+	if (!entries)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct gc_attr_table *table = per_cpu_ptr(sbi->gc_attr, cpu);
+
+		for (i = 0; i < GC_ATTR_HASH_SIZE; i++) {
+			struct gc_attr_entry *e = &table->entries[i];
+
+			if (!READ_ONCE(e->ino))
+				continue;
+			entries[count].ino = READ_ONCE(e->ino);
+			entries[count].cgroup = READ_ONCE(e->cgroup);
+			entries[count].blocks = READ_ONCE(e->blocks);
+			total += entries[count].blocks;
+			count++;
+		}
+		others += READ_ONCE(table->others);
+	}
+
+	seq_printf(seq, "GC migrated blocks: %llu (unattributed: %llu)\n",
+						total + others, others);
+
+	seq_puts(seq, "\ntop inodes:\n");
+	seq_printf(seq, "%-12s %-12s %-12s\n", "ino", "cgroup", "blocks");
+	count = gc_attr_merge(entries, count, gc_attr_cmp_ino);
+	nr = min(count, GC_ATTR_TOP_N);
+	for (i = 0; i < nr; i++)
+		seq_printf(seq, "%-12u %-12llu %-12llu\n", entries[i].ino,
+				entries[i].cgroup, entries[i].blocks);
+
+	seq_puts(seq, "\ntop cgroups:\n");
+	seq_printf(seq, "%-12s %-12s\n", "cgroup", "blocks");
+	count = gc_attr_merge(entries, count, gc_attr_cmp_cgroup);
+	nr = min(count, GC_ATTR_TOP_N);
+	for (i = 0; i < nr; i++)
+		seq_printf(seq, "%-12llu %-12llu\n", entries[i].cgroup,
+							entries[i].blocks);
+
+	kvfree(entries);
+	return 0;
+}
+
 static int check_valid_map(struct f3fs_sb_info *sbi,
 				unsigned int segno, int offset)
 {
@@ -1201,6 +1817,10 @@ static int gc_node_segment(struct f3fs_sb_info *sbi,
 		if (gc_type == BG_GC && has_not_enough_free_secs(sbi, 0, 0))
 			return submitted;
 
+		/* or if foreground requests came back */
+		if (bg_gc_preempted(sbi, gc_type))
+			return submitted;
+
 		if (check_valid_map(sbi, segno, off) == 0)
 			continue;
 
@@ -1239,6 +1859,8 @@ static int gc_node_segment(struct f3fs_sb_info *sbi,
 		err = f3fs_move_node_page(node_page, gc_type);
 		if (!err && gc_type == FG_GC)
 			submitted++;
+		if (!err)
+			gc_attr_account(sbi, ni.ino, 0);
 		stat_inc_node_blk_count(sbi, 1, gc_type);
 	}
 
@@ -1425,7 +2047,7 @@ static int ra_data_block(struct inode *inode, pgoff_t index)
  * This can be used to move blocks, aka LBAs, directly on disk.
  */
 static int move_data_block(struct inode *inode, block_t bidx,
-				int gc_type, unsigned int segno, int off)
+		int gc_type, unsigned int segno, int off, char dst_hint)
 {
 	struct f3fs_io_info fio = {
 		.sbi = F3FS_I_SB(inode),
@@ -1446,9 +2068,14 @@ static int move_data_block(struct inode *inode, block_t bidx,
 	block_t newaddr;
 	int err = 0;
 	bool lfs_mode = f3fs_lfs_mode(fio.sbi);
-	int type = fio.sbi->am.atgc_enabled && (gc_type == BG_GC) &&
-				(fio.sbi->gc_mode != GC_URGENT_HIGH) ?
-				CURSEG_ALL_DATA_ATGC : CURSEG_COLD_DATA;
+	int type = CURSEG_COLD_DATA;
+
+	/* a GC worker appends to its own log, ATGC or not */
+	if (dst_hint >= 0) {
+		type = CURSEG_COLD_GC_DATA_START + dst_hint;
+		fio.temp = COLD_GC_START + dst_hint;
+		fio.dst_hint = dst_hint;
+	}
 
 	/* do not read out */
 	page = f3fs_grab_cache_page(inode->i_mapping, bidx, false);
@@ -1491,8 +2118,9 @@ static int move_data_block(struct inode *inode, block_t bidx,
 	fio.page = page;
 	fio.new_blkaddr = fio.old_blkaddr = dn.data_blkaddr;
 
+	/* only blocks appended to the same log need to stay in order */
 	if (lfs_mode)
-		f3fs_down_write(&fio.sbi->io_order_lock);
+		f3fs_down_write(&CURSEG_I(fio.sbi, type)->io_order_lock);
 
 	mpage = f3fs_grab_cache_page(META_MAPPING(fio.sbi),
 					fio.old_blkaddr, false);
@@ -1578,7 +2206,7 @@ static int move_data_block(struct inode *inode, block_t bidx,
 							true, true, true);
 up_out:
 	if (lfs_mode)
-		f3fs_up_write(&fio.sbi->io_order_lock);
+		f3fs_up_write(&CURSEG_I(fio.sbi, type)->io_order_lock);
 put_out:
 	f3fs_put_dnode(&dn);
 out:
@@ -1587,7 +2215,7 @@ static int move_data_block(struct inode *inode, block_t bidx,
 }
 static int move_data_page2(struct inode *inode, block_t bidx, int gc_type,
               unsigned int segno, int off, char dst_hint, struct page* gc_buf,
-              block_t old_blkaddr)
+              block_t old_blkaddr, block_t *new_blkaddr)
 {
   struct page *page;
   int err = 0;
@@ -1608,6 +2236,8 @@ static int move_data_page2(struct inode *inode, block_t bidx, int gc_type,
     .inode = inode,
   };
 
+  *new_blkaddr = NULL_ADDR;
+
   if (!check_valid_map(F3FS_I_SB(inode), segno, off)) {
     lock_page(gc_buf);
     unlock_page(gc_buf);
@@ -1627,12 +2257,15 @@ static int move_data_page2(struct inode *inode, block_t bidx, int gc_type,
     return err;
   }
   lock_page(gc_buf);
+  ClearPageError(gc_buf);
 retry:
 
   err = f3fs_do_write_data_page2(&fio, bidx);
   if (err == -ENOMEM) {
     goto retry;
   }
+  if (!err)
+    *new_blkaddr = fio.new_blkaddr;
   return err;
 }
 
@@ -1662,6 +2295,9 @@ static int move_data_page(struct inode *inode, block_t bidx, int gc_type,
 		}
 		set_page_dirty(page);
 		set_page_private_gcing(page);
+		/* writeback sends it to this worker's log */
+		if (dst_hint >= 0)
+			WRITE_ONCE(F3FS_I(inode)->i_gc_log, dst_hint + 1);
 	} else {
 		struct f3fs_io_info fio = {
 			.sbi = F3FS_I_SB(inode),
@@ -1707,6 +2343,75 @@ static int move_data_page(struct inode *inode, block_t bidx, int gc_type,
 	return err;
 }
 
+/*
+ * A direct copy reads the block around the page cache and remaps it only
+ * while the node still points at the old address, which relies on every
+ * rewrite in LFS mode moving the block.  Adaptive IPU lets LFS mode
+ * overwrite in place, so such inodes go through the page cache instead.
+ */
+static bool gc_may_copy_direct(struct f3fs_sb_info *sbi)
+{
+	return !(f3fs_lfs_mode(sbi) &&
+		SM_I(sbi)->ipu_policy & (0x1 << F3FS_IPU_ADAPTIVE));
+}
+
+/*
+ * Remember a direct GC copy for the reclaim journal.  @page stays pinned
+ * until gc_reclaim_segment() has seen its write complete.  A copy that
+ * doesn't fit is left out, which keeps the segment from being reclaimed.
+ */
+static void gc_reclaim_add(struct f3fs_sb_info *sbi,
+			struct gc_reclaim_batch *rb,
+			struct f3fs_summary *entry, block_t old_blkaddr,
+			block_t new_blkaddr, struct page *page)
+{
+	struct gc_reclaim_entry *e;
+
+	if (!__is_valid_data_blkaddr(new_blkaddr) ||
+			rb->nr >= sbi->blocks_per_seg) {
+		put_page(page);
+		return;
+	}
+
+	e = &rb->entries[rb->nr++];
+	e->nid = le32_to_cpu(entry->nid);
+	e->ofs_in_node = le16_to_cpu(entry->ofs_in_node);
+	e->old_blkaddr = old_blkaddr;
+	e->new_blkaddr = new_blkaddr;
+	e->page = page;
+}
+
+/*
+ * Wait for the copies in @rb and, if they emptied the victim, let the
+ * reclaim journal hand it back without waiting for a checkpoint.
+ */
+static void gc_reclaim_segment(struct f3fs_sb_info *sbi,
+				struct gc_reclaim_batch *rb)
+{
+	bool freed = get_valid_blocks(sbi, rb->segno, false) == 0;
+	int i;
+
+	if (!rb->nr)
+		return;
+
+	f3fs_submit_merged_write(sbi, DATA);
+	for (i = 0; i < rb->nr; i++) {
+		struct page *page = rb->entries[i].page;
+
+		/* end_io unlocks the copy, and flags it if the write failed */
+		lock_page(page);
+		if (PageError(page))
+			freed = false;
+		unlock_page(page);
+		put_page(page);
+	}
+
+	/* a failed copy leaves the segment to the next checkpoint */
+	if (freed && !f3fs_cp_error(sbi))
+		f3fs_commit_reclaim(sbi, rb);
+	rb->nr = 0;
+}
+
 /*
  * This function tries to get parent node of victim data block, and identifies
  * data block validity. If the block is valid, copy that with cold status and
@@ -1716,7 +2421,7 @@ static int move_data_page(struct inode *inode, block_t bidx, int gc_type,
  */
 static int gc_data_segment(struct f3fs_sb_info *sbi, struct f3fs_summary *sum,
 		struct gc_inode_list *gc_list, unsigned int segno, int gc_type,
-		bool force_migrate, char dst_hint)
+		bool force_migrate, char dst_hint, struct gc_reclaim_batch *rb)
 {
 	struct super_block *sb = sbi->sb;
 	struct f3fs_summary *entry;
@@ -1750,8 +2455,9 @@ static int gc_data_segment(struct f3fs_sb_info *sbi, struct f3fs_summary *sum,
 		 */
 		if ((gc_type == BG_GC && has_not_enough_free_secs(sbi, 0, 0)) ||
 			(!force_migrate && get_valid_blocks(sbi, segno, true) ==
-							CAP_BLKS_PER_SEC(sbi)))
-			return submitted;
+							CAP_BLKS_PER_SEC(sbi)) ||
+			bg_gc_preempted(sbi, gc_type))
+			goto out;
 
 		if (check_valid_map(sbi, segno, off) == 0)
 			continue;
@@ -1781,7 +2487,9 @@ static int gc_data_segment(struct f3fs_sb_info *sbi, struct f3fs_summary *sum,
 		if (phase == 3) {
 			int err;
 
-			inode = f3fs_iget(sb, dni.ino);
+			inode = gc_icache_get(sbi, dni.ino);
+			if (!inode)
+				inode = f3fs_iget(sb, dni.ino);
 			if (IS_ERR(inode) || is_bad_inode(inode) ||
 					special_file(inode->i_mode))
 				continue;
@@ -1789,7 +2497,7 @@ static int gc_data_segment(struct f3fs_sb_info *sbi, struct f3fs_summary *sum,
 			err = f3fs_gc_pinned_control(inode, gc_type, segno);
 			if (err == -EAGAIN) {
 				iput(inode);
-				return submitted;
+				goto out;
 			}
 
 			start_bidx = f3fs_start_bidx_of_node(nofs, inode) +
@@ -1818,7 +2526,9 @@ static int gc_data_segment(struct f3fs_sb_info *sbi, struct f3fs_summary *sum,
 				continue;
 			}
 
-      gc_buf[off] = f3fs_get_read_data_page_without_cache(inode, start_bidx, REQ_RAHEAD, true);
+      if (gc_may_copy_direct(sbi))
+        gc_buf[off] = f3fs_get_read_data_page_without_cache(inode,
+            start_bidx, REQ_RAHEAD, true);
       if (!gc_buf[off]) {
 			data_page = f3fs_get_read_data_page(inode,
 						start_bidx, REQ_RAHEAD, true);
@@ -1868,13 +2578,35 @@ static int gc_data_segment(struct f3fs_sb_info *sbi, struct f3fs_summary *sum,
 				/* wait for all inflight aio data */
 				inode_dio_wait(inode);
 			}
-			if (f3fs_post_read_required(inode))
-				err = move_data_block(inode, start_bidx,
-							gc_type, segno, off);
-			else {
-        if (gc_buf[off]) {
-          move_data_page2(inode, start_bidx, gc_type, segno, off, dst_hint,
-            gc_buf[off], expected_blkaddr);
+			if (f3fs_post_read_required(inode)) {
+				err = -EAGAIN;
+				/* cold data that outlived GC can pack tighter */
+				if (gc_type == BG_GC &&
+					IS_COLD(get_seg_entry(sbi, segno)->type) &&
+					f3fs_gc_may_recompress(inode)) {
+					if (dst_hint >= 0)
+						WRITE_ONCE(F3FS_I(inode)->i_gc_log,
+								dst_hint + 1);
+					err = f3fs_gc_recompress_cluster(inode,
+								start_bidx);
+				}
+				if (err == -EAGAIN)
+					err = move_data_block(inode, start_bidx,
+						gc_type, segno, off, dst_hint);
+			} else {
+        /* the policy may have changed since phase 3 read the block */
+        if (gc_buf[off] && gc_may_copy_direct(sbi)) {
+          block_t new_blkaddr;
+
+          if (rb)
+            get_page(gc_buf[off]);
+          err = move_data_page2(inode, start_bidx, gc_type, segno, off,
+            dst_hint, gc_buf[off], expected_blkaddr, &new_blkaddr);
+          if (rb && !err)
+            gc_reclaim_add(sbi, rb, entry, expected_blkaddr, new_blkaddr,
+                gc_buf[off]);
+          else if (rb)
+            put_page(gc_buf[off]);
           gc_buf[off] = NULL;
         } else {
 				err = move_data_page(inode, start_bidx, gc_type,
@@ -1885,6 +2617,9 @@ static int gc_data_segment(struct f3fs_sb_info *sbi, struct f3fs_summary *sum,
 			if (!err && (gc_type == FG_GC ||
 					f3fs_post_read_required(inode)))
 				submitted++;
+			if (!err)
+				gc_attr_account(sbi, inode->i_ino,
+						gc_attr_cgroup(inode));
 
 			if (locked) {
 				f3fs_up_write_range3(range_w);
@@ -1898,6 +2633,7 @@ static int gc_data_segment(struct f3fs_sb_info *sbi, struct f3fs_summary *sum,
 	if (++phase < 5)
 		goto next_step;
 
+out:
   for (int i = 0 ; i < 512; i++) {
     if (gc_buf[i]) {
       lock_page(gc_buf[i]);
@@ -1937,7 +2673,8 @@ static int __get_victim(struct f3fs_sb_info *sbi, unsigned int *victim,
         }
 
         if (!test_bit(candidate, dirty_bitmap)) {
-          clear_bit(candidate, dirty_i->victim_secmap);
+          clear_bit(GET_SEC_FROM_SEG(sbi, candidate),
+              dirty_i->victim_secmap);
           continue;
         }
 
@@ -1978,7 +2715,8 @@ static int __get_victim(struct f3fs_sb_info *sbi, unsigned int *victim,
 static int do_garbage_collect(struct f3fs_sb_info *sbi,
 				unsigned int start_segno,
 				struct gc_inode_list *gc_list, int gc_type,
-				bool force_migrate, char dst_hint)
+				bool force_migrate, char dst_hint,
+				struct gc_reclaim_batch *rb)
 {
 	struct page *sum_page;
 	struct f3fs_summary_block *sum;
@@ -2066,7 +2804,7 @@ static int do_garbage_collect(struct f3fs_sb_info *sbi,
 		else
 			submitted += gc_data_segment(sbi, sum->entries, gc_list,
 							segno, gc_type,
-							force_migrate, dst_hint);
+							force_migrate, dst_hint, rb);
 
 		stat_inc_seg_count(sbi, type, gc_type);
 		sbi->gc_reclaimed_segs[sbi->gc_mode]++;
@@ -2106,7 +2844,9 @@ int do_gc(struct f3fs_sb_info *sbi, struct f3fs_gc_control *gc_control, char wor
 		.iroot = RADIX_TREE_INIT(gc_list.iroot, GFP_NOFS),
 	};
 	unsigned int skipped_round = 0, round = 0;
-  
+	unsigned int vblocks;
+	struct gc_reclaim_batch *rb = NULL;
+
 	trace_f3fs_gc_begin(sbi->sb, gc_type, gc_control->no_bg_gc,
 				gc_control->nr_free_secs,
 				get_pages(sbi, F3FS_DIRTY_NODES),
@@ -2119,6 +2859,14 @@ int do_gc(struct f3fs_sb_info *sbi, struct f3fs_gc_control *gc_control, char wor
 
 	cpc.reason = __get_cp_reason(sbi);
 	sbi->skipped_gc_rwsem = 0;
+
+	/*
+	 * Without it, freed victims just wait for the next checkpoint.  A
+	 * batch covers one segment, so large sections can't use it.
+	 */
+	if (sbi->reclaim_journal && !__is_large_section(sbi))
+		rb = f3fs_kvzalloc(sbi, struct_size(rb, entries,
+					sbi->blocks_per_seg), GFP_NOFS);
 gc_more:
 	if (unlikely(!(sbi->sb->s_flags & SB_ACTIVE))) {
 		ret = -EINVAL;
@@ -2128,6 +2876,8 @@ int do_gc(struct f3fs_sb_info *sbi, struct f3fs_gc_control *gc_control, char wor
 		ret = -EIO;
 		goto stop;
 	}
+	if (bg_gc_preempted(sbi, gc_type))
+		goto stop;
 
 	if (gc_type == BG_GC && has_not_enough_free_secs(sbi, 0, 0)) {
 		/*
@@ -2136,9 +2886,9 @@ int do_gc(struct f3fs_sb_info *sbi, struct f3fs_gc_control *gc_control, char wor
 		 * secure free segments which doesn't need fggc any more.
 		 */
     if (prefree_segments(sbi)) {
-      mutex_lock(&sbi->gc_internal_cp);
+      f3fs_lock_gc_cp(sbi);
       ret = f3fs_write_checkpoint(sbi, &cpc);
-      mutex_unlock(&sbi->gc_internal_cp);
+      f3fs_unlock_gc_cp(sbi);
       if (ret)
         goto stop;
     }
@@ -2163,8 +2913,18 @@ int do_gc(struct f3fs_sb_info *sbi, struct f3fs_gc_control *gc_control, char wor
 		goto stop;
 	}
 
+	if (rb) {
+		rb->segno = segno;
+		rb->nr = 0;
+	}
+	vblocks = get_valid_blocks(sbi, segno, true);
 	seg_freed = do_garbage_collect(sbi, segno, &gc_list, gc_type,
-				gc_control->should_migrate_blocks, worker_idx);
+				gc_control->should_migrate_blocks, worker_idx, rb);
+	if (seg_freed >= 0)
+		f3fs_update_adaptive_ipu(sbi, vblocks,
+				CAP_BLKS_PER_SEC(sbi) - vblocks);
+	if (rb)
+		gc_reclaim_segment(sbi, rb);
   //printk("%s victim cleand? %d %d", current->comm, segno, get_valid_blocks(sbi, segno, false));
 	total_freed += seg_freed;
 
@@ -2195,25 +2955,26 @@ int do_gc(struct f3fs_sb_info *sbi, struct f3fs_gc_control *gc_control, char wor
 		round++;
 		if (skipped_round > MAX_SKIP_GC_COUNT &&
 				skipped_round * 2 >= round) {
-      mutex_lock(&sbi->gc_internal_cp);
+      f3fs_lock_gc_cp(sbi);
 			ret = f3fs_write_checkpoint(sbi, &cpc);
-      mutex_unlock(&sbi->gc_internal_cp);
+      f3fs_unlock_gc_cp(sbi);
 			goto stop;
 		}
 	}
 
 	/* Write checkpoint to reclaim prefree segments */
-	if (free_sections(sbi) < NR_CURSEG_PERSIST_TYPE &&
+	if (free_sections(sbi) < NR_PERSIST_LOG(sbi) &&
 				prefree_segments(sbi)) {
-    mutex_lock(&sbi->gc_internal_cp);
-    if (free_sections(sbi) < NR_CURSEG_PERSIST_TYPE &&
+    f3fs_lock_gc_cp(sbi);
+    if (free_sections(sbi) < NR_PERSIST_LOG(sbi) &&
         prefree_segments(sbi)) {
       ret = f3fs_write_checkpoint(sbi, &cpc);
       if (ret) {
+        f3fs_unlock_gc_cp(sbi);
         goto stop;
       }
     }
-    mutex_unlock(&sbi->gc_internal_cp);
+    f3fs_unlock_gc_cp(sbi);
 	}
 go_gc_more:
 	segno = NULL_SEGNO;
@@ -2235,7 +2996,8 @@ int do_gc(struct f3fs_sb_info *sbi, struct f3fs_gc_control *gc_control, char wor
 				reserved_segments(sbi),
 				prefree_segments(sbi));
 
-	put_gc_inode(&gc_list);
+	gc_icache_put(sbi, &gc_list);
+	kvfree(rb);
 
 	if (gc_control->err_gc_skipped && !ret)
 		ret = atomic_read(&gc_control->freed) ? 0 : -EAGAIN;
@@ -2243,18 +3005,87 @@ int do_gc(struct f3fs_sb_info *sbi, struct f3fs_gc_control *gc_control, char wor
 
 }
 
+/*
+ * A worker left out of a round gives back the victims it cached, so other
+ * workers and the next selection can pick those sections again.
+ */
+static void release_cached_victims(struct f3fs_sb_info *sbi,
+						unsigned int *victims)
+{
+	struct dirty_seglist_info *dirty_i = DIRTY_I(sbi);
+	int i;
+
+	mutex_lock(&dirty_i->seglist_lock);
+	for (i = 0; i < VICTIM_COUNT; i++) {
+		if (victims[i] == NULL_SEGNO)
+			continue;
+		clear_bit(GET_SEC_FROM_SEG(sbi, victims[i]),
+					dirty_i->victim_secmap);
+		victims[i] = NULL_SEGNO;
+	}
+	mutex_unlock(&dirty_i->seglist_lock);
+}
+
+/*
+ * How many workers to wake for this round.  GC bios are not issued on behalf
+ * of any task, so iocost can only throttle them after the fact; background GC
+ * rather follows its feedback: whenever the device misses its QoS targets or
+ * the GC cgroup runs into debt, the number of workers is halved, and while
+ * the device keeps up one is added back.  Foreground GC always gets all of
+ * them since writers are waiting for the space.
+ */
+static int gc_nr_workers(struct f3fs_sb_info *sbi,
+				struct f3fs_gc_control *gc_control)
+{
+	struct f3fs_gc_kthread *gc_th = sbi->gc_thread;
+	struct cgroup_subsys_state *css;
+	struct blk_iocost_feedback fb;
+	unsigned int nr = gc_th->gc_active_workers;
+	int err;
+
+	if (gc_control->init_gc_type != BG_GC || !gc_th->gc_iocost)
+		return sbi->num_gc_thread;
+
+	spin_lock(&sbi->gc_css_lock);
+	css = sbi->gc_css;
+	if (css)
+		css_get(css);
+	spin_unlock(&sbi->gc_css_lock);
+
+	err = blk_iocost_feedback(bdev_get_queue(sbi->sb->s_bdev), css, &fb);
+	if (css)
+		css_put(css);
+	if (err)
+		return sbi->num_gc_thread;
+
+	if (fb.busy_level > 0 || fb.debt_us > gc_th->gc_iocost_debt_us) {
+		nr = max(nr / 2, 1U);
+		gc_th->gc_iocost_backoffs++;
+	} else {
+		nr = min_t(unsigned int, nr + 1, sbi->num_gc_thread);
+	}
+	gc_th->gc_active_workers = nr;
+	gc_th->gc_iocost_vrate = fb.vrate_pct;
+	return nr;
+}
+
 int f3fs_gc(struct f3fs_sb_info *sbi, struct f3fs_gc_control *gc_control)
 {
   int ret = 0;
 
   if (sbi->gc_thread) {
-    for (int i = 0 ; i < sbi->num_gc_thread ; i++) {
+    int nr_workers = gc_nr_workers(sbi, gc_control);
+
+    for (int i = 0 ; i < nr_workers ; i++) {
       atomic_set(&gc_control->freed, 0);
       sbi->gc_thread->worker_args[i].gc_control = gc_control;
       sbi->gc_thread->worker_args[i].state = 1;
       wake_up(&sbi->gc_thread->worker_args[i].wq);
     }
-    for (int i = 0 ; i < sbi->num_gc_thread ; i++) {
+    for (int i = nr_workers ; i < sbi->num_gc_thread ; i++)
+      release_cached_victims(sbi,
+          sbi->gc_thread->worker_args[i].multiple_victim);
+    for (int i = 0 ; i < nr_workers ; i++) {
       int local_ret;
       while (sbi->gc_thread->worker_args[i].state == 1) {
         wait_event_interruptible_timeout(sbi->gc_thread->worker_args[i].caller_wq,
@@ -2322,6 +3153,17 @@ void f3fs_build_gc_manager(struct f3fs_sb_info *sbi)
 				GET_SEGNO(sbi, FDEV(0).end_blk) + 1;
 
 	init_atgc_management(sbi);
+	init_gc_icache(sbi);
+
+	/*
+	 * The journal tracks one segment per record, and only images that
+	 * carry the feature tell older code its records may be live.
+	 */
+	sbi->reclaim_journal = f3fs_sb_has_reclaim_journal(sbi) &&
+					!__is_large_section(sbi);
+	sbi->rj_blkoff = 0;
+	sbi->rj_seq = 0;
+	sbi->rj_reclaimed_segs = 0;
 }
 
 static int free_segment_range(struct f3fs_sb_info *sbi,
@@ -2350,7 +3192,8 @@ static int free_segment_range(struct f3fs_sb_info *sbi,
 
 	/* Move out cursegs from the target range */
 	for (type = CURSEG_HOT_DATA; type < NR_CURSEG_PERSIST_TYPE; type++)
-		f3fs_allocate_segment_for_resize(sbi, type, start, end);
+		if (curseg_in_use(sbi, type))
+			f3fs_allocate_segment_for_resize(sbi, type, start, end);
 
 	/* do GC to move out valid blocks in the range */
 	for (segno = start; segno <= end; segno += sbi->segs_per_sec) {
@@ -2359,7 +3202,7 @@ static int free_segment_range(struct f3fs_sb_info *sbi,
 			.iroot = RADIX_TREE_INIT(gc_list.iroot, GFP_NOFS),
 		};
 
-		do_garbage_collect(sbi, segno, &gc_list, FG_GC, true, -1);
+		do_garbage_collect(sbi, segno, &gc_list, FG_GC, true, -1, NULL);
 		put_gc_inode(&gc_list);
 
 		if (!gc_only && get_valid_blocks(sbi, segno, true)) {
@@ -2378,7 +3221,7 @@ static int free_segment_range(struct f3fs_sb_info *sbi,
 	if (err)
 		goto out;
 
-	next_inuse = find_next_inuse(FREE_I(sbi), end + 1, start);
+	next_inuse = find_next_inuse(sbi, end + 1, start);
 	if (next_inuse <= end) {
 		f3fs_err(sbi, "segno %u should be free but still inuse!",
 			 next_inuse);
@@ -2499,12 +3342,12 @@ int f3fs_resize_fs(struct f3fs_sb_info *sbi, __u64 block_count)
 	/* stop CP to protect MAIN_SEC in free_segment_range */
 	f3fs_lock_op(sbi);
 
-	spin_lock(&sbi->stat_lock);
+	f3fs_stat_lock(sbi);
 	if (shrunk_blocks + valid_user_blocks(sbi) +
 		sbi->current_reserved_blocks + sbi->unusable_block_count +
 		F3FS_OPTION(sbi).root_reserved_blocks > sbi->user_block_count)
 		err = -ENOSPC;
-	spin_unlock(&sbi->stat_lock);
+	f3fs_stat_unlock(sbi);
 
 	if (err)
 		goto out_unlock;
@@ -2523,14 +3366,14 @@ int f3fs_resize_fs(struct f3fs_sb_info *sbi, __u64 block_count)
 	f3fs_down_write(&sbi->gc_lock);
 	f3fs_down_write(&sbi->cp_global_sem);
 
-	spin_lock(&sbi->stat_lock);
+	f3fs_stat_lock(sbi);
 	if (shrunk_blocks + valid_user_blocks(sbi) +
 		sbi->current_reserved_blocks + sbi->unusable_block_count +
 		F3FS_OPTION(sbi).root_reserved_blocks > sbi->user_block_count)
 		err = -ENOSPC;
 	else
 		sbi->user_block_count -= shrunk_blocks;
-	spin_unlock(&sbi->stat_lock);
+	f3fs_stat_unlock(sbi);
 	if (err)
 		goto out_err;
 
@@ -2561,9 +3404,9 @@ int f3fs_resize_fs(struct f3fs_sb_info *sbi, __u64 block_count)
 		set_sbi_flag(sbi, SBI_NEED_FSCK);
 		f3fs_err(sbi, "resize_fs failed, should run fsck to repair!");
 
-		spin_lock(&sbi->stat_lock);
+		f3fs_stat_lock(sbi);
 		sbi->user_block_count += shrunk_blocks;
-		spin_unlock(&sbi->stat_lock);
+		f3fs_stat_unlock(sbi);
 	}
 out_err:
 	f3fs_up_write(&sbi->cp_global_sem);
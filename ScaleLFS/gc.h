@@ -27,6 +27,16 @@
 
 #define DEF_GC_FAILED_PINNED_FILES	2048
 
+/* # of inodes GC keeps referenced between rounds */
+#define DEF_GC_ICACHE_MAX	256
+
+/* idle prediction for background GC */
+#define DEF_GC_IDLE_MIN_GAP_MS	10	/* shorter gaps belong to a burst */
+#define DEF_GC_IDLE_SLICE_MS	20	/* first guess of one BG round */
+
+/* iocost feedback for background GC */
+#define DEF_GC_IOCOST_DEBT_US	10000	/* 10ms of GC debt is too much */
+
 /* Search max. number of dirty segments to select a victim segment */
 #define DEF_MAX_VICTIM_SEARCH 4096 /* covers 8GB */
 
@@ -63,10 +73,47 @@ struct f3fs_gc_kthread {
 						 * caller of f3fs_balance_fs()
 						 * will wait on this wait queue.
 						 */
+
+	/* for idle prediction */
+	unsigned int idle_predict;		/* fit BG GC into idle gaps */
+	unsigned int slice_ewma_ms;		/* EWMA of one BG GC round */
+	unsigned int idle_skipped;		/* rounds that would not fit */
+	unsigned int idle_preempted;		/* rounds cut by new requests */
+	bool in_slice;				/* BG round of this thread */
+	unsigned long slice_stamp;		/* last request at round start */
+
+	/* for iocost feedback, see gc_nr_workers() */
+	unsigned int gc_iocost;			/* scale BG GC by iocost */
+	unsigned int gc_active_workers;		/* workers woken for BG GC */
+	unsigned int gc_iocost_debt_us;		/* GC debt treated as busy */
+	unsigned int gc_iocost_backoffs;	/* # of times halved */
+	unsigned int gc_iocost_vrate;		/* last vrate seen, in % */
   struct worker_arg* worker_args;
   struct task_struct** gc_workers;
 };
 
+/*
+ * GC cost attribution: every migrated block is charged to its owner inode and
+ * to the cgroup owning that inode's writeback, in per-cpu hash tables which
+ * are only merged when someone reads them out.
+ */
+#define GC_ATTR_HASH_BITS	8
+#define GC_ATTR_HASH_SIZE	(1 << GC_ATTR_HASH_BITS)
+#define GC_ATTR_MAX_PROBE	8	/* evict the stalest entry after that */
+#define GC_ATTR_TOP_N		20	/* # of inodes and cgroups to show */
+
+struct gc_attr_entry {
+	nid_t ino;			/* owner inode, 0 for a free slot */
+	u64 cgroup;			/* cgroup ino of the owner, 0 if unknown */
+	u64 blocks;			/* # of migrated blocks */
+	unsigned long last;		/* jiffies of the last charge */
+};
+
+struct gc_attr_table {
+	struct gc_attr_entry entries[GC_ATTR_HASH_SIZE];
+	u64 others;			/* blocks of evicted entries */
+};
+
 struct gc_inode_list {
 	struct list_head ilist;
 	struct radix_tree_root iroot;
@@ -107,11 +154,11 @@ static inline block_t free_segs_blk_count_zoned(struct f3fs_sb_info *sbi)
 	struct free_segmap_info *free_i = FREE_I(sbi);
 	int j;
 
-	spin_lock(&free_i->segmap_lock);
+	lock_segmap(sbi);
 	for (j = 0; j < MAIN_SEGS(sbi); j++)
 		if (!test_bit(j, free_i->free_segmap))
 			free_seg_blks += f3fs_usable_blks_in_seg(sbi, j);
-	spin_unlock(&free_i->segmap_lock);
+	unlock_segmap(sbi);
 
 	return free_seg_blks;
 }
@@ -176,6 +223,19 @@ static inline void decrease_sleep_time(struct f3fs_gc_kthread *gc_th,
 		*wait -= min_time;
 }
 
+/*
+ * A background round the GC thread started in a predicted idle window
+ * gives way as soon as a new foreground request shows up.
+ */
+static inline bool bg_gc_preempted(struct f3fs_sb_info *sbi, int gc_type)
+{
+	struct f3fs_gc_kthread *gc_th = sbi->gc_thread;
+
+	if (gc_type != BG_GC || !gc_th || !READ_ONCE(gc_th->in_slice))
+		return false;
+	return f3fs_last_fg_time(sbi) != gc_th->slice_stamp;
+}
+
 static inline bool has_enough_invalid_blocks(struct f3fs_sb_info *sbi)
 {
 	block_t user_block_count = sbi->user_block_count;
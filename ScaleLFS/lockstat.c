@@ -0,0 +1,173 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * f3fs lock contention profiler
+ *
+ * Samples wait and hold times of the locks ScaleLFS scales on, per CPU,
+ * so that they can be compared on kernels built without lock_stat.
+ * /sys/fs/f3fs/<dev>/lock_stat_rate samples one in that many acquisitions
+ * (0 turns it off), and /sys/kernel/debug/f3fs_lock_stat/<dev> ranks the
+ * locks by the time spent waiting on them.
+ */
+
+#include <linux/fs.h>
+#include <linux/f3fs_fs.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/sort.h>
+
+#include "f3fs.h"
+
+DEFINE_STATIC_KEY_FALSE(f3fs_lock_stat_key);
+static DEFINE_MUTEX(lock_stat_mutex);
+static struct dentry *f3fs_lock_stat_root;
+
+static const char * const lock_class_name[NR_LOCK_CLASS] = {
+	[LOCK_CURSEG]		= "curseg_mutex",
+	[LOCK_IO_RWSEM]		= "io_rwsem",
+	[LOCK_IO]		= "io_lock",
+	[LOCK_SEGMAP]		= "segmap_lock",
+	[LOCK_STAT]		= "stat_lock",
+	[LOCK_NAT_TREE]		= "nat_tree_lock",
+	[LOCK_CP_RWSEM]		= "cp_rwsem",
+	[LOCK_SENTRY]		= "seg_entry.local_lock",
+	[LOCK_GC_INTERNAL_CP]	= "gc_internal_cp",
+	[LOCK_RANGE]		= "i_gc_rwsem (lock-free list)",
+};
+
+static void lock_stat_reset(struct f3fs_sb_info *sbi)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(sbi->lock_stat, cpu), 0,
+					sizeof(struct f3fs_lock_stats));
+}
+
+/*
+ * Turning the profiler on starts a new profile. The static key stays
+ * enabled while any mount samples.
+ */
+void f3fs_set_lock_stat_rate(struct f3fs_sb_info *sbi, unsigned int rate)
+{
+	mutex_lock(&lock_stat_mutex);
+	if (!sbi->lock_stat_rate && rate) {
+		lock_stat_reset(sbi);
+		static_branch_inc(&f3fs_lock_stat_key);
+	} else if (sbi->lock_stat_rate && !rate) {
+		static_branch_dec(&f3fs_lock_stat_key);
+	}
+	WRITE_ONCE(sbi->lock_stat_rate, rate);
+	mutex_unlock(&lock_stat_mutex);
+}
+
+struct lock_stat_row {
+	int class;
+	struct f3fs_lock_stat st;
+};
+
+static int lock_stat_cmp_wait(const void *a, const void *b)
+{
+	const struct lock_stat_row *ra = a, *rb = b;
+
+	if (ra->st.wait_ns != rb->st.wait_ns)
+		return ra->st.wait_ns > rb->st.wait_ns ? -1 : 1;
+	if (ra->st.contended != rb->st.contended)
+		return ra->st.contended > rb->st.contended ? -1 : 1;
+	return ra->class - rb->class;
+}
+
+static int lock_report_show(struct seq_file *seq, void *offset)
+{
+	struct f3fs_sb_info *sbi = seq->private;
+	struct lock_stat_row rows[NR_LOCK_CLASS];
+	int i, cpu;
+
+	memset(rows, 0, sizeof(rows));
+	for (i = 0; i < NR_LOCK_CLASS; i++) {
+		struct f3fs_lock_stat *sum = &rows[i].st;
+
+		rows[i].class = i;
+		for_each_possible_cpu(cpu) {
+			struct f3fs_lock_stat *st =
+				&per_cpu_ptr(sbi->lock_stat, cpu)->stat[i];
+
+			sum->acquired += READ_ONCE(st->acquired);
+			sum->contended += READ_ONCE(st->contended);
+			sum->wait_ns += READ_ONCE(st->wait_ns);
+			sum->wait_max_ns = max(sum->wait_max_ns,
+						READ_ONCE(st->wait_max_ns));
+			sum->held += READ_ONCE(st->held);
+			sum->hold_ns += READ_ONCE(st->hold_ns);
+			sum->hold_max_ns = max(sum->hold_max_ns,
+						READ_ONCE(st->hold_max_ns));
+		}
+	}
+	sort(rows, NR_LOCK_CLASS, sizeof(*rows), lock_stat_cmp_wait, NULL);
+
+	if (READ_ONCE(sbi->lock_stat_rate))
+		seq_printf(seq, "sampling 1 in %u acquisitions\n\n",
+					READ_ONCE(sbi->lock_stat_rate));
+	else
+		seq_puts(seq, "sampling off\n\n");
+
+	seq_printf(seq, "%-28s %12s %12s %6s %14s %10s %10s %10s %10s\n",
+			"lock", "acquired", "contended", "cont%",
+			"wait-total-us", "wait-avg", "wait-max",
+			"hold-avg", "hold-max");
+	for (i = 0; i < NR_LOCK_CLASS; i++) {
+		struct f3fs_lock_stat *st = &rows[i].st;
+
+		seq_printf(seq, "%-28s %12llu %12llu %6llu %14llu %10llu %10llu",
+			lock_class_name[rows[i].class],
+			st->acquired, st->contended,
+			st->acquired ? div64_u64(st->contended * 100,
+							st->acquired) : 0,
+			div_u64(st->wait_ns, NSEC_PER_USEC),
+			st->contended ? div64_u64(st->wait_ns,
+							st->contended) : 0,
+			st->wait_max_ns);
+		if (st->held)
+			seq_printf(seq, " %10llu %10llu\n",
+				div64_u64(st->hold_ns, st->held),
+				st->hold_max_ns);
+		else
+			seq_printf(seq, " %10s %10s\n", "-", "-");
+	}
+	seq_puts(seq, "\nwait and hold times in ns unless noted; waits count "
+			"contended acquisitions only\n(every sampled one for "
+			"the lock-free list), hold times exclusive holders "
+			"only\n");
+	return 0;
+}
+
+DEFINE_SHOW_ATTRIBUTE(lock_report);
+
+int f3fs_init_lock_stat(struct f3fs_sb_info *sbi)
+{
+	sbi->lock_stat = alloc_percpu(struct f3fs_lock_stats);
+	if (!sbi->lock_stat)
+		return -ENOMEM;
+	sbi->lock_stat_dentry = debugfs_create_file(sbi->sb->s_id, 0444,
+				f3fs_lock_stat_root, sbi, &lock_report_fops);
+	return 0;
+}
+
+void f3fs_destroy_lock_stat(struct f3fs_sb_info *sbi)
+{
+	debugfs_remove(sbi->lock_stat_dentry);
+	sbi->lock_stat_dentry = NULL;
+	f3fs_set_lock_stat_rate(sbi, 0);
+	free_percpu(sbi->lock_stat);
+	sbi->lock_stat = NULL;
+}
+
+void __init f3fs_create_lock_stat_root(void)
+{
+	f3fs_lock_stat_root = debugfs_create_dir("f3fs_lock_stat", NULL);
+}
+
+void f3fs_destroy_lock_stat_root(void)
+{
+	debugfs_remove_recursive(f3fs_lock_stat_root);
+	f3fs_lock_stat_root = NULL;
+}
@@ -380,14 +380,14 @@ int f3fs_need_dentry_mark(struct f3fs_sb_info *sbi, nid_t nid)
 	struct nat_entry *e;
 	bool need = false;
 
-	f3fs_down_read(&nm_i->nat_tree_lock);
+	nat_tree_down_read(sbi);
 	e = __lookup_nat_cache(nm_i, nid);
 	if (e) {
 		if (!get_nat_flag(e, IS_CHECKPOINTED) &&
 				!get_nat_flag(e, HAS_FSYNCED_INODE))
 			need = true;
 	}
-	f3fs_up_read(&nm_i->nat_tree_lock);
+	nat_tree_up_read(sbi);
 	return need;
 }
 
@@ -397,11 +397,11 @@ bool f3fs_is_checkpointed_node(struct f3fs_sb_info *sbi, nid_t nid)
 	struct nat_entry *e;
 	bool is_cp = true;
 
-	f3fs_down_read(&nm_i->nat_tree_lock);
+	nat_tree_down_read(sbi);
 	e = __lookup_nat_cache(nm_i, nid);
 	if (e && !get_nat_flag(e, IS_CHECKPOINTED))
 		is_cp = false;
-	f3fs_up_read(&nm_i->nat_tree_lock);
+	nat_tree_up_read(sbi);
 	return is_cp;
 }
 
@@ -411,13 +411,13 @@ bool f3fs_need_inode_block_update(struct f3fs_sb_info *sbi, nid_t ino)
 	struct nat_entry *e;
 	bool need_update = true;
 
-	f3fs_down_read(&nm_i->nat_tree_lock);
+	nat_tree_down_read(sbi);
 	e = __lookup_nat_cache(nm_i, ino);
 	if (e && get_nat_flag(e, HAS_LAST_FSYNC) &&
 			(get_nat_flag(e, IS_CHECKPOINTED) ||
 			 get_nat_flag(e, HAS_FSYNCED_INODE)))
 		need_update = false;
-	f3fs_up_read(&nm_i->nat_tree_lock);
+	nat_tree_up_read(sbi);
 	return need_update;
 }
 
@@ -436,7 +436,7 @@ static void cache_nat_entry(struct f3fs_sb_info *sbi, nid_t nid,
 	if (!new)
 		return;
 
-	f3fs_down_write(&nm_i->nat_tree_lock);
+	nat_tree_down_write(sbi);
 	e = __lookup_nat_cache(nm_i, nid);
 	if (!e)
 		e = __init_nat_entry(nm_i, new, ne, false);
@@ -445,7 +445,7 @@ static void cache_nat_entry(struct f3fs_sb_info *sbi, nid_t nid,
 				nat_get_blkaddr(e) !=
 					le32_to_cpu(ne->block_addr) ||
 				nat_get_version(e) != ne->version);
-	f3fs_up_write(&nm_i->nat_tree_lock);
+	nat_tree_up_write(sbi);
 	if (e != new)
 		__free_nat_entry(new);
 }
@@ -457,7 +457,7 @@ static void set_node_addr(struct f3fs_sb_info *sbi, struct node_info *ni,
 	struct nat_entry *e;
 	struct nat_entry *new = __alloc_nat_entry(sbi, ni->nid, true);
 
-	f3fs_down_write(&nm_i->nat_tree_lock);
+	nat_tree_down_write(sbi);
 	e = __lookup_nat_cache(nm_i, ni->nid);
 	if (!e) {
 		e = __init_nat_entry(nm_i, new, NULL, true);
@@ -506,7 +506,7 @@ static void set_node_addr(struct f3fs_sb_info *sbi, struct node_info *ni,
 			set_nat_flag(e, HAS_FSYNCED_INODE, true);
 		set_nat_flag(e, HAS_LAST_FSYNC, fsync_done);
 	}
-	f3fs_up_write(&nm_i->nat_tree_lock);
+	nat_tree_up_write(sbi);
 }
 
 int f3fs_try_to_free_nats(struct f3fs_sb_info *sbi, int nr_shrink)
@@ -553,49 +553,43 @@ int f3fs_get_node_info(struct f3fs_sb_info *sbi, nid_t nid,
 	struct nat_entry *e;
 	pgoff_t index;
 	block_t blkaddr;
+	unsigned int seq;
 	int i;
 
 	ni->nid = nid;
-retry:
+
 	/* Check nat cache */
-	f3fs_down_read(&nm_i->nat_tree_lock);
+	nat_tree_down_read(sbi);
 	e = __lookup_nat_cache(nm_i, nid);
 	if (e) {
 		ni->ino = nat_get_ino(e);
 		ni->blk_addr = nat_get_blkaddr(e);
 		ni->version = nat_get_version(e);
-		f3fs_up_read(&nm_i->nat_tree_lock);
+		nat_tree_up_read(sbi);
 		return 0;
 	}
 
 	/*
-	 * Check current segment summary by trying to grab journal_rwsem first.
-	 * This sem is on the critical path on the checkpoint requiring the above
-	 * nat_tree_lock. Therefore, we should retry, if we failed to grab here
-	 * while not bothering checkpoint.
+	 * Check current segment summary through the journal index. Journal
+	 * updates are serialized by journal_seqlock, so there is no need to
+	 * grab journal_rwsem which is on the critical path of checkpoint.
 	 */
-	if (!f3fs_rwsem_is_locked(&sbi->cp_global_sem) || checkpoint_context) {
-		down_read(&curseg->journal_rwsem);
-	} else if (f3fs_rwsem_is_contended(&nm_i->nat_tree_lock) ||
-				!down_read_trylock(&curseg->journal_rwsem)) {
-		f3fs_up_read(&nm_i->nat_tree_lock);
-		goto retry;
-	}
-
-	i = f3fs_lookup_journal_in_cursum(journal, NAT_JOURNAL, nid, 0);
-	if (i >= 0) {
-		ne = nat_in_journal(journal, i);
-		node_info_from_raw_nat(ni, &ne);
-	}
-        up_read(&curseg->journal_rwsem);
+	do {
+		seq = read_seqbegin(&curseg->journal_seqlock);
+		i = f3fs_lookup_journal_in_cursum(curseg, NAT_JOURNAL, nid, 0);
+		if (i >= 0) {
+			ne = nat_in_journal(journal, i);
+			node_info_from_raw_nat(ni, &ne);
+		}
+	} while (read_seqretry(&curseg->journal_seqlock, seq));
 	if (i >= 0) {
-		f3fs_up_read(&nm_i->nat_tree_lock);
+		nat_tree_up_read(sbi);
 		goto cache;
 	}
 
 	/* Fill node_info from nat page */
 	index = current_nat_addr(sbi, nid);
-	f3fs_up_read(&nm_i->nat_tree_lock);
+	nat_tree_up_read(sbi);
 
 	page = f3fs_get_meta_page(sbi, index);
 	if (IS_ERR(page))
@@ -2232,14 +2226,14 @@ bool f3fs_nat_bitmap_enabled(struct f3fs_sb_info *sbi)
 	unsigned int i;
 	bool ret = true;
 
-	f3fs_down_read(&nm_i->nat_tree_lock);
+	nat_tree_down_read(sbi);
 	for (i = 0; i < nm_i->nat_blocks; i++) {
 		if (!test_bit_le(i, nm_i->nat_block_bitmap)) {
 			ret = false;
 			break;
 		}
 	}
-	f3fs_up_read(&nm_i->nat_tree_lock);
+	nat_tree_up_read(sbi);
 
 	return ret;
 }
@@ -2422,7 +2416,7 @@ static void scan_free_nid_bits(struct f3fs_sb_info *sbi)
 	unsigned int i, idx;
 	nid_t nid;
 
-	f3fs_down_read(&nm_i->nat_tree_lock);
+	nat_tree_down_read(sbi);
 
 	for (i = 0; i < nm_i->nat_blocks; i++) {
 		if (!test_bit_le(i, nm_i->nat_block_bitmap))
@@ -2445,7 +2439,7 @@ static void scan_free_nid_bits(struct f3fs_sb_info *sbi)
 out:
 	scan_curseg_cache(sbi);
 
-	f3fs_up_read(&nm_i->nat_tree_lock);
+	nat_tree_up_read(sbi);
 }
 
 static int __f3fs_build_free_nids(struct f3fs_sb_info *sbi,
@@ -2480,7 +2474,7 @@ static int __f3fs_build_free_nids(struct f3fs_sb_info *sbi,
 	f3fs_ra_meta_pages(sbi, NAT_BLOCK_OFFSET(nid), FREE_NID_PAGES,
 							META_NAT, true);
 
-	f3fs_down_read(&nm_i->nat_tree_lock);
+	nat_tree_down_read(sbi);
 
 	while (1) {
 		if (!test_bit_le(NAT_BLOCK_OFFSET(nid),
@@ -2495,7 +2489,7 @@ static int __f3fs_build_free_nids(struct f3fs_sb_info *sbi,
 			}
 
 			if (ret) {
-				f3fs_up_read(&nm_i->nat_tree_lock);
+				nat_tree_up_read(sbi);
 				f3fs_err(sbi, "NAT is corrupt, run fsck to fix it");
 				return ret;
 			}
@@ -2515,7 +2509,7 @@ static int __f3fs_build_free_nids(struct f3fs_sb_info *sbi,
 	/* find free nids from current sum_pages */
 	scan_curseg_cache(sbi);
 
-	f3fs_up_read(&nm_i->nat_tree_lock);
+	nat_tree_up_read(sbi);
 
 	f3fs_ra_meta_pages(sbi, NAT_BLOCK_OFFSET(nm_i->next_scan_nid),
 					nm_i->ra_nid_pages, META_NAT, false);
@@ -2893,7 +2887,10 @@ static void remove_nats_in_journal(struct f3fs_sb_info *sbi)
 
 		__set_nat_cache_dirty(nm_i, ne);
 	}
+	write_seqlock(&curseg->journal_seqlock);
 	update_nats_in_cursum(journal, -i);
+	f3fs_reset_journal_index(curseg);
+	write_sequnlock(&curseg->journal_seqlock);
 	up_write(&curseg->journal_rwsem);
 }
 
@@ -2960,7 +2957,7 @@ void f3fs_enable_nat_bits(struct f3fs_sb_info *sbi)
 	struct f3fs_nm_info *nm_i = NM_I(sbi);
 	unsigned int nat_ofs;
 
-	f3fs_down_read(&nm_i->nat_tree_lock);
+	nat_tree_down_read(sbi);
 
 	for (nat_ofs = 0; nat_ofs < nm_i->nat_blocks; nat_ofs++) {
 		unsigned int valid = 0, nid_ofs = 0;
@@ -2980,7 +2977,7 @@ void f3fs_enable_nat_bits(struct f3fs_sb_info *sbi)
 		__update_nat_bits(nm_i, nat_ofs, valid);
 	}
 
-	f3fs_up_read(&nm_i->nat_tree_lock);
+	nat_tree_up_read(sbi);
 }
 
 static int __flush_nat_entry_set(struct f3fs_sb_info *sbi,
@@ -3023,15 +3020,18 @@ static int __flush_nat_entry_set(struct f3fs_sb_info *sbi,
 		f3fs_bug_on(sbi, nat_get_blkaddr(ne) == NEW_ADDR);
 
 		if (to_journal) {
-			offset = f3fs_lookup_journal_in_cursum(journal,
+			write_seqlock(&curseg->journal_seqlock);
+			offset = f3fs_lookup_journal_in_cursum(curseg,
 							NAT_JOURNAL, nid, 1);
 			f3fs_bug_on(sbi, offset < 0);
 			raw_ne = &nat_in_journal(journal, offset);
 			nid_in_journal(journal, offset) = cpu_to_le32(nid);
+			raw_nat_from_node_info(raw_ne, &ne->ni);
+			write_sequnlock(&curseg->journal_seqlock);
 		} else {
 			raw_ne = &nat_blk->entries[nid - start_nid];
+			raw_nat_from_node_info(raw_ne, &ne->ni);
 		}
-		raw_nat_from_node_info(raw_ne, &ne->ni);
 		nat_reset_flag(ne);
 		__clear_nat_cache_dirty(NM_I(sbi), set, ne);
 		if (nat_get_blkaddr(ne) == NULL_ADDR) {
@@ -3078,15 +3078,15 @@ int f3fs_flush_nat_entries(struct f3fs_sb_info *sbi, struct cp_control *cpc)
 	 * nat_cnt[DIRTY_NAT].
 	 */
 	if (cpc->reason & CP_UMOUNT) {
-		f3fs_down_write(&nm_i->nat_tree_lock);
+		nat_tree_down_write(sbi);
 		remove_nats_in_journal(sbi);
-		f3fs_up_write(&nm_i->nat_tree_lock);
+		nat_tree_up_write(sbi);
 	}
 
 	if (!nm_i->nat_cnt[DIRTY_NAT])
 		return 0;
 
-	f3fs_down_write(&nm_i->nat_tree_lock);
+	nat_tree_down_write(sbi);
 
 	/*
 	 * if there are no enough space in journal to store dirty nat
@@ -3115,7 +3115,7 @@ int f3fs_flush_nat_entries(struct f3fs_sb_info *sbi, struct cp_control *cpc)
 			break;
 	}
 
-	f3fs_up_write(&nm_i->nat_tree_lock);
+	nat_tree_up_write(sbi);
 	/* Allow dirty nats by node block allocation in write_begin */
 
 	return err;
@@ -3342,7 +3342,7 @@ void f3fs_destroy_node_manager(struct f3fs_sb_info *sbi)
 	spin_unlock(&nm_i->nid_list_lock);
 
 	/* destroy nat cache */
-	f3fs_down_write(&nm_i->nat_tree_lock);
+	nat_tree_down_write(sbi);
 	while ((found = __gang_lookup_nat_cache(nm_i,
 					nid, NATVEC_SIZE, natvec))) {
 		unsigned idx;
@@ -3372,7 +3372,7 @@ void f3fs_destroy_node_manager(struct f3fs_sb_info *sbi)
 			kmem_cache_free(nat_entry_set_slab, setvec[idx]);
 		}
 	}
-	f3fs_up_write(&nm_i->nat_tree_lock);
+	nat_tree_up_write(sbi);
 
 	kvfree(nm_i->nat_block_bitmap);
 	if (nm_i->free_nid_bitmap) {
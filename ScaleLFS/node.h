@@ -165,6 +165,33 @@ struct free_nid {
 	int state;		/* in use or not: FREE_NID or PREALLOC_NID */
 };
 
+/* readers of nat_tree_lock only have their wait timed */
+static inline void nat_tree_down_read(struct f3fs_sb_info *sbi)
+{
+	f3fs_down_read_timed(sbi, LOCK_NAT_TREE, &NM_I(sbi)->nat_tree_lock);
+}
+
+static inline void nat_tree_up_read(struct f3fs_sb_info *sbi)
+{
+	f3fs_up_read(&NM_I(sbi)->nat_tree_lock);
+}
+
+static inline void nat_tree_down_write(struct f3fs_sb_info *sbi)
+{
+	struct f3fs_nm_info *nm_i = NM_I(sbi);
+
+	nm_i->nat_tree_lock_token = f3fs_down_write_timed(sbi, LOCK_NAT_TREE,
+							&nm_i->nat_tree_lock);
+}
+
+static inline void nat_tree_up_write(struct f3fs_sb_info *sbi)
+{
+	struct f3fs_nm_info *nm_i = NM_I(sbi);
+
+	f3fs_up_write_timed(sbi, LOCK_NAT_TREE, &nm_i->nat_tree_lock,
+					nm_i->nat_tree_lock_token);
+}
+
 static inline void next_free_nid(struct f3fs_sb_info *sbi, nid_t *nid)
 {
 	struct f3fs_nm_info *nm_i = NM_I(sbi);
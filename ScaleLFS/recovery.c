@@ -483,7 +483,7 @@ static int check_index_in_prev_nodes(struct f3fs_sb_info *sbi,
 		return 0;
 
 	/* Get the previous summary */
-	for (i = CURSEG_HOT_DATA; i <= CURSEG_COLD_GC_DATA_END; i++) {
+	for (i = CURSEG_HOT_DATA; i <= CURSEG_GC_DATA_LAST(sbi); i++) {
 		struct curseg_info *curseg = CURSEG_I(sbi, i);
 
 		if (curseg->segno == segno) {
@@ -17,6 +17,7 @@
 #include <linux/freezer.h>
 #include <linux/sched/signal.h>
 #include <linux/random.h>
+#include <linux/hash.h>
 
 #include "f3fs.h"
 #include "segment.h"
@@ -358,7 +359,7 @@ int f3fs_commit_atomic_write(struct inode *inode)
 	if (err)
 		return err;
 
-	range = f3fs_down_write3(&fi->i_gc_rwsem[WRITE]);
+	range = f3fs_down_write3(sbi, &fi->i_gc_rwsem[WRITE]);
 	f3fs_lock_op(sbi);
 
 	err = __f3fs_commit_atomic_write(inode);
@@ -452,6 +453,11 @@ void f3fs_balance_fs_bg(struct f3fs_sb_info *sbi, bool from_bg)
 	else
 		f3fs_build_free_nids(sbi, false, false);
 
+	/* start writing back early rather than all at once in do_sync */
+	if (test_opt(sbi, DATA_FLUSH) && sbi->wb_pool.workers &&
+			get_pages(sbi, F3FS_DIRTY_DATA) >= sbi->wb_pool.dirty_kick)
+		f3fs_kick_wb_workers(sbi);
+
 	if (excess_dirty_nats(sbi) || excess_dirty_threshold(sbi) ||
 		excess_prefree_segs(sbi) || !f3fs_space_for_roll_forward(sbi))
 		goto do_sync;
@@ -721,12 +727,14 @@ static void __locate_dirty_segment2(struct f3fs_sb_info *sbi, unsigned int segno
 		atomic_inc(&dirty_i->nr_dirty[dirty_type]);
 
 	if (dirty_type == DIRTY) {
-		if (unlikely(seg_dirty_type >= DIRTY)) {
+		enum dirty_type t = seg_dirty_index(seg_dirty_type);
+
+		if (unlikely(t >= DIRTY)) {
 			f3fs_bug_on(sbi, 1);
 			return;
 		}
-		if (!test_and_set_bit(segno, dirty_i->dirty_segmap[seg_dirty_type]))
-			atomic_inc(&dirty_i->nr_dirty[seg_dirty_type]);
+		if (!test_and_set_bit(segno, dirty_i->dirty_segmap[t]))
+			percpu_counter_inc(&dirty_i->nr_dirty_type[t]);
 	}
 }
 
@@ -741,8 +749,11 @@ static void __remove_dirty_segment2(struct f3fs_sb_info *sbi, unsigned int segno
 		atomic_dec(&dirty_i->nr_dirty[dirty_type]);
 
 	if (dirty_type == DIRTY) {
-		if (test_and_clear_bit(segno, dirty_i->dirty_segmap[seg_dirty_type]))
-			atomic_dec(&dirty_i->nr_dirty[seg_dirty_type]);
+		enum dirty_type t = seg_dirty_index(seg_dirty_type);
+
+		if (t < DIRTY &&
+		    test_and_clear_bit(segno, dirty_i->dirty_segmap[t]))
+			percpu_counter_dec(&dirty_i->nr_dirty_type[t]);
 
 		if (valid_blocks == 0) {
 			clear_bit(GET_SEC_FROM_SEG(sbi, segno),
@@ -2197,6 +2208,8 @@ static void update_sit_entry2(struct f3fs_sb_info *sbi, block_t blkaddr, int del
 	}
 	if (!test_bit(offset, se->ckpt_valid_map))
 		se->ckpt_valid_blocks += del;
+	if (del > 0)
+		set_bit(segno, SIT_I(sbi)->written_segmap);
 
 	__mark_sit_entry_dirty(sbi, segno);
 
@@ -2278,9 +2291,15 @@ static void __add_sum_entry(struct f3fs_sb_info *sbi, int type,
 int f3fs_npages_for_summary_flush(struct f3fs_sb_info *sbi, bool for_ra)
 {
 	int valid_sum_count = 0;
-	int i, sum_in_page;
+	int i, sum_in_page, last;
 
-	for (i = CURSEG_HOT_DATA; i <= CURSEG_COLD_GC_DATA_END; i++) {
+	if (for_ra)
+		last = CURSEG_COLD_GC_DATA_START +
+			ckpt_gc_logs(F3FS_CKPT(sbi)) - 1;
+	else
+		last = CURSEG_GC_DATA_LAST(sbi);
+
+	for (i = CURSEG_HOT_DATA; i <= last; i++) {
 		if (sbi->ckpt->alloc_type[i] == SSR)
 			valid_sum_count += sbi->blocks_per_seg;
 		else {
@@ -2296,10 +2315,8 @@ int f3fs_npages_for_summary_flush(struct f3fs_sb_info *sbi, bool for_ra)
 			SUM_FOOTER_SIZE) / SUMMARY_SIZE;
 	if (valid_sum_count <= sum_in_page)
 		return 1;
-	else if ((valid_sum_count - sum_in_page) <=
-		(PAGE_SIZE - SUM_FOOTER_SIZE) / SUMMARY_SIZE)
-		return 2;
-	return 3;
+	return 1 + DIV_ROUND_UP(valid_sum_count - sum_in_page,
+			(PAGE_SIZE - SUM_FOOTER_SIZE) / SUMMARY_SIZE);
 }
 
 /*
@@ -2339,7 +2356,7 @@ static void write_current_sum_page(struct f3fs_sb_info *sbi,
 	dst = (struct f3fs_summary_block *)page_address(page);
 	memset(dst, 0, PAGE_SIZE);
 
-	mutex_lock(&curseg->curseg_mutex);
+	lock_curseg(sbi, curseg);
 
 	down_read(&curseg->journal_rwsem);
 	memcpy(&dst->journal, curseg->journal, SUM_JOURNAL_SIZE);
@@ -2348,7 +2365,7 @@ static void write_current_sum_page(struct f3fs_sb_info *sbi,
 	memcpy(dst->entries, src->entries, SUM_ENTRY_SIZE);
 	memcpy(&dst->footer, &src->footer, SUM_FOOTER_SIZE);
 
-	mutex_unlock(&curseg->curseg_mutex);
+	unlock_curseg(sbi, curseg);
 
 	set_page_dirty(page);
 	f3fs_put_page(page, 1);
@@ -2382,7 +2399,7 @@ static void get_new_segment(struct f3fs_sb_info *sbi,
 	int go_left = 0;
 	int i;
 
-	spin_lock(&free_i->segmap_lock);
+	lock_segmap(sbi);
 
 	if (!new_sec && ((*newseg + 1) % sbi->segs_per_sec)) {
 		segno = find_next_zero_bit(free_i->free_segmap,
@@ -2453,7 +2470,7 @@ static void get_new_segment(struct f3fs_sb_info *sbi,
 	f3fs_bug_on(sbi, test_bit(segno, free_i->free_segmap));
 	__set_inuse(sbi, segno);
 	*newseg = segno;
-	spin_unlock(&free_i->segmap_lock);
+	unlock_segmap(sbi);
 }
 
 static void reset_curseg(struct f3fs_sb_info *sbi, int type, int modified)
@@ -2552,10 +2569,11 @@ static void new_curseg(struct f3fs_sb_info *sbi, int type, bool new_sec)
 static int __next_free_blkoff(struct f3fs_sb_info *sbi,
 					int segno, block_t start)
 {
-  // sentry_only (read), tmp_map
+  // sentry_only (read)
 	struct seg_entry *se = get_seg_entry(sbi, segno);
 	int entries = SIT_VBLOCK_MAP_SIZE / sizeof(unsigned long);
-	unsigned long *target_map = SIT_I(sbi)->tmp_map;
+	/* on stack: SSR logs of parallel GC workers refresh concurrently */
+	unsigned long target_map[SIT_VBLOCK_MAP_SIZE / sizeof(unsigned long)];
 	unsigned long *ckpt_map = (unsigned long *)se->ckpt_valid_map;
 	unsigned long *cur_map = (unsigned long *)se->cur_valid_map;
 	int i;
@@ -2666,6 +2684,50 @@ static void get_atssr_segment(struct f3fs_sb_info *sbi, int type,
 	stat_inc_seg_type(sbi, curseg);
 }
 
+/*
+ * AT-SSR for the log of a GC worker: reuse a dirty data segment whose age
+ * is close to @age, the age of the migrated blocks, or open a new one.
+ * Unlike get_atssr_segment() the log keeps its own seg_type, so parallel
+ * workers never share a destination segment.
+ */
+static void get_gc_atssr_segment(struct f3fs_sb_info *sbi, int type,
+					unsigned long long age)
+{
+	struct curseg_info *curseg = CURSEG_I(sbi, type);
+	const struct victim_selection *v_ops = DIRTY_I(sbi)->v_ops;
+	unsigned int segno = NULL_SEGNO;
+	int i = curseg->seg_type;
+	bool claimed;
+	int ret;
+
+	down_write(&SIT_I(sbi)->last_victim_lock);
+	ret = v_ops->get_victim(sbi, &segno, BG_GC, i, AT_SSR, age);
+	for (i = CURSEG_COLD_DATA; ret && i >= CURSEG_HOT_DATA; i--)
+		ret = v_ops->get_victim(sbi, &segno, BG_GC, i, AT_SSR, age);
+	up_write(&SIT_I(sbi)->last_victim_lock);
+
+	/*
+	 * get_victim() claimed the section in victim_secmap, which keeps
+	 * other workers off it until change_curseg() has made it a log.
+	 */
+	claimed = !ret;
+	if (claimed && !f3fs_segment_has_free_slot(sbi, segno))
+		ret = -ENOSPC;
+
+	if (!ret) {
+		curseg->next_segno = segno;
+		change_curseg(sbi, type, true);
+	} else {
+		new_curseg(sbi, type, true);
+	}
+	stat_inc_seg_type(sbi, curseg);
+
+	/* it is a log now, or was not usable; either way not a GC victim */
+	if (claimed)
+		clear_bit(GET_SEC_FROM_SEG(sbi, segno),
+					DIRTY_I(sbi)->victim_secmap);
+}
+
 static void __f3fs_init_atgc_curseg(struct f3fs_sb_info *sbi)
 {
 	struct curseg_info *curseg = CURSEG_I(sbi, CURSEG_ALL_DATA_ATGC);
@@ -2675,7 +2737,7 @@ static void __f3fs_init_atgc_curseg(struct f3fs_sb_info *sbi)
 
 	f3fs_down_read(&SM_I(sbi)->curseg_lock);
 
-	mutex_lock(&curseg->curseg_mutex);
+	lock_curseg(sbi, curseg);
 	down_write(&SIT_I(sbi)->sentry_only_lock);
 	down_write(&SIT_I(sbi)->dirty_sentry_lock);
 	down_write(&SIT_I(sbi)->tmp_map_lock);
@@ -2689,7 +2751,7 @@ static void __f3fs_init_atgc_curseg(struct f3fs_sb_info *sbi)
 	up_write(&SIT_I(sbi)->dirty_sentry_lock);
 	up_write(&SIT_I(sbi)->sentry_only_lock);
 
-	mutex_unlock(&curseg->curseg_mutex);
+	unlock_curseg(sbi, curseg);
 
 	f3fs_up_read(&SM_I(sbi)->curseg_lock);
 
@@ -2703,7 +2765,7 @@ static void __f3fs_save_inmem_curseg(struct f3fs_sb_info *sbi, int type)
 {
 	struct curseg_info *curseg = CURSEG_I(sbi, type);
 
-	mutex_lock(&curseg->curseg_mutex);
+	lock_curseg(sbi, curseg);
 	if (!curseg->inited)
 		goto out;
 
@@ -2716,7 +2778,7 @@ static void __f3fs_save_inmem_curseg(struct f3fs_sb_info *sbi, int type)
 		mutex_unlock(&DIRTY_I(sbi)->seglist_lock);
 	}
 out:
-	mutex_unlock(&curseg->curseg_mutex);
+	unlock_curseg(sbi, curseg);
 }
 
 void f3fs_save_inmem_curseg(struct f3fs_sb_info *sbi)
@@ -2731,7 +2793,7 @@ static void __f3fs_restore_inmem_curseg(struct f3fs_sb_info *sbi, int type)
 {
 	struct curseg_info *curseg = CURSEG_I(sbi, type);
 
-	mutex_lock(&curseg->curseg_mutex);
+	lock_curseg(sbi, curseg);
 	if (!curseg->inited)
 		goto out;
 	if (get_valid_blocks(sbi, curseg->segno, false))
@@ -2741,7 +2803,7 @@ static void __f3fs_restore_inmem_curseg(struct f3fs_sb_info *sbi, int type)
 	__set_test_and_inuse(sbi, curseg->segno);
 	mutex_unlock(&DIRTY_I(sbi)->seglist_lock);
 out:
-	mutex_unlock(&curseg->curseg_mutex);
+	unlock_curseg(sbi, curseg);
 }
 
 void f3fs_restore_inmem_curseg(struct f3fs_sb_info *sbi)
@@ -2791,7 +2853,12 @@ static int get_ssr_segment(struct f3fs_sb_info *sbi, int type,
 	}
 
 	for (; cnt-- > 0; reversed ? i-- : i++) {
-		if (i == seg_type)
+		if (i < 0)
+			break;
+		/* GC logs share one dirty index, so try it only once */
+		if (seg_dirty_index(i) == seg_dirty_index(seg_type))
+			continue;
+		if (i > CURSEG_COLD_GC_DATA_START && i <= CURSEG_COLD_GC_DATA_END)
 			continue;
 		if (!v_ops->get_victim(sbi, &segno, BG_GC, i, alloc_mode, age)) {
 			curseg->next_segno = segno;
@@ -2865,7 +2932,7 @@ void f3fs_allocate_segment_for_resize(struct f3fs_sb_info *sbi, int type,
 	unsigned int segno;
 
 	f3fs_down_read(&SM_I(sbi)->curseg_lock);
-	mutex_lock(&curseg->curseg_mutex);
+	lock_curseg(sbi, curseg);
 	down_write(&SIT_I(sbi)->sentry_only_lock);
 	down_write(&SIT_I(sbi)->dirty_sentry_lock);
 	down_write(&SIT_I(sbi)->tmp_map_lock);
@@ -2896,7 +2963,7 @@ void f3fs_allocate_segment_for_resize(struct f3fs_sb_info *sbi, int type,
 		f3fs_notice(sbi, "For resize: curseg of type %d: %u ==> %u",
 			    type, segno, curseg->segno);
 
-	mutex_unlock(&curseg->curseg_mutex);
+	unlock_curseg(sbi, curseg);
 	f3fs_up_read(&SM_I(sbi)->curseg_lock);
 }
 
@@ -2958,7 +3025,7 @@ void f3fs_allocate_new_segments(struct f3fs_sb_info *sbi)
 	down_write(&SIT_I(sbi)->last_victim_lock);
   f3fs_bug_on(sbi, true);
 
-	for (i = CURSEG_HOT_DATA; i <= CURSEG_COLD_GC_DATA_END; i++)
+	for (i = CURSEG_HOT_DATA; i <= CURSEG_GC_DATA_LAST(sbi); i++)
 		__allocate_new_segment(sbi, i, false, false);
 
 	up_write(&SIT_I(sbi)->last_victim_lock);
@@ -3184,7 +3251,7 @@ static int __get_segment_type_4(struct f3fs_io_info *fio)
 static int __get_segment_type_6(struct f3fs_io_info *fio)
 {
   if (fio->dst_hint != -1) {
-    f3fs_bug_on(fio->sbi, fio->dst_hint < 0 || fio->dst_hint >= MAX_GC_WORKER);
+    f3fs_bug_on(fio->sbi, fio->dst_hint < 0 || fio->dst_hint >= fio->sbi->nr_gc_log);
     return CURSEG_COLD_GC_DATA_START + fio->dst_hint;
   }
 	if (fio->type == DATA) {
@@ -3194,15 +3261,26 @@ static int __get_segment_type_6(struct f3fs_io_info *fio)
 			return CURSEG_COLD_DATA_PINNED;
 
 		if (page_private_gcing(fio->page)) {
+			/*
+			 * BG GC under ATGC leaves its pages to writeback;
+			 * send them to the log of the worker that queued
+			 * them, CURSEG_ALL_DATA_ATGC is not used here.
+			 */
 			if (fio->sbi->am.atgc_enabled &&
 				(fio->io_type == FS_DATA_IO) &&
-				(fio->sbi->gc_mode != GC_URGENT_HIGH))
-				return CURSEG_ALL_DATA_ATGC;
-			else {
+				(fio->sbi->gc_mode != GC_URGENT_HIGH)) {
+				int log = READ_ONCE(F3FS_I(inode)->i_gc_log) - 1;
+
+				if (log < 0 || log >= fio->sbi->nr_gc_log)
+					return CURSEG_COLD_DATA;
+				fio->dst_hint = log;
+				fio->temp = COLD_GC_START + log;
+				return CURSEG_COLD_GC_DATA_START + log;
+			} else {
         if (fio->dst_hint == -1) {
           return CURSEG_COLD_DATA;
         } else {
-		      f3fs_bug_on(fio->sbi, fio->dst_hint < 0 || fio->dst_hint >= MAX_GC_WORKER);
+		      f3fs_bug_on(fio->sbi, fio->dst_hint < 0 || fio->dst_hint >= fio->sbi->nr_gc_log);
           return CURSEG_COLD_GC_DATA_START + fio->dst_hint;
         }
       }
@@ -3262,11 +3340,13 @@ void f3fs_allocate_data_block2(struct f3fs_sb_info *sbi, struct page *page,
   unsigned int old_valid_blocks, new_valid_blocks;
   enum dirty_type old_seg_dirty_type, new_seg_dirty_type;
   unsigned int new_segno, old_segno;
+  bool from_atgc;
+  u64 sentry_token;
   f3fs_bug_on(sbi, type == CURSEG_ALL_DATA_ATGC);
 
 	f3fs_down_read(&SM_I(sbi)->curseg_lock);
 
-	mutex_lock(&curseg->curseg_mutex);
+	lock_curseg(sbi, curseg);
 //	down_write(&sit_i->mtime_lock);
 //	down_write(&sit_i->tmp_map_lock);
 	//down_write(&sit_i->blk_info_lock);
@@ -3275,14 +3355,18 @@ void f3fs_allocate_data_block2(struct f3fs_sb_info *sbi, struct page *page,
 	*new_blkaddr = NEXT_FREE_BLKADDR(sbi, curseg);
   new_segno = GET_SEGNO(sbi, *new_blkaddr);
   old_segno = GET_SEGNO(sbi, old_blkaddr);
+  /* GC workers under ATGC refill their own logs by age */
+  from_atgc = sbi->am.atgc_enabled && sbi->gc_mode != GC_URGENT_HIGH &&
+    old_segno != NULL_SEGNO &&
+    type >= CURSEG_COLD_GC_DATA_START && type <= CURSEG_COLD_GC_DATA_END;
   while (true) {
-    down_write(&get_seg_entry(sbi, new_segno)->local_lock);
+    sentry_token = sentry_down_write(sbi, get_seg_entry(sbi, new_segno));
     if (new_segno != old_segno && old_segno != NULL_SEGNO) {
       bool acquired = down_write_trylock(&get_seg_entry(sbi, old_segno)->local_lock);
       if (acquired) {
         break;
       } else {
-        up_write(&get_seg_entry(sbi, new_segno)->local_lock);
+        sentry_up_write(sbi, get_seg_entry(sbi, new_segno), sentry_token);
       }
     } else {
       break;
@@ -3313,7 +3397,11 @@ void f3fs_allocate_data_block2(struct f3fs_sb_info *sbi, struct page *page,
 		update_sit_entry2(sbi, old_blkaddr, -1, &old_valid_blocks, &old_seg_dirty_type, 0);
 
 	if (!__has_curseg_space(sbi, curseg)) {
-		sit_i->s_ops->allocate_segment2(sbi, type, false);
+		if (from_atgc)
+			get_gc_atssr_segment(sbi, type,
+					get_seg_entry(sbi, old_segno)->mtime);
+		else
+			sit_i->s_ops->allocate_segment2(sbi, type, false);
 	  locate_dirty_segment2(sbi, new_segno, new_valid_blocks, new_seg_dirty_type);
 	}
 	/*
@@ -3336,14 +3424,12 @@ void f3fs_allocate_data_block2(struct f3fs_sb_info *sbi, struct page *page,
   if (new_segno != old_segno && old_segno != NULL_SEGNO) {
     up_write(&get_seg_entry(sbi, old_segno)->local_lock);
   }
-  up_write(&get_seg_entry(sbi, new_segno)->local_lock);
+  sentry_up_write(sbi, get_seg_entry(sbi, new_segno), sentry_token);
 
-	if (page && IS_NODESEG(type)) {
+	/* the inode checksum is set when the node bio is submitted */
+	if (page && IS_NODESEG(type))
 		fill_node_footer_blkaddr(page, NEXT_FREE_BLKADDR(sbi, curseg));
 
-		f3fs_inode_chksum_set(sbi, page);
-	}
-
 	if (fio) {
 		struct f3fs_bio_info *io;
 
@@ -3353,14 +3439,125 @@ void f3fs_allocate_data_block2(struct f3fs_sb_info *sbi, struct page *page,
 		INIT_LIST_HEAD(&fio->list);
 		fio->in_list = true;
 		io = sbi->write_io[fio->type] + fio->temp;
-		spin_lock(&io->io_lock);
+		f3fs_io_lock(io);
 		list_add_tail(&fio->list, &io->io_list);
-		spin_unlock(&io->io_lock);
+		f3fs_io_unlock(io);
+	}
+
+	unlock_curseg(sbi, curseg);
+
+	f3fs_up_read(&SM_I(sbi)->curseg_lock);
+}
+
+/*
+ * Update SIT for a run of @count freshly allocated blocks starting at
+ * @blkaddr, all within one segment.  The caller holds the segment's
+ * local_lock.
+ */
+static void update_sit_entry_run(struct f3fs_sb_info *sbi, block_t blkaddr,
+		unsigned int count, unsigned int *valid_blocks,
+		enum dirty_type *dirty_type)
+{
+	unsigned int segno = GET_SEGNO(sbi, blkaddr);
+	struct seg_entry *se = get_seg_entry(sbi, segno);
+	unsigned int offset = GET_BLKOFF_FROM_SEG0(sbi, blkaddr);
+	unsigned int i, added = 0, ckpt_added = 0;
+
+	if (se->mtime)
+		se->mtime = div_u64(se->mtime * se->valid_blocks,
+					se->valid_blocks + count);
+
+	for (i = offset; i < offset + count; i++) {
+		if (f3fs_test_and_set_bit(i, se->cur_valid_map))
+			continue;
+		added++;
+		if (!test_bit(i, se->ckpt_valid_map))
+			ckpt_added++;
+		if (f3fs_block_unit_discard(sbi) &&
+				!f3fs_test_and_set_bit(i, se->discard_map))
+			sbi->discard_blks--;
+	}
+
+	se->valid_blocks += added;
+	se->ckpt_valid_blocks += ckpt_added;
+	if (added)
+		set_bit(segno, SIT_I(sbi)->written_segmap);
+	__mark_sit_entry_dirty(sbi, segno);
+
+	*valid_blocks = se->valid_blocks;
+	*dirty_type = se->type;
+}
+
+/*
+ * Allocate up to @count physically contiguous blocks from log @type for
+ * consecutive node offsets of dnode @nid, starting at @ofs_in_node.  The
+ * blocks must not replace valid ones.  Summaries are written per block,
+ * but curseg_mutex, the segment lock and the SIT update are taken once
+ * for the whole run.  Returns the number of blocks allocated, which stops
+ * short of @count at the end of the current segment or at an SSR hole,
+ * and is 0 if @goal is not NULL_ADDR and the log does not continue there.
+ */
+unsigned int f3fs_allocate_data_blocks(struct f3fs_sb_info *sbi,
+		block_t goal, block_t *new_blkaddr, nid_t nid,
+		unsigned int ofs_in_node, unsigned char version,
+		unsigned int count, int type)
+{
+	struct sit_info *sit_i = SIT_I(sbi);
+	struct curseg_info *curseg = CURSEG_I(sbi, type);
+	struct f3fs_summary sum;
+	unsigned int valid_blocks, segno, i;
+	enum dirty_type seg_dirty_type;
+	block_t start;
+	u64 sentry_token;
+
+	f3fs_bug_on(sbi, type == CURSEG_ALL_DATA_ATGC);
+
+	f3fs_down_read(&SM_I(sbi)->curseg_lock);
+	lock_curseg(sbi, curseg);
+
+	start = NEXT_FREE_BLKADDR(sbi, curseg);
+	if (goal != NULL_ADDR && start != goal) {
+		unlock_curseg(sbi, curseg);
+		f3fs_up_read(&SM_I(sbi)->curseg_lock);
+		return 0;
+	}
+	segno = GET_SEGNO(sbi, start);
+	sentry_token = sentry_down_write(sbi, get_seg_entry(sbi, segno));
+
+	f3fs_bug_on(sbi, curseg->next_blkoff >= sbi->blocks_per_seg);
+
+	for (i = 0; i < count; i++) {
+		if (i && NEXT_FREE_BLKADDR(sbi, curseg) != start + i)
+			break;
+
+		f3fs_wait_discard_bio(sbi, start + i);
+
+		set_summary(&sum, nid, ofs_in_node + i, version);
+		__add_sum_entry(sbi, type, &sum);
+		__refresh_next_blkoff(sbi, curseg);
+		stat_inc_block_count(sbi, curseg);
+
+		if (!__has_curseg_space(sbi, curseg)) {
+			i++;
+			break;
+		}
+	}
+
+	/* as in f3fs_allocate_data_block2, SIT goes before a new segment */
+	update_sit_entry_run(sbi, start, i, &valid_blocks, &seg_dirty_type);
+
+	if (!__has_curseg_space(sbi, curseg)) {
+		sit_i->s_ops->allocate_segment2(sbi, type, false);
+		locate_dirty_segment2(sbi, segno, valid_blocks, seg_dirty_type);
 	}
 
-	mutex_unlock(&curseg->curseg_mutex);
+	sentry_up_write(sbi, get_seg_entry(sbi, segno), sentry_token);
 
+	unlock_curseg(sbi, curseg);
 	f3fs_up_read(&SM_I(sbi)->curseg_lock);
+
+	*new_blkaddr = start;
+	return i;
 }
 
 void f3fs_update_device_state(struct f3fs_sb_info *sbi, nid_t ino,
@@ -3398,7 +3595,7 @@ static void do_write_page2(struct f3fs_summary *sum, struct f3fs_io_info *fio)
 
 
   if (keep_order)
-    f3fs_down_read(&fio->sbi->io_order_lock);
+    f3fs_down_read(&CURSEG_I(fio->sbi, type)->io_order_lock);
 
 reallocate:
   f3fs_allocate_data_block2(fio->sbi, fio->page, fio->old_blkaddr,
@@ -3419,7 +3616,7 @@ static void do_write_page2(struct f3fs_summary *sum, struct f3fs_io_info *fio)
   f3fs_update_device_state(fio->sbi, fio->ino, fio->new_blkaddr, 1);
 
   if (keep_order)
-    f3fs_up_read(&fio->sbi->io_order_lock);
+    f3fs_up_read(&CURSEG_I(fio->sbi, type)->io_order_lock);
 }
 
 static void do_write_page(struct f3fs_summary *sum, struct f3fs_io_info *fio)
@@ -3429,7 +3626,7 @@ static void do_write_page(struct f3fs_summary *sum, struct f3fs_io_info *fio)
     (type >= CURSEG_COLD_GC_DATA_START && type <= CURSEG_COLD_GC_DATA_END)));
 
 	if (keep_order)
-		f3fs_down_read(&fio->sbi->io_order_lock);
+		f3fs_down_read(&CURSEG_I(fio->sbi, type)->io_order_lock);
 reallocate:
 	f3fs_allocate_data_block2(fio->sbi, fio->page, fio->old_blkaddr,
 			&fio->new_blkaddr, sum, type, fio);
@@ -3449,7 +3646,7 @@ static void do_write_page(struct f3fs_summary *sum, struct f3fs_io_info *fio)
 	f3fs_update_device_state(fio->sbi, fio->ino, fio->new_blkaddr, 1);
 
 	if (keep_order)
-		f3fs_up_read(&fio->sbi->io_order_lock);
+		f3fs_up_read(&CURSEG_I(fio->sbi, type)->io_order_lock);
 }
 
 void f3fs_do_write_meta_page(struct f3fs_sb_info *sbi, struct page *page,
@@ -3623,7 +3820,7 @@ void f3fs_do_replace_block(struct f3fs_sb_info *sbi, struct f3fs_summary *sum,
 	f3fs_bug_on(sbi, !IS_DATASEG(type));
 	curseg = CURSEG_I(sbi, type);
 
-	mutex_lock(&curseg->curseg_mutex);
+	lock_curseg(sbi, curseg);
 	down_write(&sit_i->sentry_only_lock);
 //	down_write(&sit_i->mtime_lock);
 	down_write(&sit_i->dirty_sentry_lock);
@@ -3678,7 +3875,7 @@ void f3fs_do_replace_block(struct f3fs_sb_info *sbi, struct f3fs_summary *sum,
 //	up_write(&sit_i->mtime_lock);
 	up_write(&sit_i->sentry_only_lock);
 
-	mutex_unlock(&curseg->curseg_mutex);
+	unlock_curseg(sbi, curseg);
 	f3fs_up_write(&SM_I(sbi)->curseg_lock);
 }
 
@@ -3697,6 +3894,152 @@ void f3fs_replace_block(struct f3fs_sb_info *sbi, struct dnode_of_data *dn,
 	f3fs_update_data_blkaddr(dn, new_addr);
 }
 
+/*
+ * A prefree data segment may go back to the free pool before the next
+ * checkpoint only if nothing was written into it since the last one and
+ * every block the checkpoint still points at was moved by GC and is in
+ * @rb, so that the reclaim journal can redo all of those moves.
+ */
+bool f3fs_segment_reclaimable(struct f3fs_sb_info *sbi,
+				struct gc_reclaim_batch *rb)
+{
+	unsigned int segno = rb->segno;
+	struct seg_entry *se = get_seg_entry(sbi, segno);
+	bool ret;
+	int i;
+
+	if (!sbi->reclaim_journal || __is_large_section(sbi) ||
+			is_sbi_flag_set(sbi, SBI_CP_DISABLED) || !rb->nr)
+		return false;
+	if (!IS_DATASEG(se->type) || IS_CURSEG(sbi, segno) ||
+			test_bit(segno, SIT_I(sbi)->written_segmap) ||
+			!test_bit(segno, DIRTY_I(sbi)->dirty_segmap[PRE]))
+		return false;
+
+	sentry_down_read(sbi, se);
+	/*
+	 * Count the map itself rather than trusting ckpt_valid_blocks: all
+	 * @rb->nr entries are distinct, so equal weights mean they are
+	 * exactly the checkpointed blocks.
+	 */
+	ret = !se->valid_blocks &&
+		bitmap_weight(se->ckpt_valid_map, sbi->blocks_per_seg) == rb->nr;
+	for (i = 0; ret && i < rb->nr; i++) {
+		block_t blkaddr = rb->entries[i].old_blkaddr;
+
+		ret = GET_SEGNO(sbi, blkaddr) == segno &&
+			f3fs_test_bit(GET_BLKOFF_FROM_SEG0(sbi, blkaddr),
+					(char *)se->ckpt_valid_map);
+	}
+	up_read(&se->local_lock);
+	return ret;
+}
+
+/* Called once the journal record for @rb is durable. */
+void f3fs_reclaim_prefree_segment(struct f3fs_sb_info *sbi,
+				struct gc_reclaim_batch *rb)
+{
+	struct dirty_seglist_info *dirty_i = DIRTY_I(sbi);
+	struct seg_entry *se = get_seg_entry(sbi, rb->segno);
+	u64 token;
+	int i;
+
+	/*
+	 * Replay rewrites the node entries to point at the copies, so SSR
+	 * must not reuse them before the next checkpoint covers them.
+	 */
+	for (i = 0; i < rb->nr; i++) {
+		block_t blkaddr = rb->entries[i].new_blkaddr;
+		struct seg_entry *nse =
+			get_seg_entry(sbi, GET_SEGNO(sbi, blkaddr));
+
+		token = sentry_down_write(sbi, nse);
+		f3fs_set_bit(GET_BLKOFF_FROM_SEG0(sbi, blkaddr),
+					(char *)nse->ckpt_valid_map);
+		sentry_up_write(sbi, nse, token);
+	}
+
+	token = sentry_down_write(sbi, se);
+	memset(se->ckpt_valid_map, 0, SIT_VBLOCK_MAP_SIZE);
+	se->ckpt_valid_blocks = 0;
+	sentry_up_write(sbi, se, token);
+
+	mutex_lock(&dirty_i->seglist_lock);
+	if (test_and_clear_bit(rb->segno, dirty_i->dirty_segmap[PRE])) {
+		atomic_dec(&dirty_i->nr_dirty[PRE]);
+		__set_test_and_free(sbi, rb->segno, false);
+	}
+	mutex_unlock(&dirty_i->seglist_lock);
+}
+
+/*
+ * Redo one journaled GC move at mount time: account @new_blkaddr as
+ * valid with summary @sum and drop @old_blkaddr, the same way
+ * f3fs_allocate_data_block2 would have done it.
+ */
+void f3fs_replay_block_move(struct f3fs_sb_info *sbi, struct f3fs_summary *sum,
+				block_t old_blkaddr, block_t new_blkaddr)
+{
+	unsigned int old_segno = GET_SEGNO(sbi, old_blkaddr);
+	unsigned int new_segno = GET_SEGNO(sbi, new_blkaddr);
+	unsigned short blkoff = GET_BLKOFF_FROM_SEG0(sbi, new_blkaddr);
+	struct seg_entry *se = get_seg_entry(sbi, new_segno);
+	unsigned int valid_blocks;
+	enum dirty_type dirty_type;
+	int type;
+
+	f3fs_down_read(&SM_I(sbi)->curseg_lock);
+
+	type = __f3fs_get_curseg(sbi, new_segno);
+	if (type != NO_CHECK_TYPE) {
+		struct curseg_info *curseg = CURSEG_I(sbi, type);
+
+		lock_curseg(sbi, curseg);
+		curseg->sum_blk->entries[blkoff] = *sum;
+		update_sit_entry2(sbi, new_blkaddr, 1, &valid_blocks,
+							&dirty_type, 0);
+		if (curseg->alloc_type == SSR) {
+			if (blkoff == curseg->next_blkoff)
+				__refresh_next_blkoff(sbi, curseg);
+		} else if (blkoff >= curseg->next_blkoff) {
+			curseg->next_blkoff = blkoff + 1;
+		}
+		if (!__has_curseg_space(sbi, curseg))
+			SIT_I(sbi)->s_ops->allocate_segment2(sbi, type, false);
+		unlock_curseg(sbi, curseg);
+	} else {
+		struct page *page = f3fs_get_sum_page(sbi, new_segno);
+		struct f3fs_summary_block *sum_blk;
+
+		if (IS_ERR(page)) {
+			f3fs_up_read(&SM_I(sbi)->curseg_lock);
+			return;
+		}
+		sum_blk = (struct f3fs_summary_block *)page_address(page);
+		if (!se->valid_blocks) {
+			/* the copy went into a segment freed before the crash */
+			se->type = CURSEG_COLD_DATA;
+			memset(sum_blk, 0, PAGE_SIZE);
+			SET_SUM_TYPE(&sum_blk->footer, SUM_TYPE_DATA);
+			__set_test_and_inuse(sbi, new_segno);
+		}
+		sum_blk->entries[blkoff] = *sum;
+		set_page_dirty(page);
+		f3fs_put_page(page, 1);
+
+		update_sit_entry2(sbi, new_blkaddr, 1, &valid_blocks,
+							&dirty_type, 0);
+	}
+	/* as in f3fs_reclaim_prefree_segment, keep SSR off the copy */
+	f3fs_set_bit(blkoff, (char *)se->ckpt_valid_map);
+	locate_dirty_segment2(sbi, new_segno, valid_blocks, dirty_type);
+
+	update_sit_entry2(sbi, old_blkaddr, -1, &valid_blocks, &dirty_type, 0);
+	locate_dirty_segment2(sbi, old_segno, valid_blocks, dirty_type);
+
+	f3fs_up_read(&SM_I(sbi)->curseg_lock);
+}
+
 void f3fs_wait_on_page_writeback(struct page *page,
 				enum page_type type, bool ordered, bool locked)
 {
@@ -3756,7 +4099,7 @@ static int read_compacted_summaries(struct f3fs_sb_info *sbi)
 	unsigned char *kaddr;
 	struct page *page;
 	block_t start;
-	int i, j, offset;
+	int i, j, offset, last;
 
 	start = start_sum_block(sbi);
 
@@ -3775,7 +4118,8 @@ static int read_compacted_summaries(struct f3fs_sb_info *sbi)
 	offset = 2 * SUM_JOURNAL_SIZE;
 
 	/* Step 3: restore summary entries */
-	for (i = CURSEG_HOT_DATA; i <= CURSEG_COLD_GC_DATA_END; i++) {
+	last = CURSEG_COLD_GC_DATA_START + ckpt_gc_logs(ckpt) - 1;
+	for (i = CURSEG_HOT_DATA; i <= last; i++) {
 		unsigned short blk_off;
 		unsigned int segno;
 
@@ -3823,6 +4167,7 @@ static int read_normal_summaries(struct f3fs_sb_info *sbi, int type)
 	unsigned short blk_off;
 	unsigned int segno = 0;
 	block_t blk_addr = 0;
+	int nr_data = 3 + ckpt_gc_logs(ckpt);
 	int err = 0;
 
 	/* get segment number and block addr */
@@ -3831,9 +4176,10 @@ static int read_normal_summaries(struct f3fs_sb_info *sbi, int type)
 		blk_off = le16_to_cpu(ckpt->cur_data_blkoff[type -
 							CURSEG_HOT_DATA]);
 		if (__exist_node_summaries(sbi))
-			blk_addr = sum_blk_addr(sbi, NR_CURSEG_PERSIST_TYPE, type);
+			blk_addr = sum_blk_addr(sbi,
+					nr_data + NR_CURSEG_NODE_TYPE, type);
 		else
-			blk_addr = sum_blk_addr(sbi, NR_CURSEG_DATA_TYPE, type);
+			blk_addr = sum_blk_addr(sbi, nr_data, type);
 	} else {
 		segno = le32_to_cpu(ckpt->cur_node_segno[type -
 							CURSEG_HOT_NODE]);
@@ -3869,7 +4215,7 @@ static int read_normal_summaries(struct f3fs_sb_info *sbi, int type)
 
 	/* set uncompleted segment to curseg */
 	curseg = CURSEG_I(sbi, type);
-	mutex_lock(&curseg->curseg_mutex);
+	lock_curseg(sbi, curseg);
 
 	/* update journal info */
 	down_write(&curseg->journal_rwsem);
@@ -3882,7 +4228,7 @@ static int read_normal_summaries(struct f3fs_sb_info *sbi, int type)
 	reset_curseg(sbi, type, 0);
 	curseg->alloc_type = ckpt->alloc_type[type];
 	curseg->next_blkoff = blk_off;
-	mutex_unlock(&curseg->curseg_mutex);
+	unlock_curseg(sbi, curseg);
 out:
 	f3fs_put_page(new, 1);
 	return err;
@@ -3892,7 +4238,9 @@ static int restore_curseg_summaries(struct f3fs_sb_info *sbi)
 {
 	struct f3fs_journal *sit_j = CURSEG_I(sbi, CURSEG_COLD_DATA)->journal;
 	struct f3fs_journal *nat_j = CURSEG_I(sbi, CURSEG_HOT_DATA)->journal;
-	int type = CURSEG_HOT_DATA;
+	int ckpt_logs = ckpt_gc_logs(F3FS_CKPT(sbi));
+	int nr_data = 3 + ckpt_logs;
+	int type = CURSEG_HOT_DATA, ofs = 0;
 	int err;
 
 	if (is_set_ckpt_flags(sbi, CP_COMPACT_SUM_FLAG)) {
@@ -3907,14 +4255,19 @@ static int restore_curseg_summaries(struct f3fs_sb_info *sbi)
 		if (err)
 			return err;
 		type = CURSEG_HOT_NODE;
+		ofs = nr_data;
 	}
 
 	if (__exist_node_summaries(sbi))
 		f3fs_ra_meta_pages(sbi,
-				sum_blk_addr(sbi, NR_CURSEG_PERSIST_TYPE, type),
-				NR_CURSEG_PERSIST_TYPE - type, META_CP, true);
+			sum_blk_addr(sbi, nr_data + NR_CURSEG_NODE_TYPE, ofs),
+			nr_data + NR_CURSEG_NODE_TYPE - ofs, META_CP, true);
 
 	for (; type <= CURSEG_COLD_NODE; type++) {
+		/* GC logs the checkpoint does not carry */
+		if (type >= CURSEG_COLD_GC_DATA_START + ckpt_logs &&
+				type <= CURSEG_COLD_GC_DATA_END)
+			continue;
 		err = read_normal_summaries(sbi, type);
 		if (err)
 			return err;
@@ -3928,6 +4281,8 @@ static int restore_curseg_summaries(struct f3fs_sb_info *sbi)
 		return -EINVAL;
 	}
 
+	f3fs_build_journal_index(CURSEG_I(sbi, CURSEG_HOT_DATA), NAT_JOURNAL);
+	f3fs_build_journal_index(CURSEG_I(sbi, CURSEG_COLD_DATA), SIT_JOURNAL);
 	return 0;
 }
 
@@ -3955,7 +4310,7 @@ static void write_compacted_summaries(struct f3fs_sb_info *sbi, block_t blkaddr)
 	written_size += SUM_JOURNAL_SIZE;
 
 	/* Step 3: write summary entries */
-	for (i = CURSEG_HOT_DATA; i <= CURSEG_COLD_GC_DATA_END; i++) {
+	for (i = CURSEG_HOT_DATA; i <= CURSEG_GC_DATA_LAST(sbi); i++) {
 		unsigned short blkoff;
 
 		seg_i = CURSEG_I(sbi, i);
@@ -3996,7 +4351,7 @@ static void write_normal_summaries(struct f3fs_sb_info *sbi,
 	int i, end;
 
 	if (IS_DATASEG(type))
-		end = type + NR_CURSEG_DATA_TYPE;
+		end = type + NR_DATA_LOG(sbi);
 	else
 		end = type + NR_CURSEG_NODE_TYPE;
 
@@ -4017,26 +4372,80 @@ void f3fs_write_node_summaries(struct f3fs_sb_info *sbi, block_t start_blk)
 	write_normal_summaries(sbi, start_blk, CURSEG_HOT_NODE);
 }
 
-int f3fs_lookup_journal_in_cursum(struct f3fs_journal *journal, int type,
+static inline unsigned int journal_key(struct f3fs_journal *journal,
+						int type, int i)
+{
+	if (type == NAT_JOURNAL)
+		return le32_to_cpu(nid_in_journal(journal, i));
+	return le32_to_cpu(segno_in_journal(journal, i));
+}
+
+static inline int journal_entries(struct f3fs_journal *journal, int type)
+{
+	if (type == NAT_JOURNAL)
+		return nats_in_cursum(journal);
+	return sits_in_cursum(journal);
+}
+
+/*
+ * Caller should hold journal_seqlock for write, or sample it for read.
+ * Journal entries are only appended or dropped all together, so the index
+ * never needs to delete a single bucket.
+ */
+int f3fs_lookup_journal_in_cursum(struct curseg_info *curseg, int type,
 					unsigned int val, int alloc)
 {
+	struct f3fs_journal *journal = curseg->journal;
+	int nr = journal_entries(journal, type);
+	unsigned int hash = hash_32(val, JOURNAL_HASH_BITS);
+	int i, n;
+
+	for (n = 0; n < JOURNAL_HASH_SIZE; n++) {
+		i = READ_ONCE(curseg->journal_hash[hash]) - 1;
+		if (i < 0)
+			break;
+		if (i < nr && journal_key(journal, type, i) == val)
+			return i;
+		hash = (hash + 1) & (JOURNAL_HASH_SIZE - 1);
+	}
+
+	if (!alloc || n == JOURNAL_HASH_SIZE ||
+			!__has_cursum_space(journal, 1, type))
+		return -1;
+
+	if (type == NAT_JOURNAL)
+		i = update_nats_in_cursum(journal, 1);
+	else
+		i = update_sits_in_cursum(journal, 1);
+	WRITE_ONCE(curseg->journal_hash[hash], i + 1);
+	return i;
+}
+
+void f3fs_reset_journal_index(struct curseg_info *curseg)
+{
+	memset(curseg->journal_hash, 0, sizeof(curseg->journal_hash));
+}
+
+/*
+ * Rebuild the index after the journal was loaded from the summary blocks.
+ */
+void f3fs_build_journal_index(struct curseg_info *curseg, int type)
+{
+	struct f3fs_journal *journal = curseg->journal;
 	int i;
 
-	if (type == NAT_JOURNAL) {
-		for (i = 0; i < nats_in_cursum(journal); i++) {
-			if (le32_to_cpu(nid_in_journal(journal, i)) == val)
-				return i;
-		}
-		if (alloc && __has_cursum_space(journal, 1, NAT_JOURNAL))
-			return update_nats_in_cursum(journal, 1);
-	} else if (type == SIT_JOURNAL) {
-		for (i = 0; i < sits_in_cursum(journal); i++)
-			if (le32_to_cpu(segno_in_journal(journal, i)) == val)
-				return i;
-		if (alloc && __has_cursum_space(journal, 1, SIT_JOURNAL))
-			return update_sits_in_cursum(journal, 1);
+	write_seqlock(&curseg->journal_seqlock);
+	f3fs_reset_journal_index(curseg);
+	for (i = 0; i < journal_entries(journal, type); i++) {
+		unsigned int hash;
+
+		hash = hash_32(journal_key(journal, type, i),
+						JOURNAL_HASH_BITS);
+		while (curseg->journal_hash[hash])
+			hash = (hash + 1) & (JOURNAL_HASH_SIZE - 1);
+		curseg->journal_hash[hash] = i + 1;
 	}
-	return -1;
+	write_sequnlock(&curseg->journal_seqlock);
 }
 
 static struct page *get_current_sit_page(struct f3fs_sb_info *sbi,
@@ -4148,7 +4557,10 @@ static void remove_sits_in_journal(struct f3fs_sb_info *sbi)
 		if (!dirtied)
 			add_sit_entry(segno, &SM_I(sbi)->sit_entry_set);
 	}
+	write_seqlock(&curseg->journal_seqlock);
 	update_sits_in_cursum(journal, -i);
+	f3fs_reset_journal_index(curseg);
+	write_sequnlock(&curseg->journal_seqlock);
 	up_write(&curseg->journal_rwsem);
 }
 
@@ -4222,7 +4634,7 @@ void f3fs_flush_sit_entries(struct f3fs_sb_info *sbi, struct cp_control *cpc)
 		for_each_set_bit_from(segno, bitmap, end) {
 			int offset, sit_offset;
 			se = get_seg_entry(sbi, segno);
-      down_read(&se->local_lock);
+      sentry_down_read(sbi, se);
 
 #ifdef CONFIG_F3FS_CHECK_FS
 			if (memcmp(se->cur_valid_map, se->cur_valid_map_mir,
@@ -4237,13 +4649,15 @@ void f3fs_flush_sit_entries(struct f3fs_sb_info *sbi, struct cp_control *cpc)
 			}
 
 			if (to_journal) {
-				offset = f3fs_lookup_journal_in_cursum(journal,
+				write_seqlock(&curseg->journal_seqlock);
+				offset = f3fs_lookup_journal_in_cursum(curseg,
 							SIT_JOURNAL, segno, 1);
 				f3fs_bug_on(sbi, offset < 0);
 				segno_in_journal(journal, offset) =
 							cpu_to_le32(segno);
 				seg_info_to_raw_sit(se,
 					&sit_in_journal(journal, offset));
+				write_sequnlock(&curseg->journal_seqlock);
 				check_block_count(sbi, segno,
 					&sit_in_journal(journal, offset));
 			} else {
@@ -4255,6 +4669,7 @@ void f3fs_flush_sit_entries(struct f3fs_sb_info *sbi, struct cp_control *cpc)
 			}
 
 			__clear_bit(segno, bitmap);
+			clear_bit(segno, sit_i->written_segmap);
 			ses->entry_cnt--;
       up_read(&se->local_lock);
 		}
@@ -4320,6 +4735,11 @@ static int build_sit_info(struct f3fs_sb_info *sbi)
 	if (!sit_i->dirty_sentries_bitmap)
 		return -ENOMEM;
 
+	sit_i->written_segmap = f3fs_kvzalloc(sbi, main_bitmap_size,
+								GFP_KERNEL);
+	if (!sit_i->written_segmap)
+		return -ENOMEM;
+
 	for (start = 0; start < MAIN_SEGS(sbi); start++) {
    /* sit_i->sentries[start].cur_valmap_lock =
       f3fs_kzalloc(sbi, sizeof(struct rw_semaphore), GFP_KERNEL);
@@ -4412,7 +4832,8 @@ static int build_free_segmap(struct f3fs_sb_info *sbi)
 static int build_curseg(struct f3fs_sb_info *sbi)
 {
 	struct curseg_info *array;
-	int i;
+	unsigned int ckpt_logs = ckpt_gc_logs(F3FS_CKPT(sbi));
+	int i, last;
 
 	array = f3fs_kzalloc(sbi, array_size(NR_CURSEG_TYPE,
 					sizeof(*array)), GFP_KERNEL);
@@ -4421,25 +4842,35 @@ static int build_curseg(struct f3fs_sb_info *sbi)
 
 	SM_I(sbi)->curseg_array = array;
 
+	sbi->nr_gc_log = F3FS_OPTION(sbi).gc_logs ?: ckpt_logs;
+	if (f3fs_readonly(sbi->sb))
+		sbi->nr_gc_log = ckpt_logs;
+	/* GC logs the checkpoint carries stay loaded until resize_gc_logs() */
+	last = CURSEG_COLD_GC_DATA_START + max(sbi->nr_gc_log, ckpt_logs) - 1;
+
 	for (i = 0; i < NO_CHECK_TYPE; i++) {
 		mutex_init(&array[i].curseg_mutex);
+		init_f3fs_rwsem(&array[i].io_order_lock);
+		array[i].segno = NULL_SEGNO;
+		array[i].next_blkoff = 0;
+		array[i].inited = false;
+		if (i < NR_PERSISTENT_LOG)
+			array[i].seg_type = CURSEG_HOT_DATA + i;
+		else if (i == CURSEG_COLD_DATA_PINNED)
+			array[i].seg_type = CURSEG_COLD_DATA;
+		else if (i == CURSEG_ALL_DATA_ATGC)
+			array[i].seg_type = CURSEG_COLD_DATA;
+		if (i > last && i <= CURSEG_COLD_GC_DATA_END)
+			continue;
 		array[i].sum_blk = f3fs_kzalloc(sbi, PAGE_SIZE, GFP_KERNEL);
 		if (!array[i].sum_blk)
 			return -ENOMEM;
 		init_rwsem(&array[i].journal_rwsem);
+		seqlock_init(&array[i].journal_seqlock);
 		array[i].journal = f3fs_kzalloc(sbi,
 				sizeof(struct f3fs_journal), GFP_KERNEL);
 		if (!array[i].journal)
 			return -ENOMEM;
-		if (i < NR_PERSISTENT_LOG)
-			array[i].seg_type = CURSEG_HOT_DATA + i;
-		else if (i == CURSEG_COLD_DATA_PINNED)
-			array[i].seg_type = CURSEG_COLD_DATA;
-		else if (i == CURSEG_ALL_DATA_ATGC)
-			array[i].seg_type = CURSEG_COLD_DATA;
-		array[i].segno = NULL_SEGNO;
-		array[i].next_blkoff = 0;
-		array[i].inited = false;
 	}
 	return restore_curseg_summaries(sbi);
 }
@@ -4605,6 +5036,8 @@ static void init_free_segmap(struct f3fs_sb_info *sbi)
 	for (type = CURSEG_HOT_DATA; type <= CURSEG_COLD_NODE; type++) {
 		struct curseg_info *curseg_t = CURSEG_I(sbi, type);
 
+		if (!curseg_t->inited)
+			continue;
 		__set_test_and_inuse(sbi, curseg_t->segno);
 	}
 }
@@ -4612,13 +5045,12 @@ static void init_free_segmap(struct f3fs_sb_info *sbi)
 static void init_dirty_segmap(struct f3fs_sb_info *sbi)
 {
 	struct dirty_seglist_info *dirty_i = DIRTY_I(sbi);
-	struct free_segmap_info *free_i = FREE_I(sbi);
 	unsigned int segno = 0, offset = 0, secno;
 	block_t valid_blocks, usable_blks_in_seg;
 
 	while (1) {
 		/* find dirty segment based on free segmap */
-		segno = find_next_inuse(free_i, MAIN_SEGS(sbi), offset);
+		segno = find_next_inuse(sbi, MAIN_SEGS(sbi), offset);
 		if (segno >= MAIN_SEGS(sbi))
 			break;
 		offset = segno + 1;
@@ -4696,6 +5128,13 @@ static int build_dirty_segmap(struct f3fs_sb_info *sbi)
 			return -ENOMEM;
 	}
 
+	for (i = 0; i < DIRTY; i++) {
+		int err = percpu_counter_init(&dirty_i->nr_dirty_type[i], 0,
+								GFP_KERNEL);
+		if (err)
+			return err;
+	}
+
 	if (__is_large_section(sbi)) {
 		bitmap_size = f3fs_bitmap_size(MAIN_SECS(sbi));
 		dirty_i->dirty_secmap = f3fs_kvzalloc(sbi,
@@ -4718,9 +5157,13 @@ static int sanity_check_curseg(struct f3fs_sb_info *sbi)
 	 */
 	for (i = 0; i < NR_PERSISTENT_LOG; i++) {
 		struct curseg_info *curseg = CURSEG_I(sbi, i);
-		struct seg_entry *se = get_seg_entry(sbi, curseg->segno);
+		struct seg_entry *se;
 		unsigned int blkofs = curseg->next_blkoff;
 
+		if (!curseg_in_use(sbi, i))
+			continue;
+		se = get_seg_entry(sbi, curseg->segno);
+
 		if (f3fs_sb_has_readonly(sbi) &&
 			i != CURSEG_HOT_DATA && i != CURSEG_HOT_NODE)
 			continue;
@@ -4961,6 +5404,8 @@ int f3fs_fix_curseg_write_pointer(struct f3fs_sb_info *sbi)
 	int i, ret;
 
 	for (i = 0; i < NR_PERSISTENT_LOG; i++) {
+		if (!curseg_in_use(sbi, i))
+			continue;
 		ret = fix_curseg_write_pointer(sbi, i);
 		if (ret)
 			return ret;
@@ -5140,7 +5585,7 @@ static void init_min_max_mtime(struct f3fs_sb_info *sbi)
 	struct sit_info *sit_i = SIT_I(sbi);
 	unsigned int segno;
 
-	sit_i->min_mtime = ULLONG_MAX;
+	atomic64_set(&sit_i->min_mtime, ULLONG_MAX);
 
 	for (segno = 0; segno < MAIN_SEGS(sbi); segno += sbi->segs_per_sec) {
 		unsigned int i;
@@ -5151,13 +5596,67 @@ static void init_min_max_mtime(struct f3fs_sb_info *sbi)
 
 		mtime = div_u64(mtime, sbi->segs_per_sec);
 
-		if (sit_i->min_mtime > mtime)
-			sit_i->min_mtime = mtime;
+		update_min_mtime_atomic(sbi, mtime);
 	}
 	atomic64_set(&sit_i->max_mtime, get_mtime(sbi, false));
 	sit_i->dirty_max_mtime = 0;
 }
 
+/*
+ * Open or close GC data logs when gc_logs= asks for a count other than the
+ * one in the checkpoint.  A closed log's segment turns into an ordinary
+ * dirty or prefree segment; the next checkpoint records the new count.
+ */
+static void resize_gc_logs(struct f3fs_sb_info *sbi)
+{
+	unsigned int ckpt_logs = ckpt_gc_logs(F3FS_CKPT(sbi));
+	int type;
+
+	if (sbi->nr_gc_log == ckpt_logs)
+		return;
+
+	if (sbi->nr_gc_log > ckpt_logs &&
+			free_segments(sbi) < sbi->nr_gc_log - ckpt_logs +
+						reserved_segments(sbi)) {
+		f3fs_warn(sbi, "no room to open %u GC logs, keep %u",
+			  sbi->nr_gc_log, ckpt_logs);
+		sbi->nr_gc_log = ckpt_logs;
+		return;
+	}
+
+	for (type = CURSEG_GC_DATA_LAST(sbi) + 1;
+			type < CURSEG_COLD_GC_DATA_START + ckpt_logs; type++) {
+		struct curseg_info *curseg = CURSEG_I(sbi, type);
+		unsigned int segno = curseg->segno;
+		struct seg_entry *se = get_seg_entry(sbi, segno);
+
+		write_sum_page(sbi, curseg->sum_blk, GET_SUM_BLOCK(sbi, segno));
+		se->curseg = 0;
+		curseg->segno = NULL_SEGNO;
+		curseg->inited = false;
+		locate_dirty_segment2(sbi, segno,
+				get_valid_blocks(sbi, segno, false), se->type);
+
+		kfree(curseg->sum_blk);
+		curseg->sum_blk = NULL;
+		kfree(curseg->journal);
+		curseg->journal = NULL;
+	}
+
+	for (type = CURSEG_COLD_GC_DATA_START + ckpt_logs;
+			type <= CURSEG_GC_DATA_LAST(sbi); type++) {
+		struct curseg_info *curseg = CURSEG_I(sbi, type);
+		unsigned int segno = 0;
+
+		get_new_segment(sbi, &segno, false, ALLOC_RIGHT);
+		curseg->next_segno = segno;
+		reset_curseg(sbi, type, 1);
+		curseg->alloc_type = LFS;
+	}
+
+	f3fs_notice(sbi, "GC data logs: %u -> %u", ckpt_logs, sbi->nr_gc_log);
+}
+
 int f3fs_build_segment_manager(struct f3fs_sb_info *sbi)
 {
 	struct f3fs_super_block *raw_super = F3FS_RAW_SUPER(sbi);
@@ -5190,6 +5689,7 @@ int f3fs_build_segment_manager(struct f3fs_sb_info *sbi)
 	sm_info->min_seq_blocks = sbi->blocks_per_seg;
 	sm_info->min_hot_blocks = DEF_MIN_HOT_BLOCKS;
 	sm_info->min_ssr_sections = reserved_sections(sbi);
+	f3fs_init_adaptive_ipu(sbi);
 
 	INIT_LIST_HEAD(&sm_info->sit_entry_set);
 
@@ -5225,6 +5725,8 @@ int f3fs_build_segment_manager(struct f3fs_sb_info *sbi)
 	if (err)
 		return err;
 
+	resize_gc_logs(sbi);
+
 	err = sanity_check_curseg(sbi);
 	if (err)
 		return err;
@@ -5240,7 +5742,10 @@ static void discard_dirty_segmap(struct f3fs_sb_info *sbi,
 
 	mutex_lock(&dirty_i->seglist_lock);
 	kvfree(dirty_i->dirty_segmap[dirty_type]);
-	atomic_set(&dirty_i->nr_dirty[dirty_type], 0);
+	if (dirty_type < DIRTY)
+		percpu_counter_destroy(&dirty_i->nr_dirty_type[dirty_type]);
+	else
+		atomic_set(&dirty_i->nr_dirty[dirty_type], 0);
 	mutex_unlock(&dirty_i->seglist_lock);
 }
 
@@ -5320,6 +5825,7 @@ static void destroy_sit_info(struct f3fs_sb_info *sbi)
 	kvfree(sit_i->sentries);
 	kvfree(sit_i->sec_entries);
 	kvfree(sit_i->dirty_sentries_bitmap);
+	kvfree(sit_i->written_segmap);
 
 	SM_I(sbi)->sit_info = NULL;
 	kvfree(sit_i->sit_bitmap);
@@ -190,6 +190,8 @@ struct victim_sel_policy {
 	unsigned int min_segno;		/* segment # having min. cost */
 	unsigned long long age;		/* mtime of GCed section*/
 	unsigned long long age_threshold;/* age threshold */
+	unsigned long long dirty_min_mtime;	/* rerange candidates in GC_AT */
+	unsigned long long dirty_max_mtime;	/* rerange candidates in GC_AT */
 };
 
 struct seg_entry {
@@ -238,6 +240,7 @@ struct sit_info {
 
 	unsigned long *tmp_map;			/* bitmap for temporal use */
 	unsigned long *dirty_sentries_bitmap;	/* bitmap for dirty sentries */
+	unsigned long *written_segmap;		/* segments written since last cp */
 	atomic_t dirty_sentries;		/* # of dirty sentries */
 	unsigned int sents_per_block;		/* # of SIT entries per block */
 	struct seg_entry *sentries;		/* SIT segment-level cache */
@@ -255,11 +258,10 @@ struct sit_info {
 	/* for cost-benefit algorithm in cleaning procedure */
 	unsigned long long elapsed_time;	/* elapsed time after mount */
 	unsigned long long mounted_time;	/* mount time */
-	unsigned long long min_mtime;		/* min. modification time */
+	atomic64_t min_mtime;			/* min. modification time */
 	//unsigned long long max_mtime;		/* max. modification time */
 	atomic64_t max_mtime;
-	unsigned long long dirty_min_mtime;	/* rerange candidates in GC_AT */
-	unsigned long long dirty_max_mtime;	/* rerange candidates in GC_AT */
+	unsigned long long dirty_max_mtime;	/* newest candidate seen in GC_AT */
 
 	unsigned int last_victim[MAX_GC_POLICY]; /* last victim segment # */
 };
@@ -269,17 +271,21 @@ struct free_segmap_info {
 	unsigned int free_segments;	/* # of free segments */
 	unsigned int free_sections;	/* # of free sections */
 	spinlock_t segmap_lock;		/* free segmap lock */
+	u64 segmap_lock_token;		/* lock_segmap() timing */
 	unsigned long *free_segmap;	/* free segment bitmap */
 	unsigned long *free_secmap;	/* free section bitmap */
 };
 
-/* Notice: The order of dirty type is same with CURSEG_XXX in f3fs.h */
+/*
+ * Per-type dirty indexes used by SSR.  They follow the CURSEG_XXX order in
+ * f3fs.h, except that all GC logs share the single DIRTY_GC_DATA index;
+ * use seg_dirty_index() to map a segment type onto one.
+ */
 enum dirty_type {
 	DIRTY_HOT_DATA,		/* dirty segments assigned as hot data logs */
 	DIRTY_WARM_DATA,	/* dirty segments assigned as warm data logs */
 	DIRTY_COLD_DATA,	/* dirty segments assigned as cold data logs */
-  DIRTY_COLD_GC_DATA_START,
-  DIRTY_COLD_GC_DATA_END = DIRTY_COLD_GC_DATA_START + MAX_GC_WORKER - 1,
+	DIRTY_GC_DATA,		/* dirty segments assigned as any GC data log */
 	DIRTY_HOT_NODE,		/* dirty segments assigned as hot node logs */
 	DIRTY_WARM_NODE,	/* dirty segments assigned as warm node logs */
 	DIRTY_COLD_NODE,	/* dirty segments assigned as cold node logs */
@@ -288,12 +294,24 @@ enum dirty_type {
 	NR_DIRTY_TYPE
 };
 
+static inline enum dirty_type seg_dirty_index(int seg_type)
+{
+	if (seg_type < CURSEG_COLD_GC_DATA_START)
+		return seg_type;
+	if (seg_type <= CURSEG_COLD_GC_DATA_END)
+		return DIRTY_GC_DATA;
+	if (seg_type <= CURSEG_COLD_NODE)
+		return DIRTY_HOT_NODE + seg_type - CURSEG_HOT_NODE;
+	return DIRTY;
+}
+
 struct dirty_seglist_info {
 	const struct victim_selection *v_ops;	/* victim selction operation */
 	unsigned long *dirty_segmap[NR_DIRTY_TYPE];
 	unsigned long *dirty_secmap;
 	struct mutex seglist_lock;		/* lock for segment bitmaps */
-	atomic_t nr_dirty[NR_DIRTY_TYPE];		/* # of dirty segments */
+	atomic_t nr_dirty[NR_DIRTY_TYPE];	/* # of dirty/prefree segments */
+	struct percpu_counter nr_dirty_type[DIRTY];	/* # of dirty segments per index */
 	unsigned long *victim_secmap;		/* background GC victims */
 	unsigned long *pinned_secmap;		/* pinned victims from foreground GC */
 	unsigned int pinned_secmap_cnt;		/* count of victims which has pinned data */
@@ -308,12 +326,23 @@ struct victim_selection {
 					int, int, char, unsigned long long);
 };
 
+/*
+ * in-memory index over NAT/SIT journal entries, so that lookups neither scan
+ * the journal nor take journal_rwsem; each bucket keeps (journal slot + 1).
+ */
+#define JOURNAL_HASH_BITS	6
+#define JOURNAL_HASH_SIZE	(1 << JOURNAL_HASH_BITS)
+
 /* for active log information */
 struct curseg_info {
 	struct mutex curseg_mutex;		/* lock for consistency */
+	u64 curseg_mutex_token;			/* lock_curseg() timing */
+	struct f3fs_rwsem io_order_lock;	/* keep migration IO order in LFS mode */
 	struct f3fs_summary_block *sum_blk;	/* cached summary block */
 	struct rw_semaphore journal_rwsem;	/* protect journal area */
 	struct f3fs_journal *journal;		/* cached journal info */
+	seqlock_t journal_seqlock;		/* journal updates vs. lookups */
+	unsigned char journal_hash[JOURNAL_HASH_SIZE];	/* journal index */
 	unsigned char alloc_type;		/* current allocation type */
 	unsigned short seg_type;		/* segment type like CURSEG_XXX_TYPE */
 	unsigned int segno;			/* current segment number */
@@ -345,6 +374,31 @@ static inline struct seg_entry *get_seg_entry(struct f3fs_sb_info *sbi,
 	return &sit_i->sentries[segno];
 }
 
+/*
+ * seg_entry has no room for a stamp, so writers keep the token the
+ * profiler hands out and readers only have their wait timed.
+ */
+static inline u64 sentry_down_write(struct f3fs_sb_info *sbi,
+						struct seg_entry *se)
+{
+	return f3fs_lock_timed(sbi, LOCK_SENTRY,
+			down_write_trylock(&se->local_lock),
+			down_write(&se->local_lock));
+}
+
+static inline void sentry_up_write(struct f3fs_sb_info *sbi,
+					struct seg_entry *se, u64 token)
+{
+	f3fs_unlock_timed(sbi, LOCK_SENTRY, up_write(&se->local_lock), token);
+}
+
+static inline void sentry_down_read(struct f3fs_sb_info *sbi,
+						struct seg_entry *se)
+{
+	f3fs_lock_timed(sbi, LOCK_SENTRY, down_read_trylock(&se->local_lock),
+					down_read(&se->local_lock));
+}
+
 #if 0
 #define IS_CURSEG(sbi, seg)						\
 	(((seg) == CURSEG_I(sbi, CURSEG_HOT_DATA)->segno) ||	\
@@ -485,6 +539,23 @@ static inline unsigned long long update_max_mtime_atomic(struct f3fs_sb_info* sb
   return max_mtime;
 }
 
+/* GC workers age victims in parallel, so lower min_mtime with cmpxchg */
+static inline unsigned long long update_min_mtime_atomic(
+			struct f3fs_sb_info *sbi, unsigned long long new_time)
+{
+	u64 min_mtime = atomic64_read(&SIT_I(sbi)->min_mtime);
+
+	while (new_time < min_mtime) {
+		u64 old = atomic64_cmpxchg(&SIT_I(sbi)->min_mtime,
+						min_mtime, new_time);
+
+		if (old == min_mtime)
+			return new_time;
+		min_mtime = old;
+	}
+	return min_mtime;
+}
+
 static inline void seg_info_to_raw_sit(struct seg_entry *se,
 					struct f3fs_sit_entry *rs)
 {
@@ -494,13 +565,43 @@ static inline void seg_info_to_raw_sit(struct seg_entry *se,
 	se->ckpt_valid_blocks = se->valid_blocks;
 }
 
-static inline unsigned int find_next_inuse(struct free_segmap_info *free_i,
+static inline void lock_segmap(struct f3fs_sb_info *sbi)
+{
+	struct free_segmap_info *free_i = FREE_I(sbi);
+
+	free_i->segmap_lock_token = f3fs_spin_lock_timed(sbi, LOCK_SEGMAP,
+							&free_i->segmap_lock);
+}
+
+static inline void unlock_segmap(struct f3fs_sb_info *sbi)
+{
+	struct free_segmap_info *free_i = FREE_I(sbi);
+
+	f3fs_spin_unlock_timed(sbi, LOCK_SEGMAP, &free_i->segmap_lock,
+					free_i->segmap_lock_token);
+}
+
+static inline void lock_curseg(struct f3fs_sb_info *sbi,
+					struct curseg_info *curseg)
+{
+	curseg->curseg_mutex_token = f3fs_mutex_lock_timed(sbi, LOCK_CURSEG,
+							&curseg->curseg_mutex);
+}
+
+static inline void unlock_curseg(struct f3fs_sb_info *sbi,
+					struct curseg_info *curseg)
+{
+	f3fs_mutex_unlock_timed(sbi, LOCK_CURSEG, &curseg->curseg_mutex,
+					curseg->curseg_mutex_token);
+}
+
+static inline unsigned int find_next_inuse(struct f3fs_sb_info *sbi,
 		unsigned int max, unsigned int segno)
 {
 	unsigned int ret;
-	spin_lock(&free_i->segmap_lock);
-	ret = find_next_bit(free_i->free_segmap, max, segno);
-	spin_unlock(&free_i->segmap_lock);
+	lock_segmap(sbi);
+	ret = find_next_bit(FREE_I(sbi)->free_segmap, max, segno);
+	unlock_segmap(sbi);
 	return ret;
 }
 
@@ -512,7 +613,7 @@ static inline void __set_free(struct f3fs_sb_info *sbi, unsigned int segno)
 	unsigned int next;
 	unsigned int usable_segs = f3fs_usable_segs_in_sec(sbi, segno);
 
-	spin_lock(&free_i->segmap_lock);
+	lock_segmap(sbi);
 	clear_bit(segno, free_i->free_segmap);
 	free_i->free_segments++;
 
@@ -522,7 +623,7 @@ static inline void __set_free(struct f3fs_sb_info *sbi, unsigned int segno)
 		clear_bit(secno, free_i->free_secmap);
 		free_i->free_sections++;
 	}
-	spin_unlock(&free_i->segmap_lock);
+	unlock_segmap(sbi);
 }
 
 static inline void __set_inuse(struct f3fs_sb_info *sbi,
@@ -546,7 +647,7 @@ static inline void __set_test_and_free(struct f3fs_sb_info *sbi,
 	unsigned int next;
 	unsigned int usable_segs = f3fs_usable_segs_in_sec(sbi, segno);
 
-	spin_lock(&free_i->segmap_lock);
+	lock_segmap(sbi);
 	if (test_and_clear_bit(segno, free_i->free_segmap)) {
 		free_i->free_segments++;
 
@@ -560,7 +661,7 @@ static inline void __set_test_and_free(struct f3fs_sb_info *sbi,
 		}
 	}
 skip_free:
-	spin_unlock(&free_i->segmap_lock);
+	unlock_segmap(sbi);
 }
 
 static inline void __set_test_and_inuse(struct f3fs_sb_info *sbi,
@@ -569,13 +670,13 @@ static inline void __set_test_and_inuse(struct f3fs_sb_info *sbi,
 	struct free_segmap_info *free_i = FREE_I(sbi);
 	unsigned int secno = GET_SEC_FROM_SEG(sbi, segno);
 
-	spin_lock(&free_i->segmap_lock);
+	lock_segmap(sbi);
 	if (!test_and_set_bit(segno, free_i->free_segmap)) {
 		free_i->free_segments--;
 		if (!test_and_set_bit(secno, free_i->free_secmap))
 			free_i->free_sections--;
 	}
-	spin_unlock(&free_i->segmap_lock);
+	unlock_segmap(sbi);
 }
 
 static inline void get_sit_bitmap(struct f3fs_sb_info *sbi,
@@ -619,13 +720,7 @@ static inline unsigned int prefree_segments(struct f3fs_sb_info *sbi)
 
 static inline unsigned int dirty_segments(struct f3fs_sb_info *sbi)
 {
-  struct dirty_seglist_info* dirty_i = DIRTY_I(sbi);
-	return atomic_read(&dirty_i->nr_dirty[DIRTY_HOT_DATA]) +
-		atomic_read(&dirty_i->nr_dirty[DIRTY_WARM_DATA]) +
-		atomic_read(&dirty_i->nr_dirty[DIRTY_COLD_DATA]) +
-		atomic_read(&dirty_i->nr_dirty[DIRTY_HOT_NODE]) +
-		atomic_read(&dirty_i->nr_dirty[DIRTY_WARM_NODE]) +
-		atomic_read(&dirty_i->nr_dirty[DIRTY_COLD_NODE]);
+	return atomic_read(&DIRTY_I(sbi)->nr_dirty[DIRTY]);
 }
 
 static inline unsigned int total_written_direct_request_blocks(struct f3fs_sb_info* sbi)
@@ -752,11 +847,22 @@ static inline int utilization(struct f3fs_sb_info *sbi)
  * F3FS_IPU_NOCACHE - disable IPU bio cache.
  * F3FS_IPU_HONOR_OPU_WRITE - use OPU write prior to IPU write if inode has
  *                            FI_OPU_WRITE flag.
+ * F3FS_IPU_ADAPTIVE - do IPU for random overwrites while GC moves more than
+ *                     ipu_adaptive_cost% of what it frees, FS utilization is
+ *                     over threshold and the device takes random writes
+ *                     well. Also honoured in LFS mode on non-zoned devices,
+ *                     where GC then copies through the page cache.
  * F3FS_IPU_DISABLE - disable IPU. (=default option in LFS mode)
  */
 #define DEF_MIN_IPU_UTIL	70
 #define DEF_MIN_FSYNC_BLOCKS	8
 #define DEF_MIN_HOT_BLOCKS	16
+#define DEF_IPU_ADAPTIVE_COST	200	/* GC moved blocks per 100 freed */
+#define DEF_IPU_ADAPTIVE_SCORE	16	/* inode score to take IPU */
+#define IPU_ADAPTIVE_COST_MAX	10000
+#define IPU_ADAPTIVE_SCORE_MAX	64
+#define IPU_ADAPTIVE_SMALL	4	/* score added by a non-sequential write */
+#define IPU_ADAPTIVE_HYST	5	/* utilization % to drop before off */
 
 #define SMALL_VOLUME_SEGMENTS	(16 * 512)	/* 16GB */
 
@@ -769,6 +875,7 @@ enum {
 	F3FS_IPU_ASYNC,
 	F3FS_IPU_NOCACHE,
 	F3FS_IPU_HONOR_OPU_WRITE,
+	F3FS_IPU_ADAPTIVE,
 };
 
 static inline unsigned int curseg_segno(struct f3fs_sb_info *sbi,
@@ -62,11 +62,17 @@ unsigned long f3fs_shrink_count(struct shrinker *shrink,
 		/* count free nids cache entries */
 		count += __count_free_nids(sbi);
 
+		/* count inodes pinned by GC */
+		count += f3fs_count_gc_icache(sbi);
+
 		spin_lock(&f3fs_list_lock);
 		p = p->next;
 		mutex_unlock(&sbi->umount_mutex);
 	}
 	spin_unlock(&f3fs_list_lock);
+
+	/* count cached compressor workspaces, shared by all instances */
+	count += f3fs_count_compress_workspaces();
 	return count;
 }
 
@@ -110,6 +116,10 @@ unsigned long f3fs_shrink_scan(struct shrinker *shrink,
 		if (freed < nr)
 			freed += f3fs_try_to_free_nids(sbi, nr - freed);
 
+		/* dropping the last reference may evict, which needs fs */
+		if (freed < nr && (sc->gfp_mask & __GFP_FS))
+			freed += f3fs_shrink_gc_icache(sbi, nr - freed);
+
 		spin_lock(&f3fs_list_lock);
 		p = p->next;
 		list_move_tail(&sbi->s_list, &f3fs_list);
@@ -118,6 +128,9 @@ unsigned long f3fs_shrink_scan(struct shrinker *shrink,
 			break;
 	}
 	spin_unlock(&f3fs_list_lock);
+
+	if (freed < nr)
+		freed += f3fs_shrink_compress_workspaces(nr - freed);
 	return freed;
 }
 
@@ -28,6 +28,7 @@
 #include <linux/part_stat.h>
 #include <linux/zstd.h>
 #include <linux/lz4.h>
+#include <crypto/hash.h>
 
 #include "f3fs.h"
 #include "node.h"
@@ -101,6 +102,7 @@ enum {
 	Opt_acl,
 	Opt_noacl,
 	Opt_active_logs,
+	Opt_gc_logs,
 	Opt_disable_ext_identify,
 	Opt_inline_xattr,
 	Opt_noinline_xattr,
@@ -177,6 +179,7 @@ static match_table_t f3fs_tokens = {
 	{Opt_acl, "acl"},
 	{Opt_noacl, "noacl"},
 	{Opt_active_logs, "active_logs=%u"},
+	{Opt_gc_logs, "gc_logs=%u"},
 	{Opt_disable_ext_identify, "disable_ext_identify"},
 	{Opt_inline_xattr, "inline_xattr"},
 	{Opt_noinline_xattr, "noinline_xattr"},
@@ -244,6 +247,14 @@ static match_table_t f3fs_tokens = {
 static int num_gc_thread = 32;
 module_param(num_gc_thread, int, 0);
 
+static int num_wb_thread;
+module_param(num_wb_thread, int, 0);
+MODULE_PARM_DESC(num_wb_thread, "# of data flush workers with data_flush, 0 to flush inline");
+
+static bool chksum_selftest;
+module_param(chksum_selftest, bool, 0);
+MODULE_PARM_DESC(chksum_selftest, "check and time the crc32 used for metadata at load");
+
 void f3fs_printk(struct f3fs_sb_info *sbi, const char *fmt, ...)
 {
 	struct va_format vaf;
@@ -788,6 +799,13 @@ static int parse_options(struct super_block *sb, char *options, bool is_remount)
 				return -EINVAL;
 			F3FS_OPTION(sbi).active_logs = arg;
 			break;
+		case Opt_gc_logs:
+			if (args->from && match_int(args, &arg))
+				return -EINVAL;
+			if (arg < 1 || arg > MAX_GC_WORKER)
+				return -EINVAL;
+			F3FS_OPTION(sbi).gc_logs = arg;
+			break;
 		case Opt_disable_ext_identify:
 			set_opt(sbi, DISABLE_EXT_IDENTIFY);
 			break;
@@ -1511,6 +1529,8 @@ static void f3fs_free_inode(struct inode *inode)
 
 static void destroy_percpu_info(struct f3fs_sb_info *sbi)
 {
+	f3fs_destroy_lock_stat(sbi);
+	f3fs_destroy_gc_attr(sbi);
 	percpu_counter_destroy(&sbi->total_valid_inode_count);
 	percpu_counter_destroy(&sbi->rf_node_block_count);
 	percpu_counter_destroy(&sbi->alloc_valid_block_count);
@@ -1537,6 +1557,7 @@ static void f3fs_put_super(struct super_block *sb)
 
 	/* unregister procfs/sysfs entries in advance to avoid race case */
 	f3fs_unregister_sysfs(sbi);
+	f3fs_stop_wb_workers(sbi);
 
 	f3fs_quota_off_umount(sb);
 
@@ -1612,8 +1633,6 @@ static void f3fs_put_super(struct super_block *sb)
 	kvfree(sbi->ckpt);
 
 	sb->s_fs_info = NULL;
-	if (sbi->s_chksum_driver)
-		crypto_free_shash(sbi->s_chksum_driver);
 	kfree(sbi->raw_super);
 
 	destroy_device_list(sbi);
@@ -1745,7 +1764,7 @@ static int f3fs_statfs(struct dentry *dentry, struct kstatfs *buf)
 
 	buf->f_blocks = total_count - start_count;
 
-	spin_lock(&sbi->stat_lock);
+	f3fs_stat_lock(sbi);
 
 	user_block_count = sbi->user_block_count;
 	total_valid_node_count = valid_node_count(sbi);
@@ -1757,7 +1776,7 @@ static int f3fs_statfs(struct dentry *dentry, struct kstatfs *buf)
 		buf->f_bfree = 0;
 	else
 		buf->f_bfree -= sbi->unusable_block_count;
-	spin_unlock(&sbi->stat_lock);
+	f3fs_stat_unlock(sbi);
 
 	if (buf->f_bfree > F3FS_OPTION(sbi).root_reserved_blocks)
 		buf->f_bavail = buf->f_bfree -
@@ -1957,6 +1976,8 @@ static int f3fs_show_options(struct seq_file *seq, struct dentry *root)
 	else if (F3FS_OPTION(sbi).fs_mode == FS_MODE_FRAGMENT_BLK)
 		seq_puts(seq, "fragment:block");
 	seq_printf(seq, ",active_logs=%u", F3FS_OPTION(sbi).active_logs);
+	if (F3FS_OPTION(sbi).gc_logs)
+		seq_printf(seq, ",gc_logs=%u", sbi->nr_gc_log);
 	if (test_opt(sbi, RESERVE_ROOT))
 		seq_printf(seq, ",reserve_root=%u,resuid=%u,resgid=%u",
 				F3FS_OPTION(sbi).root_reserved_blocks,
@@ -2151,9 +2172,9 @@ static int f3fs_disable_checkpoint(struct f3fs_sb_info *sbi)
 	if (err)
 		goto out_unlock;
 
-	spin_lock(&sbi->stat_lock);
+	f3fs_stat_lock(sbi);
 	sbi->unusable_block_count = unusable;
-	spin_unlock(&sbi->stat_lock);
+	f3fs_stat_unlock(sbi);
 
 out_unlock:
 	f3fs_up_write(&sbi->gc_lock);
@@ -2310,6 +2331,13 @@ static int f3fs_remount(struct super_block *sb, int *flags, char *data)
 		goto restore_opts;
 	}
 
+	if (F3FS_OPTION(sbi).gc_logs &&
+			F3FS_OPTION(sbi).gc_logs != sbi->nr_gc_log) {
+		err = -EINVAL;
+		f3fs_warn(sbi, "switch gc_logs option is not allowed");
+		goto restore_opts;
+	}
+
 	if ((*flags & SB_RDONLY) && test_opt(sbi, DISABLE_CHECKPOINT)) {
 		err = -EINVAL;
 		f3fs_warn(sbi, "disabling checkpoint not compatible with read-only");
@@ -2399,6 +2427,12 @@ static int f3fs_remount(struct super_block *sb, int *flags, char *data)
 		}
 	}
 
+	/* data flush workers serve data_flush on a writable fs only */
+	if ((*flags & SB_RDONLY) || !test_opt(sbi, DATA_FLUSH))
+		f3fs_stop_wb_workers(sbi);
+	else if (f3fs_start_wb_workers(sbi))
+		f3fs_warn(sbi, "data flush workers have not started");
+
 skip:
 #ifdef CONFIG_QUOTA
 	/* Release old quota file names */
@@ -3439,6 +3473,7 @@ int f3fs_sanity_check_ckpt(struct f3fs_sb_info *sbi)
 	block_t user_block_count, valid_user_blocks;
 	block_t avail_node_count, valid_node_count;
 	unsigned int nat_blocks, nat_bits_bytes, nat_bits_blocks;
+	unsigned int nr_data;
 	int i, j;
 
 	total = le32_to_cpu(raw_super->segment_count);
@@ -3491,6 +3526,13 @@ int f3fs_sanity_check_ckpt(struct f3fs_sb_info *sbi)
 	main_segs = le32_to_cpu(raw_super->segment_count_main);
 	blocks_per_seg = sbi->blocks_per_seg;
 
+	if (le16_to_cpu(ckpt->nr_gc_log) > MAX_GC_WORKER) {
+		f3fs_err(sbi, "Wrong nr_gc_log: %u, max: %u",
+			 le16_to_cpu(ckpt->nr_gc_log), MAX_GC_WORKER);
+		return 1;
+	}
+	nr_data = 3 + ckpt_gc_logs(ckpt);
+
 	for (i = 0; i < NR_CURSEG_NODE_TYPE; i++) {
 		if (le32_to_cpu(ckpt->cur_node_segno[i]) >= main_segs ||
 			le16_to_cpu(ckpt->cur_node_blkoff[i]) >= blocks_per_seg)
@@ -3510,7 +3552,7 @@ int f3fs_sanity_check_ckpt(struct f3fs_sb_info *sbi)
 		}
 	}
 check_data:
-	for (i = 0; i < NR_CURSEG_DATA_TYPE; i++) {
+	for (i = 0; i < nr_data; i++) {
 		if (le32_to_cpu(ckpt->cur_data_segno[i]) >= main_segs ||
 			le16_to_cpu(ckpt->cur_data_blkoff[i]) >= blocks_per_seg)
 			return 1;
@@ -3518,7 +3560,7 @@ int f3fs_sanity_check_ckpt(struct f3fs_sb_info *sbi)
 		if (f3fs_sb_has_readonly(sbi))
 			goto skip_cross;
 
-		for (j = i + 1; j < NR_CURSEG_DATA_TYPE; j++) {
+		for (j = i + 1; j < nr_data; j++) {
 			if (le32_to_cpu(ckpt->cur_data_segno[i]) ==
 				le32_to_cpu(ckpt->cur_data_segno[j])) {
 				f3fs_err(sbi, "Data segment (%u, %u) has the same segno: %u",
@@ -3529,7 +3571,7 @@ int f3fs_sanity_check_ckpt(struct f3fs_sb_info *sbi)
 		}
 	}
 	for (i = 0; i < NR_CURSEG_NODE_TYPE; i++) {
-		for (j = 0; j < NR_CURSEG_DATA_TYPE; j++) {
+		for (j = 0; j < nr_data; j++) {
 			if (le32_to_cpu(ckpt->cur_node_segno[i]) ==
 				le32_to_cpu(ckpt->cur_data_segno[j])) {
 				f3fs_err(sbi, "Node segment (%u) and Data segment (%u) has the same segno: %u",
@@ -3627,6 +3669,9 @@ static void init_sb_info(struct f3fs_sb_info *sbi)
 	sbi->interval_time[DISABLE_TIME] = DEF_DISABLE_INTERVAL;
 	sbi->interval_time[UMOUNT_DISCARD_TIMEOUT] =
 				DEF_UMOUNT_DISCARD_TIMEOUT;
+	sbi->idle_gap_min_ms = DEF_GC_IDLE_MIN_GAP_MS;
+	sbi->idle_gap_ewma_ms = 0;
+	sbi->last_read_time = jiffies;
 	clear_sbi_flag(sbi, SBI_NEED_FSCK);
 
 	for (i = 0; i < NR_COUNT_TYPE; i++)
@@ -3637,7 +3682,6 @@ static void init_sb_info(struct f3fs_sb_info *sbi)
 
 	INIT_LIST_HEAD(&sbi->s_list);
 	mutex_init(&sbi->umount_mutex);
-	init_f3fs_rwsem(&sbi->io_order_lock);
 	spin_lock_init(&sbi->cp_lock);
 
 	sbi->dirty_device = 0;
@@ -3664,8 +3708,20 @@ static int init_percpu_info(struct f3fs_sb_info *sbi)
 								GFP_KERNEL);
 	if (err)
 		goto err_node_block;
+
+	err = f3fs_init_gc_attr(sbi);
+	if (err)
+		goto err_valid_inode;
+
+	err = f3fs_init_lock_stat(sbi);
+	if (err)
+		goto err_gc_attr;
 	return 0;
 
+err_gc_attr:
+	f3fs_destroy_gc_attr(sbi);
+err_valid_inode:
+	percpu_counter_destroy(&sbi->total_valid_inode_count);
 err_node_block:
 	percpu_counter_destroy(&sbi->rf_node_block_count);
 err_valid_block:
@@ -4039,15 +4095,8 @@ static int f3fs_fill_super(struct super_block *sb, void *data, int silent)
   atomic_set(&sbi->gc_read_blocks, 0);
   atomic_set(&sbi->gc_written_blocks, 0);
   sbi->num_gc_thread = num_gc_thread;
-
-	/* Load the checksum driver */
-	sbi->s_chksum_driver = crypto_alloc_shash("crc32", 0, 0);
-	if (IS_ERR(sbi->s_chksum_driver)) {
-		f3fs_err(sbi, "Cannot load crc32 driver.");
-		err = PTR_ERR(sbi->s_chksum_driver);
-		sbi->s_chksum_driver = NULL;
-		goto free_sbi;
-	}
+	sbi->num_wb_thread = min_t(int, num_wb_thread, num_online_cpus());
+	sbi->wb_pool.dirty_kick = DEF_WB_DIRTY_KICK;
 
 	/* set a block size */
 	if (unlikely(!sb_set_blocksize(sb, F3FS_BLKSIZE))) {
@@ -4245,6 +4294,9 @@ static int f3fs_fill_super(struct super_block *sb, void *data, int silent)
 			 err);
 		goto free_sm;
 	}
+	/* each GC worker migrates into its own GC log */
+	if (sbi->num_gc_thread > sbi->nr_gc_log)
+		sbi->num_gc_thread = sbi->nr_gc_log;
 	err = f3fs_build_node_manager(sbi);
 	if (err) {
 		f3fs_err(sbi, "Failed to initialize F3FS node manager (%d)",
@@ -4279,6 +4331,11 @@ static int f3fs_fill_super(struct super_block *sb, void *data, int silent)
 		goto free_stats;
 	}
 
+	/* redo GC moves of segments reused since the last checkpoint */
+	err = f3fs_replay_reclaim_journal(sbi);
+	if (err)
+		goto free_node_inode;
+
 	/* read root inode and dentry */
 	root = f3fs_iget(sb, F3FS_ROOT_INO(sbi));
 	if (IS_ERR(root)) {
@@ -4406,6 +4463,10 @@ static int f3fs_fill_super(struct super_block *sb, void *data, int silent)
 		if (err)
 			goto sync_free_meta;
 	}
+
+	if (test_opt(sbi, DATA_FLUSH) && !f3fs_readonly(sb) &&
+			f3fs_start_wb_workers(sbi))
+		f3fs_warn(sbi, "data flush workers have not started");
 	kvfree(options);
 
 	/* recover broken superblock */
@@ -4444,9 +4505,16 @@ static int f3fs_fill_super(struct super_block *sb, void *data, int silent)
 	 * falls into an infinite loop in f3fs_sync_meta_pages().
 	 */
 	truncate_inode_pages_final(META_MAPPING(sbi));
+	/*
+	 * GC run during mount (e.g. by f3fs_disable_checkpoint()) may have
+	 * left inodes pinned in gc_icache; drop those references first, or
+	 * evict_inodes() skips them and they leak.
+	 */
+	f3fs_shrink_gc_icache(sbi, ULONG_MAX);
 	/* evict some inodes being cached by GC */
 	evict_inodes(sb);
 	f3fs_unregister_sysfs(sbi);
+	f3fs_stop_wb_workers(sbi);
 free_compress_inode:
 	f3fs_destroy_compress_inode(sbi);
 free_root_inode:
@@ -4503,8 +4571,6 @@ static int f3fs_fill_super(struct super_block *sb, void *data, int silent)
 free_sb_buf:
 	kfree(raw_super);
 free_sbi:
-	if (sbi->s_chksum_driver)
-		crypto_free_shash(sbi->s_chksum_driver);
 	kfree(sbi);
 
 	/* give only one another chance */
@@ -4531,6 +4597,9 @@ static void kill_f3fs_super(struct super_block *sb)
 		f3fs_stop_gc_thread(sbi);
 		f3fs_stop_discard_thread(sbi);
 
+		/* GC won't cache any more inodes once SBI_IS_CLOSE is set */
+		f3fs_shrink_gc_icache(sbi, ULONG_MAX);
+
 #ifdef CONFIG_F3FS_FS_COMPRESSION
 		/*
 		 * latter evict_inode() can bypass checking and invalidating
@@ -4583,6 +4652,88 @@ static void destroy_inodecache(void)
 	kmem_cache_destroy(f3fs_inode_cachep);
 }
 
+#define CHKSUM_BENCH_LOOPS	4096
+
+/*
+ * __f3fs_crc32() must keep producing what the "crc32" shash produced, or
+ * every checksum on disk would turn invalid.  Compare the two on odd
+ * lengths and alignments and time both over whole blocks.
+ */
+static int __init f3fs_chksum_selftest(void)
+{
+	static const unsigned int lens[] = { 0, 1, 3, 4, 7, 64, 511, 4095 };
+	struct crypto_shash *tfm;
+	u8 *buf;
+	u64 t0, lib_ns, shash_ns;
+	u32 crc, ref = 0;
+	int i, j, err = 0;
+
+	/* check value of the standard crc32 */
+	if ((crc32_le(~0, "123456789", 9) ^ ~0) != 0xcbf43926) {
+		printk("F3FS crc32 self-test failed on check value\n");
+		return -EINVAL;
+	}
+
+	tfm = crypto_alloc_shash("crc32", 0, 0);
+	if (IS_ERR(tfm)) {
+		/* nothing to compare against, lib crc32 passed above */
+		return 0;
+	}
+
+	buf = kmalloc(F3FS_BLKSIZE + 4, GFP_KERNEL);
+	if (!buf) {
+		err = -ENOMEM;
+		goto free_tfm;
+	}
+	get_random_bytes(buf, F3FS_BLKSIZE + 4);
+
+	for (i = 0; i < ARRAY_SIZE(lens) && !err; i++) {
+		for (j = 0; j < 4 && !err; j++) {
+			SHASH_DESC_ON_STACK(desc, tfm);
+
+			desc->tfm = tfm;
+			*(u32 *)shash_desc_ctx(desc) = F3FS_SUPER_MAGIC;
+			crypto_shash_update(desc, buf + j, lens[i]);
+			ref = *(u32 *)shash_desc_ctx(desc);
+			crc = __f3fs_crc32(NULL, F3FS_SUPER_MAGIC, buf + j,
+								lens[i]);
+			if (crc != ref) {
+				printk("F3FS crc32 self-test failed: len %u ofs %d %08x vs. %08x\n",
+					lens[i], j, crc, ref);
+				err = -EINVAL;
+			}
+		}
+	}
+	if (err)
+		goto free_buf;
+
+	t0 = ktime_get_ns();
+	for (i = 0, crc = 0; i < CHKSUM_BENCH_LOOPS; i++)
+		crc = __f3fs_crc32(NULL, crc, buf, F3FS_BLKSIZE);
+	lib_ns = max_t(u64, ktime_get_ns() - t0, 1);
+
+	t0 = ktime_get_ns();
+	for (i = 0; i < CHKSUM_BENCH_LOOPS; i++) {
+		SHASH_DESC_ON_STACK(desc, tfm);
+
+		desc->tfm = tfm;
+		*(u32 *)shash_desc_ctx(desc) = ref;
+		crypto_shash_update(desc, buf, F3FS_BLKSIZE);
+		ref = *(u32 *)shash_desc_ctx(desc);
+	}
+	shash_ns = max_t(u64, ktime_get_ns() - t0, 1);
+
+	printk("F3FS crc32 self-test passed: lib %llu MB/s, shash (%s) %llu MB/s\n",
+		div64_u64((u64)CHKSUM_BENCH_LOOPS * F3FS_BLKSIZE * 1000, lib_ns),
+		crypto_shash_driver_name(tfm),
+		div64_u64((u64)CHKSUM_BENCH_LOOPS * F3FS_BLKSIZE * 1000, shash_ns));
+free_buf:
+	kfree(buf);
+free_tfm:
+	crypto_free_shash(tfm);
+	return err;
+}
+
 static int __init init_f3fs_fs(void)
 {
 	int err;
@@ -4594,6 +4745,12 @@ static int __init init_f3fs_fs(void)
 	}
   printk("GC thread count %d\n", num_gc_thread);
 
+	if (chksum_selftest) {
+		err = f3fs_chksum_selftest();
+		if (err)
+			return err;
+	}
+
 	err = init_inodecache();
 	if (err)
 		goto fail;
@@ -4625,6 +4782,7 @@ static int __init init_f3fs_fs(void)
 	if (err)
 		goto free_shrinker;
 	f3fs_create_root_stats();
+	f3fs_create_lock_stat_root();
 	err = f3fs_init_post_read_processing();
 	if (err)
 		goto free_root_stats;
@@ -4660,6 +4818,7 @@ static int __init init_f3fs_fs(void)
 free_post_read:
 	f3fs_destroy_post_read_processing();
 free_root_stats:
+	f3fs_destroy_lock_stat_root();
 	f3fs_destroy_root_stats();
 	unregister_filesystem(&f3fs_fs_type);
 free_shrinker:
@@ -4693,6 +4852,7 @@ static void __exit exit_f3fs_fs(void)
 	f3fs_destroy_bio_entry_cache();
 	f3fs_destroy_iostat_processing();
 	f3fs_destroy_post_read_processing();
+	f3fs_destroy_lock_stat_root();
 	f3fs_destroy_root_stats();
 	unregister_filesystem(&f3fs_fs_type);
 	unregister_shrinker(&f3fs_shrinker_info);
@@ -190,6 +190,9 @@ static ssize_t features_show(struct f3fs_attr *a,
 	if (f3fs_sb_has_compression(sbi))
 		len += scnprintf(buf + len, PAGE_SIZE - len, "%s%s",
 				len ? ", " : "", "compression");
+	if (f3fs_sb_has_reclaim_journal(sbi))
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%s%s",
+				len ? ", " : "", "reclaim_journal");
 	len += scnprintf(buf + len, PAGE_SIZE - len, "%s%s",
 				len ? ", " : "", "pin_file");
 	len += scnprintf(buf + len, PAGE_SIZE - len, "\n");
@@ -330,12 +333,25 @@ static ssize_t f3fs_sbi_show(struct f3fs_attr *a,
 
 	if (!strcmp(a->attr.name, "compr_new_inode"))
 		return sysfs_emit(buf, "%u\n", sbi->compr_new_inode);
+
+	if (!strcmp(a->attr.name, "compr_skipped_cluster"))
+		return sysfs_emit(buf, "%llu\n", sbi->compr_skipped_cluster);
 #endif
 
 	if (!strcmp(a->attr.name, "gc_urgent"))
 		return sysfs_emit(buf, "%s\n",
 				gc_mode_names[sbi->gc_mode]);
 
+	if (!strcmp(a->attr.name, "gc_cgroup")) {
+		ssize_t len;
+
+		spin_lock(&sbi->gc_css_lock);
+		len = sysfs_emit(buf, "%s\n",
+				sbi->gc_cgroup ? sbi->gc_cgroup : "/");
+		spin_unlock(&sbi->gc_css_lock);
+		return len;
+	}
+
 	if (!strcmp(a->attr.name, "gc_segment_mode"))
 		return sysfs_emit(buf, "%s\n",
 				gc_mode_names[sbi->gc_segment_mode]);
@@ -445,6 +461,11 @@ static ssize_t __sbi_store(struct f3fs_attr *a,
 		return count;
 	}
 
+	if (!strcmp(a->attr.name, "gc_cgroup")) {
+		ret = f3fs_set_gc_cgroup(sbi, strim((char *)buf));
+		return ret ? ret : count;
+	}
+
 	ui = (unsigned int *)(ptr + a->offset);
 
 	ret = kstrtoul(skip_spaces(buf), 0, &t);
@@ -457,18 +478,18 @@ static ssize_t __sbi_store(struct f3fs_attr *a,
 		return -EINVAL;
 #endif
 	if (a->struct_type == RESERVED_BLOCKS) {
-		spin_lock(&sbi->stat_lock);
+		f3fs_stat_lock(sbi);
 		if (t > (unsigned long)(sbi->user_block_count -
 				F3FS_OPTION(sbi).root_reserved_blocks -
 				sbi->blocks_per_seg *
 				SM_I(sbi)->additional_reserved_segments)) {
-			spin_unlock(&sbi->stat_lock);
+			f3fs_stat_unlock(sbi);
 			return -EINVAL;
 		}
 		*ui = t;
 		sbi->current_reserved_blocks = min(sbi->reserved_blocks,
 				sbi->user_block_count - valid_user_blocks(sbi));
-		spin_unlock(&sbi->stat_lock);
+		f3fs_stat_unlock(sbi);
 		return count;
 	}
 
@@ -488,6 +509,29 @@ static ssize_t __sbi_store(struct f3fs_attr *a,
 			return -EINVAL;
 	}
 
+	if (!strcmp(a->attr.name, "reclaim_journal") && t) {
+		/* the journal records one segment per batch */
+		if (__is_large_section(sbi))
+			return -EINVAL;
+		if (!f3fs_sb_has_reclaim_journal(sbi)) {
+			if (f3fs_readonly(sbi->sb))
+				return -EROFS;
+			f3fs_down_write(&sbi->sb_lock);
+			F3FS_SET_FEATURE(sbi, F3FS_FEATURE_RECLAIM_JOURNAL);
+			ret = f3fs_commit_super(sbi, false);
+			if (ret)
+				F3FS_CLEAR_FEATURE(sbi,
+					F3FS_FEATURE_RECLAIM_JOURNAL);
+			f3fs_up_write(&sbi->sb_lock);
+			if (ret)
+				return ret;
+		}
+	}
+
+	/* a zero gap would let the GC thread poll without ever sleeping */
+	if (!strcmp(a->attr.name, "gc_idle_min_gap_ms") && !t)
+		return -EINVAL;
+
 	if (!strcmp(a->attr.name, "trim_sections"))
 		return -EINVAL;
 
@@ -540,6 +584,11 @@ static ssize_t __sbi_store(struct f3fs_attr *a,
 		return count;
 	}
 
+	if (!strcmp(a->attr.name, "lock_stat_rate")) {
+		f3fs_set_lock_stat_rate(sbi, t);
+		return count;
+	}
+
 #ifdef CONFIG_F3FS_IOSTAT
 	if (!strcmp(a->attr.name, "iostat_enable")) {
 		sbi->iostat_enable = !!t;
@@ -574,6 +623,13 @@ static ssize_t __sbi_store(struct f3fs_attr *a,
 		sbi->compr_new_inode = 0;
 		return count;
 	}
+
+	if (!strcmp(a->attr.name, "compr_skipped_cluster")) {
+		if (t != 0)
+			return -EINVAL;
+		sbi->compr_skipped_cluster = 0;
+		return count;
+	}
 #endif
 
 	if (!strcmp(a->attr.name, "atgc_candidate_ratio")) {
@@ -781,6 +837,20 @@ F3FS_RW_ATTR(GC_THREAD, f3fs_gc_kthread, gc_urgent_sleep_time,
 F3FS_RW_ATTR(GC_THREAD, f3fs_gc_kthread, gc_min_sleep_time, min_sleep_time);
 F3FS_RW_ATTR(GC_THREAD, f3fs_gc_kthread, gc_max_sleep_time, max_sleep_time);
 F3FS_RW_ATTR(GC_THREAD, f3fs_gc_kthread, gc_no_gc_sleep_time, no_gc_sleep_time);
+F3FS_RW_ATTR(GC_THREAD, f3fs_gc_kthread, gc_idle_predict, idle_predict);
+F3FS_RO_ATTR(GC_THREAD, f3fs_gc_kthread, gc_idle_slice_ms, slice_ewma_ms);
+F3FS_RO_ATTR(GC_THREAD, f3fs_gc_kthread, gc_idle_skipped, idle_skipped);
+F3FS_RO_ATTR(GC_THREAD, f3fs_gc_kthread, gc_idle_preempted, idle_preempted);
+F3FS_RW_ATTR(GC_THREAD, f3fs_gc_kthread, gc_iocost, gc_iocost);
+F3FS_RW_ATTR(GC_THREAD, f3fs_gc_kthread, gc_iocost_debt_us, gc_iocost_debt_us);
+F3FS_RO_ATTR(GC_THREAD, f3fs_gc_kthread, gc_active_workers, gc_active_workers);
+F3FS_RO_ATTR(GC_THREAD, f3fs_gc_kthread, gc_iocost_backoffs, gc_iocost_backoffs);
+F3FS_RO_ATTR(GC_THREAD, f3fs_gc_kthread, gc_iocost_vrate, gc_iocost_vrate);
+F3FS_RW_ATTR(F3FS_SBI, f3fs_sb_info, gc_cgroup, gc_cgroup);
+F3FS_RW_ATTR(F3FS_SBI, f3fs_sb_info, lock_stat_rate, lock_stat_rate);
+F3FS_RW_ATTR(F3FS_SBI, f3fs_sb_info, gc_idle_min_gap_ms, idle_gap_min_ms);
+F3FS_RW_ATTR(F3FS_SBI, f3fs_sb_info, wb_dirty_kick, wb_pool.dirty_kick);
+F3FS_RO_ATTR(F3FS_SBI, f3fs_sb_info, gc_idle_gap_ms, idle_gap_ewma_ms);
 F3FS_RW_ATTR(F3FS_SBI, f3fs_sb_info, gc_idle, gc_mode);
 F3FS_RW_ATTR(F3FS_SBI, f3fs_sb_info, gc_urgent, gc_mode);
 F3FS_RW_ATTR(SM_INFO, f3fs_sm_info, reclaim_segments, rec_prefree_segments);
@@ -793,6 +863,9 @@ F3FS_RW_ATTR(DCC_INFO, discard_cmd_control, discard_granularity, discard_granula
 F3FS_RW_ATTR(RESERVED_BLOCKS, f3fs_sb_info, reserved_blocks, reserved_blocks);
 F3FS_RW_ATTR(SM_INFO, f3fs_sm_info, batched_trim_sections, trim_sections);
 F3FS_RW_ATTR(SM_INFO, f3fs_sm_info, ipu_policy, ipu_policy);
+F3FS_RW_ATTR(F3FS_SBI, f3fs_sb_info, ipu_adaptive_cost, adaptive_ipu.cost);
+F3FS_RW_ATTR(F3FS_SBI, f3fs_sb_info, ipu_adaptive_score,
+					adaptive_ipu.min_score);
 F3FS_RW_ATTR(SM_INFO, f3fs_sm_info, min_ipu_util, min_ipu_util);
 F3FS_RW_ATTR(SM_INFO, f3fs_sm_info, min_fsync_blocks, min_fsync_blocks);
 F3FS_RW_ATTR(SM_INFO, f3fs_sm_info, min_seq_blocks, min_seq_blocks);
@@ -819,6 +892,9 @@ F3FS_RW_ATTR(F3FS_SBI, f3fs_sb_info, iostat_period_ms, iostat_period_ms);
 F3FS_RW_ATTR(F3FS_SBI, f3fs_sb_info, readdir_ra, readdir_ra);
 F3FS_RW_ATTR(F3FS_SBI, f3fs_sb_info, max_io_bytes, max_io_bytes);
 F3FS_RW_ATTR(F3FS_SBI, f3fs_sb_info, gc_pin_file_thresh, gc_pin_file_threshold);
+F3FS_RW_ATTR(F3FS_SBI, f3fs_sb_info, gc_icache_max, gc_icache.max_count);
+F3FS_RW_ATTR(F3FS_SBI, f3fs_sb_info, reclaim_journal, reclaim_journal);
+F3FS_RO_ATTR(F3FS_SBI, f3fs_sb_info, reclaim_journal_segs, rj_reclaimed_segs);
 F3FS_RW_ATTR(F3FS_SBI, f3fs_super_block, extension_list, extension_list);
 #ifdef CONFIG_F3FS_FAULT_INJECTION
 F3FS_RW_ATTR(FAULT_INFO_RATE, f3fs_fault_info, inject_rate, inject_rate);
@@ -882,6 +958,10 @@ F3FS_FEATURE_RO_ATTR(compression);
 F3FS_RW_ATTR(F3FS_SBI, f3fs_sb_info, compr_written_block, compr_written_block);
 F3FS_RW_ATTR(F3FS_SBI, f3fs_sb_info, compr_saved_block, compr_saved_block);
 F3FS_RW_ATTR(F3FS_SBI, f3fs_sb_info, compr_new_inode, compr_new_inode);
+F3FS_RW_ATTR(F3FS_SBI, f3fs_sb_info, compr_skipped_cluster, compr_skipped_cluster);
+F3FS_RW_ATTR(F3FS_SBI, f3fs_sb_info, gc_recompress_level, gc_recompr.level);
+F3FS_RW_ATTR(F3FS_SBI, f3fs_sb_info, gc_recompress_budget_ms,
+					gc_recompr.budget_ms);
 #endif
 F3FS_FEATURE_RO_ATTR(pin_file);
 
@@ -909,6 +989,20 @@ static struct attribute *f3fs_attrs[] = {
 	ATTR_LIST(gc_min_sleep_time),
 	ATTR_LIST(gc_max_sleep_time),
 	ATTR_LIST(gc_no_gc_sleep_time),
+	ATTR_LIST(gc_idle_predict),
+	ATTR_LIST(gc_idle_slice_ms),
+	ATTR_LIST(gc_idle_skipped),
+	ATTR_LIST(gc_idle_preempted),
+	ATTR_LIST(gc_iocost),
+	ATTR_LIST(gc_iocost_debt_us),
+	ATTR_LIST(gc_active_workers),
+	ATTR_LIST(gc_iocost_backoffs),
+	ATTR_LIST(gc_iocost_vrate),
+	ATTR_LIST(gc_cgroup),
+	ATTR_LIST(lock_stat_rate),
+	ATTR_LIST(gc_idle_min_gap_ms),
+	ATTR_LIST(wb_dirty_kick),
+	ATTR_LIST(gc_idle_gap_ms),
 	ATTR_LIST(gc_idle),
 	ATTR_LIST(gc_urgent),
 	ATTR_LIST(reclaim_segments),
@@ -922,6 +1016,8 @@ static struct attribute *f3fs_attrs[] = {
 	ATTR_LIST(pending_discard),
 	ATTR_LIST(batched_trim_sections),
 	ATTR_LIST(ipu_policy),
+	ATTR_LIST(ipu_adaptive_cost),
+	ATTR_LIST(ipu_adaptive_score),
 	ATTR_LIST(min_ipu_util),
 	ATTR_LIST(min_fsync_blocks),
 	ATTR_LIST(min_seq_blocks),
@@ -946,6 +1042,9 @@ static struct attribute *f3fs_attrs[] = {
 	ATTR_LIST(readdir_ra),
 	ATTR_LIST(max_io_bytes),
 	ATTR_LIST(gc_pin_file_thresh),
+	ATTR_LIST(gc_icache_max),
+	ATTR_LIST(reclaim_journal),
+	ATTR_LIST(reclaim_journal_segs),
 	ATTR_LIST(extension_list),
 #ifdef CONFIG_F3FS_FAULT_INJECTION
 	ATTR_LIST(inject_rate),
@@ -981,6 +1080,9 @@ static struct attribute *f3fs_attrs[] = {
 	ATTR_LIST(compr_written_block),
 	ATTR_LIST(compr_saved_block),
 	ATTR_LIST(compr_new_inode),
+	ATTR_LIST(compr_skipped_cluster),
+	ATTR_LIST(gc_recompress_level),
+	ATTR_LIST(gc_recompress_budget_ms),
 #endif
 	/* For ATGC */
 	ATTR_LIST(atgc_candidate_ratio),
@@ -1056,6 +1158,7 @@ F3FS_SB_FEATURE_RO_ATTR(sb_checksum, SB_CHKSUM);
 F3FS_SB_FEATURE_RO_ATTR(casefold, CASEFOLD);
 F3FS_SB_FEATURE_RO_ATTR(compression, COMPRESSION);
 F3FS_SB_FEATURE_RO_ATTR(readonly, RO);
+F3FS_SB_FEATURE_RO_ATTR(reclaim_journal, RECLAIM_JOURNAL);
 
 static struct attribute *f3fs_sb_feat_attrs[] = {
 	ATTR_LIST(sb_encryption),
@@ -1072,6 +1175,7 @@ static struct attribute *f3fs_sb_feat_attrs[] = {
 	ATTR_LIST(sb_casefold),
 	ATTR_LIST(sb_compression),
 	ATTR_LIST(sb_readonly),
+	ATTR_LIST(sb_reclaim_journal),
 	NULL,
 };
 ATTRIBUTE_GROUPS(f3fs_sb_feat);
@@ -1312,6 +1416,16 @@ int f3fs_register_sysfs(struct f3fs_sb_info *sbi)
 #endif
 		proc_create_single_data("victim_bits", 0444, sbi->s_proc,
 				victim_bits_seq_show, sb);
+		proc_create_single_data("gc_attribution", 0444, sbi->s_proc,
+				f3fs_gc_attr_seq_show, sb);
+		proc_create_single_data("wb_workers", 0444, sbi->s_proc,
+				f3fs_wb_workers_seq_show, sb);
+		proc_create_single_data("adaptive_ipu", 0444, sbi->s_proc,
+				f3fs_adaptive_ipu_seq_show, sb);
+#ifdef CONFIG_F3FS_FS_COMPRESSION
+		proc_create_single_data("gc_recompress", 0444, sbi->s_proc,
+				f3fs_gc_recompress_seq_show, sb);
+#endif
 	}
 	return 0;
 put_feature_list_kobj:
@@ -1335,6 +1449,12 @@ void f3fs_unregister_sysfs(struct f3fs_sb_info *sbi)
 		remove_proc_entry("segment_info", sbi->s_proc);
 		remove_proc_entry("segment_bits", sbi->s_proc);
 		remove_proc_entry("victim_bits", sbi->s_proc);
+		remove_proc_entry("gc_attribution", sbi->s_proc);
+		remove_proc_entry("wb_workers", sbi->s_proc);
+		remove_proc_entry("adaptive_ipu", sbi->s_proc);
+#ifdef CONFIG_F3FS_FS_COMPRESSION
+		remove_proc_entry("gc_recompress", sbi->s_proc);
+#endif
 		remove_proc_entry(sbi->sb->s_id, f3fs_proc_root);
 	}
 
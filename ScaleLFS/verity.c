@@ -210,7 +210,7 @@ static int f3fs_end_enable_verity(struct file *filp, const void *desc,
 	 * from re-instantiating cached pages we are truncating (since unlike
 	 * normal file accesses, garbage collection isn't limited by i_size).
 	 */
-	range = f3fs_down_write3(&F3FS_I(inode)->i_gc_rwsem[WRITE]);
+	range = f3fs_down_write3(sbi, &F3FS_I(inode)->i_gc_rwsem[WRITE]);
 	truncate_inode_pages(inode->i_mapping, inode->i_size);
 	err2 = f3fs_truncate(inode);
 	if (err2) {
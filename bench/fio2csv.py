@@ -0,0 +1,43 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: GPL-2.0
+#
+# Turn one fio --output-format=json result into a CSV row:
+#   ops_per_sec,mb_per_sec,p50_us,p99_us,p999_us,user_kb
+#
+# Latencies come from the clat histogram of whichever direction did the
+# work, or from the sync (fsync) latencies when there are any.
+
+import json
+import sys
+
+
+def pick(job):
+    for ddir in ('write', 'read'):
+        if job[ddir]['total_ios']:
+            return job[ddir]
+    return job['write']
+
+
+def pct(lat, p):
+    return lat.get('percentile', {}).get(p, 0) / 1000.0
+
+
+def main():
+    with open(sys.argv[1]) as f:
+        text = f.read()
+    # fio prints warnings ahead of the json document
+    res = json.loads(text[text.index('{'):])
+    job = res['jobs'][0]
+    io = pick(job)
+    lat = io.get('clat_ns', {})
+    if job.get('sync', {}).get('total_ios'):
+        lat = job['sync']['lat_ns']
+
+    print('%.1f,%.2f,%.1f,%.1f,%.1f,%d' % (
+        io['iops'], io['bw'] / 1024.0,
+        pct(lat, '50.000000'), pct(lat, '99.000000'),
+        pct(lat, '99.900000'), job['write']['io_kbytes']))
+
+
+if __name__ == '__main__':
+    main()
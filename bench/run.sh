@@ -0,0 +1,235 @@
+#!/bin/bash
+# SPDX-License-Identifier: GPL-2.0
+#
+# Run the same workload matrix over ScaleLFS (f3fs), pgc (f3fs) and max
+# (f4fs) on a RAM-backed block device and collect one CSV.
+#
+# usage: run.sh [-v "scalelfs pgc max"] [-w "overwrite fsync meta varmail"]
+#               [-t "1 2 4 8 16 32"] [-d brd|null_blk] [-s size_gb]
+#               [-r runtime_sec] [-o results.csv]
+#
+# Needs root, fio, python3, and filebench for varmail.  Every variant is
+# formatted with ScaleLFS/f2fs-tools/mkfs/mkfs.f2fs.
+#
+# BRD_OPTS is passed on to brd, e.g. to emulate an SSD:
+#   BRD_OPTS="brd_channels=8 brd_read_lat_us=80 brd_write_lat_us=20
+#             brd_flush_lat_us=500 brd_write_mbps=2000" run.sh
+
+set -e
+
+TOP=$(cd "$(dirname "$0")/.." && pwd)
+BENCH=$TOP/bench
+MKFS=${MKFS:-$TOP/ScaleLFS/f2fs-tools/mkfs/mkfs.f2fs}
+MNT=${MNT:-/mnt/bench}
+
+VARIANTS="scalelfs pgc max"
+WORKLOADS="overwrite fsync meta varmail"
+THREADS="1 2 4 8 16 32"
+DEVTYPE=brd
+SIZE_GB=16
+RUNTIME=60
+OUT=$BENCH/results-$(date +%Y%m%d-%H%M%S).csv
+
+while getopts "v:w:t:d:s:r:o:" opt; do
+	case $opt in
+	v) VARIANTS=$OPTARG ;;
+	w) WORKLOADS=$OPTARG ;;
+	t) THREADS=$OPTARG ;;
+	d) DEVTYPE=$OPTARG ;;
+	s) SIZE_GB=$OPTARG ;;
+	r) RUNTIME=$OPTARG ;;
+	o) OUT=$OPTARG ;;
+	*) sed -n '5,16p' "$0"; exit 1 ;;
+	esac
+done
+
+export BENCH_RUNTIME=$RUNTIME
+export BENCH_RAMP=5
+export BENCH_DIR=$MNT
+export BENCH_NRFILES=${BENCH_NRFILES:-10000}
+
+# variant -> source dir, module, fs type
+variant_dir() {
+	case $1 in
+	scalelfs) echo ScaleLFS ;;
+	pgc) echo pgc ;;
+	max) echo max ;;
+	esac
+}
+
+variant_mod() {
+	case $1 in
+	scalelfs) echo scalelfs ;;
+	pgc) echo f3fs ;;
+	max) echo max ;;
+	esac
+}
+
+variant_fs() {
+	case $1 in
+	max) echo f4fs ;;
+	*) echo f3fs ;;
+	esac
+}
+
+setup_dev() {
+	case $DEVTYPE in
+	brd)
+		modprobe brd rd_nr=1 rd_size=$((SIZE_GB * 1024 * 1024)) $BRD_OPTS
+		DEV=/dev/ram0
+		;;
+	null_blk)
+		modprobe null_blk nr_devices=1 memory_backed=1 \
+			gb="$SIZE_GB" bs=4096 irqmode=0
+		DEV=/dev/nullb0
+		;;
+	*)
+		echo "unknown device type $DEVTYPE" >&2
+		exit 1
+		;;
+	esac
+}
+
+teardown_dev() {
+	modprobe -r "$DEVTYPE" 2>/dev/null || true
+}
+
+# Start every run from a freshly formatted device, so one variant's
+# leftovers never age the next one's layout.
+format_mount() {
+	local v=$1
+
+	teardown_dev
+	setup_dev
+	"$MKFS" -f "$DEV" >/dev/null
+	mkdir -p "$MNT"
+	mount -t "$(variant_fs "$v")" "$DEV" "$MNT"
+	SYSFS=/sys/fs/$(variant_fs "$v")/$(basename "$DEV")
+}
+
+umount_dev() {
+	umount "$MNT"
+}
+
+lifetime_kb() {
+	cat "$SYSFS/lifetime_write_kbytes"
+}
+
+run_fio() {
+	local job=$1 out=$2
+
+	fio --output-format=json --output="$out" "$BENCH/workloads/$job.fio"
+}
+
+# Emit one CSV row: variant,workload,threads,ops_per_sec,mb_per_sec,
+# p50_us,p99_us,p999_us,waf
+emit() {
+	local v=$1 w=$2 t=$3 json=$4 kb0=$5 kb1=$6
+	local row user waf
+
+	row=$(python3 "$BENCH/fio2csv.py" "$json")
+	user=${row##*,}
+	row=${row%,*}
+	waf=$(awk -v d=$((kb1 - kb0)) -v u="$user" \
+		'BEGIN { if (u > 0) printf "%.3f", d / u }')
+	echo "$v,$w,$t,$row,$waf" >> "$OUT"
+}
+
+run_overwrite() {
+	local v=$1 t=$2 tmp=$3 kb0
+
+	# cover 80% of the device so the cleaner has to keep up
+	export BENCH_FILE_SIZE=$((SIZE_GB * 1024 * 8 / 10 / t))m
+	kb0=$(lifetime_kb)
+	run_fio overwrite "$tmp/overwrite.json"
+	emit "$v" overwrite "$t" "$tmp/overwrite.json" "$kb0" "$(lifetime_kb)"
+}
+
+run_fsync() {
+	local v=$1 t=$2 tmp=$3 kb0
+
+	kb0=$(lifetime_kb)
+	run_fio fsync "$tmp/fsync.json"
+	emit "$v" fsync "$t" "$tmp/fsync.json" "$kb0" "$(lifetime_kb)"
+}
+
+run_meta() {
+	local v=$1 t=$2 tmp=$3 op kb0
+
+	for op in create stat unlink; do
+		kb0=$(lifetime_kb)
+		run_fio "meta-$op" "$tmp/meta-$op.json"
+		sync
+		emit "$v" "meta-$op" "$t" "$tmp/meta-$op.json" "$kb0" \
+			"$(lifetime_kb)"
+	done
+}
+
+# filebench wants ASLR off; put the old setting back whenever we leave.
+ASLR=/proc/sys/kernel/randomize_va_space
+ASLR_SAVED=
+
+restore_aslr() {
+	if [ -n "$ASLR_SAVED" ]; then
+		echo "$ASLR_SAVED" > "$ASLR"
+		ASLR_SAVED=
+	fi
+}
+
+# filebench does not report how much the workload wrote, so varmail
+# rows carry throughput only.
+run_varmail() {
+	local v=$1 t=$2 tmp=$3 ops mbs
+
+	if ! command -v filebench >/dev/null; then
+		echo "filebench not found, skipping varmail" >&2
+		return
+	fi
+	sed -e "s|BENCH_DIR|$MNT|" -e "s|BENCH_THREADS|$t|" \
+		-e "s|BENCH_RUNTIME|$RUNTIME|" \
+		"$BENCH/workloads/varmail.f" > "$tmp/varmail.f"
+	ASLR_SAVED=$(cat "$ASLR")
+	echo 0 > "$ASLR"
+	filebench -f "$tmp/varmail.f" > "$tmp/varmail.out"
+	restore_aslr
+	ops=$(grep 'IO Summary' "$tmp/varmail.out" | grep -o '[0-9.]* ops/s' |
+		cut -d' ' -f1)
+	mbs=$(grep 'IO Summary' "$tmp/varmail.out" | grep -o '[0-9.]*mb/s' |
+		sed 's|mb/s||')
+	echo "$v,varmail,$t,$ops,$mbs,,,," >> "$OUT"
+}
+
+build_variants() {
+	local v
+
+	for v in $VARIANTS; do
+		make -C "$TOP/$(variant_dir "$v")" >/dev/null
+	done
+}
+
+main() {
+	local v w t tmp
+
+	[ "$(id -u)" -eq 0 ] || { echo "run as root" >&2; exit 1; }
+	build_variants
+	tmp=$(mktemp -d)
+	trap 'restore_aslr; umount "$MNT" 2>/dev/null; teardown_dev; rm -rf "$tmp"' EXIT
+
+	echo "variant,workload,threads,ops_per_sec,mb_per_sec,p50_us,p99_us,p999_us,waf" > "$OUT"
+	for v in $VARIANTS; do
+		# scalelfs and pgc both register "f3fs"
+		insmod "$TOP/$(variant_dir "$v")/$(variant_mod "$v").ko"
+		for w in $WORKLOADS; do
+			for t in $THREADS; do
+				export BENCH_THREADS=$t
+				format_mount "$v"
+				"run_$w" "$v" "$t" "$tmp"
+				umount_dev
+			done
+		done
+		rmmod "$(variant_mod "$v")"
+	done
+	echo "results in $OUT"
+}
+
+main
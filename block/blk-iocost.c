@@ -2823,6 +2823,50 @@ static void ioc_rqos_exit(struct rq_qos *rqos)
 	kfree(ioc);
 }
 
+/**
+ * blk_iocost_feedback - report how iocost sees a device and a cgroup on it
+ * @q: request_queue of interest
+ * @css: blkcg css whose debt to report, NULL for none
+ * @fb: filled with the feedback
+ *
+ * For kernel I/O generators which issue on behalf of nobody in particular,
+ * e.g. filesystem garbage collection, and want to scale down on their own
+ * before iocost has to throttle their bios.  @fb->busy_level is positive
+ * while QoS targets are being missed and grows the longer that lasts.
+ *
+ * Returns -ENODEV if iocost is not enabled on @q.
+ */
+int blk_iocost_feedback(struct request_queue *q,
+			struct cgroup_subsys_state *css,
+			struct blk_iocost_feedback *fb)
+{
+	struct ioc *ioc = q_to_ioc(q);
+	struct blkcg_gq *blkg;
+
+	memset(fb, 0, sizeof(*fb));
+	if (!ioc || !READ_ONCE(ioc->enabled))
+		return -ENODEV;
+
+	fb->busy_level = READ_ONCE(ioc->busy_level);
+	fb->vrate_pct = div64_u64(atomic64_read(&ioc->vtime_rate) * 100,
+				  VTIME_PER_USEC);
+	if (!css)
+		return 0;
+
+	rcu_read_lock();
+	blkg = blkg_lookup(css_to_blkcg(css), q);
+	if (blkg) {
+		struct ioc_gq *iocg = blkg_to_iocg(blkg);
+
+		if (iocg)
+			fb->debt_us = div64_u64(READ_ONCE(iocg->abs_vdebt),
+						VTIME_PER_USEC);
+	}
+	rcu_read_unlock();
+	return 0;
+}
+EXPORT_SYMBOL_GPL(blk_iocost_feedback);
+
 static struct rq_qos_ops ioc_rqos_ops = {
 	.throttle = ioc_rqos_throttle,
 	.merge = ioc_rqos_merge,
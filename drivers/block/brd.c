@@ -24,6 +24,9 @@
 #include <linux/slab.h>
 #include <linux/backing-dev.h>
 #include <linux/debugfs.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/wait_bit.h>
 
 #include <linux/uaccess.h>
 
@@ -46,6 +49,15 @@ struct brd_device {
 	spinlock_t		brd_lock;
 	struct radix_tree_root	brd_pages;
 	u64			brd_nr_pages;
+
+	/*
+	 * Device emulation, see brd_emu_complete(). The channels and the
+	 * transfer cursors are in ktime nanoseconds.
+	 */
+	spinlock_t		emu_lock;
+	u64			*emu_chan_busy;	/* channel busy until */
+	u64			emu_xfer_busy[2]; /* read/write bus busy until */
+	atomic_t		emu_inflight;
 };
 
 /*
@@ -282,6 +294,147 @@ static int brd_do_bvec(struct brd_device *brd, struct page *page,
 	return err;
 }
 
+/*
+ * Device emulation. brd completes every bio at memory speed, which says
+ * little about how a filesystem scales on a real SSD. When any of the
+ * parameters below is set, the data is still copied at submission, but the
+ * bio is completed from an hrtimer once the emulated device is done with it:
+ *
+ *  - every bio is served by the channel that frees up first, and occupies
+ *    it for the per-op latency (flush latency for a PREFLUSH, then the
+ *    read or write latency for the data);
+ *  - the data of reads and writes additionally goes through one bus per
+ *    direction, capped at brd_read_mbps/brd_write_mbps.
+ *
+ * brd_channels is the number of channels, 0 for as many as there are bios
+ * in flight.
+ */
+static unsigned int brd_read_lat_us;
+module_param(brd_read_lat_us, uint, 0644);
+MODULE_PARM_DESC(brd_read_lat_us, "Emulated read latency in usec");
+
+static unsigned int brd_write_lat_us;
+module_param(brd_write_lat_us, uint, 0644);
+MODULE_PARM_DESC(brd_write_lat_us, "Emulated write latency in usec");
+
+static unsigned int brd_flush_lat_us;
+module_param(brd_flush_lat_us, uint, 0644);
+MODULE_PARM_DESC(brd_flush_lat_us, "Emulated cache flush latency in usec");
+
+static unsigned int brd_read_mbps;
+module_param(brd_read_mbps, uint, 0644);
+MODULE_PARM_DESC(brd_read_mbps, "Emulated read bandwidth in MB/s, 0 for no cap");
+
+static unsigned int brd_write_mbps;
+module_param(brd_write_mbps, uint, 0644);
+MODULE_PARM_DESC(brd_write_mbps, "Emulated write bandwidth in MB/s, 0 for no cap");
+
+#define BRD_MAX_CHANNELS	256
+static unsigned int brd_channels;
+module_param(brd_channels, uint, 0444);
+MODULE_PARM_DESC(brd_channels, "Emulated internal parallelism, 0 for unlimited");
+
+struct brd_emu_cmd {
+	struct hrtimer		timer;
+	struct bio		*bio;
+	struct brd_device	*brd;
+};
+
+static struct kmem_cache *brd_emu_cache;
+
+static bool brd_emulating(void)
+{
+	return READ_ONCE(brd_read_lat_us) || READ_ONCE(brd_write_lat_us) ||
+		READ_ONCE(brd_flush_lat_us) || READ_ONCE(brd_read_mbps) ||
+		READ_ONCE(brd_write_mbps) || brd_channels;
+}
+
+/* nanoseconds to move len bytes at mbps MB/s */
+static u64 brd_xfer_ns(unsigned int len, unsigned int mbps)
+{
+	return mbps ? div_u64((u64)len * NSEC_PER_USEC, mbps) : 0;
+}
+
+/*
+ * Returns when the emulated device is done with a bio of len data bytes
+ * submitted at now.
+ */
+static u64 brd_emu_complete(struct brd_device *brd, u64 now, bool write,
+			    bool flush, unsigned int len)
+{
+	u64 lat = 0, start = now, done;
+	unsigned int mbps;
+	int i, chan = -1;
+
+	if (flush)
+		lat += (u64)READ_ONCE(brd_flush_lat_us) * NSEC_PER_USEC;
+	if (len)
+		lat += (u64)(write ? READ_ONCE(brd_write_lat_us) :
+			     READ_ONCE(brd_read_lat_us)) * NSEC_PER_USEC;
+	mbps = write ? READ_ONCE(brd_write_mbps) : READ_ONCE(brd_read_mbps);
+
+	spin_lock(&brd->emu_lock);
+	if (brd->emu_chan_busy) {
+		chan = 0;
+		for (i = 1; i < brd_channels; i++)
+			if (brd->emu_chan_busy[i] < brd->emu_chan_busy[chan])
+				chan = i;
+		start = max(now, brd->emu_chan_busy[chan]);
+	}
+	done = start + lat;
+	if (len && mbps) {
+		u64 *bus = &brd->emu_xfer_busy[write];
+
+		*bus = max(start, *bus) + brd_xfer_ns(len, mbps);
+		done = max(done, *bus);
+	}
+	if (chan >= 0)
+		brd->emu_chan_busy[chan] = done;
+	spin_unlock(&brd->emu_lock);
+
+	return done;
+}
+
+static enum hrtimer_restart brd_emu_timer_fn(struct hrtimer *timer)
+{
+	struct brd_emu_cmd *cmd = container_of(timer, struct brd_emu_cmd,
+					       timer);
+	struct brd_device *brd = cmd->brd;
+
+	bio_endio(cmd->bio);
+	kmem_cache_free(brd_emu_cache, cmd);
+	if (atomic_dec_and_test(&brd->emu_inflight))
+		wake_up_var(&brd->emu_inflight);
+	return HRTIMER_NORESTART;
+}
+
+/* completes the bio now if it cannot be delayed */
+static void brd_emu_endio(struct brd_device *brd, struct bio *bio,
+			  unsigned int len)
+{
+	struct brd_emu_cmd *cmd;
+	u64 now = ktime_get_ns(), done;
+
+	done = brd_emu_complete(brd, now, op_is_write(bio_op(bio)),
+				bio->bi_opf & REQ_PREFLUSH, len);
+	if (done <= now)
+		goto endio;
+
+	cmd = kmem_cache_alloc(brd_emu_cache, GFP_NOIO);
+	if (!cmd)
+		goto endio;
+
+	cmd->bio = bio;
+	cmd->brd = brd;
+	atomic_inc(&brd->emu_inflight);
+	hrtimer_init(&cmd->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS_SOFT);
+	cmd->timer.function = brd_emu_timer_fn;
+	hrtimer_start(&cmd->timer, ns_to_ktime(done), HRTIMER_MODE_ABS_SOFT);
+	return;
+endio:
+	bio_endio(bio);
+}
+
 static void brd_submit_bio(struct bio *bio)
 {
 	struct brd_device *brd = bio->bi_bdev->bd_disk->private_data;
@@ -306,6 +459,10 @@ static void brd_submit_bio(struct bio *bio)
 		sector += len >> SECTOR_SHIFT;
 	}
 
+	if (brd_emulating()) {
+		brd_emu_endio(brd, bio, bio->bi_iter.bi_size);
+		return;
+	}
 	bio_endio(bio);
 }
 
@@ -317,6 +474,9 @@ static int brd_rw_page(struct block_device *bdev, sector_t sector,
 
 	if (PageTransHuge(page))
 		return -ENOTSUPP;
+	/* go through brd_submit_bio() to be delayed */
+	if (brd_emulating())
+		return -EOPNOTSUPP;
 	err = brd_do_bvec(brd, page, PAGE_SIZE, 0, op, sector);
 	page_endio(page, op_is_write(op), err);
 	return err;
@@ -382,6 +542,14 @@ static int brd_alloc(int i)
 
 	spin_lock_init(&brd->brd_lock);
 	INIT_RADIX_TREE(&brd->brd_pages, GFP_ATOMIC);
+	spin_lock_init(&brd->emu_lock);
+	atomic_set(&brd->emu_inflight, 0);
+	if (brd_channels) {
+		brd->emu_chan_busy = kcalloc(brd_channels, sizeof(u64),
+					     GFP_KERNEL);
+		if (!brd->emu_chan_busy)
+			goto out_free_dev;
+	}
 
 	snprintf(buf, DISK_NAME_LEN, "ram%d", i);
 	if (!IS_ERR_OR_NULL(brd_debugfs_dir))
@@ -422,6 +590,7 @@ static int brd_alloc(int i)
 	put_disk(disk);
 out_free_dev:
 	list_del(&brd->brd_list);
+	kfree(brd->emu_chan_busy);
 	kfree(brd);
 	return err;
 }
@@ -439,9 +608,13 @@ static void brd_cleanup(void)
 
 	list_for_each_entry_safe(brd, next, &brd_devices, brd_list) {
 		del_gendisk(brd->brd_disk);
+		/* bios held back by the emulation still point at brd */
+		wait_var_event(&brd->emu_inflight,
+			       !atomic_read(&brd->emu_inflight));
 		put_disk(brd->brd_disk);
 		brd_free_pages(brd);
 		list_del(&brd->brd_list);
+		kfree(brd->emu_chan_busy);
 		kfree(brd);
 	}
 }
@@ -471,6 +644,16 @@ static int __init brd_init(void)
 
 	brd_check_and_reset_par();
 
+	if (brd_channels > BRD_MAX_CHANNELS) {
+		pr_info("brd: brd_channels can't be larger than %d, reset brd_channels = %d.\n",
+			BRD_MAX_CHANNELS, BRD_MAX_CHANNELS);
+		brd_channels = BRD_MAX_CHANNELS;
+	}
+
+	brd_emu_cache = KMEM_CACHE(brd_emu_cmd, 0);
+	if (!brd_emu_cache)
+		return -ENOMEM;
+
 	brd_debugfs_dir = debugfs_create_dir("ramdisk_pages", NULL);
 
 	for (i = 0; i < rd_nr; i++) {
@@ -504,6 +687,7 @@ static int __init brd_init(void)
 
 out_free:
 	brd_cleanup();
+	kmem_cache_destroy(brd_emu_cache);
 
 	pr_info("brd: module NOT loaded !!!\n");
 	return err;
@@ -514,6 +698,7 @@ static void __exit brd_exit(void)
 
 	unregister_blkdev(RAMDISK_MAJOR, "ramdisk");
 	brd_cleanup();
+	kmem_cache_destroy(brd_emu_cache);
 
 	pr_info("brd: module unloaded\n");
 }
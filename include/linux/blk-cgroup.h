@@ -14,6 +14,7 @@
  * 	              Nauman Rafique <nauman@google.com>
  */
 
+#include <linux/errno.h>
 #include <linux/types.h>
 
 struct bio;
@@ -22,6 +23,13 @@ struct request_queue;
 
 #define FC_APPID_LEN              129
 
+/* see blk_iocost_feedback() */
+struct blk_iocost_feedback {
+	int	busy_level;	/* > 0 while QoS targets are missed */
+	u32	vrate_pct;	/* current vrate, 100 is nominal */
+	u64	debt_us;	/* outstanding debt of the cgroup */
+};
+
 #ifdef CONFIG_BLK_CGROUP
 extern struct cgroup_subsys_state * const blkcg_root_css;
 
@@ -46,6 +54,19 @@ static inline struct cgroup_subsys_state *bio_blkcg_css(struct bio *bio)
 }
 #endif	/* CONFIG_BLK_CGROUP */
 
+#ifdef CONFIG_BLK_CGROUP_IOCOST
+int blk_iocost_feedback(struct request_queue *q,
+			struct cgroup_subsys_state *css,
+			struct blk_iocost_feedback *fb);
+#else
+static inline int blk_iocost_feedback(struct request_queue *q,
+			struct cgroup_subsys_state *css,
+			struct blk_iocost_feedback *fb)
+{
+	return -ENODEV;
+}
+#endif
+
 int blkcg_set_fc_appid(char *app_id, u64 cgrp_id, size_t app_id_len);
 char *blkcg_get_fc_appid(struct bio *bio);
 
@@ -123,6 +123,7 @@ struct f3fs_super_block {
 /*
  * For checkpoint
  */
+#define CP_RECLAIM_JOURNAL_FLAG	0x00010000
 #define CP_RESIZEFS_FLAG		0x00004000
 #define CP_DISABLED_QUICK_FLAG		0x00002000
 #define CP_DISABLED_FLAG		0x00001000
@@ -166,7 +167,8 @@ struct f3fs_checkpoint {
 	__le32 checksum_offset;		/* checksum offset inside cp block */
 	__le64 elapsed_time;		/* mounted time */
 	/* allocation type of current segment */
-	unsigned char alloc_type[MAX_ACTIVE_LOGS];
+	unsigned char alloc_type[MAX_ACTIVE_LOGS - 2];
+	__le16 nr_gc_log;		/* # of GC data logs, 0 for all */
 
 	/* SIT and NAT version bitmap */
 	unsigned char sit_nat_version_bitmap[];
@@ -193,6 +195,35 @@ struct f3fs_orphan_block {
 	__le32 check_sum;	/* CRC32 for orphan inode block */
 } __packed;
 
+/*
+ * Reclaim journal blocks follow the live CP pack in its segment. A record
+ * lists where GC moved the checkpointed blocks of one segment, so that the
+ * segment can be reused before the next checkpoint.
+ */
+#define F3FS_RECLAIM_MAGIC	0x4a4c4352	/* "RCLJ" */
+#define F3FS_RECLAIM_ENTRIES	254
+
+struct f3fs_reclaim_entry {
+	__le32 nid;		/* dnode holding the block address */
+	__le16 ofs_in_node;	/* slot in that dnode */
+	__le16 reserved;
+	__le32 old_addr;	/* address in the checkpoint */
+	__le32 new_addr;	/* address of the durable copy */
+} __packed;
+
+struct f3fs_reclaim_block {
+	__le32 magic;		/* F3FS_RECLAIM_MAGIC */
+	__le32 check_sum;	/* CRC32 from cp_ver to the end */
+	__le64 cp_ver;		/* checkpoint this record applies to */
+	__le32 seq;		/* record number since that checkpoint */
+	__le32 segno;		/* reclaimed segment */
+	__le16 blk_idx;		/* block index in this record */
+	__le16 blk_count;	/* # of blocks in this record */
+	__le16 entry_count;	/* # of entries in this block */
+	__le16 reserved;
+	struct f3fs_reclaim_entry entries[F3FS_RECLAIM_ENTRIES];
+} __packed;
+
 /*
  * For NODE structure
  */
@@ -797,6 +797,9 @@ struct f4fs_inode_info {
 	nid_t i_xattr_nid;		/* node id that contains xattrs */
 	loff_t	last_disk_size;		/* lastly written file size */
 	spinlock_t i_size_lock;		/* protect last_disk_size */
+#ifdef MLOG
+	unsigned int i_mlog;		/* sticky log + 1, 0 if unassigned */
+#endif
 
 #ifdef CONFIG_QUOTA
 	struct dquot *i_dquot[MAXQUOTAS];
@@ -1621,6 +1624,22 @@ struct max_info {
   struct rps rps_node_write;
 };
 
+#ifdef MLOG
+/* contended allocations on one log before its cpu moves to the next log */
+#define MLOG_REBALANCE_THRESHOLD	16
+
+struct mlog_cpu {
+  unsigned int log;		/* log this cpu appends to */
+  unsigned int contended;	/* contended allocations since last move */
+};
+
+struct mlog_stat {
+  atomic64_t writes;		/* # of blocks allocated in this log */
+  atomic64_t contended;		/* # of times curseg_mutex was busy */
+  atomic64_t moves;		/* # of cpus rebalanced away from this log */
+} ____cacheline_aligned_in_smp;
+#endif
+
 #define NULL_CLUSTER			((unsigned int)(~0))
 #define MIN_COMPRESS_LOG_SIZE		2
 #define MAX_COMPRESS_LOG_SIZE		8
@@ -1893,7 +1912,10 @@ struct f4fs_sb_info {
 #endif
 #ifdef MLOG
   uint nr_mlog;
-  atomic_t next_mlog;
+  uint nr_curseg_sets;			/* # of curseg sets, one per log */
+  uint nr_curseg_logs;			/* # of logs open for allocation */
+  struct mlog_cpu __percpu *mlog_cpu;	/* log affinity of each cpu */
+  struct mlog_stat *mlog_stat;		/* per-log allocation stats */
 #endif
 };
 
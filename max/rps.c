@@ -6,22 +6,117 @@
 #include <linux/rcupdate.h>
 #include <linux/sched.h>
 #include <linux/errno.h>
+#include <linux/ktime.h>
 
 #include "rps.h"
 
+/*
+ * The writer side follows kernel/rcu/sync.c, which is not exported to
+ * modules: readers stay on the per-cpu highway while the state is idle,
+ * a writer waits for one normal grace period to push them onto the lowway,
+ * and leaving the writer only queues a callback.  Back-to-back writers
+ * (e.g. consecutive checkpoints) which come before that callback runs
+ * don't wait for another grace period.
+ */
+enum { RPS_GP_IDLE = 0, RPS_GP_ENTER, RPS_GP_PASSED, RPS_GP_EXIT,
+                                                RPS_GP_REPLAY };
+
+#define rss_lock        gp_wait.lock
+
+static void rps_sync_func(struct rcu_head *rhp);
+
+static void rps_sync_init(struct rcu_sync *rsp) {
+        memset(rsp, 0, sizeof(*rsp));
+        init_waitqueue_head(&rsp->gp_wait);
+}
+
+static void rps_sync_func(struct rcu_head *rhp) {
+        struct rcu_sync *rsp = container_of(rhp, struct rcu_sync, cb_head);
+        unsigned long flags;
+
+        spin_lock_irqsave(&rsp->rss_lock, flags);
+        if (rsp->gp_count) {
+                /* a grace period after RPS_GP_ENTER, readers are slow now */
+                WRITE_ONCE(rsp->gp_state, RPS_GP_PASSED);
+                wake_up_locked(&rsp->gp_wait);
+        } else if (rsp->gp_state == RPS_GP_REPLAY) {
+                /* another writer came and left in the meantime */
+                WRITE_ONCE(rsp->gp_state, RPS_GP_EXIT);
+                call_rcu(&rsp->cb_head, rps_sync_func);
+        } else {
+                /* everybody has observed the last writer, let 'em rip */
+                WRITE_ONCE(rsp->gp_state, RPS_GP_IDLE);
+        }
+        spin_unlock_irqrestore(&rsp->rss_lock, flags);
+}
+
+/* return true if we had to wait for a grace period */
+static bool rps_sync_enter(struct rcu_sync *rsp) {
+        int gp_state;
+
+        spin_lock_irq(&rsp->rss_lock);
+        gp_state = rsp->gp_state;
+        if (gp_state == RPS_GP_IDLE)
+                WRITE_ONCE(rsp->gp_state, RPS_GP_ENTER);
+        rsp->gp_count++;
+        spin_unlock_irq(&rsp->rss_lock);
+
+        if (gp_state == RPS_GP_IDLE) {
+                synchronize_rcu();
+                rps_sync_func(&rsp->cb_head);
+                return true;
+        }
+
+        wait_event(rsp->gp_wait, READ_ONCE(rsp->gp_state) >= RPS_GP_PASSED);
+        return false;
+}
+
+static void rps_sync_exit(struct rcu_sync *rsp) {
+        spin_lock_irq(&rsp->rss_lock);
+        if (!--rsp->gp_count) {
+                if (rsp->gp_state == RPS_GP_PASSED) {
+                        WRITE_ONCE(rsp->gp_state, RPS_GP_EXIT);
+                        call_rcu(&rsp->cb_head, rps_sync_func);
+                } else if (rsp->gp_state == RPS_GP_EXIT) {
+                        WRITE_ONCE(rsp->gp_state, RPS_GP_REPLAY);
+                }
+        }
+        spin_unlock_irq(&rsp->rss_lock);
+}
+
+static void rps_sync_dtor(struct rcu_sync *rsp) {
+        int gp_state;
+
+        spin_lock_irq(&rsp->rss_lock);
+        if (rsp->gp_state == RPS_GP_REPLAY)
+                WRITE_ONCE(rsp->gp_state, RPS_GP_EXIT);
+        gp_state = rsp->gp_state;
+        spin_unlock_irq(&rsp->rss_lock);
+
+        /* the callback lives in this module, so wait for it to finish */
+        if (gp_state != RPS_GP_IDLE)
+                rcu_barrier();
+}
+
 int __rps_init_rwsem(struct rps *rps,
                                          const char *name, struct lock_class_key *rw_sem_key) {
         rps->highway_cnt = alloc_percpu(int);
         if (unlikely(!rps->highway_cnt))
                 return -ENOMEM;
         __init_rwsem(&rps->rw_sem, name, rw_sem_key);
-        atomic_set(&rps->writers_cnt, 0);
+        rps_sync_init(&rps->rss);
         atomic_set(&rps->lowway_cnt, 0);
         init_waitqueue_head(&rps->writers_wait_q);
+        atomic_set(&rps->nr_writes, 0);
+        atomic_set(&rps->nr_gp_waits, 0);
+        atomic64_set(&rps->write_wait_ns, 0);
         return 0;
 }
 
 void rps_free_rwsem(struct rps *rps) {
+        if (!rps->highway_cnt)
+                return;
+        rps_sync_dtor(&rps->rss);
         free_percpu(rps->highway_cnt);
         rps->highway_cnt = NULL;
 }
@@ -29,7 +124,7 @@ void rps_free_rwsem(struct rps *rps) {
 static inline bool go_highway(struct rps *rps, int val) {
         bool highway = false;
         preempt_disable();
-        if (likely(!atomic_read(&rps->writers_cnt))) {
+        if (likely(rcu_sync_is_idle(&rps->rss))) {
                 this_cpu_add(*rps->highway_cnt, val);
                 highway = true;
         }
@@ -84,16 +179,21 @@ static int clear_highway(struct rps *rps) {
 }
 
 void rps_down_write(struct rps *rps) {
-        atomic_inc(&rps->writers_cnt);
-        synchronize_rcu_expedited();
+        ktime_t start = ktime_get();
+
+        /* no reader can touch the highway once this returns */
+        if (rps_sync_enter(&rps->rss))
+                atomic_inc(&rps->nr_gp_waits);
         down_write(&rps->rw_sem);
         atomic_add(clear_highway(rps), &rps->lowway_cnt);
         wait_event(rps->writers_wait_q, !atomic_read(&rps->lowway_cnt));
+
+        atomic_inc(&rps->nr_writes);
+        atomic64_add(ktime_to_ns(ktime_sub(ktime_get(), start)),
+                                                &rps->write_wait_ns);
 }
 
 void rps_up_write(struct rps *rps) {
         up_write(&rps->rw_sem);
-        synchronize_rcu_expedited();
-        atomic_dec(&rps->writers_cnt);
+        rps_sync_exit(&rps->rss);
 }
-
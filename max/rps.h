@@ -6,13 +6,19 @@
 #include <linux/percpu.h>
 #include <linux/wait.h>
 #include <linux/lockdep.h>
+#include <linux/rcu_sync.h>
 
 struct rps {
     int __percpu *highway_cnt;
     atomic_t lowway_cnt;
-    atomic_t writers_cnt;
+    struct rcu_sync rss;            /* readers go lowway unless idle */
     wait_queue_head_t writers_wait_q;
     struct rw_semaphore rw_sem;
+
+    /* writer side statistics */
+    atomic_t nr_writes;             /* # of rps_down_write() */
+    atomic_t nr_gp_waits;           /* # of writes waited for a grace period */
+    atomic64_t write_wait_ns;       /* time spent in rps_down_write() */
 };
 
 void rps_down_read(struct rps *);
@@ -88,7 +88,7 @@ static inline unsigned long __reverse_ffs(unsigned long word)
 
 #ifdef MLOG
 int IS_CURSEG(struct f4fs_sb_info *sbi, int seg) {
-  for (int i = 0 ; i < sbi->nr_mlog ; i++) {
+  for (int i = 0 ; i < sbi->nr_curseg_logs ; i++) {
     for (int j = 0 ; j < NR_CURSEG_TYPE ; j++) {
       if (seg == (CURSEG_I(sbi, j + i * NR_CURSEG_TYPE)->segno)) return 1;
     }
@@ -97,13 +97,86 @@ int IS_CURSEG(struct f4fs_sb_info *sbi, int seg) {
 }
 
 int IS_CURSEC(struct f4fs_sb_info *sbi, int secno) {
-  for (int i = 0 ; i < sbi->nr_mlog ; i++) {
+  for (int i = 0 ; i < sbi->nr_curseg_logs ; i++) {
     for (int j = 0 ; j < NR_CURSEG_TYPE ; j++) {
       if (secno == (CURSEG_I(sbi, j+i*NR_CURSEG_TYPE)->segno / sbi->segs_per_sec)) return 1;
     }
   }
   return 0;
 }
+
+/*
+ * Pick the log a data block goes to.  An inode sticks to the log it first
+ * wrote to so that its blocks stay contiguous, and everybody else takes the
+ * log of the cpu it runs on, so writers on different cpus do not serialize
+ * on a single curseg_mutex.
+ */
+static unsigned int select_mlog(struct f4fs_sb_info *sbi, struct inode *inode)
+{
+  unsigned int log;
+
+  if (inode) {
+    log = READ_ONCE(F4FS_I(inode)->i_mlog);
+    if (log && log <= sbi->nr_curseg_logs)
+      return log - 1;
+  }
+  log = this_cpu_read(sbi->mlog_cpu->log);
+  if (inode)
+    WRITE_ONCE(F4FS_I(inode)->i_mlog, log + 1);
+  return log;
+}
+
+/*
+ * Called when the curseg_mutex of @log was found busy.  Once a cpu keeps
+ * hitting a busy log it moves on to the next one, and the inode follows.
+ */
+static void mlog_contended(struct f4fs_sb_info *sbi, struct inode *inode,
+    unsigned int log)
+{
+  struct mlog_cpu *mc;
+
+  atomic64_inc(&sbi->mlog_stat[log].contended);
+  if (sbi->nr_curseg_logs < 2)
+    return;
+
+  mc = get_cpu_ptr(sbi->mlog_cpu);
+  if (++mc->contended >= MLOG_REBALANCE_THRESHOLD) {
+    mc->contended = 0;
+    mc->log = (log + 1) % sbi->nr_curseg_logs;
+    atomic64_inc(&sbi->mlog_stat[log].moves);
+    if (inode)
+      WRITE_ONCE(F4FS_I(inode)->i_mlog, 0);
+  }
+  put_cpu_ptr(sbi->mlog_cpu);
+}
+
+static int init_mlog(struct f4fs_sb_info *sbi)
+{
+  /*
+   * Only the first log is open until roll-forward recovery is done, see
+   * __f4fs_init_mlog_curseg().
+   */
+  sbi->nr_curseg_logs = 1;
+
+  sbi->mlog_stat = f4fs_kzalloc(sbi, array_size(sbi->nr_curseg_sets,
+        sizeof(struct mlog_stat)), GFP_KERNEL);
+  if (!sbi->mlog_stat)
+    return -ENOMEM;
+
+  /* alloc_percpu() zeroes, so every cpu starts on log 0 */
+  sbi->mlog_cpu = alloc_percpu(struct mlog_cpu);
+  if (!sbi->mlog_cpu)
+    return -ENOMEM;
+  return 0;
+}
+
+static void destroy_mlog(struct f4fs_sb_info *sbi)
+{
+  free_percpu(sbi->mlog_cpu);
+  sbi->mlog_cpu = NULL;
+  kfree(sbi->mlog_stat);
+  sbi->mlog_stat = NULL;
+}
 #endif
 
 /*
@@ -2749,9 +2822,59 @@ static void __f4fs_init_atgc_curseg(struct f4fs_sb_info *sbi)
 	f4fs_up_read(&SM_I(sbi)->curseg_lock);
 
 }
+
+#ifdef MLOG
+/*
+ * Open the data cursegs of every log beyond the first.  This runs after
+ * roll-forward recovery, so the extra logs cannot take the free segments
+ * recovery replays blocks into.
+ */
+static void __f4fs_init_mlog_curseg(struct f4fs_sb_info *sbi)
+{
+	unsigned int nr_extra = (sbi->nr_curseg_sets - 1) * NR_CURSEG_DATA_TYPE;
+	int log, type, cpu;
+
+	if (sbi->nr_curseg_sets < 2 || sbi->nr_curseg_logs > 1)
+		return;
+
+	if (free_segments(sbi) < reserved_segments(sbi) + nr_extra) {
+		f4fs_warn(sbi, "Not enough free segments for %u logs, use one",
+							sbi->nr_curseg_sets);
+		return;
+	}
+
+	f4fs_down_read(&SM_I(sbi)->curseg_lock);
+	for (log = 1; log < sbi->nr_curseg_sets; log++) {
+		for (type = CURSEG_HOT_DATA; type <= CURSEG_COLD_DATA; type++) {
+			int i = type + log * NR_CURSEG_TYPE;
+			struct curseg_info *curseg = CURSEG_I(sbi, i);
+
+			mutex_lock(&curseg->curseg_mutex);
+			down_write(&SIT_I(sbi)->sentry_lock);
+			/* not on any segment yet, search from the start */
+			curseg->segno = 0;
+			new_curseg(sbi, i, true);
+			stat_inc_seg_type(sbi, curseg);
+			up_write(&SIT_I(sbi)->sentry_lock);
+			mutex_unlock(&curseg->curseg_mutex);
+		}
+	}
+	f4fs_up_read(&SM_I(sbi)->curseg_lock);
+
+	/* IS_CURSEG() must cover the new logs before anybody writes there */
+	WRITE_ONCE(sbi->nr_curseg_logs, sbi->nr_curseg_sets);
+	for_each_possible_cpu(cpu)
+		per_cpu_ptr(sbi->mlog_cpu, cpu)->log =
+					cpu % sbi->nr_curseg_sets;
+}
+#endif
+
 void f4fs_init_inmem_curseg(struct f4fs_sb_info *sbi)
 {
 	__f4fs_init_atgc_curseg(sbi);
+#ifdef MLOG
+	__f4fs_init_mlog_curseg(sbi);
+#endif
 }
 
 static void __f4fs_save_inmem_curseg(struct f4fs_sb_info *sbi, int type)
@@ -2776,10 +2899,20 @@ static void __f4fs_save_inmem_curseg(struct f4fs_sb_info *sbi, int type)
 
 void f4fs_save_inmem_curseg(struct f4fs_sb_info *sbi)
 {
+#ifdef MLOG
+	int log, type;
+
+#endif
 	__f4fs_save_inmem_curseg(sbi, CURSEG_COLD_DATA_PINNED);
 
 	if (sbi->am.atgc_enabled)
 		__f4fs_save_inmem_curseg(sbi, CURSEG_ALL_DATA_ATGC);
+#ifdef MLOG
+	for (log = 1; log < sbi->nr_curseg_logs; log++)
+		for (type = CURSEG_HOT_DATA; type <= CURSEG_COLD_DATA; type++)
+			__f4fs_save_inmem_curseg(sbi,
+					type + log * NR_CURSEG_TYPE);
+#endif
 }
 
 static void __f4fs_restore_inmem_curseg(struct f4fs_sb_info *sbi, int type)
@@ -2801,10 +2934,20 @@ static void __f4fs_restore_inmem_curseg(struct f4fs_sb_info *sbi, int type)
 
 void f4fs_restore_inmem_curseg(struct f4fs_sb_info *sbi)
 {
+#ifdef MLOG
+	int log, type;
+
+#endif
 	__f4fs_restore_inmem_curseg(sbi, CURSEG_COLD_DATA_PINNED);
 
 	if (sbi->am.atgc_enabled)
 		__f4fs_restore_inmem_curseg(sbi, CURSEG_ALL_DATA_ATGC);
+#ifdef MLOG
+	for (log = 1; log < sbi->nr_curseg_logs; log++)
+		for (type = CURSEG_HOT_DATA; type <= CURSEG_COLD_DATA; type++)
+			__f4fs_restore_inmem_curseg(sbi,
+					type + log * NR_CURSEG_TYPE);
+#endif
 }
 
 static int get_ssr_segment(struct f4fs_sb_info *sbi, int type,
@@ -3245,14 +3388,35 @@ void f4fs_allocate_data_block(struct f4fs_sb_info *sbi, struct page *page,
 		struct f4fs_io_info *fio)
 {
 	struct sit_info *sit_i = SIT_I(sbi);
-	struct curseg_info *curseg = CURSEG_I(sbi, type);
+	struct curseg_info *curseg;
 	unsigned long long old_mtime;
 	bool from_gc = (type == CURSEG_ALL_DATA_ATGC);
 	struct seg_entry *se = NULL;
+#ifdef MLOG
+	struct inode *inode = NULL;
+	unsigned int log = 0;
+
+	/* node logs stay put, roll-forward recovery walks the warm node chain */
+	if (IS_DATASEG(type)) {
+		if (page && page->mapping)
+			inode = page->mapping->host;
+		log = select_mlog(sbi, inode);
+		type += log * NR_CURSEG_TYPE;
+	}
+#endif
+	curseg = CURSEG_I(sbi, type);
 
 	f4fs_down_read(&SM_I(sbi)->curseg_lock);
 
+#ifdef MLOG
+	if (!mutex_trylock(&curseg->curseg_mutex)) {
+		mlog_contended(sbi, inode, log);
+		mutex_lock(&curseg->curseg_mutex);
+	}
+	atomic64_inc(&sbi->mlog_stat[log].writes);
+#else
 	mutex_lock(&curseg->curseg_mutex);
+#endif
 	down_write(&sit_i->sentry_lock);
 
 	if (from_gc) {
@@ -4335,16 +4499,26 @@ static int build_free_segmap(struct f4fs_sb_info *sbi)
 static int build_curseg(struct f4fs_sb_info *sbi)
 {
 	struct curseg_info *array;
-	int i;
+	int i, nr_cursegs = NR_CURSEG_TYPE;
 
-	array = f4fs_kzalloc(sbi, array_size(NR_CURSEG_TYPE,
+#ifdef MLOG
+	/*
+	 * Every log beyond the first gets its own set of data cursegs, kept
+	 * in memory like the ATGC log and saved to SSA at checkpoint.
+	 */
+	sbi->nr_curseg_sets = max_t(uint, sbi->nr_mlog, 1);
+	nr_cursegs *= sbi->nr_curseg_sets;
+#endif
+	array = f4fs_kzalloc(sbi, array_size(nr_cursegs,
 					sizeof(*array)), GFP_KERNEL);
 	if (!array)
 		return -ENOMEM;
 
 	SM_I(sbi)->curseg_array = array;
 
-	for (i = 0; i < NO_CHECK_TYPE; i++) {
+	for (i = 0; i < nr_cursegs; i++) {
+		int type = i % NR_CURSEG_TYPE;
+
 		mutex_init(&array[i].curseg_mutex);
 		array[i].sum_blk = f4fs_kzalloc(sbi, PAGE_SIZE, GFP_KERNEL);
 		if (!array[i].sum_blk)
@@ -4354,11 +4528,11 @@ static int build_curseg(struct f4fs_sb_info *sbi)
 				sizeof(struct f4fs_journal), GFP_KERNEL);
 		if (!array[i].journal)
 			return -ENOMEM;
-		if (i < NR_PERSISTENT_LOG)
-			array[i].seg_type = CURSEG_HOT_DATA + i;
-		else if (i == CURSEG_COLD_DATA_PINNED)
+		if (type < NR_PERSISTENT_LOG)
+			array[i].seg_type = CURSEG_HOT_DATA + type;
+		else if (type == CURSEG_COLD_DATA_PINNED)
 			array[i].seg_type = CURSEG_COLD_DATA;
-		else if (i == CURSEG_ALL_DATA_ATGC)
+		else if (type == CURSEG_ALL_DATA_ATGC)
 			array[i].seg_type = CURSEG_COLD_DATA;
 		array[i].segno = NULL_SEGNO;
 		array[i].next_blkoff = 0;
@@ -5137,6 +5311,11 @@ int f4fs_build_segment_manager(struct f4fs_sb_info *sbi)
 	err = build_curseg(sbi);
 	if (err)
 		return err;
+#ifdef MLOG
+	err = init_mlog(sbi);
+	if (err)
+		return err;
+#endif
 
 	/* reinit free segmap based on SIT */
 	err = build_sit_entries(sbi);
@@ -5206,7 +5385,11 @@ static void destroy_curseg(struct f4fs_sb_info *sbi)
 	if (!array)
 		return;
 	SM_I(sbi)->curseg_array = NULL;
+#ifdef MLOG
+	for (i = 0; i < NR_CURSEG_TYPE * sbi->nr_curseg_sets; i++) {
+#else
 	for (i = 0; i < NR_CURSEG_TYPE; i++) {
+#endif
 		kfree(array[i].sum_blk);
 		kfree(array[i].journal);
 	}
@@ -5258,6 +5441,9 @@ void f4fs_destroy_segment_manager(struct f4fs_sb_info *sbi)
 	f4fs_destroy_flush_cmd_control(sbi, true);
 	destroy_discard_cmd_control(sbi);
 	destroy_dirty_segmap(sbi);
+#ifdef MLOG
+	destroy_mlog(sbi);
+#endif
 	destroy_curseg(sbi);
 	destroy_free_segmap(sbi);
 	destroy_sit_info(sbi);
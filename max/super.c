@@ -1543,6 +1543,10 @@ static void destroy_percpu_info(struct f4fs_sb_info *sbi)
 	percpu_counter_destroy(&sbi->total_valid_inode_count);
 	percpu_counter_destroy(&sbi->rf_node_block_count);
 	percpu_counter_destroy(&sbi->alloc_valid_block_count);
+#ifdef RPS
+	rps_free_rwsem(&sbi->max_info.rps_cp_rwsem);
+	rps_free_rwsem(&sbi->max_info.rps_node_write);
+#endif
 }
 
 static void destroy_device_list(struct f4fs_sb_info *sbi)
@@ -4172,10 +4176,6 @@ static int f4fs_fill_super(struct super_block *sb, void *data, int silent)
 #endif
 	init_f4fs_rwsem(&sbi->node_change);
 
-#ifdef MLOG
-  atomic_set(&sbi->next_mlog, 0);
-#endif
-
 	/* disallow all the data/node/meta page writes */
 	set_sbi_flag(sbi, SBI_POR_DOING);
 	spin_lock_init(&sbi->stat_lock);
@@ -4253,6 +4253,8 @@ static int f4fs_fill_super(struct super_block *sb, void *data, int silent)
 #ifdef MLOG
   if (sbi->nr_mlog > le32_to_cpu(sbi->ckpt->nr_mlog))
     sbi->nr_mlog = le32_to_cpu(sbi->ckpt->nr_mlog);
+  if (!sbi->nr_mlog)
+    sbi->nr_mlog = 1;
 #endif
 
 	sbi->total_valid_node_count =
@@ -99,6 +99,44 @@ static ssize_t dirty_segments_show(struct f4fs_attr *a,
 			(unsigned long long)(dirty_segments(sbi)));
 }
 
+#ifdef RPS
+static ssize_t rps_stat_show(struct f4fs_attr *a,
+		struct f4fs_sb_info *sbi, char *buf)
+{
+	struct rps *cp = &sbi->max_info.rps_cp_rwsem;
+	struct rps *nw = &sbi->max_info.rps_node_write;
+
+	return sprintf(buf, "cp_rwsem: writes %d gp_waits %d wait_ns %lld\n"
+			"node_write: writes %d gp_waits %d wait_ns %lld\n",
+			atomic_read(&cp->nr_writes),
+			atomic_read(&cp->nr_gp_waits),
+			(long long)atomic64_read(&cp->write_wait_ns),
+			atomic_read(&nw->nr_writes),
+			atomic_read(&nw->nr_gp_waits),
+			(long long)atomic64_read(&nw->write_wait_ns));
+}
+#endif
+
+#ifdef MLOG
+static ssize_t mlog_stat_show(struct f4fs_attr *a,
+		struct f4fs_sb_info *sbi, char *buf)
+{
+	struct mlog_stat *ms;
+	int len = 0;
+	int i;
+
+	for (i = 0; i < sbi->nr_curseg_logs; i++) {
+		ms = &sbi->mlog_stat[i];
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+				"log %d: writes %lld contended %lld moves %lld\n",
+				i, (long long)atomic64_read(&ms->writes),
+				(long long)atomic64_read(&ms->contended),
+				(long long)atomic64_read(&ms->moves));
+	}
+	return len;
+}
+#endif
+
 static ssize_t free_segments_show(struct f4fs_attr *a,
 		struct f4fs_sb_info *sbi, char *buf)
 {
@@ -833,6 +871,12 @@ F4FS_GENERAL_RO_ATTR(encoding);
 F4FS_GENERAL_RO_ATTR(mounted_time_sec);
 F4FS_GENERAL_RO_ATTR(main_blkaddr);
 F4FS_GENERAL_RO_ATTR(pending_discard);
+#ifdef RPS
+F4FS_GENERAL_RO_ATTR(rps_stat);
+#endif
+#ifdef MLOG
+F4FS_GENERAL_RO_ATTR(mlog_stat);
+#endif
 #ifdef CONFIG_F4FS_STAT_FS
 F4FS_STAT_ATTR(STAT_INFO, f4fs_stat_info, cp_foreground_calls, cp_count);
 F4FS_STAT_ATTR(STAT_INFO, f4fs_stat_info, cp_background_calls, bg_cp_count);
@@ -914,6 +958,12 @@ static struct attribute *f4fs_attrs[] = {
 	ATTR_LIST(max_discard_issue_time),
 	ATTR_LIST(discard_granularity),
 	ATTR_LIST(pending_discard),
+#ifdef RPS
+	ATTR_LIST(rps_stat),
+#endif
+#ifdef MLOG
+	ATTR_LIST(mlog_stat),
+#endif
 	ATTR_LIST(batched_trim_sections),
 	ATTR_LIST(ipu_policy),
 	ATTR_LIST(min_ipu_util),
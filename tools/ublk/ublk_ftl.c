@@ -0,0 +1,854 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * ublk_ftl: a ublk server which emulates a page-mapped SSD FTL in memory.
+ *
+ * The block device it exposes stores data by logical 4KiB page, while a
+ * flash model underneath maps every logical page to a physical page in
+ * erase blocks, writes out of place, and cleans erase blocks with greedy or
+ * cost-benefit GC once free blocks run low.  It reports what that costs on
+ * top of the host write stream: device-level write amplification, erases,
+ * and the stalls host writes see while the FTL cleans in the foreground.
+ *
+ * One hardware queue served by one thread; see README for usage.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <linux/ublk_cmd.h>
+
+#define CTRL_DEV		"/dev/ublk-control"
+#define CDEV_FMT		"/dev/ublkc%d"
+#define BDEV_FMT		"/dev/ublkb%d"
+
+#define SECTOR_SHIFT		9
+#define FTL_PAGE_SHIFT		12
+#define FTL_PAGE_SIZE		(1U << FTL_PAGE_SHIFT)
+#define SECTORS_PER_PAGE	(FTL_PAGE_SIZE >> SECTOR_SHIFT)
+
+#define DEF_QUEUE_DEPTH		128
+#define MAX_IO_BYTES		(512 << 10)
+
+#define NO_PAGE			UINT32_MAX
+#define NO_BLOCK		UINT32_MAX
+
+/*
+ * io_uring, through the raw syscalls.  Both rings are set up with 128 byte
+ * SQEs, which ublk needs for its commands.
+ */
+struct ring {
+	int fd;
+	unsigned int entries;
+	unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	unsigned int sqe_tail;		/* next SQE to hand out */
+	unsigned int submitted;		/* SQ tail the kernel has seen */
+	char *sqes;
+	struct io_uring_cqe *cqes;
+};
+
+static int ring_setup(struct ring *r, unsigned int entries)
+{
+	struct io_uring_params p;
+	size_t sq_sz, cq_sz;
+	char *sq, *cq;
+
+	memset(&p, 0, sizeof(p));
+	memset(r, 0, sizeof(*r));
+	p.flags = IORING_SETUP_SQE128;
+	r->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (r->fd < 0)
+		return -errno;
+
+	sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	sq = mmap(NULL, sq_sz, PROT_READ | PROT_WRITE,
+		  MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (sq == MAP_FAILED)
+		return -errno;
+	r->sq_head = (unsigned int *)(sq + p.sq_off.head);
+	r->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+	r->sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+	r->sq_array = (unsigned int *)(sq + p.sq_off.array);
+	r->entries = p.sq_entries;
+
+	r->sqes = mmap(NULL, p.sq_entries * 2 * sizeof(struct io_uring_sqe),
+		       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		       r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED)
+		return -errno;
+
+	cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	cq = mmap(NULL, cq_sz, PROT_READ | PROT_WRITE,
+		  MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+	if (cq == MAP_FAILED)
+		return -errno;
+	r->cq_head = (unsigned int *)(cq + p.cq_off.head);
+	r->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+	r->cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	return 0;
+}
+
+static struct io_uring_sqe *ring_get_sqe(struct ring *r)
+{
+	unsigned int head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+	unsigned int idx;
+	struct io_uring_sqe *sqe;
+
+	if (r->sqe_tail - head >= r->entries)
+		return NULL;
+
+	idx = r->sqe_tail & *r->sq_mask;
+	sqe = (struct io_uring_sqe *)(r->sqes + 2 * sizeof(*sqe) * idx);
+	memset(sqe, 0, 2 * sizeof(*sqe));
+	r->sq_array[idx] = idx;
+	r->sqe_tail++;
+	return sqe;
+}
+
+static int ring_submit_and_wait(struct ring *r, unsigned int wait)
+{
+	unsigned int to_submit = r->sqe_tail - r->submitted;
+	int ret;
+
+	__atomic_store_n(r->sq_tail, r->sqe_tail, __ATOMIC_RELEASE);
+	r->submitted = r->sqe_tail;
+	do {
+		ret = syscall(__NR_io_uring_enter, r->fd, to_submit, wait,
+			      wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+		to_submit = 0;
+	} while (ret < 0 && errno == EINTR);
+	return ret < 0 ? -errno : ret;
+}
+
+static struct io_uring_cqe *ring_peek_cqe(struct ring *r)
+{
+	unsigned int head = *r->cq_head;
+
+	if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+		return NULL;
+	return &r->cqes[head & *r->cq_mask];
+}
+
+static void ring_cqe_seen(struct ring *r)
+{
+	__atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * The flash model.  Host and GC writes go to separate open blocks, as most
+ * FTLs do to keep relocated (colder) data apart from new data.
+ */
+enum { GC_GREEDY, GC_COST_BENEFIT };
+
+enum { BLK_FREE, BLK_OPEN, BLK_FULL };
+
+struct ftl_block {
+	uint32_t valid;			/* valid pages */
+	uint32_t wp;			/* next page to program */
+	uint32_t erases;
+	int state;
+	uint64_t stamp;			/* write sequence of the newest data */
+};
+
+struct ftl_stats {
+	uint64_t host_reads;		/* 4KiB pages */
+	uint64_t host_writes;
+	uint64_t gc_writes;
+	uint64_t trimmed;
+	uint64_t erases;
+	uint64_t gc_runs;		/* erase blocks cleaned */
+	uint64_t stalls;		/* host writes that waited for GC */
+	uint64_t stall_us;		/* total modelled stall time */
+	uint64_t max_stall_us;
+};
+
+struct ftl {
+	uint32_t nr_lpns;
+	uint32_t nr_blocks;
+	uint32_t ppb;			/* pages per erase block */
+	uint32_t gc_low;		/* free blocks that start GC */
+	int policy;
+
+	uint32_t *l2p;
+	uint32_t *p2l;
+	struct ftl_block *blk;
+
+	uint32_t *free_fifo;		/* erased blocks, oldest first */
+	uint32_t free_head, nr_free;
+
+	uint32_t host_blk, gc_blk;	/* open blocks */
+	uint64_t seq;
+
+	/* flash timings for the stall model, usec */
+	unsigned int t_read, t_prog, t_erase;
+	bool delay;			/* really wait out GC stalls */
+
+	struct ftl_stats st;
+};
+
+static void ftl_put_free(struct ftl *f, uint32_t b)
+{
+	f->free_fifo[(f->free_head + f->nr_free) % f->nr_blocks] = b;
+	f->nr_free++;
+}
+
+static uint32_t ftl_take_free(struct ftl *f)
+{
+	uint32_t b;
+
+	if (!f->nr_free)
+		return NO_BLOCK;
+	b = f->free_fifo[f->free_head];
+	f->free_head = (f->free_head + 1) % f->nr_blocks;
+	f->nr_free--;
+	f->blk[b].state = BLK_OPEN;
+	return b;
+}
+
+static uint32_t ftl_alloc_page(struct ftl *f, uint32_t *open)
+{
+	struct ftl_block *b;
+
+	if (*open == NO_BLOCK || f->blk[*open].wp == f->ppb) {
+		if (*open != NO_BLOCK)
+			f->blk[*open].state = BLK_FULL;
+		*open = ftl_take_free(f);
+		if (*open == NO_BLOCK)
+			return NO_PAGE;
+	}
+	b = &f->blk[*open];
+	return *open * f->ppb + b->wp++;
+}
+
+static void ftl_map(struct ftl *f, uint32_t lpn, uint32_t ppn, uint64_t stamp)
+{
+	struct ftl_block *b = &f->blk[ppn / f->ppb];
+
+	f->l2p[lpn] = ppn;
+	f->p2l[ppn] = lpn;
+	b->valid++;
+	if (stamp > b->stamp)
+		b->stamp = stamp;
+}
+
+static void ftl_invalidate(struct ftl *f, uint32_t lpn)
+{
+	uint32_t ppn = f->l2p[lpn];
+
+	if (ppn == NO_PAGE)
+		return;
+	f->blk[ppn / f->ppb].valid--;
+	f->p2l[ppn] = NO_PAGE;
+	f->l2p[lpn] = NO_PAGE;
+}
+
+/* higher is a better victim */
+static double ftl_victim_score(struct ftl *f, struct ftl_block *b)
+{
+	double u = (double)b->valid / f->ppb;
+
+	if (f->policy == GC_GREEDY)
+		return 1.0 - u;
+	if (!b->valid)
+		return INFINITY;
+	/* (1 - u) / 2u * age, from the LFS cleaner */
+	return (1.0 - u) / (2.0 * u) * (double)(f->seq - b->stamp + 1);
+}
+
+static uint32_t ftl_pick_victim(struct ftl *f)
+{
+	uint32_t i, victim = NO_BLOCK;
+	double best = -1.0;
+
+	for (i = 0; i < f->nr_blocks; i++) {
+		struct ftl_block *b = &f->blk[i];
+		double score;
+
+		if (b->state != BLK_FULL || b->valid == f->ppb)
+			continue;
+		score = ftl_victim_score(f, b);
+		if (score > best) {
+			best = score;
+			victim = i;
+		}
+	}
+	return victim;
+}
+
+/* cleans one erase block, returns the modelled time it took in usec */
+static uint64_t ftl_gc_one(struct ftl *f)
+{
+	uint32_t victim = ftl_pick_victim(f);
+	struct ftl_block *b;
+	uint32_t i, moved = 0;
+
+	if (victim == NO_BLOCK)
+		return 0;
+
+	b = &f->blk[victim];
+	for (i = 0; i < f->ppb && b->valid; i++) {
+		uint32_t ppn = victim * f->ppb + i;
+		uint32_t lpn = f->p2l[ppn], new;
+
+		if (lpn == NO_PAGE)
+			continue;
+		new = ftl_alloc_page(f, &f->gc_blk);
+		if (new == NO_PAGE)
+			break;
+		ftl_invalidate(f, lpn);
+		ftl_map(f, lpn, new, b->stamp);
+		moved++;
+	}
+	f->st.gc_writes += moved;
+	if (b->valid)
+		return (uint64_t)moved * (f->t_read + f->t_prog);
+
+	b->state = BLK_FREE;
+	b->wp = 0;
+	b->stamp = 0;
+	b->erases++;
+	ftl_put_free(f, victim);
+	f->st.erases++;
+	f->st.gc_runs++;
+	return (uint64_t)moved * (f->t_read + f->t_prog) + f->t_erase;
+}
+
+static void ftl_stall(struct ftl *f, uint64_t us)
+{
+	struct timespec ts;
+
+	f->st.stalls++;
+	f->st.stall_us += us;
+	if (us > f->st.max_stall_us)
+		f->st.max_stall_us = us;
+	if (!f->delay || !us)
+		return;
+	ts.tv_sec = us / 1000000;
+	ts.tv_nsec = (us % 1000000) * 1000;
+	while (nanosleep(&ts, &ts) && errno == EINTR)
+		;
+}
+
+static int ftl_write(struct ftl *f, uint32_t lpn)
+{
+	uint64_t stall = 0;
+	uint32_t ppn;
+
+	/* foreground GC: the host write waits until there is room */
+	while (f->nr_free <= f->gc_low) {
+		uint64_t us = ftl_gc_one(f);
+
+		if (!us)
+			break;
+		stall += us;
+	}
+	if (stall)
+		ftl_stall(f, stall);
+
+	ftl_invalidate(f, lpn);
+	ppn = ftl_alloc_page(f, &f->host_blk);
+	if (ppn == NO_PAGE)
+		return -ENOSPC;
+	ftl_map(f, lpn, ppn, ++f->seq);
+	f->st.host_writes++;
+	return 0;
+}
+
+static void ftl_trim(struct ftl *f, uint32_t lpn)
+{
+	if (f->l2p[lpn] != NO_PAGE)
+		f->st.trimmed++;
+	ftl_invalidate(f, lpn);
+}
+
+static int ftl_init(struct ftl *f, uint64_t size, unsigned int op_pct,
+		    unsigned int block_kb)
+{
+	uint64_t lpns = size >> FTL_PAGE_SHIFT, pages, i;
+
+	f->ppb = (block_kb << 10) >> FTL_PAGE_SHIFT;
+	if (!f->ppb || lpns >= NO_PAGE)
+		return -EINVAL;
+
+	pages = lpns + lpns * op_pct / 100;
+	f->nr_lpns = lpns;
+	f->nr_blocks = (pages + f->ppb - 1) / f->ppb;
+	f->gc_low = 2;
+
+	/* the open blocks and the GC reserve must not eat the spare area */
+	if ((uint64_t)(f->nr_blocks - f->gc_low - 2) * f->ppb <= lpns ||
+	    (uint64_t)f->nr_blocks * f->ppb >= NO_PAGE) {
+		fprintf(stderr, "overprovisioning too small for %u KiB blocks\n",
+			block_kb);
+		return -EINVAL;
+	}
+
+	f->l2p = malloc(sizeof(uint32_t) * f->nr_lpns);
+	f->p2l = malloc(sizeof(uint32_t) * f->nr_blocks * f->ppb);
+	f->blk = calloc(f->nr_blocks, sizeof(struct ftl_block));
+	f->free_fifo = malloc(sizeof(uint32_t) * f->nr_blocks);
+	if (!f->l2p || !f->p2l || !f->blk || !f->free_fifo)
+		return -ENOMEM;
+
+	memset(f->l2p, 0xff, sizeof(uint32_t) * f->nr_lpns);
+	memset(f->p2l, 0xff, sizeof(uint32_t) * f->nr_blocks * f->ppb);
+	for (i = 0; i < f->nr_blocks; i++)
+		ftl_put_free(f, i);
+	f->host_blk = f->gc_blk = NO_BLOCK;
+	return 0;
+}
+
+static void ftl_print_stats(struct ftl *f, FILE *out)
+{
+	struct ftl_stats *st = &f->st;
+	uint64_t flash = st->host_writes + st->gc_writes;
+
+	fprintf(out, "host_read_pages: %llu\n",
+		(unsigned long long)st->host_reads);
+	fprintf(out, "host_write_pages: %llu\n",
+		(unsigned long long)st->host_writes);
+	fprintf(out, "gc_write_pages: %llu\n",
+		(unsigned long long)st->gc_writes);
+	fprintf(out, "trimmed_pages: %llu\n", (unsigned long long)st->trimmed);
+	fprintf(out, "erases: %llu\n", (unsigned long long)st->erases);
+	fprintf(out, "waf: %.3f\n",
+		st->host_writes ? (double)flash / st->host_writes : 0.0);
+	fprintf(out, "gc_stalls: %llu\n", (unsigned long long)st->stalls);
+	fprintf(out, "gc_stall_ms: %llu\n",
+		(unsigned long long)st->stall_us / 1000);
+	fprintf(out, "gc_stall_max_us: %llu\n",
+		(unsigned long long)st->max_stall_us);
+	fprintf(out, "free_blocks: %u/%u\n", f->nr_free, f->nr_blocks);
+	fflush(out);
+}
+
+/*
+ * The ublk device.
+ */
+struct ftl_dev {
+	struct ublksrv_ctrl_dev_info info;
+	int ctrl_fd, cdev_fd;
+	struct ring ctrl_ring;
+
+	uint64_t size;
+	bool discard;
+	unsigned int depth;
+
+	/* the queue */
+	pthread_t thread;
+	struct ring ring;
+	struct ublksrv_io_desc *iods;
+	void **bufs;
+	int nr_live;			/* tags not aborted yet */
+
+	char *data;			/* contents, by logical page */
+	pthread_mutex_t lock;		/* FTL against stats readers */
+	struct ftl ftl;
+};
+
+static int ctrl_cmd(struct ftl_dev *dev, unsigned int op, void *buf,
+		    unsigned int len, uint64_t data)
+{
+	struct io_uring_sqe *sqe = ring_get_sqe(&dev->ctrl_ring);
+	struct ublksrv_ctrl_cmd *cmd = (struct ublksrv_ctrl_cmd *)sqe->cmd;
+	struct io_uring_cqe *cqe;
+	int ret;
+
+	sqe->opcode = IORING_OP_URING_CMD;
+	sqe->fd = dev->ctrl_fd;
+	sqe->cmd_op = op;
+	cmd->dev_id = dev->info.dev_id;
+	cmd->queue_id = (__u16)-1;
+	cmd->addr = (__u64)(uintptr_t)buf;
+	cmd->len = len;
+	cmd->data[0] = data;
+
+	ret = ring_submit_and_wait(&dev->ctrl_ring, 1);
+	if (ret < 0)
+		return ret;
+	cqe = ring_peek_cqe(&dev->ctrl_ring);
+	if (!cqe)
+		return -EIO;
+	ret = cqe->res;
+	ring_cqe_seen(&dev->ctrl_ring);
+	return ret;
+}
+
+static int dev_set_params(struct ftl_dev *dev)
+{
+	struct ublk_params p;
+
+	memset(&p, 0, sizeof(p));
+	p.len = sizeof(p);
+	p.types = UBLK_PARAM_TYPE_BASIC;
+	p.basic.logical_bs_shift = FTL_PAGE_SHIFT;
+	p.basic.physical_bs_shift = FTL_PAGE_SHIFT;
+	p.basic.io_min_shift = FTL_PAGE_SHIFT;
+	p.basic.io_opt_shift = FTL_PAGE_SHIFT;
+	p.basic.max_sectors = dev->info.max_io_buf_bytes >> SECTOR_SHIFT;
+	p.basic.dev_sectors = dev->size >> SECTOR_SHIFT;
+
+	if (dev->discard) {
+		p.types |= UBLK_PARAM_TYPE_DISCARD;
+		p.discard.discard_granularity = FTL_PAGE_SIZE;
+		p.discard.max_discard_sectors = UINT_MAX >> SECTOR_SHIFT;
+		p.discard.max_write_zeroes_sectors = UINT_MAX >> SECTOR_SHIFT;
+		p.discard.max_discard_segments = 1;
+	}
+	return ctrl_cmd(dev, UBLK_CMD_SET_PARAMS, &p, sizeof(p), 0);
+}
+
+static int handle_io(struct ftl_dev *dev, const struct ublksrv_io_desc *iod,
+		     void *buf)
+{
+	struct ftl *f = &dev->ftl;
+	uint64_t start = iod->start_sector;
+	uint32_t nr = iod->nr_sectors;
+	uint32_t lpn = start / SECTORS_PER_PAGE, end, i;
+	uint8_t op = ublksrv_get_op(iod);
+	int ret = 0;
+
+	if ((start | nr) & (SECTORS_PER_PAGE - 1) ||
+	    ((start + nr) << SECTOR_SHIFT) > dev->size)
+		return -EINVAL;
+	end = lpn + nr / SECTORS_PER_PAGE;
+
+	pthread_mutex_lock(&dev->lock);
+	switch (op) {
+	case UBLK_IO_OP_READ:
+		for (i = lpn; i < end; i++) {
+			char *dst = (char *)buf + (size_t)(i - lpn) * FTL_PAGE_SIZE;
+
+			if (f->l2p[i] == NO_PAGE)
+				memset(dst, 0, FTL_PAGE_SIZE);
+			else
+				memcpy(dst, dev->data + (size_t)i * FTL_PAGE_SIZE,
+				       FTL_PAGE_SIZE);
+		}
+		f->st.host_reads += end - lpn;
+		break;
+	case UBLK_IO_OP_WRITE:
+		for (i = lpn; i < end && !ret; i++) {
+			memcpy(dev->data + (size_t)i * FTL_PAGE_SIZE,
+			       (char *)buf + (size_t)(i - lpn) * FTL_PAGE_SIZE,
+			       FTL_PAGE_SIZE);
+			ret = ftl_write(f, i);
+		}
+		break;
+	case UBLK_IO_OP_FLUSH:
+		break;
+	case UBLK_IO_OP_DISCARD:
+	case UBLK_IO_OP_WRITE_ZEROES:
+		/* unmapped pages read back as zeroes */
+		for (i = lpn; i < end; i++)
+			ftl_trim(f, i);
+		madvise(dev->data + (size_t)lpn * FTL_PAGE_SIZE,
+			(size_t)(end - lpn) * FTL_PAGE_SIZE, MADV_DONTNEED);
+		break;
+	default:
+		ret = -EOPNOTSUPP;
+		break;
+	}
+	pthread_mutex_unlock(&dev->lock);
+
+	if (ret)
+		return ret;
+	/* only data transfers report a byte count; discards can exceed INT_MAX */
+	if (op != UBLK_IO_OP_READ && op != UBLK_IO_OP_WRITE)
+		return 0;
+	return (int)(nr << SECTOR_SHIFT);
+}
+
+static void queue_io_cmd(struct ftl_dev *dev, unsigned int tag,
+			 unsigned int op, int result)
+{
+	struct io_uring_sqe *sqe = ring_get_sqe(&dev->ring);
+	struct ublksrv_io_cmd *cmd = (struct ublksrv_io_cmd *)sqe->cmd;
+
+	sqe->opcode = IORING_OP_URING_CMD;
+	sqe->fd = dev->cdev_fd;
+	sqe->cmd_op = op;
+	sqe->user_data = tag;
+	cmd->q_id = 0;
+	cmd->tag = tag;
+	cmd->result = result;
+	cmd->addr = (__u64)(uintptr_t)dev->bufs[tag];
+}
+
+static void *queue_thread(void *arg)
+{
+	struct ftl_dev *dev = arg;
+	unsigned int tag;
+	int ret;
+
+	for (tag = 0; tag < dev->depth; tag++)
+		queue_io_cmd(dev, tag, UBLK_IO_FETCH_REQ, 0);
+	dev->nr_live = dev->depth;
+
+	while (dev->nr_live) {
+		struct io_uring_cqe *cqe;
+
+		ret = ring_submit_and_wait(&dev->ring, 1);
+		if (ret < 0) {
+			fprintf(stderr, "queue: io_uring_enter: %s\n",
+				strerror(-ret));
+			break;
+		}
+
+		while ((cqe = ring_peek_cqe(&dev->ring))) {
+			int res = cqe->res;
+
+			tag = cqe->user_data;
+			ring_cqe_seen(&dev->ring);
+
+			if (res == UBLK_IO_RES_OK) {
+				ret = handle_io(dev, &dev->iods[tag],
+						dev->bufs[tag]);
+				queue_io_cmd(dev, tag,
+					     UBLK_IO_COMMIT_AND_FETCH_REQ, ret);
+				continue;
+			}
+			if (res != UBLK_IO_RES_ABORT)
+				fprintf(stderr, "queue: tag %u failed: %s\n",
+					tag, strerror(-res));
+			dev->nr_live--;
+		}
+	}
+	return NULL;
+}
+
+static int queue_setup(struct ftl_dev *dev)
+{
+	size_t sz = dev->depth * sizeof(struct ublksrv_io_desc);
+	long page = sysconf(_SC_PAGESIZE);
+	char path[64];
+	unsigned int tag;
+	int ret, retry;
+
+	snprintf(path, sizeof(path), CDEV_FMT, dev->info.dev_id);
+	/* udev may still be creating the node */
+	for (retry = 0; retry < 100; retry++) {
+		dev->cdev_fd = open(path, O_RDWR);
+		if (dev->cdev_fd >= 0 || errno != ENOENT)
+			break;
+		usleep(10000);
+	}
+	if (dev->cdev_fd < 0) {
+		fprintf(stderr, "open %s: %s\n", path, strerror(errno));
+		return -errno;
+	}
+
+	sz = (sz + page - 1) / page * page;
+	dev->iods = mmap(NULL, sz, PROT_READ, MAP_SHARED | MAP_POPULATE,
+			 dev->cdev_fd, UBLKSRV_CMD_BUF_OFFSET);
+	if (dev->iods == MAP_FAILED)
+		return -errno;
+
+	dev->bufs = calloc(dev->depth, sizeof(void *));
+	if (!dev->bufs)
+		return -ENOMEM;
+	for (tag = 0; tag < dev->depth; tag++)
+		if (posix_memalign(&dev->bufs[tag], page,
+				   dev->info.max_io_buf_bytes))
+			return -ENOMEM;
+
+	ret = ring_setup(&dev->ring, dev->depth);
+	if (ret)
+		return ret;
+
+	return -pthread_create(&dev->thread, NULL, queue_thread, dev);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-s size_mb] [-p op_pct] [-b block_kb] [-g greedy|cb]\n"
+		"          [-N] [-r read_us] [-w prog_us] [-e erase_us] [-D]\n"
+		"          [-i interval_s] [-q depth] [-n dev_id]\n"
+		"\n"
+		"  -s  logical size in MiB (default 4096)\n"
+		"  -p  overprovisioning in %% of the logical size (default 7)\n"
+		"  -b  erase block size in KiB (default 1024)\n"
+		"  -g  GC victim policy, greedy or cost-benefit (default greedy)\n"
+		"  -N  do not advertise discard\n"
+		"  -r/-w/-e  flash read/program/erase time for the stall model\n"
+		"      (default 50/500/3000 usec)\n"
+		"  -D  sleep through modelled GC stalls instead of only counting\n"
+		"  -i  print stats every interval_s seconds\n"
+		"  -q  queue depth (default %d)\n"
+		"  -n  ublk device id (default: first free)\n"
+		"\n"
+		"SIGUSR1 prints stats, SIGINT/SIGTERM removes the device.\n",
+		prog, DEF_QUEUE_DEPTH);
+}
+
+int main(int argc, char *argv[])
+{
+	struct ftl_dev dev;
+	unsigned int op_pct = 7, block_kb = 1024, interval = 0;
+	uint64_t size_mb = 4096;
+	sigset_t sigs;
+	char path[64];
+	int opt, sig, ret;
+
+	memset(&dev, 0, sizeof(dev));
+	dev.discard = true;
+	dev.depth = DEF_QUEUE_DEPTH;
+	dev.info.dev_id = (__u32)-1;
+	dev.ftl.policy = GC_GREEDY;
+	dev.ftl.t_read = 50;
+	dev.ftl.t_prog = 500;
+	dev.ftl.t_erase = 3000;
+
+	while ((opt = getopt(argc, argv, "s:p:b:g:Nr:w:e:Di:q:n:h")) != -1) {
+		switch (opt) {
+		case 's':
+			size_mb = strtoull(optarg, NULL, 0);
+			break;
+		case 'p':
+			op_pct = atoi(optarg);
+			break;
+		case 'b':
+			block_kb = atoi(optarg);
+			break;
+		case 'g':
+			if (!strcmp(optarg, "greedy")) {
+				dev.ftl.policy = GC_GREEDY;
+			} else if (!strcmp(optarg, "cb")) {
+				dev.ftl.policy = GC_COST_BENEFIT;
+			} else {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'N':
+			dev.discard = false;
+			break;
+		case 'r':
+			dev.ftl.t_read = atoi(optarg);
+			break;
+		case 'w':
+			dev.ftl.t_prog = atoi(optarg);
+			break;
+		case 'e':
+			dev.ftl.t_erase = atoi(optarg);
+			break;
+		case 'D':
+			dev.ftl.delay = true;
+			break;
+		case 'i':
+			interval = atoi(optarg);
+			break;
+		case 'q':
+			dev.depth = atoi(optarg);
+			break;
+		case 'n':
+			dev.info.dev_id = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (!dev.depth || dev.depth > UBLK_MAX_QUEUE_DEPTH) {
+		fprintf(stderr, "queue depth must be 1..%d\n",
+			UBLK_MAX_QUEUE_DEPTH);
+		return 1;
+	}
+
+	dev.size = size_mb << 20;
+	ret = ftl_init(&dev.ftl, dev.size, op_pct, block_kb);
+	if (ret) {
+		fprintf(stderr, "ftl: %s\n", strerror(-ret));
+		return 1;
+	}
+	dev.data = mmap(NULL, dev.size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (dev.data == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	pthread_mutex_init(&dev.lock, NULL);
+
+	/* signals are only taken by sigwait() below */
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGINT);
+	sigaddset(&sigs, SIGTERM);
+	sigaddset(&sigs, SIGUSR1);
+	sigaddset(&sigs, SIGALRM);
+	pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+	dev.ctrl_fd = open(CTRL_DEV, O_RDWR);
+	if (dev.ctrl_fd < 0) {
+		perror(CTRL_DEV);
+		return 1;
+	}
+	ret = ring_setup(&dev.ctrl_ring, 4);
+	if (ret) {
+		fprintf(stderr, "io_uring_setup: %s\n", strerror(-ret));
+		return 1;
+	}
+
+	dev.info.nr_hw_queues = 1;
+	dev.info.queue_depth = dev.depth;
+	dev.info.max_io_buf_bytes = MAX_IO_BYTES;
+	ret = ctrl_cmd(&dev, UBLK_CMD_ADD_DEV, &dev.info, sizeof(dev.info), 0);
+	if (ret) {
+		fprintf(stderr, "add device: %s\n", strerror(-ret));
+		return 1;
+	}
+
+	ret = dev_set_params(&dev);
+	if (!ret)
+		ret = queue_setup(&dev);
+	if (!ret)
+		ret = ctrl_cmd(&dev, UBLK_CMD_START_DEV, NULL, 0, getpid());
+	if (ret) {
+		fprintf(stderr, "start device: %s\n", strerror(-ret));
+		goto del;
+	}
+
+	snprintf(path, sizeof(path), BDEV_FMT, dev.info.dev_id);
+	printf("%s: %llu MiB, %u%% op, %u KiB blocks, %s GC%s\n", path,
+	       (unsigned long long)size_mb, op_pct, block_kb,
+	       dev.ftl.policy == GC_GREEDY ? "greedy" : "cost-benefit",
+	       dev.discard ? ", discard" : "");
+	fflush(stdout);
+
+	if (interval)
+		alarm(interval);
+	for (;;) {
+		if (sigwait(&sigs, &sig))
+			continue;
+		if (sig == SIGINT || sig == SIGTERM)
+			break;
+		pthread_mutex_lock(&dev.lock);
+		ftl_print_stats(&dev.ftl, stdout);
+		pthread_mutex_unlock(&dev.lock);
+		if (sig == SIGALRM)
+			alarm(interval);
+	}
+
+	ctrl_cmd(&dev, UBLK_CMD_STOP_DEV, NULL, 0, 0);
+	pthread_join(dev.thread, NULL);
+	ftl_print_stats(&dev.ftl, stdout);
+del:
+	if (dev.cdev_fd > 0)
+		close(dev.cdev_fd);
+	ctrl_cmd(&dev, UBLK_CMD_DEL_DEV, NULL, 0, 0);
+	return ret ? 1 : 0;
+}